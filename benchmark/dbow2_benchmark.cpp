@@ -0,0 +1,830 @@
+/**
+ * File: dbow2_benchmark.cpp
+ * Date: October 2026
+ * Description: benchmarks of the vocabulary and database operations, with
+ *   synthetic descriptors and with descriptor files of recorded images
+ * License: see the LICENSE.txt file
+ */
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <memory>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+// DBoW2
+#include "DBoW2.h"
+#include "DescriptorDump.h"
+#include "DescriptorTraits.h"
+
+// Google Benchmark
+#include <benchmark/benchmark.h>
+
+using namespace DBoW2;
+using namespace std;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// synthetic images and descriptors per image
+const int SYNTHETIC_IMAGES = 300;
+const int SYNTHETIC_FEATURES = 500;
+
+// clusters the synthetic descriptors are drawn around
+const int SYNTHETIC_CENTRES = 2000;
+
+// probability of flipping each bit of a synthetic descriptor
+const double SYNTHETIC_NOISE = 0.15;
+
+// branching factor and depth levels of the benchmark vocabularies
+const int VOC_K = 10;
+const int VOC_L = 5;
+
+// images read from a descriptor file at most
+int g_max_images = 1000;
+
+// words of each synthetic entry of the query databases
+int g_entry_words = 100;
+
+// prefix of the files written by the load and save benchmarks
+string g_tmp_prefix = "dbow2_benchmark";
+
+// whether a benchmark got wrong results
+bool g_failed = false;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// Images and vocabulary the benchmarks of a descriptor class run on
+/// @param TDescriptor class of descriptor
+/// @param F class of descriptor functions
+template<class TDescriptor, class F>
+class Dataset
+{
+public:
+
+  /**
+   * Creates a dataset of synthetic descriptors
+   * @param seed seed of the descriptors
+   */
+  explicit Dataset(unsigned int seed): m_seed(seed),
+    m_db_scoring(L1_NORM) {}
+
+  /**
+   * Creates a dataset with the images of a descriptor file
+   * @param filename descriptor file
+   */
+  explicit Dataset(const string &filename): m_seed(0), m_file(filename),
+    m_db_scoring(L1_NORM) {}
+
+  /**
+   * Returns the descriptors of each image. They are read or generated the
+   * first time, along with the vocabulary
+   * @return images
+   */
+  const vector<vector<TDescriptor> >& images()
+  {
+    build();
+    return m_images;
+  }
+
+  /**
+   * Returns the vocabulary trained with the images
+   * @return vocabulary
+   */
+  const TemplatedVocabulary<TDescriptor, F>& vocabulary()
+  {
+    build();
+    return *m_voc;
+  }
+
+  /**
+   * Returns the bow vector of each image
+   * @return bow vectors
+   */
+  const vector<FlatBowVector>& vectors()
+  {
+    build();
+    return m_vectors;
+  }
+
+  /**
+   * Returns a database with synthetic entries and a vocabulary with the
+   * given scoring. The words of the entries are drawn from those of the
+   * images, so that the lengths of the posting lists are like those of a
+   * database of images of the same kind. Only the last database is kept
+   * @param scoring scoring type
+   * @param entries number of entries
+   * @return database
+   */
+  const TemplatedDatabase<TDescriptor, F>& database(ScoringType scoring,
+    int entries);
+
+protected:
+
+  /// Reads or generates the images and trains the vocabulary
+  void build();
+
+  /// Generates the synthetic images
+  void generate();
+
+  /// Reads the images of the descriptor file
+  void read();
+
+protected:
+
+  /// Seed of the synthetic descriptors
+  unsigned int m_seed;
+
+  /// Descriptor file, if the images are recorded
+  string m_file;
+
+  /// Descriptors of each image
+  vector<vector<TDescriptor> > m_images;
+
+  /// Vocabulary trained with the images
+  shared_ptr<TemplatedVocabulary<TDescriptor, F> > m_voc;
+
+  /// Bow vector of each image
+  vector<FlatBowVector> m_vectors;
+
+  /// Last query database created
+  shared_ptr<TemplatedDatabase<TDescriptor, F> > m_db;
+
+  /// Scoring of the vocabulary of m_db
+  ScoringType m_db_scoring;
+};
+
+// ----------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void Dataset<TDescriptor, F>::build()
+{
+  if(m_voc) return;
+
+  if(m_file.empty()) generate();
+  else read();
+
+  cerr << "Training a vocabulary with " << m_images.size() << " images..."
+    << endl;
+
+  m_voc.reset(new TemplatedVocabulary<TDescriptor, F>(VOC_K, VOC_L));
+  m_voc->create(m_images);
+
+  m_vectors.resize(m_images.size());
+  for(size_t i = 0; i < m_images.size(); ++i)
+    m_voc->transform(m_images[i], m_vectors[i]);
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void Dataset<TDescriptor, F>::generate()
+{
+  // descriptors are drawn around random centres, as real descriptors are
+  // clustered around the appearance of common patches
+  const int bytes = DescriptorTraits<F>::bytes;
+  srand(m_seed);
+
+  vector<unsigned char> centres(SYNTHETIC_CENTRES * bytes);
+  for(size_t i = 0; i < centres.size(); ++i) centres[i] = rand() & 0xff;
+
+  const int threshold = (int)(SYNTHETIC_NOISE * RAND_MAX);
+  vector<unsigned char> packed(bytes);
+
+  m_images.resize(SYNTHETIC_IMAGES);
+  for(int i = 0; i < SYNTHETIC_IMAGES; ++i)
+  {
+    m_images[i].resize(SYNTHETIC_FEATURES);
+    for(int j = 0; j < SYNTHETIC_FEATURES; ++j)
+    {
+      const unsigned char *c = &centres[(rand() % SYNTHETIC_CENTRES) * bytes];
+      for(int b = 0; b < bytes; ++b)
+      {
+        unsigned char noise = 0;
+        for(int bit = 0; bit < 8; ++bit)
+          if(rand() < threshold) noise |= 1 << bit;
+        packed[b] = c[b] ^ noise;
+      }
+      DescriptorTraits<F>::unpack(&packed[0], m_images[i][j]);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void Dataset<TDescriptor, F>::read()
+{
+  TemplatedDescriptorReader<TDescriptor, F> reader(m_file);
+
+  m_images.clear();
+  vector<TDescriptor> features;
+  while((int)m_images.size() < g_max_images && reader.read(features))
+  {
+    if(!features.empty()) m_images.push_back(features);
+  }
+
+  if(m_images.empty()) throw string("No images in ") + m_file;
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+const TemplatedDatabase<TDescriptor, F>& Dataset<TDescriptor, F>::database
+  (ScoringType scoring, int entries)
+{
+  build();
+
+  if(m_db && m_db_scoring == scoring && (int)m_db->size() == entries)
+    return *m_db;
+
+  // only the last database is kept, to bound the memory
+  m_db.reset();
+  m_db_scoring = scoring;
+
+  cerr << "Creating a database with " << entries << " entries..." << endl;
+
+  shared_ptr<TemplatedVocabulary<TDescriptor, F> > voc(
+    new TemplatedVocabulary<TDescriptor, F>(*m_voc));
+  voc->setScoringType(scoring);
+  m_db.reset(new TemplatedDatabase<TDescriptor, F>(voc, false));
+
+  // all the words of the images, with repetitions, to draw them with their
+  // frequency
+  vector<pair<WordId, WordValue> > words;
+  for(size_t i = 0; i < m_vectors.size(); ++i)
+    for(size_t j = 0; j < m_vectors[i].size(); ++j)
+      words.push_back(make_pair(m_vectors[i].id(j), m_vectors[i].value(j)));
+
+  srand(m_seed + 1);
+
+  // entries are added in batches to bound the memory of the vectors
+  const int batch = 10000;
+  vector<FlatBowVector> vecs;
+  for(int added = 0; added < entries; added += batch)
+  {
+    vecs.resize(min(batch, entries - added));
+    for(size_t i = 0; i < vecs.size(); ++i)
+    {
+      BowVector v;
+      for(int j = 0; j < g_entry_words; ++j)
+      {
+        const pair<WordId, WordValue> &w = words[rand() % words.size()];
+        v.addIfNotExist(w.first, w.second);
+      }
+
+      if(scoring == L1_NORM) v.normalize(L1);
+      else if(scoring == L2_NORM) v.normalize(L2);
+
+      vecs[i].fromBowVector(v);
+    }
+    m_db->addBatch(vecs);
+  }
+
+  return *m_db;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// Reports wrong results of a benchmark, which then makes the program fail
+void fail(benchmark::State &state, const string &what)
+{
+  g_failed = true;
+  state.SkipWithError(what.c_str());
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns whether two lists of results have the same entries, and their
+// scores differ at most tolerance
+bool sameResults(const QueryResults &a, const QueryResults &b,
+  double tolerance)
+{
+  if(a.size() != b.size()) return false;
+  for(size_t i = 0; i < a.size(); ++i)
+  {
+    if(a[i].Id != b[i].Id || fabs(a[i].Score - b[i].Score) > tolerance)
+      return false;
+  }
+  return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// Transforms descriptors one by one
+template<class TDescriptor, class F>
+void transformDescriptor(benchmark::State &state,
+  Dataset<TDescriptor, F> *data)
+{
+  const TemplatedVocabulary<TDescriptor, F> &voc = data->vocabulary();
+  const vector<vector<TDescriptor> > &images = data->images();
+
+  size_t i = 0, j = 0;
+  for(auto _ : state)
+  {
+    benchmark::DoNotOptimize(voc.transform(images[i][j]));
+    if(++j == images[i].size())
+    {
+      j = 0;
+      i = (i + 1) % images.size();
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// ----------------------------------------------------------------------------
+
+// Transforms the descriptors of images, with their feature vectors
+template<class TDescriptor, class F>
+void transformImage(benchmark::State &state, Dataset<TDescriptor, F> *data)
+{
+  const TemplatedVocabulary<TDescriptor, F> &voc = data->vocabulary();
+  const vector<vector<TDescriptor> > &images = data->images();
+
+  size_t i = 0, descriptors = 0;
+  FlatBowVector v;
+  FlatFeatureVector fv;
+  for(auto _ : state)
+  {
+    voc.transform(images[i], v, fv, VOC_L - 1);
+    benchmark::DoNotOptimize(v.ids());
+    descriptors += images[i].size();
+    i = (i + 1) % images.size();
+  }
+  state.SetItemsProcessed(descriptors);
+}
+
+// ----------------------------------------------------------------------------
+
+// Adds the images to a database, with the direct index
+template<class TDescriptor, class F>
+void databaseAdd(benchmark::State &state, Dataset<TDescriptor, F> *data)
+{
+  const TemplatedVocabulary<TDescriptor, F> &voc = data->vocabulary();
+  const vector<FlatBowVector> &vectors = data->vectors();
+
+  // feature vectors of the images
+  vector<FlatFeatureVector> features(vectors.size());
+  for(size_t i = 0; i < vectors.size(); ++i)
+  {
+    FlatBowVector v;
+    voc.transform(data->images()[i], v, features[i], VOC_L - 1);
+  }
+
+  TemplatedDatabase<TDescriptor, F> db(voc, true, VOC_L - 1);
+
+  size_t i = 0;
+  for(auto _ : state)
+  {
+    db.add(vectors[i], features[i]);
+    if(++i == vectors.size())
+    {
+      i = 0;
+      // the database is cleared from time to time so that the memory does
+      // not grow with the iterations
+      if(db.size() >= 100000)
+      {
+        state.PauseTiming();
+        db.clear();
+        state.ResumeTiming();
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// ----------------------------------------------------------------------------
+
+// Queries a database of state.range(0) entries with the images
+template<class TDescriptor, class F>
+void databaseQuery(benchmark::State &state, Dataset<TDescriptor, F> *data,
+  ScoringType scoring)
+{
+  const TemplatedDatabase<TDescriptor, F> &db =
+    data->database(scoring, (int)state.range(0));
+  const vector<FlatBowVector> &vectors = data->vectors();
+
+  size_t i = 0;
+  QueryResults ret;
+  for(auto _ : state)
+  {
+    db.query(vectors[i], ret, 10);
+    benchmark::DoNotOptimize(ret.data());
+    i = (i + 1) % vectors.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// ----------------------------------------------------------------------------
+
+// Queries a database of state.range(0) entries with batches of 
+// state.range(1) consecutive images, with queryBatch, or with query in a 
+// loop to compare
+template<class TDescriptor, class F>
+void databaseQueryBatch(benchmark::State &state, 
+  Dataset<TDescriptor, F> *data, bool batch)
+{
+  const TemplatedDatabase<TDescriptor, F> &db =
+    data->database(L1_NORM, (int)state.range(0));
+  const vector<FlatBowVector> &vectors = data->vectors();
+  const size_t n = min((size_t)state.range(1), vectors.size());
+
+  // consecutive images share words, as those of a sequence
+  vector<vector<FlatBowVector> > batches;
+  for(size_t i = 0; i + n <= vectors.size(); i += n)
+    batches.push_back(vector<FlatBowVector>(vectors.begin() + i, 
+      vectors.begin() + i + n));
+
+  // a batch gives the results of its queries one by one
+  vector<QueryResults> ret(n), expected(n);
+  db.queryBatch(batches[0], ret, 10);
+  for(size_t j = 0; j < n; ++j)
+  {
+    db.query(batches[0][j], expected[j], 10);
+    if(!sameResults(expected[j], ret[j], 1e-9))
+    {
+      fail(state, "queryBatch does not give the results of query");
+      return;
+    }
+  }
+
+  size_t i = 0;
+  for(auto _ : state)
+  {
+    if(batch) db.queryBatch(batches[i], ret, 10);
+    else
+    {
+      for(size_t j = 0; j < n; ++j) db.query(batches[i][j], ret[j], 10);
+    }
+    benchmark::DoNotOptimize(ret.data());
+    i = (i + 1) % batches.size();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+// ----------------------------------------------------------------------------
+
+// Clusters all the descriptors of the images once, as the first step of
+// the creation of a vocabulary with branching factor state.range(0)
+template<class TDescriptor, class F>
+void kmeansStep(benchmark::State &state, Dataset<TDescriptor, F> *data)
+{
+  const vector<vector<TDescriptor> > &images = data->images();
+  const int k = (int)state.range(0);
+
+  size_t descriptors = 0;
+  for(size_t i = 0; i < images.size(); ++i) descriptors += images[i].size();
+
+  for(auto _ : state)
+  {
+    // a single level is a single HKmeansStep at the root
+    TemplatedVocabulary<TDescriptor, F> voc(k, 1);
+    srand(0);
+    voc.create(images);
+    benchmark::DoNotOptimize(voc.size());
+  }
+  state.SetItemsProcessed(state.iterations() * descriptors);
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns a copy of the images with SYNTHETIC_NOISE of the bits of their
+// descriptors flipped, as if they were seen again
+template<class TDescriptor, class F>
+vector<vector<TDescriptor> > perturb(const vector<vector<TDescriptor> > &images,
+  unsigned int seed)
+{
+  const int bytes = DescriptorTraits<F>::bytes;
+  const int threshold = (int)(SYNTHETIC_NOISE * RAND_MAX);
+  vector<unsigned char> packed(bytes);
+  srand(seed);
+
+  vector<vector<TDescriptor> > copies(images.size());
+  for(size_t i = 0; i < images.size(); ++i)
+  {
+    copies[i].resize(images[i].size());
+    for(size_t j = 0; j < images[i].size(); ++j)
+    {
+      DescriptorTraits<F>::pack(images[i][j], &packed[0]);
+      for(int b = 0; b < bytes; ++b)
+        for(int bit = 0; bit < 8; ++bit)
+          if(rand() < threshold) packed[b] ^= 1 << bit;
+      DescriptorTraits<F>::unpack(&packed[0], copies[i][j]);
+    }
+  }
+  return copies;
+}
+
+// ----------------------------------------------------------------------------
+
+// Creates a vocabulary with the images and the given kmeans options. The
+// quality of the vocabulary is given by the fraction of perturbed copies
+// of the images whose best match in a database of the images is their
+// original (recall@1)
+template<class TDescriptor, class F>
+void vocabularyCreate(benchmark::State &state, Dataset<TDescriptor, F> *data,
+  const KMeansOptions &options)
+{
+  const vector<vector<TDescriptor> > &images = data->images();
+
+  size_t descriptors = 0;
+  for(size_t i = 0; i < images.size(); ++i) descriptors += images[i].size();
+
+  TemplatedVocabulary<TDescriptor, F> voc(VOC_K, VOC_L);
+  voc.setKMeansOptions(options);
+  for(auto _ : state)
+  {
+    srand(0);
+    voc.create(images);
+    benchmark::DoNotOptimize(voc.size());
+  }
+  state.SetItemsProcessed(state.iterations() * descriptors);
+
+  TemplatedDatabase<TDescriptor, F> db(voc, false);
+  for(size_t i = 0; i < images.size(); ++i) db.add(images[i]);
+
+  const vector<vector<TDescriptor> > queries = 
+    perturb<TDescriptor, F>(images, 3);
+  int found = 0;
+  QueryResults ret;
+  for(size_t i = 0; i < queries.size(); ++i)
+  {
+    db.query(queries[i], ret, 1);
+    if(!ret.empty() && ret[0].Id == i) ++found;
+  }
+
+  state.counters["recall@1"] = (double)found / queries.size();
+  state.counters["words"] = voc.size();
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns the size of a file in bytes
+long fileSize(const string &filename)
+{
+  ifstream f(filename.c_str(), ios::binary | ios::ate);
+  return f.is_open() ? (long)f.tellg() : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// Saves the vocabulary in a file with the given extension
+template<class TDescriptor, class F>
+void vocabularySave(benchmark::State &state, Dataset<TDescriptor, F> *data,
+  const string &extension)
+{
+  const TemplatedVocabulary<TDescriptor, F> &voc = data->vocabulary();
+  const string filename = g_tmp_prefix + "_voc" + extension;
+
+  for(auto _ : state) voc.save(filename);
+  state.SetBytesProcessed(state.iterations() * fileSize(filename));
+  remove(filename.c_str());
+}
+
+// ----------------------------------------------------------------------------
+
+// Loads the vocabulary from a file with the given extension
+template<class TDescriptor, class F>
+void vocabularyLoad(benchmark::State &state, Dataset<TDescriptor, F> *data,
+  const string &extension)
+{
+  const string filename = g_tmp_prefix + "_voc" + extension;
+  data->vocabulary().save(filename);
+
+  for(auto _ : state)
+  {
+    TemplatedVocabulary<TDescriptor, F> voc(filename);
+    benchmark::DoNotOptimize(voc.size());
+  }
+  state.SetBytesProcessed(state.iterations() * fileSize(filename));
+
+  // the words of the images are those of the saved vocabulary (the
+  // weights of text files may differ in the last digits)
+  TemplatedVocabulary<TDescriptor, F> voc(filename);
+  remove(filename.c_str());
+  if(voc.size() != data->vocabulary().size())
+  {
+    fail(state, "the vocabulary loaded has other words");
+    return;
+  }
+  for(size_t i = 0; i < data->images().size(); i += 50)
+  {
+    FlatBowVector v;
+    voc.transform(data->images()[i], v);
+    const FlatBowVector &expected = data->vectors()[i];
+    if(v.size() != expected.size() ||
+      !equal(v.ids(), v.ids() + v.size(), expected.ids()))
+    {
+      fail(state, "the vocabulary loaded gives other words");
+      return;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+// Saves a database of state.range(0) entries in a file with the given
+// extension
+template<class TDescriptor, class F>
+void databaseSave(benchmark::State &state, Dataset<TDescriptor, F> *data,
+  const string &extension)
+{
+  const TemplatedDatabase<TDescriptor, F> &db =
+    data->database(L1_NORM, (int)state.range(0));
+  const string filename = g_tmp_prefix + "_db" + extension;
+
+  for(auto _ : state) db.save(filename);
+  state.SetBytesProcessed(state.iterations() * fileSize(filename));
+  remove(filename.c_str());
+}
+
+// ----------------------------------------------------------------------------
+
+// Loads a database of state.range(0) entries from a file with the given
+// extension
+template<class TDescriptor, class F>
+void databaseLoad(benchmark::State &state, Dataset<TDescriptor, F> *data,
+  const string &extension)
+{
+  const string filename = g_tmp_prefix + "_db" + extension;
+  data->database(L1_NORM, (int)state.range(0)).save(filename);
+
+  for(auto _ : state)
+  {
+    TemplatedDatabase<TDescriptor, F> db(filename);
+    benchmark::DoNotOptimize(db.size());
+  }
+  state.SetBytesProcessed(state.iterations() * fileSize(filename));
+
+  // the queries give the results of the saved database
+  const TemplatedDatabase<TDescriptor, F> &saved =
+    data->database(L1_NORM, (int)state.range(0));
+  TemplatedDatabase<TDescriptor, F> db(filename);
+  remove(filename.c_str());
+  for(size_t i = 0; i < data->vectors().size(); i += 50)
+  {
+    QueryResults expected, ret;
+    saved.query(data->vectors()[i], expected, 10);
+    db.query(data->vectors()[i], ret, 10);
+    if(db.size() != saved.size() || !sameResults(expected, ret, 1e-9))
+    {
+      fail(state, "the database loaded gives other results");
+      return;
+    }
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// Registers the benchmarks of a dataset, with names that start with name
+template<class TDescriptor, class F>
+void registerBenchmarks(const string &name, Dataset<TDescriptor, F> *data)
+{
+  benchmark::RegisterBenchmark((name + "/transform/descriptor").c_str(),
+    transformDescriptor<TDescriptor, F>, data);
+  benchmark::RegisterBenchmark((name + "/transform/image").c_str(),
+    transformImage<TDescriptor, F>, data)->Unit(benchmark::kMicrosecond);
+
+  benchmark::RegisterBenchmark((name + "/database/add").c_str(),
+    databaseAdd<TDescriptor, F>, data)->Unit(benchmark::kMicrosecond);
+
+  const ScoringType scorings[] = { L1_NORM, L2_NORM, DOT_PRODUCT };
+  const char *scoring_names[] = { "L1", "L2", "DotProduct" };
+  for(int s = 0; s < 3; ++s)
+  {
+    benchmark::RegisterBenchmark(
+      (name + "/database/query" + scoring_names[s]).c_str(),
+      databaseQuery<TDescriptor, F>, data, scorings[s])
+      ->RangeMultiplier(10)->Range(1000, 1000000)
+      ->Unit(benchmark::kMicrosecond);
+  }
+
+  // a batch of queries against the same queries one by one, one after 
+  // the other so that they use the same database
+  const int batch_entries[] = { 100000, 1000000 };
+  for(int e = 0; e < 2; ++e)
+  {
+    benchmark::RegisterBenchmark((name + "/database/queryLoop").c_str(),
+      databaseQueryBatch<TDescriptor, F>, data, false)
+      ->Args({batch_entries[e], 16})->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark((name + "/database/queryBatch").c_str(),
+      databaseQueryBatch<TDescriptor, F>, data, true)
+      ->Args({batch_entries[e], 16})->Unit(benchmark::kMillisecond);
+  }
+
+  benchmark::RegisterBenchmark((name + "/train/HKmeansStep").c_str(),
+    kmeansStep<TDescriptor, F>, data)->Arg(10)->Arg(50)
+    ->Unit(benchmark::kMillisecond);
+
+  // the whole training, with the default kmeans and with the faster ones
+  vector<pair<string, KMeansOptions> > trainings(6);
+  trainings[0].first = "default";
+  trainings[1].first = "iterations5";
+  trainings[1].second.max_iterations = 5;
+  trainings[2].first = "tolerance1%";
+  trainings[2].second.tolerance = 0.01;
+  trainings[3].first = "seeding10000";
+  trainings[3].second.seeding_sample = 10000;
+  trainings[4].first = "minibatch2";
+  trainings[4].second.minibatch_levels = 2;
+  trainings[5].first = "all";
+  trainings[5].second.max_iterations = 5;
+  trainings[5].second.tolerance = 0.01;
+  trainings[5].second.seeding_sample = 10000;
+  trainings[5].second.minibatch_levels = 2;
+  for(size_t t = 0; t < trainings.size(); ++t)
+  {
+    benchmark::RegisterBenchmark(
+      (name + "/train/create/" + trainings[t].first).c_str(),
+      vocabularyCreate<TDescriptor, F>, data, trainings[t].second)
+      ->Unit(benchmark::kMillisecond);
+  }
+
+  const char *extensions[] = { ".yml.gz", ".dbow2" };
+  for(int e = 0; e < 2; ++e)
+  {
+    const string ext = extensions[e];
+    benchmark::RegisterBenchmark((name + "/vocabulary/save" + ext).c_str(),
+      vocabularySave<TDescriptor, F>, data, ext)
+      ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark((name + "/vocabulary/load" + ext).c_str(),
+      vocabularyLoad<TDescriptor, F>, data, ext)
+      ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark((name + "/database/save" + ext).c_str(),
+      databaseSave<TDescriptor, F>, data, ext)->Arg(10000)
+      ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark((name + "/database/load" + ext).c_str(),
+      databaseLoad<TDescriptor, F>, data, ext)->Arg(10000)
+      ->Unit(benchmark::kMillisecond);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void usage(const char *program)
+{
+  cerr << "Usage: " << program << " [benchmark options] "
+    "[--descriptors=<file>] [--images=<n>] [--entry-words=<n>] "
+    "[--tmp=<prefix>]" << endl << endl
+    << "  --descriptors  BRISK descriptor file of recorded images, as "
+    "written by trainBRISK" << endl
+    << "  --images       images to read from it at most (default "
+    << g_max_images << ")" << endl
+    << "  --entry-words  words of each entry of the query databases "
+    "(default " << g_entry_words << ")" << endl
+    << "  --tmp          prefix of the temporary files (default "
+    << g_tmp_prefix << ")" << endl << endl
+    << "Use --benchmark_format=json or --benchmark_out=<file> to get "
+    "machine-readable results." << endl;
+}
+
+// ----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+  // removes the benchmark options from argv
+  benchmark::Initialize(&argc, argv);
+
+  string descriptors;
+  for(int i = 1; i < argc; ++i)
+  {
+    const string arg = argv[i];
+    const string value = arg.substr(arg.find('=') + 1);
+
+    if(arg.compare(0, 14, "--descriptors=") == 0) descriptors = value;
+    else if(arg.compare(0, 9, "--images=") == 0)
+      g_max_images = atoi(value.c_str());
+    else if(arg.compare(0, 14, "--entry-words=") == 0)
+      g_entry_words = atoi(value.c_str());
+    else if(arg.compare(0, 6, "--tmp=") == 0) g_tmp_prefix = value;
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  Dataset<FORB::TDescriptor, FORB> orb(1);
+  Dataset<FBRISK::TDescriptor, FBRISK> brisk(2);
+  Dataset<FBRISK::TDescriptor, FBRISK> recorded(descriptors);
+
+  registerBenchmarks("ORB/synthetic", &orb);
+  registerBenchmarks("BRISK/synthetic", &brisk);
+  if(!descriptors.empty()) registerBenchmarks("BRISK/recorded", &recorded);
+
+  try
+  {
+    benchmark::RunSpecifiedBenchmarks();
+  }
+  catch(const string &ex)
+  {
+    cerr << "Error: " << ex << endl;
+    return 1;
+  }
+
+  return (g_failed ? 1 : 0);
+}
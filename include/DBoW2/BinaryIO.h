@@ -0,0 +1,119 @@
+/**
+ * File: BinaryIO.h
+ * Date: October 2026
+ * Description: helpers to read and write the binary file formats
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_BINARY_IO__
+#define __D_T_BINARY_IO__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace DBoW2 {
+
+/// Read-only memory mapping of a whole file
+/**
+ * The pages are shared with the other processes that map the same file.
+ */
+class MappedFile
+{
+public:
+
+  /**
+   * Maps a file
+   * @param filename
+   * @throw std::string if the file cannot be opened or mapped
+   */
+  explicit MappedFile(const std::string &filename);
+
+  /**
+   * Unmaps the file
+   */
+  ~MappedFile();
+
+  /**
+   * Returns the content of the file
+   * @return pointer to size() bytes, aligned to a page boundary
+   */
+  inline const unsigned char* data() const { return m_data; }
+
+  /**
+   * Returns the size of the file
+   * @return bytes
+   */
+  inline size_t size() const { return m_size; }
+
+private:
+
+  MappedFile(const MappedFile &);
+  MappedFile& operator=(const MappedFile &);
+
+  /// Mapped memory
+  const unsigned char *m_data;
+  /// Bytes mapped
+  size_t m_size;
+#ifdef _WIN32
+  /// Handle of the file mapping object
+  void *m_mapping;
+#endif
+};
+
+/**
+ * Returns whether a file name has the extension of the binary formats
+ * @param filename
+ * @return true iff filename ends with .dbow2
+ */
+bool isBinaryFile(const std::string &filename);
+
+/**
+ * Calculates a 64-bit checksum of a block of bytes. It is not
+ * cryptographically secure, only meant to detect corrupted files
+ * @param data
+ * @param bytes
+ * @param seed checksum of the preceding data, if any
+ * @return checksum
+ */
+uint64_t checksum(const unsigned char *data, size_t bytes, uint64_t seed = 0);
+
+/**
+ * Appends the raw bytes of an array of plain values to a buffer
+ * @param buffer buffer to write to
+ * @param p values
+ * @param n number of values
+ */
+template<class T>
+inline void appendArray(std::vector<unsigned char> &buffer, const T *p,
+  size_t n)
+{
+  const unsigned char *b = reinterpret_cast<const unsigned char*>(p);
+  buffer.insert(buffer.end(), b, b + n * sizeof(T));
+}
+
+/**
+ * Pads a buffer with zeros until its size is a multiple of the given
+ * alignment
+ * @param buffer
+ * @param alignment bytes
+ */
+inline void alignBuffer(std::vector<unsigned char> &buffer, size_t alignment)
+{
+  buffer.resize((buffer.size() + alignment - 1) / alignment * alignment, 0);
+}
+
+/**
+ * Writes a whole buffer into a file
+ * @param filename
+ * @param buffer
+ * @throw std::string if the file cannot be written
+ */
+void writeFile(const std::string &filename,
+  const std::vector<unsigned char> &buffer);
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,229 @@
+/**
+ * File: BoundedQueue.h
+ * Date: October 2026
+ * Description: bounded lock-free queue between one producer thread and
+ *   one consumer thread
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_BOUNDED_QUEUE__
+#define __D_T_BOUNDED_QUEUE__
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <utility>
+
+namespace DBoW2 {
+
+/// @param T type of the items, default-constructible and movable
+/// Ring buffer of a fixed capacity for a single producer and consumer
+/**
+ * Items are pushed and popped without locking. The blocking push and pop
+ * spin for a while and then sleep until the other side makes room or
+ * pushes an item; the mutex is only taken while one of the sides sleeps.
+ * Once closed, items cannot be pushed any longer, and pop returns false
+ * when there are no items left.
+ */
+template<class T>
+class BoundedQueue
+{
+public:
+
+  /// Times a blocked side checks the queue again before sleeping
+  static const int SPINS = 64;
+
+  /**
+   * Creates an empty queue
+   * @param capacity maximum number of items (0 is taken as 1)
+   */
+  explicit BoundedQueue(size_t capacity)
+    : m_items(capacity > 0 ? capacity : 1), m_head(0), m_tail(0),
+    m_closed(false), m_waiters(0)
+  {
+  }
+
+  /**
+   * Returns the maximum number of items
+   * @return capacity
+   */
+  inline size_t capacity() const { return m_items.size(); }
+
+  /**
+   * Returns the number of items. It may be outdated if the other side is
+   * working on the queue
+   * @return number of items
+   */
+  inline size_t size() const
+  {
+    return m_tail.load(std::memory_order_acquire) -
+      m_head.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Appends an item if there is room for it. Only the producer can call it
+   * @param item item to move into the queue. It is not changed if it could
+   *   not be pushed
+   * @return true iff pushed
+   */
+  bool tryPush(T &item)
+  {
+    if(m_closed.load(std::memory_order_acquire)) return false;
+
+    const size_t t = m_tail.load(std::memory_order_relaxed);
+    if(t - m_head.load(std::memory_order_acquire) == m_items.size())
+      return false;
+
+    m_items[t % m_items.size()] = std::move(item);
+    m_tail.store(t + 1);
+    wake();
+    return true;
+  }
+
+  /**
+   * Appends an item, waiting until there is room for it. Only the producer
+   * can call it
+   * @param item item to move into the queue
+   * @return false if the queue was closed, and the item was not pushed
+   */
+  bool push(T &item)
+  {
+    for(;;)
+    {
+      if(tryPush(item)) return true;
+      if(m_closed.load(std::memory_order_acquire)) return false;
+      wait([this]()
+      {
+        return m_closed.load() ||
+          m_tail.load(std::memory_order_relaxed) - m_head.load() <
+          m_items.size();
+      });
+    }
+  }
+
+  /**
+   * Takes the first item if there is any. Only the consumer can call it
+   * @param item (out) item
+   * @return true iff there was an item
+   */
+  bool tryPop(T &item)
+  {
+    const size_t h = m_head.load(std::memory_order_relaxed);
+    if(h == m_tail.load(std::memory_order_acquire)) return false;
+
+    T &slot = m_items[h % m_items.size()];
+    item = std::move(slot);
+    slot = T();
+    m_head.store(h + 1);
+    wake();
+    return true;
+  }
+
+  /**
+   * Takes the first item, waiting until there is one. Only the consumer
+   * can call it
+   * @param item (out) item
+   * @return false if the queue is closed and empty
+   */
+  bool pop(T &item)
+  {
+    for(;;)
+    {
+      if(tryPop(item)) return true;
+      if(m_closed.load(std::memory_order_acquire))
+        return tryPop(item); // pushed before closing
+      wait([this]()
+      {
+        return m_closed.load() ||
+          m_head.load(std::memory_order_relaxed) != m_tail.load();
+      });
+    }
+  }
+
+  /**
+   * Closes the queue, waking up the side that waits on it. The items
+   * already pushed can still be popped
+   */
+  void close()
+  {
+    m_closed.store(true);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_condition.notify_all();
+  }
+
+  /**
+   * Returns whether the queue was closed
+   * @return true iff closed
+   */
+  inline bool closed() const
+  {
+    return m_closed.load(std::memory_order_acquire);
+  }
+
+protected:
+
+  /**
+   * Waits until a condition holds, spinning first and then sleeping
+   * @param ready condition, which changes when the other side pushes,
+   *   pops or closes
+   */
+  template<class Predicate>
+  void wait(Predicate ready)
+  {
+    for(int i = 0; i < SPINS; ++i)
+    {
+      if(ready()) return;
+      std::this_thread::yield();
+    }
+
+    // the counters are sequentially consistent, and the other side reads
+    // m_waiters after changing the queue, so either the change is seen
+    // here or it notifies
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_waiters.fetch_add(1);
+    while(!ready()) m_condition.wait(lock);
+    m_waiters.fetch_sub(1);
+  }
+
+  /**
+   * Wakes up the other side if it is sleeping
+   */
+  inline void wake()
+  {
+    if(m_waiters.load() > 0)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_condition.notify_all();
+    }
+  }
+
+private:
+
+  BoundedQueue(const BoundedQueue &);
+  BoundedQueue& operator=(const BoundedQueue &);
+
+private:
+
+  /// Slots of the items
+  std::vector<T> m_items;
+  /// Number of items popped
+  std::atomic<size_t> m_head;
+  /// Number of items pushed
+  std::atomic<size_t> m_tail;
+  /// Whether no more items can be pushed
+  std::atomic<bool> m_closed;
+  /// Number of sides sleeping
+  std::atomic<int> m_waiters;
+  /// Protects the sleeps
+  std::mutex m_mutex;
+  /// Signals changes to the sleeping side
+  std::condition_variable m_condition;
+};
+
+} // namespace DBoW2
+
+#endif
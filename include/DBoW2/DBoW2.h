@@ -51,12 +51,16 @@ namespace DBoW2
 
 #include "TemplatedVocabulary.h"
 #include "TemplatedDatabase.h"
+#include "TemplatedShardedDatabase.h"
+#include "TemplatedPipeline.h"
 #include "BowVector.h"
 #include "FeatureVector.h"
 #include "QueryResults.h"
+#include "QueryStats.h"
 #include "FBrief.h"
 #include "FORB.h"
 #include "FBRISK.h"
+#include "FBinary.h"
 
 /// ORB Vocabulary
 typedef DBoW2::TemplatedVocabulary<DBoW2::FORB::TDescriptor, DBoW2::FORB> 
@@ -82,5 +86,86 @@ typedef DBoW2::TemplatedVocabulary<DBoW2::FBRISK::TDescriptor, DBoW2::FBRISK>
 typedef DBoW2::TemplatedDatabase<DBoW2::FBRISK::TDescriptor, DBoW2::FBRISK> 
   BriskDatabase;
 
+/// FORB sharded database
+typedef DBoW2::TemplatedShardedDatabase<DBoW2::FORB::TDescriptor, 
+  DBoW2::FORB> OrbShardedDatabase;
+
+/// BRIEF sharded database
+typedef DBoW2::TemplatedShardedDatabase<DBoW2::FBrief::TDescriptor, 
+  DBoW2::FBrief> BriefShardedDatabase;
+
+/// BRISK sharded database
+typedef DBoW2::TemplatedShardedDatabase<DBoW2::FBRISK::TDescriptor, 
+  DBoW2::FBRISK> BriskShardedDatabase;
+
+/// FORB pipeline
+typedef DBoW2::TemplatedPipeline<DBoW2::FORB::TDescriptor, DBoW2::FORB> 
+  OrbPipeline;
+
+/// BRIEF pipeline
+typedef DBoW2::TemplatedPipeline<DBoW2::FBrief::TDescriptor, DBoW2::FBrief> 
+  BriefPipeline;
+
+/// BRISK pipeline
+typedef DBoW2::TemplatedPipeline<DBoW2::FBRISK::TDescriptor, DBoW2::FBRISK> 
+  BriskPipeline;
+
+/// 256-bit binary descriptors (ORB, BRIEF), stored by value
+typedef DBoW2::FBinary<32> FBinary32;
+
+/// 384-bit binary descriptors (BRISK), stored by value
+typedef DBoW2::FBinary<48> FBinary48;
+
+/// 512-bit binary descriptors (FREAK), stored by value
+typedef DBoW2::FBinary<64> FBinary64;
+
+/// 256-bit binary Vocabulary
+typedef DBoW2::TemplatedVocabulary<FBinary32::TDescriptor, FBinary32> 
+  Binary32Vocabulary;
+
+/// 256-bit binary Database
+typedef DBoW2::TemplatedDatabase<FBinary32::TDescriptor, FBinary32> 
+  Binary32Database;
+
+/// 256-bit binary sharded database
+typedef DBoW2::TemplatedShardedDatabase<FBinary32::TDescriptor, FBinary32> 
+  Binary32ShardedDatabase;
+
+/// 256-bit binary pipeline
+typedef DBoW2::TemplatedPipeline<FBinary32::TDescriptor, FBinary32> 
+  Binary32Pipeline;
+
+/// 384-bit binary Vocabulary
+typedef DBoW2::TemplatedVocabulary<FBinary48::TDescriptor, FBinary48> 
+  Binary48Vocabulary;
+
+/// 384-bit binary Database
+typedef DBoW2::TemplatedDatabase<FBinary48::TDescriptor, FBinary48> 
+  Binary48Database;
+
+/// 384-bit binary sharded database
+typedef DBoW2::TemplatedShardedDatabase<FBinary48::TDescriptor, FBinary48> 
+  Binary48ShardedDatabase;
+
+/// 384-bit binary pipeline
+typedef DBoW2::TemplatedPipeline<FBinary48::TDescriptor, FBinary48> 
+  Binary48Pipeline;
+
+/// 512-bit binary Vocabulary
+typedef DBoW2::TemplatedVocabulary<FBinary64::TDescriptor, FBinary64> 
+  Binary64Vocabulary;
+
+/// 512-bit binary Database
+typedef DBoW2::TemplatedDatabase<FBinary64::TDescriptor, FBinary64> 
+  Binary64Database;
+
+/// 512-bit binary sharded database
+typedef DBoW2::TemplatedShardedDatabase<FBinary64::TDescriptor, FBinary64> 
+  Binary64ShardedDatabase;
+
+/// 512-bit binary pipeline
+typedef DBoW2::TemplatedPipeline<FBinary64::TDescriptor, FBinary64> 
+  Binary64Pipeline;
+
 #endif
 
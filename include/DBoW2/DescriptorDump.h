@@ -0,0 +1,308 @@
+/**
+ * File: DescriptorDump.h
+ * Date: October 2026
+ * Description: files of packed descriptors grouped by image, used to train
+ *   vocabularies that do not fit in memory
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_DESCRIPTOR_DUMP__
+#define __D_T_DESCRIPTOR_DUMP__
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "DescriptorTraits.h"
+
+namespace DBoW2 {
+
+/// Header of a descriptor dump file
+/**
+ * The header is followed by one record per image: the number of
+ * descriptors (uint32) and the packed descriptors of the image. The file
+ * is written in the byte order of the machine.
+ */
+struct DescriptorDumpHeader
+{
+  /// "DBoW2DSC"
+  char magic[8];
+  /// Version of the format
+  uint32_t version;
+  /// 0x01020304 in the byte order of the writer
+  uint32_t byte_order;
+  /// Name of the descriptor (DescriptorTraits<F>::name())
+  char descriptor[16];
+  /// Bytes of a packed descriptor
+  uint32_t descriptor_bytes;
+  /// Unused
+  uint32_t reserved;
+  /// Number of images in the file
+  uint64_t nimages;
+  /// Number of descriptors in the file
+  uint64_t ndescriptors;
+};
+
+/// @param TDescriptor class of descriptor
+/// @param F class of descriptor functions
+/// Writes the descriptors of a sequence of images into a dump file
+template<class TDescriptor, class F>
+class TemplatedDescriptorWriter
+{
+public:
+
+  /**
+   * Creates the file
+   * @param filename
+   * @throw std::string if F has no packed descriptors or the file cannot
+   *   be created
+   */
+  explicit TemplatedDescriptorWriter(const std::string &filename);
+
+  /**
+   * Closes the file if it is still open
+   */
+  ~TemplatedDescriptorWriter();
+
+  /**
+   * Appends the descriptors of an image
+   * @param features
+   * @throw std::string if the file cannot be written
+   */
+  void add(const std::vector<TDescriptor> &features);
+
+  /**
+   * Writes the final header and closes the file
+   * @throw std::string if the file cannot be written
+   */
+  void close();
+
+  /**
+   * Returns the number of images written
+   * @return number of images
+   */
+  inline uint64_t images() const { return m_header.nimages; }
+
+  /**
+   * Returns the number of descriptors written
+   * @return number of descriptors
+   */
+  inline uint64_t descriptors() const { return m_header.ndescriptors; }
+
+private:
+
+  TemplatedDescriptorWriter(const TemplatedDescriptorWriter &);
+  TemplatedDescriptorWriter& operator=(const TemplatedDescriptorWriter &);
+
+  /// File being written
+  std::ofstream m_file;
+  /// Header with the current counters
+  DescriptorDumpHeader m_header;
+  /// Packed descriptors of the last image
+  std::vector<unsigned char> m_buffer;
+};
+
+/// @param TDescriptor class of descriptor
+/// @param F class of descriptor functions
+/// Reads the images of a dump file one after another
+template<class TDescriptor, class F>
+class TemplatedDescriptorReader
+{
+public:
+
+  /**
+   * Opens a file and checks its header
+   * @param filename
+   * @throw std::string if the file cannot be read or it was not written
+   *   with the same descriptor class and byte order
+   */
+  explicit TemplatedDescriptorReader(const std::string &filename);
+
+  /**
+   * Reads the descriptors of the next image
+   * @param features (out) descriptors of the image
+   * @return false if there are no more images
+   * @throw std::string if the file is truncated
+   */
+  bool read(std::vector<TDescriptor> &features);
+
+  /**
+   * Goes back to the first image
+   */
+  void rewind();
+
+  /**
+   * Returns the number of images in the file
+   * @return number of images
+   */
+  inline uint64_t images() const { return m_header.nimages; }
+
+  /**
+   * Returns the number of descriptors in the file
+   * @return number of descriptors
+   */
+  inline uint64_t descriptors() const { return m_header.ndescriptors; }
+
+private:
+
+  TemplatedDescriptorReader(const TemplatedDescriptorReader &);
+  TemplatedDescriptorReader& operator=(const TemplatedDescriptorReader &);
+
+  /// File being read
+  std::ifstream m_file;
+  /// Header of the file
+  DescriptorDumpHeader m_header;
+  /// Images read since the last rewind
+  uint64_t m_read;
+  /// Packed descriptors of the last image
+  std::vector<unsigned char> m_buffer;
+};
+
+// --------------------------------------------------------------------------
+
+/// Version of the descriptor dump files
+static const uint32_t DESCRIPTOR_DUMP_VERSION = 1;
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+TemplatedDescriptorWriter<TDescriptor,F>::TemplatedDescriptorWriter
+  (const std::string &filename)
+{
+  if(!DescriptorTraits<F>::packed)
+    throw std::string("Only packed descriptors can be dumped");
+
+  memset(&m_header, 0, sizeof(m_header));
+  memcpy(m_header.magic, "DBoW2DSC", 8);
+  m_header.version = DESCRIPTOR_DUMP_VERSION;
+  m_header.byte_order = 0x01020304;
+  strncpy(m_header.descriptor, DescriptorTraits<F>::name(),
+    sizeof(m_header.descriptor) - 1);
+  m_header.descriptor_bytes = DescriptorTraits<F>::bytes;
+
+  m_file.open(filename.c_str(), std::ios::out | std::ios::binary);
+  if(!m_file.is_open()) throw std::string("Could not open file ") + filename;
+
+  // the counters are written again by close
+  m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+TemplatedDescriptorWriter<TDescriptor,F>::~TemplatedDescriptorWriter()
+{
+  try { close(); } catch(std::string &) {}
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedDescriptorWriter<TDescriptor,F>::add
+  (const std::vector<TDescriptor> &features)
+{
+  const size_t bytes = DescriptorTraits<F>::bytes;
+  const uint32_t n = features.size();
+
+  m_buffer.resize(features.size() * bytes);
+  for(size_t i = 0; i < features.size(); ++i)
+    DescriptorTraits<F>::pack(features[i], &m_buffer[i * bytes]);
+
+  m_file.write(reinterpret_cast<const char*>(&n), sizeof(n));
+  if(!m_buffer.empty())
+    m_file.write(reinterpret_cast<const char*>(&m_buffer[0]),
+      m_buffer.size());
+  if(m_file.fail()) throw std::string("Could not write descriptor file");
+
+  m_header.nimages++;
+  m_header.ndescriptors += n;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedDescriptorWriter<TDescriptor,F>::close()
+{
+  if(!m_file.is_open()) return;
+
+  m_file.seekp(0);
+  m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+  m_file.close();
+  if(m_file.fail()) throw std::string("Could not write descriptor file");
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+TemplatedDescriptorReader<TDescriptor,F>::TemplatedDescriptorReader
+  (const std::string &filename): m_read(0)
+{
+  m_file.open(filename.c_str(), std::ios::in | std::ios::binary);
+  if(!m_file.is_open()) throw std::string("Could not open file ") + filename;
+
+  m_file.read(reinterpret_cast<char*>(&m_header), sizeof(m_header));
+  if(m_file.fail() || memcmp(m_header.magic, "DBoW2DSC", 8) != 0)
+    throw std::string("Not a descriptor file: ") + filename;
+
+  if(m_header.version != DESCRIPTOR_DUMP_VERSION)
+    throw std::string("Unsupported descriptor file version: ") + filename;
+
+  if(m_header.byte_order != 0x01020304)
+    throw std::string("Descriptor file written with another byte order: ") +
+      filename;
+
+  m_header.descriptor[sizeof(m_header.descriptor) - 1] = '\0';
+  if(!DescriptorTraits<F>::packed ||
+    m_header.descriptor_bytes != (uint32_t)DescriptorTraits<F>::bytes ||
+    strcmp(m_header.descriptor, DescriptorTraits<F>::name()) != 0)
+  {
+    throw std::string("Descriptor file of ") + m_header.descriptor +
+      " descriptors: " + filename;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedDescriptorReader<TDescriptor,F>::read
+  (std::vector<TDescriptor> &features)
+{
+  if(m_read == m_header.nimages) return false;
+
+  const size_t bytes = DescriptorTraits<F>::bytes;
+
+  uint32_t n = 0;
+  m_file.read(reinterpret_cast<char*>(&n), sizeof(n));
+  if(m_file.fail()) throw std::string("Truncated descriptor file");
+
+  m_buffer.resize((size_t)n * bytes);
+  if(n > 0)
+    m_file.read(reinterpret_cast<char*>(&m_buffer[0]), m_buffer.size());
+  if(m_file.fail()) throw std::string("Truncated descriptor file");
+
+  features.resize(n);
+  for(uint32_t i = 0; i < n; ++i)
+    DescriptorTraits<F>::unpack(&m_buffer[i * bytes], features[i]);
+
+  m_read++;
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedDescriptorReader<TDescriptor,F>::rewind()
+{
+  m_file.clear();
+  m_file.seekg(sizeof(DescriptorDumpHeader));
+  m_read = 0;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * File: DescriptorMatrix.h
+ * Date: October 2026
+ * Description: view of descriptors stored in the rows of a matrix, to
+ *   transform them without copying them into vectors of descriptors
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_DESCRIPTOR_MATRIX__
+#define __D_T_DESCRIPTOR_MATRIX__
+
+#include <opencv2/core.hpp>
+#include <cstddef>
+#include <string>
+
+namespace DBoW2 {
+
+/// Rows of packed descriptors in memory that belongs to someone else
+/**
+ * Each row holds the packed version of a descriptor (see
+ * DescriptorTraits), as the matrices computed by the extractors of OpenCV
+ * do: 8-bit rows for binary descriptors and 32-bit float rows for SURF.
+ * The rows are read in place by TemplatedVocabulary::transform and by the
+ * TemplatedDatabase::add and query that take them, so the memory must
+ * outlive the call. A cv::Mat converts implicitly into a DescriptorMatrix.
+ */
+class DescriptorMatrix
+{
+public:
+
+  /**
+   * Creates an empty matrix
+   */
+  DescriptorMatrix(): m_data(NULL), m_rows(0), m_row_bytes(0), m_stride(0)
+  {
+  }
+
+  /**
+   * Views the rows of an OpenCV matrix, which may be a region of another
+   * @param mat NxL matrix of type CV_8U or CV_32F
+   * @throw std::string if the matrix has another type
+   */
+  DescriptorMatrix(const cv::Mat &mat)
+    : m_data(mat.data), m_rows(mat.rows),
+    m_row_bytes((size_t)mat.cols * mat.elemSize()), m_stride(mat.step)
+  {
+    if(mat.rows > 0 && mat.depth() != CV_8U && mat.depth() != CV_32F)
+      throw std::string("DescriptorMatrix: the descriptors must be a "
+        "CV_8U or a CV_32F matrix");
+  }
+
+  /**
+   * Views rows of raw memory
+   * @param data first row
+   * @param rows number of rows
+   * @param row_bytes length of each row
+   * @param stride bytes from the start of a row to the start of the next
+   *   one, or 0 if the rows are contiguous
+   */
+  DescriptorMatrix(const void *data, size_t rows, size_t row_bytes,
+    size_t stride = 0)
+    : m_data(static_cast<const unsigned char*>(data)), m_rows(rows),
+    m_row_bytes(row_bytes), m_stride(stride > 0 ? stride : row_bytes)
+  {
+  }
+
+  /**
+   * Returns the number of rows (descriptors)
+   * @return rows
+   */
+  inline size_t rows() const { return m_rows; }
+
+  /**
+   * Returns whether there are no rows
+   * @return true iff empty
+   */
+  inline bool empty() const { return m_rows == 0; }
+
+  /**
+   * Returns the length of each row
+   * @return bytes
+   */
+  inline size_t rowBytes() const { return m_row_bytes; }
+
+  /**
+   * Returns the distance between the starts of two consecutive rows
+   * @return bytes
+   */
+  inline size_t stride() const { return m_stride; }
+
+  /**
+   * Returns a row
+   * @param i row index (must be < rows())
+   * @return pointer to its first byte
+   */
+  inline const unsigned char* row(size_t i) const
+  {
+    return m_data + i * m_stride;
+  }
+
+private:
+
+  /// First row
+  const unsigned char *m_data;
+  /// Number of rows
+  size_t m_rows;
+  /// Bytes of each row
+  size_t m_row_bytes;
+  /// Bytes between rows
+  size_t m_stride;
+};
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * File: DescriptorTraits.h
+ * Date: October 2026
+ * Description: packed representation of fixed-length descriptors
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_DESCRIPTOR_TRAITS__
+#define __D_T_DESCRIPTOR_TRAITS__
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace DBoW2 {
+
+/// Describes how the descriptors managed by a class F can be stored as
+/// fixed-width blocks of bytes.
+/**
+ * Templated structures (TemplatedVocabulary, TemplatedDatabase, ...) use
+ * this class to lay out descriptors contiguously. By default, descriptors
+ * are not packable and F::distance is used on TDescriptor objects.
+ * F classes with fixed-length descriptors specialize this class next to
+ * their declaration.
+ */
+template<class F>
+struct DescriptorTraits
+{
+  /// Whether the descriptors of F have a packed representation
+  static const bool packed = false;
+
+  /// Bytes of a packed descriptor
+  static const int bytes = 0;
+
+  /// Whether the packed descriptors are binary and distance is their
+  /// hamming distance. Only their trees can be uploaded to the GPU
+  static const bool hamming = false;
+
+  /// Whether the packed descriptors are vectors of bytes / sizeof(float)
+  /// floats and distance is their squared euclidean distance. Training
+  /// then compares descriptors and clusters with a matrix product
+  static const bool squared_l2 = false;
+
+  /**
+   * Returns the name of the descriptor, stored in binary vocabulary files
+   * to check that they are loaded with the right class
+   * @return name, or an empty string if unknown
+   */
+  static const char* name() { return ""; }
+
+  /**
+   * Writes the packed version of a descriptor
+   * @param a descriptor
+   * @param p (out) buffer of at least bytes bytes
+   */
+  template<class TDescriptor>
+  static void pack(const TDescriptor &, unsigned char *) {}
+
+  /**
+   * Reads a descriptor from its packed version
+   * @param p packed descriptor
+   * @param a (out) descriptor
+   */
+  template<class TDescriptor>
+  static void unpack(const unsigned char *, TDescriptor &) {}
+
+  /**
+   * Returns a pointer to the packed version of a descriptor, avoiding the
+   * copy when the descriptor memory is already packed
+   * @param a descriptor
+   * @param buffer buffer of at least bytes bytes, used if a copy is needed
+   * @return pointer to the packed descriptor
+   */
+  template<class TDescriptor>
+  static const unsigned char* view(const TDescriptor &, unsigned char *)
+  {
+    return NULL;
+  }
+
+  /**
+   * Calculates the distance between two packed descriptors. It must return
+   * the same value as F::distance on the unpacked descriptors
+   * @param a
+   * @param b
+   * @return distance
+   */
+  static double distance(const unsigned char *, const unsigned char *)
+  {
+    return 0;
+  }
+
+  /**
+   * Finds the closest descriptor to a query among n packed descriptors 
+   * stored contiguously. Ties are resolved in favour of the first one
+   * @param q packed query descriptor
+   * @param blocks n > 0 packed descriptors
+   * @param n number of descriptors in blocks
+   * @param best_distance (out) if given, distance to the closest descriptor
+   * @return index of the closest descriptor in blocks
+   */
+  static unsigned int nearest(const unsigned char *, const unsigned char *,
+    unsigned int, double * = NULL)
+  {
+    return 0;
+  }
+
+  /**
+   * Calculates the distances between a query and n packed descriptors
+   * stored contiguously
+   * @param q packed query descriptor
+   * @param blocks n packed descriptors
+   * @param n number of descriptors in blocks
+   * @param distances (out) n distances
+   */
+  static void distances(const unsigned char *, const unsigned char *,
+    unsigned int, double *) {}
+};
+
+} // namespace DBoW2
+
+#endif
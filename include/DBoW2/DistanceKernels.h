@@ -0,0 +1,117 @@
+/**
+ * File: DistanceKernels.h
+ * Date: October 2026
+ * Description: vectorized distance functions for packed descriptors
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_DISTANCE_KERNELS__
+#define __D_T_DISTANCE_KERNELS__
+
+#include <cstddef>
+#include <string>
+
+namespace DBoW2 {
+
+/// Distance kernels are selected according to the instruction sets the
+/// CPU supports when the library is loaded. The available kernels are
+/// "avx512" (AVX-512 VPOPCNTDQ), "avx2", "popcnt", "neon" and "generic".
+
+/**
+ * Returns the hamming distance between two blocks of bytes
+ * @param a
+ * @param b
+ * @param bytes length of the blocks
+ * @return number of bits that differ in a and b
+ */
+unsigned int hammingDistance(const unsigned char *a, const unsigned char *b,
+  int bytes);
+
+/**
+ * Computes the hamming distances between a query block and n blocks stored
+ * contiguously, as the children of a vocabulary node
+ * @param q query block
+ * @param blocks n blocks of the same length
+ * @param n number of blocks
+ * @param bytes length of each block
+ * @param distances (out) n distances
+ */
+void hammingDistances(const unsigned char *q, const unsigned char *blocks,
+  unsigned int n, int bytes, unsigned int *distances);
+
+/**
+ * Returns the index of the block closest to the query among n blocks stored
+ * contiguously. Ties are resolved in favour of the first block.
+ * @param q query block
+ * @param blocks n > 0 blocks of the same length
+ * @param n number of blocks
+ * @param bytes length of each block
+ * @param distance (out) if given, distance to the closest block
+ * @return index of the closest block
+ */
+unsigned int hammingNearest(const unsigned char *q,
+  const unsigned char *blocks, unsigned int n, int bytes,
+  unsigned int *distance = NULL);
+
+/**
+ * Returns the squared L2 distance between two float vectors. All the
+ * kernels add up the squares in the same order, so that they return
+ * exactly the same value
+ * @param a
+ * @param b
+ * @param dims length of the vectors
+ * @return squared euclidean distance
+ */
+double squaredL2Distance(const float *a, const float *b, int dims);
+
+/**
+ * Returns the squared L2 norm of a float vector
+ * @param a
+ * @param dims length of the vector
+ * @return sum of the squares of a
+ */
+double squaredL2Norm(const float *a, int dims);
+
+/**
+ * Computes the squared L2 distances between a query vector and n vectors
+ * stored contiguously
+ * @param q query vector
+ * @param blocks n vectors of the same length
+ * @param n number of vectors
+ * @param dims length of each vector
+ * @param distances (out) n distances
+ */
+void squaredL2Distances(const float *q, const float *blocks,
+  unsigned int n, int dims, double *distances);
+
+/**
+ * Returns the index of the vector closest to the query among n vectors
+ * stored contiguously. Ties are resolved in favour of the first vector.
+ * @param q query vector
+ * @param blocks n > 0 vectors of the same length
+ * @param n number of vectors
+ * @param dims length of each vector
+ * @param distance (out) if given, squared distance to the closest vector
+ * @return index of the closest vector
+ */
+unsigned int squaredL2Nearest(const float *q, const float *blocks,
+  unsigned int n, int dims, double *distance = NULL);
+
+/**
+ * Returns the name of the distance kernel in use
+ * @return kernel name
+ */
+const char* distanceKernel();
+
+/**
+ * Forces the use of a given distance kernel. This function is not
+ * thread-safe and should be called before using any vocabulary
+ * @param name kernel name
+ * @return true iff the kernel is supported by this CPU and was selected
+ */
+bool selectDistanceKernel(const std::string &name);
+
+} // namespace DBoW2
+
+#endif
@@ -13,8 +13,11 @@
 #include <opencv2/core.hpp>
 #include <vector>
 #include <string>
+#include <algorithm>
 
 #include "FClass.h"
+#include "DescriptorTraits.h"
+#include "DistanceKernels.h"
 
 namespace DBoW2 {
 
@@ -75,6 +78,62 @@ public:
 
 };
 
+/// BRISK descriptors are packed as their L bytes
+template<>
+struct DescriptorTraits<FBRISK>
+{
+  static const bool packed = true;
+  static const int bytes = FBRISK::L;
+  static const bool hamming = true;
+  static const bool squared_l2 = false;
+
+  static inline const char* name() { return "BRISK"; }
+
+  static inline void pack(const FBRISK::TDescriptor &a, unsigned char *p)
+  {
+    std::copy(a.begin(), a.begin() + bytes, p);
+  }
+
+  static inline void unpack(const unsigned char *p, FBRISK::TDescriptor &a)
+  {
+    a.assign(p, p + bytes);
+  }
+
+  static inline const unsigned char* view(const FBRISK::TDescriptor &a,
+    unsigned char *)
+  {
+    return &a.front();
+  }
+
+  static inline double distance(const unsigned char *a,
+    const unsigned char *b)
+  {
+    return static_cast<double>(hammingDistance(a, b, bytes));
+  }
+
+  static inline unsigned int nearest(const unsigned char *q,
+    const unsigned char *blocks, unsigned int n, double *best_distance = NULL)
+  {
+    unsigned int d;
+    const unsigned int i = hammingNearest(q, blocks, n, bytes, &d);
+    if(best_distance) *best_distance = static_cast<double>(d);
+    return i;
+  }
+
+  static inline void distances(const unsigned char *q,
+    const unsigned char *blocks, unsigned int n, double *d)
+  {
+    // in runs of up to 64 blocks
+    unsigned int h[64];
+    for(unsigned int i = 0; i < n; i += 64)
+    {
+      const unsigned int m = (n - i < 64 ? n - i : 64);
+      hammingDistances(q, blocks + (size_t)i * bytes, m, bytes, h);
+      for(unsigned int j = 0; j < m; ++j) d[i + j] = h[j];
+    }
+  }
+};
+
 } // namespace DBoW2
 
 #endif
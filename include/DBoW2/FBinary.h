@@ -0,0 +1,361 @@
+/**
+ * File: FBinary.h
+ * Date: October 2026
+ * Description: functions for binary descriptors of a length known at
+ *   compile time, stored by value
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_F_BINARY__
+#define __D_T_F_BINARY__
+
+#include <opencv2/core.hpp>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <stdint.h>
+#include <array>
+
+#include "FClass.h"
+#include "DescriptorTraits.h"
+#include "DistanceKernels.h"
+
+namespace DBoW2 {
+
+/// Functions to manipulate binary descriptors of N bytes
+/**
+ * Descriptors are arrays of N / 8 64-bit words, so that they are copied by
+ * value and vectors of them are contiguous, with no allocation per
+ * descriptor. Their bytes are those of the descriptor in memory order, as
+ * the rows of the CV_8U matrices of OpenCV, and the text version is the
+ * one of FORB and FBRISK, so that FBinary<32> reads the text vocabularies
+ * of ORB and FBinary<48> the ones of BRISK. Distances are the hamming
+ * distance, and every loop runs over a number of words known at compile
+ * time, which the compiler unrolls.
+ */
+template<int N>
+class FBinary: protected FClass
+{
+public:
+
+  static_assert(N > 0 && N % 8 == 0,
+    "FBinary: the length must be a positive multiple of 8 bytes");
+
+  /// Number of 64-bit words of a descriptor
+  static const int W = N / 8;
+
+  /// Descriptor type
+  typedef std::array<uint64_t, W> TDescriptor;
+
+  /// Pointer to a single descriptor
+  typedef const TDescriptor *pDescriptor;
+
+  /// Descriptor length (in bytes)
+  static const int L = N;
+
+  /**
+   * Calculates the mean value of a set of descriptors. Each bit is set if
+   * it is set in at least half of them, as in FORB
+   * @param descriptors vector of pointers to descriptors
+   * @param mean mean descriptor (all zeros if there are no descriptors)
+   */
+  static void meanValue(const std::vector<pDescriptor> &descriptors,
+    TDescriptor &mean);
+
+  /**
+   * Calculates the hamming distance between two descriptors
+   * @param a
+   * @param b
+   * @return distance
+   */
+  static inline double distance(const TDescriptor &a, const TDescriptor &b)
+  {
+    unsigned int d = 0;
+    for(int w = 0; w < W; ++w) d += popcount(a[w] ^ b[w]);
+    return static_cast<double>(d);
+  }
+
+  /**
+   * Returns a string version of the descriptor
+   * @param a descriptor
+   * @return string version
+   */
+  static std::string toString(const TDescriptor &a);
+
+  /**
+   * Returns a descriptor from a string
+   * @param a descriptor
+   * @param s string version
+   */
+  static void fromString(TDescriptor &a, const std::string &s);
+
+  /**
+   * Returns a mat with the descriptors in float format, a value per bit,
+   * the most significant bit of each byte first, as FORB
+   * @param descriptors
+   * @param mat (out) NxL*8 32F matrix
+   */
+  static void toMat32F(const std::vector<TDescriptor> &descriptors,
+    cv::Mat &mat);
+
+  /**
+   * Returns a mat with the descriptors in byte format
+   * @param descriptors
+   * @param mat (out) NxL 8U matrix
+   */
+  static void toMat8U(const std::vector<TDescriptor> &descriptors,
+    cv::Mat &mat);
+
+  /**
+   * Returns the descriptors stored in the rows of a matrix, such as the
+   * ones computed by OpenCV
+   * @param mat NxL 8U matrix
+   * @param descriptors (out) N descriptors
+   * @throw std::string if the matrix does not have L bytes per row
+   */
+  static void fromMat8U(const cv::Mat &mat,
+    std::vector<TDescriptor> &descriptors);
+
+  /**
+   * Returns the bytes of a descriptor
+   * @param a descriptor
+   * @return pointer to its L bytes
+   */
+  static inline const unsigned char* bytes(const TDescriptor &a)
+  {
+    return reinterpret_cast<const unsigned char*>(a.data());
+  }
+
+  /**
+   * Returns the bytes of a descriptor
+   * @param a descriptor
+   * @return pointer to its L bytes
+   */
+  static inline unsigned char* bytes(TDescriptor &a)
+  {
+    return reinterpret_cast<unsigned char*>(a.data());
+  }
+
+protected:
+
+  /**
+   * Counts the bits set in a word
+   * @param v
+   * @return number of bits set
+   */
+  static inline unsigned int popcount(uint64_t v)
+  {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int)__builtin_popcountll(v);
+#else
+    // http://graphics.stanford.edu/~seander/bithacks.html
+    v = v - ((v >> 1) & (uint64_t)~(uint64_t)0/3);
+    v = (v & (uint64_t)~(uint64_t)0/15*3) + ((v >> 2) &
+      (uint64_t)~(uint64_t)0/15*3);
+    v = (v + (v >> 4)) & (uint64_t)~(uint64_t)0/255*15;
+    return (unsigned int)((uint64_t)(v * ((uint64_t)~(uint64_t)0/255)) >>
+      56);
+#endif
+  }
+
+};
+
+// --------------------------------------------------------------------------
+
+template<int N>
+void FBinary<N>::meanValue(const std::vector<pDescriptor> &descriptors,
+  TDescriptor &mean)
+{
+  mean.fill(0);
+  if(descriptors.empty()) return;
+
+  if(descriptors.size() == 1)
+  {
+    mean = *descriptors[0];
+    return;
+  }
+
+  // bits are counted per word: bit b of word w in sum[w][b]
+  unsigned int sum[W][64];
+  std::memset(sum, 0, sizeof(sum));
+
+  for(size_t i = 0; i < descriptors.size(); ++i)
+  {
+    const TDescriptor &d = *descriptors[i];
+    for(int w = 0; w < W; ++w)
+    {
+      const uint64_t v = d[w];
+      unsigned int *s = sum[w];
+      for(int b = 0; b < 64; ++b) s[b] += (unsigned int)((v >> b) & 1);
+    }
+  }
+
+  const unsigned int N2 = (unsigned int)(descriptors.size() / 2 +
+    descriptors.size() % 2);
+  for(int w = 0; w < W; ++w)
+  {
+    uint64_t v = 0;
+    for(int b = 0; b < 64; ++b)
+      if(sum[w][b] >= N2) v |= (uint64_t)1 << b;
+    mean[w] = v;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<int N>
+std::string FBinary<N>::toString(const TDescriptor &a)
+{
+  std::stringstream ss;
+  const unsigned char *p = bytes(a);
+
+  for(int i = 0; i < L; ++i, ++p)
+  {
+    ss << (int)*p << " ";
+  }
+
+  return ss.str();
+}
+
+// --------------------------------------------------------------------------
+
+template<int N>
+void FBinary<N>::fromString(TDescriptor &a, const std::string &s)
+{
+  a.fill(0);
+  unsigned char *p = bytes(a);
+
+  std::stringstream ss(s);
+  for(int i = 0; i < L; ++i, ++p)
+  {
+    int n;
+    ss >> n;
+
+    if(!ss.fail())
+      *p = (unsigned char)n;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<int N>
+void FBinary<N>::toMat32F(const std::vector<TDescriptor> &descriptors,
+  cv::Mat &mat)
+{
+  if(descriptors.empty())
+  {
+    mat.release();
+    return;
+  }
+
+  mat.create((int)descriptors.size(), L*8, CV_32F);
+  float *p = mat.ptr<float>();
+
+  for(size_t i = 0; i < descriptors.size(); ++i)
+  {
+    const unsigned char *desc = bytes(descriptors[i]);
+
+    for(int j = 0; j < L; ++j, p += 8)
+    {
+      for(int b = 0; b < 8; ++b)
+        p[b] = (desc[j] & (1 << (7 - b)) ? 1.f : 0.f);
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<int N>
+void FBinary<N>::toMat8U(const std::vector<TDescriptor> &descriptors,
+  cv::Mat &mat)
+{
+  mat.create((int)descriptors.size(), L, CV_8U);
+
+  for(size_t i = 0; i < descriptors.size(); ++i)
+    std::memcpy(mat.ptr<unsigned char>((int)i), bytes(descriptors[i]), L);
+}
+
+// --------------------------------------------------------------------------
+
+template<int N>
+void FBinary<N>::fromMat8U(const cv::Mat &mat,
+  std::vector<TDescriptor> &descriptors)
+{
+  descriptors.clear();
+  if(mat.rows == 0) return;
+
+  if(mat.type() != CV_8U || mat.cols != L)
+    throw std::string("FBinary: the descriptors must be a matrix of "
+      "8-bit rows of the descriptor length");
+
+  descriptors.resize(mat.rows);
+  for(int i = 0; i < mat.rows; ++i)
+    std::memcpy(bytes(descriptors[i]), mat.ptr<unsigned char>(i), L);
+}
+
+// --------------------------------------------------------------------------
+
+/// Binary descriptors are packed as their N bytes
+template<int N>
+struct DescriptorTraits<FBinary<N> >
+{
+  static const bool packed = true;
+  static const int bytes = N;
+  static const bool hamming = true;
+  static const bool squared_l2 = false;
+
+  // the length is stored apart in the binary files
+  static inline const char* name() { return "BINARY"; }
+
+  static inline void pack(const typename FBinary<N>::TDescriptor &a,
+    unsigned char *p)
+  {
+    std::memcpy(p, a.data(), bytes);
+  }
+
+  static inline void unpack(const unsigned char *p,
+    typename FBinary<N>::TDescriptor &a)
+  {
+    std::memcpy(a.data(), p, bytes);
+  }
+
+  static inline const unsigned char* view(
+    const typename FBinary<N>::TDescriptor &a, unsigned char *)
+  {
+    return FBinary<N>::bytes(a);
+  }
+
+  static inline double distance(const unsigned char *a,
+    const unsigned char *b)
+  {
+    return static_cast<double>(hammingDistance(a, b, bytes));
+  }
+
+  static inline unsigned int nearest(const unsigned char *q,
+    const unsigned char *blocks, unsigned int n, double *best_distance = NULL)
+  {
+    unsigned int d;
+    const unsigned int i = hammingNearest(q, blocks, n, bytes, &d);
+    if(best_distance) *best_distance = static_cast<double>(d);
+    return i;
+  }
+
+  static inline void distances(const unsigned char *q,
+    const unsigned char *blocks, unsigned int n, double *d)
+  {
+    // in runs of up to 64 blocks
+    unsigned int h[64];
+    for(unsigned int i = 0; i < n; i += 64)
+    {
+      const unsigned int m = (n - i < 64 ? n - i : 64);
+      hammingDistances(q, blocks + (size_t)i * bytes, m, bytes, h);
+      for(unsigned int j = 0; j < m; ++j) d[i + j] = h[j];
+    }
+  }
+};
+
+} // namespace DBoW2
+
+#endif
@@ -14,8 +14,11 @@
 #include <bitset>
 #include <vector>
 #include <string>
+#include <algorithm>
 
 #include "FClass.h"
+#include "DescriptorTraits.h"
+#include "DistanceKernels.h"
 
 namespace DBoW2 {
 
@@ -68,6 +71,72 @@ public:
 
 };
 
+/// BRIEF descriptors are packed as L/8 bytes, bit i at byte i/8
+template<>
+struct DescriptorTraits<FBrief>
+{
+  static const bool packed = true;
+  static const int bytes = FBrief::L / 8;
+  static const bool hamming = true;
+  static const bool squared_l2 = false;
+
+  static inline const char* name() { return "BRIEF"; }
+
+  static inline void pack(const FBrief::TDescriptor &a, unsigned char *p)
+  {
+    // 64 bits at a time
+    const FBrief::TDescriptor mask(~0ULL);
+    for(int w = 0; w < FBrief::L / 64; ++w)
+    {
+      uint64_t v = ((a >> (64 * w)) & mask).to_ullong();
+      for(int j = 0; j < 8; ++j, v >>= 8) *p++ = (unsigned char)(v & 0xff);
+    }
+  }
+
+  static inline void unpack(const unsigned char *p, FBrief::TDescriptor &a)
+  {
+    for(int i = 0; i < FBrief::L; ++i)
+    {
+      a[i] = (p[i / 8] & (1 << (i % 8))) != 0;
+    }
+  }
+
+  static inline const unsigned char* view(const FBrief::TDescriptor &a,
+    unsigned char *buffer)
+  {
+    pack(a, buffer);
+    return buffer;
+  }
+
+  static inline double distance(const unsigned char *a,
+    const unsigned char *b)
+  {
+    return static_cast<double>(hammingDistance(a, b, bytes));
+  }
+
+  static inline unsigned int nearest(const unsigned char *q,
+    const unsigned char *blocks, unsigned int n, double *best_distance = NULL)
+  {
+    unsigned int d;
+    const unsigned int i = hammingNearest(q, blocks, n, bytes, &d);
+    if(best_distance) *best_distance = static_cast<double>(d);
+    return i;
+  }
+
+  static inline void distances(const unsigned char *q,
+    const unsigned char *blocks, unsigned int n, double *d)
+  {
+    // in runs of up to 64 blocks
+    unsigned int h[64];
+    for(unsigned int i = 0; i < n; i += 64)
+    {
+      const unsigned int m = (n - i < 64 ? n - i : 64);
+      hammingDistances(q, blocks + (size_t)i * bytes, m, bytes, h);
+      for(unsigned int j = 0; j < m; ++j) d[i + j] = h[j];
+    }
+  }
+};
+
 } // namespace DBoW2
 
 #endif
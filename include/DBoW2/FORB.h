@@ -13,8 +13,11 @@
 #include <opencv2/core.hpp>
 #include <vector>
 #include <string>
+#include <algorithm>
 
 #include "FClass.h"
+#include "DescriptorTraits.h"
+#include "DistanceKernels.h"
 
 namespace DBoW2 {
 
@@ -85,6 +88,64 @@ public:
 
 };
 
+/// ORB descriptors are packed as their L bytes
+template<>
+struct DescriptorTraits<FORB>
+{
+  static const bool packed = true;
+  static const int bytes = FORB::L;
+  static const bool hamming = true;
+  static const bool squared_l2 = false;
+
+  static inline const char* name() { return "ORB"; }
+
+  static inline void pack(const FORB::TDescriptor &a, unsigned char *p)
+  {
+    const unsigned char *d = a.ptr<unsigned char>();
+    std::copy(d, d + bytes, p);
+  }
+
+  static inline void unpack(const unsigned char *p, FORB::TDescriptor &a)
+  {
+    a.create(1, FORB::L, CV_8U);
+    std::copy(p, p + bytes, a.ptr<unsigned char>());
+  }
+
+  static inline const unsigned char* view(const FORB::TDescriptor &a, 
+    unsigned char *)
+  {
+    return a.ptr<unsigned char>();
+  }
+
+  static inline double distance(const unsigned char *a, 
+    const unsigned char *b)
+  {
+    return static_cast<double>(hammingDistance(a, b, bytes));
+  }
+
+  static inline unsigned int nearest(const unsigned char *q,
+    const unsigned char *blocks, unsigned int n, double *best_distance = NULL)
+  {
+    unsigned int d;
+    const unsigned int i = hammingNearest(q, blocks, n, bytes, &d);
+    if(best_distance) *best_distance = static_cast<double>(d);
+    return i;
+  }
+
+  static inline void distances(const unsigned char *q,
+    const unsigned char *blocks, unsigned int n, double *d)
+  {
+    // in runs of up to 64 blocks
+    unsigned int h[64];
+    for(unsigned int i = 0; i < n; i += 64)
+    {
+      const unsigned int m = (n - i < 64 ? n - i : 64);
+      hammingDistances(q, blocks + (size_t)i * bytes, m, bytes, h);
+      for(unsigned int j = 0; j < m; ++j) d[i + j] = h[j];
+    }
+  }
+};
+
 } // namespace DBoW2
 
 #endif
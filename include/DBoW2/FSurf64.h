@@ -15,6 +15,8 @@
 #include <string>
 
 #include "FClass.h"
+#include "DescriptorTraits.h"
+#include "DistanceKernels.h"
 
 namespace DBoW2 {
 
@@ -54,6 +56,15 @@ public:
    * @return (squared) distance
    */
   static double distance(const TDescriptor &a, const TDescriptor &b);
+
+  /**
+   * Calculates the (squared) distance between two descriptors given by
+   * their L values
+   * @param a
+   * @param b
+   * @return (squared) distance
+   */
+  static double distance(const float *a, const float *b);
   
   /**
    * Returns a string version of the descriptor
@@ -79,6 +90,56 @@ public:
 
 };
 
+/// SURF64 descriptors are packed as their L floats
+template<>
+struct DescriptorTraits<FSurf64>
+{
+  static const bool packed = true;
+  static const int bytes = FSurf64::L * sizeof(float);
+  static const bool hamming = false;
+  static const bool squared_l2 = true;
+
+  static inline const char* name() { return "SURF64"; }
+
+  static inline void pack(const FSurf64::TDescriptor &a, unsigned char *p)
+  {
+    std::memcpy(p, &a[0], bytes);
+  }
+
+  static inline void unpack(const unsigned char *p, FSurf64::TDescriptor &a)
+  {
+    a.resize(FSurf64::L);
+    std::memcpy(&a[0], p, bytes);
+  }
+
+  static inline const unsigned char* view(const FSurf64::TDescriptor &a,
+    unsigned char *)
+  {
+    return reinterpret_cast<const unsigned char*>(&a[0]);
+  }
+
+  static inline double distance(const unsigned char *a,
+    const unsigned char *b)
+  {
+    return FSurf64::distance(reinterpret_cast<const float*>(a), 
+      reinterpret_cast<const float*>(b));
+  }
+
+  static inline unsigned int nearest(const unsigned char *q,
+    const unsigned char *blocks, unsigned int n, double *best_distance = NULL)
+  {
+    return squaredL2Nearest(reinterpret_cast<const float*>(q),
+      reinterpret_cast<const float*>(blocks), n, FSurf64::L, best_distance);
+  }
+
+  static inline void distances(const unsigned char *q,
+    const unsigned char *blocks, unsigned int n, double *d)
+  {
+    squaredL2Distances(reinterpret_cast<const float*>(q),
+      reinterpret_cast<const float*>(blocks), n, FSurf64::L, d);
+  }
+};
+
 } // namespace DBoW2
 
 #endif
@@ -0,0 +1,165 @@
+/**
+ * File: FlatBowVector.h
+ * Date: October 2026
+ * Description: bag of words vector stored in sorted arrays
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_FLAT_BOW_VECTOR__
+#define __D_T_FLAT_BOW_VECTOR__
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include "BowVector.h"
+
+namespace DBoW2 {
+
+/// Vector of words stored as two parallel arrays of word ids and values,
+/// sorted in ascending order of word id
+/**
+ * This is an alternative to BowVector that needs two allocations instead
+ * of one per word, and can be traversed linearly by the scoring functions.
+ */
+class FlatBowVector
+{
+public:
+
+  /**
+   * Constructor
+   */
+  FlatBowVector(void);
+
+  /**
+   * Creates the vector from a bow vector
+   * @param v
+   */
+  explicit FlatBowVector(const BowVector &v);
+
+  /**
+   * Destructor
+   */
+  ~FlatBowVector(void);
+
+  /**
+   * Returns the number of words in the vector
+   * @return number of words
+   */
+  inline size_t size() const { return m_ids.size(); }
+
+  /**
+   * Returns whether the vector has no words
+   * @return true iff empty
+   */
+  inline bool empty() const { return m_ids.empty(); }
+
+  /**
+   * Removes all the words
+   */
+  inline void clear() { m_ids.clear(); m_values.clear(); }
+
+  /**
+   * Reserves memory for some words
+   * @param n number of words
+   */
+  inline void reserve(size_t n) { m_ids.reserve(n); m_values.reserve(n); }
+
+  /**
+   * Returns the id of the i-th word
+   * @param i index (< size())
+   * @return word id
+   */
+  inline WordId id(size_t i) const { return m_ids[i]; }
+
+  /**
+   * Returns the value of the i-th word
+   * @param i index (< size())
+   * @return word value
+   */
+  inline const WordValue& value(size_t i) const { return m_values[i]; }
+
+  /**
+   * Returns the value of the i-th word
+   * @param i index (< size())
+   * @return word value
+   */
+  inline WordValue& value(size_t i) { return m_values[i]; }
+
+  /**
+   * Returns the array of word ids
+   * @return pointer to size() word ids
+   */
+  inline const WordId* ids() const { return m_ids.data(); }
+
+  /**
+   * Returns the array of word values
+   * @return pointer to size() word values
+   */
+  inline const WordValue* values() const { return m_values.data(); }
+
+  /**
+   * Appends a word to the vector. Its id must be greater than the id of
+   * the last word
+   * @param id word id
+   * @param v word value
+   */
+  inline void push_back(WordId id, WordValue v)
+  {
+    m_ids.push_back(id);
+    m_values.push_back(v);
+  }
+
+  /**
+   * Returns the value of a word, or 0 if it is not in the vector
+   * @param id word id
+   * @return word value
+   */
+  WordValue find(WordId id) const;
+
+  /**
+   * Normalizes the values in the vector, in the same way as
+   * BowVector::normalize
+   * @param norm_type norm used
+   */
+  void normalize(LNorm norm_type);
+
+  /**
+   * Sets the content of this vector from a bow vector
+   * @param v
+   */
+  void fromBowVector(const BowVector &v);
+
+  /**
+   * Converts this vector into a bow vector
+   * @param v (out) bow vector
+   */
+  void toBowVector(BowVector &v) const;
+
+  /**
+   * Compares two vectors
+   * @param v
+   * @return true iff the vectors have the same words and values
+   */
+  bool operator==(const FlatBowVector &v) const;
+
+  /**
+   * Prints the content of the bow vector, as the operator of BowVector
+   * @param out stream
+   * @param v
+   */
+  friend std::ostream& operator<<(std::ostream &out, const FlatBowVector &v);
+
+protected:
+
+  /// Word ids in ascending order
+  std::vector<WordId> m_ids;
+
+  /// Word values
+  std::vector<WordValue> m_values;
+};
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,170 @@
+/**
+ * File: FlatFeatureVector.h
+ * Date: October 2026
+ * Description: feature vector stored in sorted arrays
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_FLAT_FEATURE_VECTOR__
+#define __D_T_FLAT_FEATURE_VECTOR__
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include "BowVector.h"
+#include "FeatureVector.h"
+
+namespace DBoW2 {
+
+/// Vector of nodes with indexes of local features, stored as an array of
+/// node ids sorted in ascending order and the concatenation of the feature
+/// indexes of all the nodes
+/**
+ * This is an alternative to FeatureVector that needs a constant number of
+ * allocations.
+ */
+class FlatFeatureVector
+{
+public:
+
+  /**
+   * Constructor
+   */
+  FlatFeatureVector(void);
+
+  /**
+   * Creates the vector from a feature vector
+   * @param v
+   */
+  explicit FlatFeatureVector(const FeatureVector &v);
+
+  /**
+   * Destructor
+   */
+  ~FlatFeatureVector(void);
+
+  /**
+   * Returns the number of nodes in the vector
+   * @return number of nodes
+   */
+  inline size_t size() const { return m_nodes.size(); }
+
+  /**
+   * Returns whether the vector has no nodes
+   * @return true iff empty
+   */
+  inline bool empty() const { return m_nodes.empty(); }
+
+  /**
+   * Removes all the nodes
+   */
+  void clear();
+
+  /**
+   * Reserves memory
+   * @param nodes number of nodes
+   * @param features total number of features
+   */
+  void reserve(size_t nodes, size_t features);
+
+  /**
+   * Returns the id of the i-th node
+   * @param i index (< size())
+   * @return node id
+   */
+  inline NodeId nodeId(size_t i) const { return m_nodes[i]; }
+
+  /**
+   * Returns the number of features of the i-th node
+   * @param i index (< size())
+   * @return number of features
+   */
+  inline size_t nfeatures(size_t i) const
+  {
+    return m_offsets[i+1] - m_offsets[i];
+  }
+
+  /**
+   * Returns the feature indexes of the i-th node
+   * @param i index (< size())
+   * @return pointer to nfeatures(i) feature indexes
+   */
+  inline const unsigned int* features(size_t i) const
+  {
+    return m_features.data() + m_offsets[i];
+  }
+
+  /**
+   * Returns the total number of features in the vector
+   * @return number of features
+   */
+  inline size_t totalFeatures() const { return m_features.size(); }
+
+  /**
+   * Adds a feature to the last node if it has the given id, or appends a
+   * new node with it otherwise. Nodes must be added in ascending order
+   * @param id node id
+   * @param i_feature index of feature
+   */
+  void push_back(NodeId id, unsigned int i_feature);
+
+  /**
+   * Appends a new node with some features. Nodes must be added in 
+   * ascending order
+   * @param id node id (greater than that of the last node)
+   * @param features indexes of the features
+   * @param n number of features
+   */
+  void push_back(NodeId id, const unsigned int *features, size_t n);
+
+  /**
+   * Swaps the content of two vectors
+   * @param v
+   */
+  void swap(FlatFeatureVector &v);
+
+  /**
+   * Sets the content of this vector from a feature vector
+   * @param v
+   */
+  void fromFeatureVector(const FeatureVector &v);
+
+  /**
+   * Converts this vector into a feature vector
+   * @param v (out) feature vector
+   */
+  void toFeatureVector(FeatureVector &v) const;
+
+  /**
+   * Compares two vectors
+   * @param v
+   * @return true iff the vectors have the same nodes and features
+   */
+  bool operator==(const FlatFeatureVector &v) const;
+
+  /**
+   * Sends a string version of the feature vector through the stream, as
+   * the operator of FeatureVector
+   * @param out stream
+   * @param v feature vector
+   */
+  friend std::ostream& operator<<(std::ostream &out,
+    const FlatFeatureVector &v);
+
+protected:
+
+  /// Node ids in ascending order
+  std::vector<NodeId> m_nodes;
+
+  /// Features of node i are m_features[m_offsets[i] .. m_offsets[i+1])
+  std::vector<unsigned int> m_offsets;
+
+  /// Feature indexes of all the nodes
+  std::vector<unsigned int> m_features;
+};
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * File: GpuTree.h
+ * Date: October 2026
+ * Description: copy of a vocabulary tree in GPU memory to quantize binary
+ *   descriptors in large batches
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_GPU_TREE__
+#define __D_T_GPU_TREE__
+
+#include <cstddef>
+
+namespace DBoW2 {
+
+/// Vocabulary tree uploaded to the GPU
+/**
+ * It is filled by TemplatedVocabulary::uploadTree and used by the batch
+ * transforms that take it, which return the same words as the CPU ones.
+ * The GPU backend is only built with the DBoW2_WITH_CUDA option of CMake;
+ * otherwise, available() returns false and upload throws. Several threads
+ * can quantize with the same tree at the same time.
+ */
+class GpuTree
+{
+public:
+
+  /**
+   * Returns whether the library was built with CUDA and there is a CUDA
+   * device to use
+   * @return true iff trees can be uploaded
+   */
+  static bool available();
+
+  /**
+   * Creates an empty tree
+   */
+  GpuTree();
+
+  /**
+   * Frees the GPU memory
+   */
+  ~GpuTree();
+
+  /**
+   * Copies a frozen tree to the GPU, replacing the previous one. Nodes are
+   * given in breadth-first order, the root first
+   * @param first_child frozen index of the first child of each node
+   * @param nchildren number of children of each node (0 for words)
+   * @param nodes number of nodes
+   * @param packed packed binary descriptors of the nodes, bytes each, the
+   *   first of them (the root) unused
+   * @param bytes length of each packed descriptor, a multiple of 4
+   * @throw std::string if the tree cannot be uploaded
+   */
+  void upload(const unsigned int *first_child, const unsigned int *nchildren,
+    unsigned int nodes, const unsigned char *packed, int bytes);
+
+  /**
+   * Frees the uploaded tree
+   */
+  void clear();
+
+  /**
+   * Returns whether no tree has been uploaded
+   * @return true iff empty
+   */
+  inline bool empty() const { return m_nodes == 0; }
+
+  /**
+   * Returns the number of nodes of the uploaded tree
+   * @return nodes
+   */
+  inline unsigned int nodes() const { return m_nodes; }
+
+  /**
+   * Returns the length of the packed descriptors of the uploaded tree
+   * @return bytes
+   */
+  inline int bytes() const { return m_bytes; }
+
+  /**
+   * Propagates packed descriptors down the tree. At each level, the child
+   * at the smallest hamming distance is chosen, the first one on ties, as
+   * DescriptorTraits::nearest does
+   * @param descriptors n packed descriptors, bytes() each
+   * @param n number of descriptors
+   * @param level level of the node of each path to return in ancestors
+   *   (1 for the children of the root). If the level is not reached, or
+   *   it is <= 0, the root (frozen index 0) is returned
+   * @param leaves (out) frozen index of the word of each descriptor
+   * @param ancestors (out) if given, frozen index of the node at the given
+   *   level of the path of each descriptor
+   * @throw std::string if the tree is empty or the GPU fails
+   */
+  void quantize(const unsigned char *descriptors, size_t n, int level,
+    unsigned int *leaves, unsigned int *ancestors = NULL) const;
+
+private:
+
+  GpuTree(const GpuTree &);
+  GpuTree& operator=(const GpuTree &);
+
+  /// Buffers in GPU memory, defined by the backend
+  struct Device;
+
+  /// Uploaded tree, or NULL
+  Device *m_device;
+  /// Number of nodes uploaded
+  unsigned int m_nodes;
+  /// Bytes of each packed descriptor
+  int m_bytes;
+};
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,55 @@
+/**
+ * File: KMeansOptions.h
+ * Date: October 2026
+ * Description: options of the kmeans that builds the tree of a vocabulary
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_KMEANS_OPTIONS__
+#define __D_T_KMEANS_OPTIONS__
+
+namespace DBoW2 {
+
+/// Options of the kmeans of each node of the vocabulary tree
+/**
+ * The default options seed the clusters with kmeans++ on all the
+ * descriptors of the node and iterate until no descriptor changes its
+ * cluster, as the original training does. The others trade some quality
+ * of the tree for a faster training of large datasets.
+ */
+struct KMeansOptions
+{
+  /// Maximum number of times the centres are updated after the seeding.
+  /// 0 means no limit
+  unsigned int max_iterations;
+
+  /// The iterations stop when the fraction of the descriptors of the node
+  /// that change their cluster is not above it. 0 stops when none changes
+  double tolerance;
+
+  /// If the node has more descriptors, kmeans++ seeds the clusters with a
+  /// random sample of this size (at least the branching factor), instead
+  /// of with all of them. 0 seeds with all of them
+  unsigned int seeding_sample;
+
+  /// Number of top levels of the tree whose nodes are clustered with
+  /// mini-batch kmeans, if they have more than minibatch_size descriptors.
+  /// Each iteration assigns a random batch of descriptors only and moves
+  /// their centres towards them; all the descriptors are assigned once at
+  /// the end. 0 runs the standard kmeans on all the levels
+  int minibatch_levels;
+
+  /// Descriptors of each batch
+  unsigned int minibatch_size;
+
+  /// Batches of each mini-batch kmeans
+  unsigned int minibatch_iterations;
+
+  KMeansOptions(): max_iterations(0), tolerance(0), seeding_sample(0),
+    minibatch_levels(0), minibatch_size(10000), minibatch_iterations(20) {}
+};
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * File: MatchOptions.h
+ * Date: October 2026
+ * Description: matches between the features of a query and an entry
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_MATCH_OPTIONS__
+#define __D_T_MATCH_OPTIONS__
+
+#include <limits>
+
+namespace DBoW2 {
+
+/// Match between a feature of a query and a feature of a database entry
+struct FeatureMatch
+{
+  /// Index of the query feature
+  unsigned int query;
+
+  /// Index of the entry feature
+  unsigned int entry;
+
+  /// Distance between their descriptors
+  double distance;
+
+  FeatureMatch(): query(0), entry(0), distance(0) {}
+
+  FeatureMatch(unsigned int _query, unsigned int _entry, double _distance):
+    query(_query), entry(_entry), distance(_distance) {}
+};
+
+/// Options to accept the matches between features
+/**
+ * Each query feature is matched to the closest entry feature of its
+ * direct index node, if any. The default options accept all these matches.
+ */
+struct MatchOptions
+{
+  /// Matches with a greater distance are discarded
+  double max_distance;
+
+  /// A match is discarded if its distance is not below ratio times the
+  /// distance to the second closest entry feature of the node (Lowe's
+  /// ratio test). Features alone in their node have no second closest
+  /// one and pass the test. 1 disables it
+  double ratio;
+
+  /// If true, each entry feature keeps only its closest query feature, so
+  /// that the matches are one to one
+  bool unique;
+
+  MatchOptions(): max_distance(std::numeric_limits<double>::max()),
+    ratio(1), unique(false) {}
+};
+
+} // namespace DBoW2
+
+#endif
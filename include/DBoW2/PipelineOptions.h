@@ -0,0 +1,125 @@
+/**
+ * File: PipelineOptions.h
+ * Date: October 2026
+ * Description: options and results of the frames of a TemplatedPipeline
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_PIPELINE_OPTIONS__
+#define __D_T_PIPELINE_OPTIONS__
+
+#include <vector>
+#include <string>
+
+#include "QueryResults.h"
+#include "QueryOptions.h"
+#include "MatchOptions.h"
+
+namespace DBoW2 {
+
+/// What happened to a frame given to a pipeline
+enum FrameStatus
+{
+  /// It went through all the stages
+  FRAME_DONE,
+  /// The pipeline was full, and it was not processed
+  FRAME_DROPPED,
+  /// A stage threw an exception
+  FRAME_FAILED
+};
+
+/// Result of a frame given to a pipeline
+struct FrameResult
+{
+  /// Index of the frame, in the order they were submitted
+  unsigned int frame;
+
+  /// What happened to it
+  FrameStatus status;
+
+  /// Whether the frame was added to the database
+  bool added;
+
+  /// Id of the new entry of the frame, if it was added
+  EntryId entry;
+
+  /// Candidates returned by the query of the frame
+  QueryResults candidates;
+
+  /// Matches between the features of the frame and those of each one of
+  /// the first candidates, if they were verified
+  std::vector<std::vector<FeatureMatch> > matches;
+
+  /// Message of the exception of a failed frame
+  std::string error;
+
+  /// Seconds since the frame was submitted until its result was ready
+  double latency;
+
+  FrameResult(): frame(0), status(FRAME_DONE), added(false), entry(0),
+    latency(0) {}
+};
+
+/// Options of the stages of a pipeline
+/**
+ * The default options query the database with each frame and add it
+ * afterwards, and wait for room when the pipeline is full.
+ */
+struct PipelineOptions
+{
+  /// Frames that can wait before each stage
+  unsigned int queue_size;
+
+  /// If true, a frame submitted while the first stage is full is dropped
+  /// (e.g. when the robot moves faster than the frames are processed), so
+  /// that submit does not block. Its result is delivered by the last stage
+  /// right after that of the previous frame. If false, submit waits for
+  /// room
+  bool drop_frames;
+
+  /// Number of candidates returned by each query. <= 0 means all
+  int max_results;
+
+  /// The entries of the frames submitted right before a frame are not
+  /// returned by its query, nor the others added after them: the query of
+  /// a frame that is going to be entry n only returns entries with id
+  /// < n - exclude_recent (e.g. to look for loops with older places)
+  unsigned int exclude_recent;
+
+  /// Options of the queries
+  QueryOptions query;
+
+  /// If true, each frame is added to the database after its query
+  bool add;
+
+  /// Number of the best candidates whose features are matched with those
+  /// of the frame, on the thread pool if any. It needs the direct index.
+  /// Only candidates added by the pipeline can be verified, since the
+  /// database does not keep the descriptors of its entries. It needs add
+  unsigned int verify;
+
+  /// Number of the last entries added whose features are kept to be
+  /// verified. The features of the older ones are freed, and those entries
+  /// are not verified any longer. 0 keeps the features of all the entries
+  unsigned int keep_features;
+
+  /// Options to accept the matches
+  MatchOptions match;
+
+  /// Frames waiting to be queried that are queried at once, with a single
+  /// traversal of the inverted index, when the query stage falls behind.
+  /// Each frame gets the same candidates it would get alone, so when the
+  /// frames are added, at most exclude_recent + 1 frames are batched (the
+  /// entries of the previous frames of the batch do not exist yet). Batches
+  /// are only used with the default query options
+  unsigned int max_batch;
+
+  PipelineOptions(): queue_size(4), drop_frames(false), max_results(4),
+    exclude_recent(0), add(true), verify(0), keep_features(0),
+    max_batch(1) {}
+};
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,708 @@
+/**
+ * File: PostingList.h
+ * Date: October 2026
+ * Description: row of the inverted file of a database, stored in chunks
+ *   and, once sealed, in compressed blocks
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_POSTING_LIST__
+#define __D_T_POSTING_LIST__
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+#include "QueryResults.h"
+
+namespace DBoW2 {
+
+/// @param TWeight type of the weights stored with the entries
+/// List of (entry id, weight) postings stored in a chain of contiguous
+/// chunks. Entry ids and weights are kept in separate arrays of each chunk
+/**
+ * Postings are appended to the last chunk. When it is full, a new chunk
+ * is allocated with a capacity that grows geometrically with the size of
+ * the list (up to MAX_CHUNK postings), so push_back is amortized O(1) and
+ * existing postings are never moved. Each chunk is a single allocation.
+ *
+ * A posting is published by storing the new size of its chunk after
+ * writing it, so one thread can append postings while others traverse the
+ * chunks of the list: readers see a prefix of the postings. The other
+ * functions must be called from the thread that appends.
+ *
+ * The list also keeps the greatest weight appended, which bounds the
+ * contribution of its postings to the score of a query.
+ *
+ * seal() moves the postings of the list into a read-only segment, in a
+ * single allocation, where entry ids are stored in blocks of BLOCK as
+ * the differences between consecutive ids, each block with the fewest
+ * bits that hold its differences, and weights are kept as they are.
+ * Postings appended later go to chunks again. Readers see the postings of
+ * the segment and then those of the chunks, decoding the blocks as they
+ * go (see Reader).
+ */
+template<class TWeight>
+class PostingList
+{
+public:
+
+  /// Minimum number of postings of a chunk
+  static const unsigned int MIN_CHUNK = 4;
+  /// Maximum number of postings of a chunk, unless more are reserved
+  static const unsigned int MAX_CHUNK = 1024;
+  /// Postings of each block of a sealed segment
+  static const unsigned int BLOCK = 128;
+
+  /// Contiguous block of postings
+  class Chunk
+  {
+  public:
+
+    /**
+     * Returns the next chunk of the list
+     * @return next chunk, or NULL if this is the last one
+     */
+    inline const Chunk* next() const
+    {
+      return m_next.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Returns the number of postings in this chunk
+     * @return number of postings
+     */
+    inline unsigned int size() const
+    {
+      return m_size.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Returns the entry ids of the postings of this chunk
+     * @return pointer to size() entry ids
+     */
+    inline const EntryId* ids() const
+    {
+      return reinterpret_cast<const EntryId*>(this + 1);
+    }
+
+    /**
+     * Returns the weights of the postings of this chunk
+     * @return pointer to size() weights
+     */
+    inline const TWeight* weights() const
+    {
+      return reinterpret_cast<const TWeight*>(
+        reinterpret_cast<const char*>(this + 1) + weightsOffset(m_capacity));
+    }
+
+  protected:
+    friend class PostingList<TWeight>;
+
+    inline EntryId* ids() { return reinterpret_cast<EntryId*>(this + 1); }
+
+    inline TWeight* weights()
+    {
+      return reinterpret_cast<TWeight*>(
+        reinterpret_cast<char*>(this + 1) + weightsOffset(m_capacity));
+    }
+
+    /**
+     * Returns the offset of the weight array from the id array
+     * @param capacity postings of the chunk
+     */
+    static inline size_t weightsOffset(unsigned int capacity)
+    {
+      const size_t a = sizeof(TWeight);
+      return (capacity * sizeof(EntryId) + a - 1) / a * a;
+    }
+
+    /// Next chunk
+    std::atomic<Chunk*> m_next;
+    /// Postings in use
+    std::atomic<unsigned int> m_size;
+    /// Postings allocated
+    unsigned int m_capacity;
+  };
+
+protected:
+
+  /// Block of postings of a sealed segment
+  struct Block
+  {
+    /// Entry id of the first posting
+    EntryId first;
+    /// Entry id of the last posting
+    EntryId last;
+    /// Index of the first 64-bit word of the differences of the block
+    uint32_t offset;
+    /// Number of postings
+    unsigned short count;
+    /// Bits of each difference between consecutive entry ids
+    unsigned char width;
+  };
+
+  /// Read-only segment, followed in memory by its blocks, the 64-bit words
+  /// of the differences of their ids and the weights of the postings
+  struct Sealed
+  {
+    /// Number of postings
+    size_t size;
+    /// Number of 64-bit words of differences
+    size_t nwords;
+    /// Bytes of the segment
+    size_t bytes;
+    /// Number of blocks
+    unsigned int nblocks;
+
+    inline const Block* blocks() const
+    {
+      return reinterpret_cast<const Block*>(this + 1);
+    }
+
+    inline const uint64_t* words() const
+    {
+      return reinterpret_cast<const uint64_t*>(blocks() + nblocks);
+    }
+
+    inline const TWeight* weights() const
+    {
+      return reinterpret_cast<const TWeight*>(words() + nwords);
+    }
+  };
+
+public:
+
+  /// Traverses the postings of a list in blocks of contiguous entry ids
+  /// and weights: the blocks of the sealed segment and then the chunks
+  /**
+   * A reader can traverse the list while postings are appended to it, as
+   * the chunks can, and sees a prefix of the postings. The ids of a sealed
+   * block are decoded the first time they are read.
+   */
+  class Reader
+  {
+  public:
+
+    /**
+     * Creates a reader before the first block of a list
+     * @param l list
+     */
+    explicit Reader(const PostingList<TWeight> &l): m_list(&l), 
+      m_sealed(l.m_sealed), m_block(0), m_chunk(NULL), m_done(false), 
+      m_size(0), m_ids(NULL), m_weights(NULL), m_current(NULL) {}
+
+    /**
+     * Moves to the next block
+     * @return false if there are no more blocks
+     */
+    inline bool next()
+    {
+      if(m_sealed && m_block < m_sealed->nblocks)
+      {
+        m_current = m_sealed->blocks() + m_block;
+        m_size = m_current->count;
+        m_ids = NULL;
+        m_weights = m_sealed->weights() + (size_t)m_block * BLOCK;
+        ++m_block;
+        return true;
+      }
+
+      if(m_done) return false;
+      m_chunk = (m_chunk ? m_chunk->next() : m_list->first());
+      m_current = NULL;
+      if(m_chunk == NULL)
+      {
+        m_done = true;
+        return false;
+      }
+
+      // postings appended from now on are not seen
+      m_size = m_chunk->size();
+      m_ids = m_chunk->ids();
+      m_weights = m_chunk->weights();
+      return true;
+    }
+
+    /**
+     * Returns whether the current block belongs to the sealed segment
+     * @return true iff sealed
+     */
+    inline bool sealed() const { return m_current != NULL; }
+
+    /**
+     * Returns the number of postings of the current block
+     * @return number of postings
+     */
+    inline unsigned int size() const { return m_size; }
+
+    /**
+     * Returns the entry id of the first posting of the current block, 
+     * without decoding it
+     * @return entry id (size() must be > 0)
+     */
+    inline EntryId first() const
+    {
+      return (m_current ? m_current->first : m_ids[0]);
+    }
+
+    /**
+     * Returns the entry id of the last posting of the current block, 
+     * without decoding it
+     * @return entry id (size() must be > 0)
+     */
+    inline EntryId last() const
+    {
+      return (m_current ? m_current->last : m_ids[m_size - 1]);
+    }
+
+    /**
+     * Returns the entry ids of the current block
+     * @return pointer to size() entry ids in ascending order
+     */
+    inline const EntryId* ids()
+    {
+      if(m_ids == NULL)
+      {
+        decode(*m_current, m_sealed->words(), m_buffer);
+        m_ids = m_buffer;
+      }
+      return m_ids;
+    }
+
+    /**
+     * Returns the weights of the current block
+     * @return pointer to size() weights
+     */
+    inline const TWeight* weights() const { return m_weights; }
+
+  private:
+
+    /// List traversed
+    const PostingList<TWeight> *m_list;
+    /// Sealed segment of the list, or NULL
+    const Sealed *m_sealed;
+    /// Next block of the sealed segment
+    unsigned int m_block;
+    /// Current chunk, or NULL
+    const Chunk *m_chunk;
+    /// Whether the chunks have been traversed
+    bool m_done;
+    /// Postings of the current block
+    unsigned int m_size;
+    /// Entry ids of the current block, or NULL if not decoded yet
+    const EntryId *m_ids;
+    /// Weights of the current block
+    const TWeight *m_weights;
+    /// Current sealed block, or NULL if it is a chunk
+    const Block *m_current;
+    /// Decoded entry ids
+    EntryId m_buffer[BLOCK];
+  };
+
+public:
+
+  /**
+   * Creates an empty list
+   */
+  PostingList(): m_head(NULL), m_tail(NULL), m_size(0), m_reserved(0),
+    m_max(0), m_sealed(NULL) {}
+
+  /**
+   * Copy constructor. The chunks of the copy are stored in a single one
+   * @param l
+   */
+  PostingList(const PostingList<TWeight> &l)
+    : m_head(NULL), m_tail(NULL), m_size(0), m_reserved(0), m_max(0),
+    m_sealed(NULL)
+  {
+    *this = l;
+  }
+
+  /**
+   * Destructor
+   */
+  ~PostingList() { clear(); }
+
+  /**
+   * Copies a list. The chunks of the copy are stored in a single one
+   * @param l
+   * @return reference to this list
+   */
+  PostingList<TWeight>& operator=(const PostingList<TWeight> &l)
+  {
+    if(this != &l)
+    {
+      clear();
+      if(l.m_sealed)
+      {
+        m_sealed = static_cast<Sealed*>(::operator new(l.m_sealed->bytes));
+        std::memcpy(m_sealed, l.m_sealed, l.m_sealed->bytes);
+      }
+      if(l.m_size > 0)
+      {
+        Chunk *tail = newChunk(l.m_size);
+        unsigned int n = 0;
+        for(const Chunk *c = l.first(); c; c = c->next())
+        {
+          const unsigned int cn = c->size();
+          std::copy(c->ids(), c->ids() + cn, tail->ids() + n);
+          std::copy(c->weights(), c->weights() + cn, tail->weights() + n);
+          n += cn;
+        }
+        tail->m_size.store(n, std::memory_order_release);
+        m_tail = tail;
+        m_head.store(tail, std::memory_order_release);
+        m_size = l.m_size;
+      }
+      m_max.store(l.maxWeight(), std::memory_order_relaxed);
+    }
+    return *this;
+  }
+
+  /**
+   * Exchanges the content of two lists
+   * @param l
+   */
+  void swap(PostingList<TWeight> &l)
+  {
+    Chunk *head = m_head.load(std::memory_order_relaxed);
+    m_head.store(l.m_head.load(std::memory_order_relaxed), 
+      std::memory_order_relaxed);
+    l.m_head.store(head, std::memory_order_relaxed);
+    std::swap(m_tail, l.m_tail);
+    std::swap(m_size, l.m_size);
+    std::swap(m_reserved, l.m_reserved);
+    std::swap(m_sealed, l.m_sealed);
+
+    const TWeight w = maxWeight();
+    m_max.store(l.maxWeight(), std::memory_order_relaxed);
+    l.m_max.store(w, std::memory_order_relaxed);
+  }
+
+  /**
+   * Returns the number of postings
+   * @return number of postings
+   */
+  inline size_t size() const { return m_size + sealedSize(); }
+
+  /**
+   * Returns whether the list is empty
+   * @return true iff there are no postings
+   */
+  inline bool empty() const { return size() == 0; }
+
+  /**
+   * Returns the number of postings of the sealed segment
+   * @return number of postings
+   */
+  inline size_t sealedSize() const { return m_sealed ? m_sealed->size : 0; }
+
+  /**
+   * Returns the first chunk of the list, after the sealed segment
+   * @return first chunk, or NULL if there are no chunks
+   */
+  inline const Chunk* first() const
+  {
+    return m_head.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Returns the greatest weight of the list. It is updated before the 
+   * postings are published, so it bounds the weights readers see
+   * @return greatest weight appended since the last clear, or 0
+   */
+  inline TWeight maxWeight() const
+  {
+    return m_max.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Removes all the postings and frees the memory
+   */
+  void clear()
+  {
+    clearChunks();
+    ::operator delete(m_sealed);
+    m_sealed = NULL;
+    m_max.store(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * Makes the next allocation big enough to hold n postings in total
+   * @param n number of postings, including those of the sealed segment
+   */
+  inline void reserve(size_t n)
+  {
+    const size_t sealed = sealedSize();
+    m_reserved = (n > sealed ? n - sealed : 0);
+  }
+
+  /**
+   * Moves all the postings into the sealed segment, compressing their
+   * entry ids, which must be in ascending order, and frees the chunks.
+   * It must not be called while the list is traversed
+   */
+  void seal()
+  {
+    if(m_size == 0) return;
+
+    std::vector<EntryId> ids;
+    std::vector<TWeight> weights;
+    ids.reserve(size());
+    weights.reserve(size());
+    for(Reader r(*this); r.next(); )
+    {
+      ids.insert(ids.end(), r.ids(), r.ids() + r.size());
+      weights.insert(weights.end(), r.weights(), r.weights() + r.size());
+    }
+
+    Sealed *sealed = encode(ids.data(), weights.data(), ids.size());
+    clearChunks();
+    ::operator delete(m_sealed);
+    m_sealed = sealed;
+  }
+
+  /**
+   * Appends a posting
+   * @param id entry id
+   * @param w weight
+   */
+  inline void push_back(EntryId id, TWeight w)
+  {
+    if(m_tail == NULL || 
+      m_tail->m_size.load(std::memory_order_relaxed) == m_tail->m_capacity)
+      grow();
+
+    if(w > m_max.load(std::memory_order_relaxed))
+      m_max.store(w, std::memory_order_relaxed);
+
+    const unsigned int n = m_tail->m_size.load(std::memory_order_relaxed);
+    m_tail->ids()[n] = id;
+    m_tail->weights()[n] = w;
+    m_tail->m_size.store(n + 1, std::memory_order_release);
+    ++m_size;
+  }
+
+  /**
+   * Returns whether there is a posting with the given entry id. It assumes
+   * that postings are in ascending order of entry id
+   * @param id entry id
+   * @return true iff found
+   */
+  bool contains(EntryId id) const
+  {
+    for(Reader r(*this); r.next(); )
+    {
+      const unsigned int n = r.size();
+      if(n > 0 && r.last() >= id)
+        return std::binary_search(r.ids(), r.ids() + n, id);
+    }
+    return false;
+  }
+
+  /**
+   * Returns the number of bytes allocated by the list
+   * @return bytes
+   */
+  size_t memory() const
+  {
+    size_t bytes = (m_sealed ? m_sealed->bytes : 0);
+    for(const Chunk *c = first(); c; c = c->next())
+      bytes += chunkBytes(c->m_capacity);
+    return bytes;
+  }
+
+protected:
+
+  /**
+   * Frees the chunks, keeping the sealed segment
+   */
+  void clearChunks()
+  {
+    Chunk *c = m_head.load(std::memory_order_relaxed);
+    while(c)
+    {
+      Chunk *next = c->m_next.load(std::memory_order_relaxed);
+      c->~Chunk();
+      ::operator delete(c);
+      c = next;
+    }
+    m_head.store(NULL, std::memory_order_relaxed);
+    m_tail = NULL;
+    m_size = 0;
+  }
+
+  /**
+   * Creates a sealed segment
+   * @param ids n > 0 entry ids in ascending order
+   * @param weights n weights
+   * @param n number of postings
+   * @return new segment
+   */
+  static Sealed* encode(const EntryId *ids, const TWeight *weights, 
+    size_t n)
+  {
+    const unsigned int nblocks = (unsigned int)((n + BLOCK - 1) / BLOCK);
+
+    // bits of the differences of each block
+    std::vector<unsigned char> widths(nblocks);
+    size_t nwords = 0;
+    for(unsigned int b = 0; b < nblocks; ++b)
+    {
+      const size_t begin = (size_t)b * BLOCK;
+      const size_t end = std::min(n, begin + BLOCK);
+
+      uint64_t max = 0;
+      for(size_t i = begin + 1; i < end; ++i)
+        max = std::max<uint64_t>(max, ids[i] - ids[i - 1]);
+
+      unsigned char width = 0;
+      while((max >> width) != 0) ++width;
+      widths[b] = width;
+      nwords += ((end - begin - 1) * width + 63) / 64;
+    }
+
+    const size_t bytes = sizeof(Sealed) + nblocks * sizeof(Block) +
+      nwords * sizeof(uint64_t) + n * sizeof(TWeight);
+    Sealed *s = new (::operator new(bytes)) Sealed;
+    s->size = n;
+    s->nwords = nwords;
+    s->bytes = bytes;
+    s->nblocks = nblocks;
+
+    Block *blocks = const_cast<Block*>(s->blocks());
+    uint64_t *words = const_cast<uint64_t*>(s->words());
+    std::memset(words, 0, nwords * sizeof(uint64_t));
+    std::copy(weights, weights + n, const_cast<TWeight*>(s->weights()));
+
+    size_t offset = 0;
+    for(unsigned int b = 0; b < nblocks; ++b)
+    {
+      const size_t begin = (size_t)b * BLOCK;
+      const size_t end = std::min(n, begin + BLOCK);
+      const unsigned int width = widths[b];
+
+      Block &block = blocks[b];
+      block.first = ids[begin];
+      block.last = ids[end - 1];
+      block.offset = (uint32_t)offset;
+      block.count = (unsigned short)(end - begin);
+      block.width = (unsigned char)width;
+
+      // differences packed from the least significant bit of each word
+      uint64_t *p = words + offset;
+      for(size_t i = begin + 1; i < end; ++i)
+      {
+        const uint64_t d = ids[i] - ids[i - 1];
+        const size_t pos = (i - begin - 1) * width;
+        const unsigned int shift = pos % 64;
+        p[pos / 64] |= d << shift;
+        if(shift + width > 64) p[pos / 64 + 1] |= d >> (64 - shift);
+      }
+      offset += ((end - begin - 1) * width + 63) / 64;
+    }
+
+    return s;
+  }
+
+  /**
+   * Decodes the entry ids of a sealed block
+   * @param block
+   * @param words words of the differences of the segment
+   * @param ids (out) block.count entry ids
+   */
+  static inline void decode(const Block &block, const uint64_t *words,
+    EntryId *ids)
+  {
+    const unsigned int n = block.count;
+    const unsigned int width = block.width;
+
+    EntryId id = block.first;
+    ids[0] = id;
+    if(width == 0)
+    {
+      for(unsigned int i = 1; i < n; ++i) ids[i] = id;
+      return;
+    }
+
+    // all the differences have the same width, so the positions are
+    // known in advance and the loop has no dependencies but the sum
+    const uint64_t *p = words + block.offset;
+    const uint64_t mask = ~(uint64_t)0 >> (64 - width);
+    for(unsigned int i = 1; i < n; ++i)
+    {
+      const size_t pos = (size_t)(i - 1) * width;
+      const unsigned int shift = pos % 64;
+      uint64_t d = p[pos / 64] >> shift;
+      if(shift + width > 64) d |= p[pos / 64 + 1] << (64 - shift);
+      id += (EntryId)(d & mask);
+      ids[i] = id;
+    }
+  }
+
+  /**
+   * Returns the bytes of a chunk
+   * @param capacity postings of the chunk
+   */
+  static inline size_t chunkBytes(unsigned int capacity)
+  {
+    return sizeof(Chunk) + Chunk::weightsOffset(capacity) +
+      capacity * sizeof(TWeight);
+  }
+
+  /**
+   * Allocates an empty chunk
+   * @param capacity postings of the chunk
+   * @return new chunk
+   */
+  static Chunk* newChunk(size_t capacity)
+  {
+    Chunk *c = new (::operator new(chunkBytes((unsigned int)capacity))) 
+      Chunk;
+    c->m_next.store(NULL, std::memory_order_relaxed);
+    c->m_size.store(0, std::memory_order_relaxed);
+    c->m_capacity = (unsigned int)capacity;
+    return c;
+  }
+
+  /**
+   * Appends a new empty chunk
+   */
+  void grow()
+  {
+    size_t capacity = std::min<size_t>(std::max<size_t>(m_size, MIN_CHUNK),
+      MAX_CHUNK);
+    if(m_reserved > m_size + capacity) capacity = m_reserved - m_size;
+    m_reserved = 0;
+
+    Chunk *c = newChunk(capacity);
+    if(m_tail) m_tail->m_next.store(c, std::memory_order_release);
+    else m_head.store(c, std::memory_order_release);
+    m_tail = c;
+  }
+
+protected:
+
+  /// First chunk
+  std::atomic<Chunk*> m_head;
+  /// Last chunk, where postings are appended
+  Chunk *m_tail;
+  /// Number of postings in chunks
+  size_t m_size;
+  /// Postings requested by reserve
+  size_t m_reserved;
+  /// Greatest weight
+  std::atomic<TWeight> m_max;
+  /// Sealed segment, or NULL
+  Sealed *m_sealed;
+};
+
+} // namespace DBoW2
+
+#endif
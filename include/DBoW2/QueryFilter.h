@@ -0,0 +1,125 @@
+/**
+ * File: QueryFilter.h
+ * Date: October 2026
+ * Description: entries that database queries may return
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_QUERY_FILTER__
+#define __D_T_QUERY_FILTER__
+
+#include <vector>
+#include <utility>
+#include <limits>
+
+#include "QueryResults.h"
+
+namespace DBoW2 {
+
+/// Entries a query can return
+/**
+ * A filter accepts some ranges of entry ids and, if it has a mask, only
+ * the entries set in it (e.g. those of a session, or those not culled).
+ * Since the posting lists are sorted by entry id, the queries skip the
+ * postings outside the ranges with binary searches, and the blocks of the
+ * sealed segments that are out of them are not decoded; the mask is
+ * checked for the postings in the ranges. The default filter accepts all
+ * the entries.
+ */
+class QueryFilter
+{
+public:
+
+  /// Range [first, second) of entry ids
+  typedef std::pair<EntryId, EntryId> Range;
+
+  /// End of the ranges that are not bounded
+  static const EntryId END = std::numeric_limits<EntryId>::max();
+
+  /**
+   * Creates a filter that accepts all the entries
+   */
+  QueryFilter();
+
+  /**
+   * Creates a filter that accepts the entries of a range
+   * @param begin first id accepted
+   * @param end id after the last one accepted
+   */
+  QueryFilter(EntryId begin, EntryId end = END);
+
+  /**
+   * Accepts the entries of a range too
+   * @param begin first id
+   * @param end id after the last one
+   * @return this filter
+   */
+  QueryFilter& include(EntryId begin, EntryId end = END);
+
+  /**
+   * Rejects the entries of a range (e.g. the keyframes of the last
+   * seconds, with exclude(first_recent_id))
+   * @param begin first id
+   * @param end id after the last one
+   * @return this filter
+   */
+  QueryFilter& exclude(EntryId begin, EntryId end = END);
+
+  /**
+   * Accepts only the entries of the ranges whose value is true in a mask.
+   * Entries with ids beyond the mask are rejected. The mask is not copied,
+   * so it must exist and not change while queries use the filter
+   * @param mask mask indexed by entry id, or NULL to remove it
+   * @return this filter
+   */
+  QueryFilter& setMask(const std::vector<bool> *mask);
+
+  /**
+   * Returns the ranges of ids accepted
+   * @return disjoint ranges in ascending order, not empty nor adjacent
+   */
+  inline const std::vector<Range>& ranges() const { return m_ranges; }
+
+  /**
+   * Returns the mask of the filter
+   * @return mask, or NULL if it has not any
+   */
+  inline const std::vector<bool>* mask() const { return m_mask; }
+
+  /**
+   * Returns whether the filter accepts all the entries
+   * @return true iff it has a single unbounded range and no mask
+   */
+  inline bool all() const
+  {
+    return m_mask == NULL && m_ranges.size() == 1 &&
+      m_ranges[0] == Range(0, END);
+  }
+
+  /**
+   * Returns whether the filter accepts an entry
+   * @param id entry id
+   * @return true iff accepted
+   */
+  bool accepts(EntryId id) const;
+
+  /**
+   * Returns the ranges accepted below an id
+   * @param end id after the last one to get
+   * @param ranges (out) ranges of ids < end
+   */
+  void clip(EntryId end, std::vector<Range> &ranges) const;
+
+protected:
+
+  /// Ranges accepted
+  std::vector<Range> m_ranges;
+
+  /// Mask of the entries accepted, or NULL
+  const std::vector<bool> *m_mask;
+};
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ * File: QueryOptions.h
+ * Date: October 2026
+ * Description: options to prune the words and entries visited by database
+ *   queries
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_QUERY_OPTIONS__
+#define __D_T_QUERY_OPTIONS__
+
+#include "QueryFilter.h"
+
+namespace DBoW2 {
+
+/// Options of a database query that trade exactness or work for speed
+/**
+ * The default options give the same results as a query without options.
+ */
+struct QueryOptions
+{
+  /// Words of the query that are in more than this fraction of the
+  /// entries of the database are ignored, as stop words. 1 keeps all.
+  /// This changes the scores of the entries that have those words
+  double max_df;
+
+  /// If true, the words of the query are visited in decreasing order of
+  /// the most they can add to the score of an entry. Since the values are
+  /// added in another order, the scores may differ slightly from those of
+  /// a normal query
+  bool sort_words;
+
+  /// If true, the query stops visiting new entries once the words left
+  /// cannot take an entry that has not been visited into the best
+  /// max_results ones, and only completes the scores of the entries that
+  /// can still be among them (MaxScore). The best results are the same as
+  /// without it, but the other entries are not returned. It implies
+  /// sort_words, needs max_results > 0, and is ignored with KL scoring,
+  /// whose partial scores are not bounded. It pays off when the query has
+  /// rare words with high weights; if most words are in most entries, it
+  /// may be slower than a normal query
+  bool early_termination;
+
+  /// Entries that can be returned, along with the max_id of the query.
+  /// The postings of the others are skipped
+  QueryFilter filter;
+
+  QueryOptions(): max_df(1), sort_words(false), early_termination(false) {}
+};
+
+} // namespace DBoW2
+
+#endif
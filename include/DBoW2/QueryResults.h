@@ -10,6 +10,8 @@
 #ifndef __D_T_QUERY_RESULTS__
 #define __D_T_QUERY_RESULTS__
 
+#include <iostream>
+#include <string>
 #include <vector>
 
 namespace DBoW2 {
@@ -29,9 +31,7 @@ public:
   double Score;
   
   /// debug
-  int nWords; // words in common
-  // !!! this is filled only by Bhatt score!
-  // (and for BCMatching, BCThresholding then)
+  int nWords; // words in common, filled by all the scores
   
   double bhatScore, chiScore;
   /// debug
@@ -52,7 +52,9 @@ public:
    * @param _id entry id
    * @param _score score
    */
-  inline Result(EntryId _id, double _score): Id(_id), Score(_score){}
+  inline Result(EntryId _id, double _score): Id(_id), Score(_score),
+    nWords(0), bhatScore(0), chiScore(0), sumCommonVi(0), sumCommonWi(0),
+    expectedChiScore(0){}
 
   /**
    * Compares the scores of two results
@@ -173,6 +175,47 @@ public:
    * @param factor
    */
   inline void scaleScores(double factor);
+
+  /**
+   * Sorts the results from best to worst and keeps the best max_results
+   * ones. Only those are sorted, so this is faster than sorting all the 
+   * results. Results with the same score are sorted by entry id
+   * @param max_results number of results to keep (all if <= 0)
+   * @param ascending true if the lower the score the better the result
+   */
+  void selectBest(int max_results, bool ascending);
+
+  /**
+   * Merges the results of the same query to several databases with the 
+   * same vocabulary (e.g. the shards of a larger one), whose scores are 
+   * comparable, into the best max_results ones. The ids of the results
+   * must identify the entries among all the databases
+   * @param parts results of each database, with at least its best 
+   *   max_results ones
+   * @param ret (out) merged results, sorted from best to worst
+   * @param max_results number of results to keep (all if <= 0)
+   * @param ascending true if the lower the score the better the result
+   */
+  static void merge(const std::vector<QueryResults> &parts, 
+    QueryResults &ret, int max_results, bool ascending);
+
+  /**
+   * Appends the ids and the scores of the results to a buffer, to send 
+   * them to another process. The debug fields are not written
+   * @param buffer
+   */
+  void serialize(std::vector<unsigned char> &buffer) const;
+
+  /**
+   * Reads the results written by serialize, on a machine with the same
+   * byte order. They replace the current ones, and only have their id and
+   * score (the other fields are 0)
+   * @param data
+   * @param bytes bytes available from data
+   * @return bytes read
+   * @throw std::string if the data is truncated
+   */
+  size_t deserialize(const unsigned char *data, size_t bytes);
   
   /**
    * Prints a string version of the results
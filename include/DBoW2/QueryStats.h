@@ -0,0 +1,232 @@
+/**
+ * File: QueryStats.h
+ * Date: October 2026
+ * Description: counters of the work done by transforms and queries
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_QUERY_STATS__
+#define __D_T_QUERY_STATS__
+
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+// The code that fills the stats is only compiled if DBOW2_ENABLE_STATS is
+// defined (e.g. with the DBoW2_ENABLE_STATS option of CMake), so that it
+// costs nothing otherwise. It must be defined or not for the whole program
+#ifdef DBOW2_ENABLE_STATS
+  #define DBOW2_STATS(...) __VA_ARGS__
+#else
+  #define DBOW2_STATS(...)
+#endif
+
+namespace DBoW2 {
+
+/// Work done by one or several transforms and queries
+/**
+ * The counters are only updated if DBOW2_ENABLE_STATS is defined;
+ * otherwise, they stay 0.
+ */
+struct QueryStats
+{
+  /// Descriptors transformed into words
+  uint64_t descriptors;
+
+  /// Descriptor distances computed while descending the vocabulary tree
+  uint64_t distances;
+
+  /// Tree levels descended by all the descriptors
+  uint64_t levels;
+
+  /// Queries run
+  uint64_t queries;
+
+  /// Posting lists (rows of the inverted file) visited
+  uint64_t lists;
+
+  /// Postings visited
+  uint64_t postings;
+
+  /// Entries that got a score, i.e. candidates to be returned
+  uint64_t candidates;
+
+  /// Results returned
+  uint64_t results;
+
+  /// Seconds spent transforming descriptors
+  double transform_time;
+
+  /// Seconds spent adding up the scores of the postings
+  double scoring_time;
+
+  /// Seconds spent completing the scores and sorting the results
+  double sorting_time;
+
+  /**
+   * Creates stats with all the counters at 0
+   */
+  QueryStats() { clear(); }
+
+  /**
+   * Sets all the counters to 0
+   */
+  void clear();
+
+  /**
+   * Adds the counters of other stats
+   * @param s
+   * @return this
+   */
+  QueryStats& operator+=(const QueryStats &s);
+
+  /**
+   * Prints the counters
+   * @param out stream
+   * @param s stats
+   */
+  friend std::ostream& operator<<(std::ostream &out, const QueryStats &s);
+};
+
+/// Cumulative stats that several threads can add to
+/**
+ * Each database and vocabulary keeps the counters of its queries and
+ * transforms, e.g. to export them to a monitoring system.
+ */
+class QueryCounters
+{
+public:
+
+  /**
+   * Creates the counters at 0
+   */
+  QueryCounters() { reset(); }
+
+  /**
+   * Adds stats to the counters
+   * @param s
+   */
+  void add(const QueryStats &s);
+
+  /**
+   * Returns the current value of the counters. If other threads add to
+   * them meanwhile, the counters may be read at slightly different times
+   * @return counters
+   */
+  QueryStats get() const;
+
+  /**
+   * Sets the counters to 0
+   */
+  void reset();
+
+protected:
+
+  /// Counters, in the order of QueryStats
+  std::atomic<uint64_t> m_counts[8];
+
+  /// Times in nanoseconds, in the order of QueryStats
+  std::atomic<uint64_t> m_nanoseconds[3];
+};
+
+#ifdef DBOW2_ENABLE_STATS
+
+/// Measures the time between consecutive calls
+class StatsTimer
+{
+public:
+
+  /**
+   * Starts the timer
+   */
+  StatsTimer(): m_last(std::chrono::steady_clock::now()) {}
+
+  /**
+   * Returns the seconds since the last call, or since the timer started
+   * @return seconds
+   */
+  inline double lap()
+  {
+    const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    const double s = std::chrono::duration<double>(now - m_last).count();
+    m_last = now;
+    return s;
+  }
+
+protected:
+
+  /// Time of the last call
+  std::chrono::steady_clock::time_point m_last;
+};
+
+/// Stats of a call to a transform or a query
+/**
+ * When the call ends, its stats are added to the cumulative counters of
+ * the object and, if given, to the stats of the caller.
+ */
+class StatsScope
+{
+public:
+
+  /**
+   * Starts the stats of a call
+   * @param counters cumulative counters of the object
+   * @param caller if given, stats of the caller
+   */
+  StatsScope(QueryCounters &counters, QueryStats *caller):
+    m_counters(counters), m_caller(caller) {}
+
+  /**
+   * Adds the stats of the call to the counters and to those of the caller
+   */
+  ~StatsScope()
+  {
+    m_counters.add(m_stats);
+    if(m_caller) *m_caller += m_stats;
+  }
+
+  /**
+   * Returns the stats of the call to fill
+   * @return stats
+   */
+  inline QueryStats* stats() { return &m_stats; }
+
+protected:
+
+  /// Counters of the object
+  QueryCounters &m_counters;
+
+  /// Stats of the caller
+  QueryStats *m_caller;
+
+  /// Stats of the call
+  QueryStats m_stats;
+};
+
+#else
+
+/// Stats of a call, which are not filled if stats are not enabled
+class StatsScope
+{
+public:
+
+  /**
+   * Does nothing
+   */
+  StatsScope(QueryCounters &, QueryStats *) {}
+
+  /**
+   * Returns the stats of the call to fill
+   * @return NULL, since stats are not enabled
+   */
+  inline QueryStats* stats() { return NULL; }
+};
+
+#endif
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,495 @@
+/**
+ * File: ScoreAccumulator.h
+ * Date: October 2026
+ * Description: dense array of partial scores of database entries
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_SCORE_ACCUMULATOR__
+#define __D_T_SCORE_ACCUMULATOR__
+
+#include <cstddef>
+#include <vector>
+
+#include "QueryResults.h"
+
+namespace DBoW2 {
+
+/// Partial scores of the entries of a database touched by a query, stored
+/// in arrays indexed by entry id
+/**
+ * Only the entries touched since the last clear() are reset, so the same
+ * accumulator can be reused by consecutive queries in O(touched entries).
+ * Each entry keeps a score, a counter of common words and two optional
+ * sums.
+ */
+class ScoreAccumulator
+{
+public:
+
+  /**
+   * Creates an empty accumulator
+   */
+  ScoreAccumulator();
+
+  /**
+   * Clears the accumulator and makes room for entries with id < nentries
+   * @param nentries number of entries of the database
+   * @param sums if true, the sums of the entries are used too
+   */
+  void reset(size_t nentries, bool sums = false);
+
+  /**
+   * Clears the entries touched since the last reset
+   */
+  void clear();
+
+  /**
+   * Frees the arrays. The accumulator must be reset before using it again
+   */
+  void release();
+
+  /**
+   * Adds a value to the score of an entry
+   * @param id entry id (< nentries)
+   * @param value
+   */
+  inline void add(EntryId id, double value)
+  {
+    if(m_count[id]++ == 0)
+    {
+      m_touched.push_back(id);
+      m_score[id] = value;
+    }
+    else
+      m_score[id] += value;
+  }
+
+  /**
+   * Adds a value to the score of an entry and two values to its sums.
+   * The accumulator must have been reset with sums
+   * @param id entry id (< nentries)
+   * @param value
+   * @param a value to add to the first sum
+   * @param b value to add to the second sum
+   */
+  inline void add(EntryId id, double value, double a, double b)
+  {
+    if(m_count[id]++ == 0)
+    {
+      m_touched.push_back(id);
+      m_score[id] = value;
+      m_sum_a[id] = a;
+      m_sum_b[id] = b;
+    }
+    else
+    {
+      m_score[id] += value;
+      m_sum_a[id] += a;
+      m_sum_b[id] += b;
+    }
+  }
+
+  /**
+   * Returns the number of entries touched
+   * @return number of entries
+   */
+  inline size_t size() const { return m_touched.size(); }
+
+  /**
+   * Returns the id of the i-th touched entry
+   * @param i index (< size())
+   * @return entry id
+   */
+  inline EntryId entry(size_t i) const { return m_touched[i]; }
+
+  /**
+   * Returns the score of a touched entry
+   * @param id entry id
+   * @return score
+   */
+  inline double score(EntryId id) const { return m_score[id]; }
+
+  /**
+   * Returns the number of values added to a touched entry
+   * @param id entry id
+   * @return number of common words
+   */
+  inline unsigned int count(EntryId id) const { return m_count[id]; }
+
+  /**
+   * Returns the first sum of a touched entry
+   * @param id entry id
+   * @return sum
+   */
+  inline double sumA(EntryId id) const { return m_sum_a[id]; }
+
+  /**
+   * Returns the second sum of a touched entry
+   * @param id entry id
+   * @return sum
+   */
+  inline double sumB(EntryId id) const { return m_sum_b[id]; }
+
+  /**
+   * Drops some touched entries, keeping the order of the others
+   * @param TPredicate functor called as pred(entry_id), true to drop it
+   * @param pred
+   */
+  template<class TPredicate>
+  void erase(const TPredicate &pred)
+  {
+    size_t n = 0;
+    for(size_t i = 0; i < m_touched.size(); ++i)
+    {
+      const EntryId id = m_touched[i];
+      if(pred(id)) m_count[id] = 0;
+      else m_touched[n++] = id;
+    }
+    m_touched.resize(n);
+  }
+
+protected:
+
+  /// Scores (valid only for touched entries)
+  std::vector<double> m_score;
+  /// Values added to each entry (0 for untouched entries)
+  std::vector<unsigned int> m_count;
+  /// First sums (valid only for touched entries)
+  std::vector<double> m_sum_a;
+  /// Second sums (valid only for touched entries)
+  std::vector<double> m_sum_b;
+  /// Ids of the touched entries in order of first touch
+  std::vector<EntryId> m_touched;
+};
+
+/// Partial scores of a tile of entries of a database touched by a group of
+/// queries, with the values of the queries for each entry stored together
+/**
+ * The entries of the database are visited tile after tile, so the values
+ * of a whole group stay in the cache while its rows are traversed. When 
+ * several queries of the group have a word, each posting of its row adds
+ * to their scores of the entry touching the same cache lines, instead of 
+ * one line per query. Each query is read and written through a Column,
+ * which has the interface of ScoreAccumulator. As with ScoreAccumulator,
+ * only the entries touched since the last clear() are reset.
+ */
+class BlockScoreAccumulator
+{
+public:
+
+  /// Queries of a group at most. Their scores of an entry fill a cache line
+  static const unsigned int QUERIES = 8;
+
+  /// Entries of a tile at most, so that the values of a tile fit in the L2 
+  /// cache: 768 KB, or 1.75 MB if the scoring uses the sums
+  static const unsigned int ENTRIES = 32768;
+
+  /// Values of a query of the group
+  class Column
+  {
+  public:
+
+    /**
+     * Creates a column that does not belong to any accumulator
+     */
+    Column(): m_first(0), m_score(NULL), m_count(NULL), m_sum_a(NULL), 
+      m_sum_b(NULL), m_touched(NULL) {}
+
+    /**
+     * Adds a value to the score of an entry
+     * @param id entry id, in the tile
+     * @param value
+     */
+    inline void add(EntryId id, double value)
+    {
+      const size_t i = (size_t)(id - m_first) * QUERIES;
+      if(m_count[i]++ == 0)
+      {
+        m_touched->push_back(id);
+        m_score[i] = value;
+      }
+      else
+        m_score[i] += value;
+    }
+
+    /**
+     * Adds a value to the score of an entry and two values to its sums.
+     * The accumulator must have been reset with sums
+     * @param id entry id, in the tile
+     * @param value
+     * @param a value to add to the first sum
+     * @param b value to add to the second sum
+     */
+    inline void add(EntryId id, double value, double a, double b)
+    {
+      const size_t i = (size_t)(id - m_first) * QUERIES;
+      if(m_count[i]++ == 0)
+      {
+        m_touched->push_back(id);
+        m_score[i] = value;
+        m_sum_a[i] = a;
+        m_sum_b[i] = b;
+      }
+      else
+      {
+        m_score[i] += value;
+        m_sum_a[i] += a;
+        m_sum_b[i] += b;
+      }
+    }
+
+    /**
+     * Returns the number of entries touched by the query
+     * @return number of entries
+     */
+    inline size_t size() const { return m_touched->size(); }
+
+    /**
+     * Returns the id of the i-th entry touched by the query
+     * @param i index (< size())
+     * @return entry id
+     */
+    inline EntryId entry(size_t i) const { return (*m_touched)[i]; }
+
+    /**
+     * Returns the score of a touched entry
+     * @param id entry id
+     * @return score
+     */
+    inline double score(EntryId id) const
+    {
+      return m_score[(size_t)(id - m_first) * QUERIES];
+    }
+
+    /**
+     * Returns the number of values added to a touched entry
+     * @param id entry id
+     * @return number of common words
+     */
+    inline unsigned int count(EntryId id) const
+    {
+      return m_count[(size_t)(id - m_first) * QUERIES];
+    }
+
+    /**
+     * Returns the first sum of a touched entry
+     * @param id entry id
+     * @return sum
+     */
+    inline double sumA(EntryId id) const
+    {
+      return m_sum_a[(size_t)(id - m_first) * QUERIES];
+    }
+
+    /**
+     * Returns the second sum of a touched entry
+     * @param id entry id
+     * @return sum
+     */
+    inline double sumB(EntryId id) const
+    {
+      return m_sum_b[(size_t)(id - m_first) * QUERIES];
+    }
+
+    /**
+     * Drops some touched entries, keeping the order of the others
+     * @param TPredicate functor called as pred(entry_id), true to drop it
+     * @param pred
+     */
+    template<class TPredicate>
+    void erase(const TPredicate &pred)
+    {
+      std::vector<EntryId> &touched = *m_touched;
+      size_t n = 0;
+      for(size_t i = 0; i < touched.size(); ++i)
+      {
+        const EntryId id = touched[i];
+        if(pred(id)) m_count[(size_t)(id - m_first) * QUERIES] = 0;
+        else touched[n++] = id;
+      }
+      touched.resize(n);
+    }
+
+  protected:
+
+    friend class BlockScoreAccumulator;
+
+    /// First entry of the tile
+    EntryId m_first;
+    /// Values of the query for the first entry. Those of the i-th entry of
+    /// the tile are QUERIES * i items after them
+    double *m_score;
+    unsigned int *m_count;
+    double *m_sum_a;
+    double *m_sum_b;
+    /// Entries touched by the query in order of first touch
+    std::vector<EntryId> *m_touched;
+  };
+
+public:
+
+  /**
+   * Creates an empty accumulator
+   */
+  BlockScoreAccumulator();
+
+  /**
+   * Clears the accumulator and makes room for a tile of entries
+   * @param first id of the first entry of the tile
+   * @param nentries number of entries of the tile
+   * @param sums if true, the sums of the entries are used too
+   */
+  void reset(EntryId first, size_t nentries, bool sums = false);
+
+  /**
+   * Clears the entries touched since the last reset
+   */
+  void clear();
+
+  /**
+   * Frees the arrays. The accumulator must be reset before using it again
+   */
+  void release();
+
+  /**
+   * Returns the values of a query of the group in the tile. The column is
+   * valid until the accumulator is reset or released
+   * @param q index of the query in the group (< QUERIES)
+   * @return column
+   */
+  Column column(unsigned int q);
+
+protected:
+
+  /**
+   * Returns the first item of an array aligned to a cache line
+   * @param v array, with room for the alignment
+   * @return pointer to the item
+   */
+  template<class T>
+  static T* aligned(std::vector<T> &v);
+
+protected:
+
+  /// First entry of the tile
+  EntryId m_first;
+  /// Values of the entries of the tile, with those of the queries of each
+  /// entry together (valid only for touched entries, 0 counts for the 
+  /// others). The arrays have room to align the values to cache lines
+  std::vector<double> m_score;
+  std::vector<unsigned int> m_count;
+  std::vector<double> m_sum_a;
+  std::vector<double> m_sum_b;
+  /// Entries touched by each query
+  std::vector<EntryId> m_touched[QUERIES];
+};
+
+/// Gives exclusive use of the accumulator kept for the calling thread
+/**
+ * If the accumulator of the thread is already in use (e.g. by a query that
+ * is running a nested one), a private accumulator is used instead.
+ * The accumulator of a thread keeps the arrays of the largest database it
+ * has queried until the thread ends: 12 bytes per entry, 28 if the
+ * scoring uses the sums, plus 4 bytes per entry touched by a query. A
+ * thread that no longer queries a large database (e.g. after compacting
+ * or clearing it) can free them with releaseThreadAccumulator, which also
+ * frees its LocalBlockScoreAccumulator.
+ */
+class LocalScoreAccumulator
+{
+public:
+
+  /**
+   * Takes the accumulator of the thread and resets it
+   * @param nentries number of entries of the database
+   * @param sums if true, the sums of the entries are used too
+   */
+  LocalScoreAccumulator(size_t nentries, bool sums = false);
+
+  /**
+   * Clears the accumulator and gives it back
+   */
+  ~LocalScoreAccumulator();
+
+  /**
+   * Frees the arrays of the accumulator of the calling thread. The next
+   * query of the thread allocates them again
+   * @return false if they are in use by the thread, so they were not freed
+   */
+  static bool releaseThreadAccumulator();
+
+  /**
+   * Returns the accumulator
+   * @return accumulator
+   */
+  inline ScoreAccumulator& operator*() { return *m_acc; }
+
+  /**
+   * Returns the accumulator
+   * @return accumulator
+   */
+  inline ScoreAccumulator* operator->() { return m_acc; }
+
+private:
+
+  LocalScoreAccumulator(const LocalScoreAccumulator &);
+  LocalScoreAccumulator& operator=(const LocalScoreAccumulator &);
+
+  /// Accumulator in use
+  ScoreAccumulator *m_acc;
+  /// Whether m_acc is the accumulator of the thread
+  bool m_shared;
+};
+
+/// Gives exclusive use of the block accumulator kept for the calling thread
+/**
+ * As LocalScoreAccumulator, but with a BlockScoreAccumulator, whose arrays
+ * take 96 bytes per entry of a tile, 224 if the scoring uses the sums. 
+ * They are freed by LocalScoreAccumulator::releaseThreadAccumulator too.
+ */
+class LocalBlockScoreAccumulator
+{
+public:
+
+  /**
+   * Takes the block accumulator of the thread and resets it
+   * @param first id of the first entry of the tile
+   * @param nentries number of entries of the tile
+   * @param sums if true, the sums of the entries are used too
+   */
+  LocalBlockScoreAccumulator(EntryId first, size_t nentries, 
+    bool sums = false);
+
+  /**
+   * Clears the accumulator and gives it back
+   */
+  ~LocalBlockScoreAccumulator();
+
+  /**
+   * Returns the accumulator
+   * @return accumulator
+   */
+  inline BlockScoreAccumulator& operator*() { return *m_acc; }
+
+  /**
+   * Returns the accumulator
+   * @return accumulator
+   */
+  inline BlockScoreAccumulator* operator->() { return m_acc; }
+
+private:
+
+  LocalBlockScoreAccumulator(const LocalBlockScoreAccumulator &);
+  LocalBlockScoreAccumulator& operator=(const LocalBlockScoreAccumulator &);
+
+  /// Accumulator in use
+  BlockScoreAccumulator *m_acc;
+  /// Whether m_acc is the accumulator of the thread
+  bool m_shared;
+};
+
+} // namespace DBoW2
+
+#endif
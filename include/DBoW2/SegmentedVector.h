@@ -0,0 +1,196 @@
+/**
+ * File: SegmentedVector.h
+ * Date: October 2026
+ * Description: vector whose items are never moved when it grows
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_SEGMENTED_VECTOR__
+#define __D_T_SEGMENTED_VECTOR__
+
+#include <cstddef>
+#include <utility>
+
+namespace DBoW2 {
+
+/// @param T type of the items
+/// Vector stored in segments of increasing size
+/**
+ * Segment k has FIRST * 2^k items, and segments are allocated as the
+ * vector grows, so that items are never moved and the references to them
+ * stay valid. The table of segments has a fixed size, so an item that
+ * exists can be read by a thread while another one appends more items.
+ * The items at or after size() are always default-constructed.
+ */
+template<class T>
+class SegmentedVector
+{
+public:
+
+  /// Items of the first segment
+  static const size_t FIRST = 64;
+
+  /// Maximum number of segments
+  static const unsigned int MAX_SEGMENTS = 32;
+
+  /**
+   * Creates an empty vector
+   */
+  SegmentedVector(): m_size(0)
+  {
+    for(unsigned int k = 0; k < MAX_SEGMENTS; ++k) m_segments[k] = NULL;
+  }
+
+  /**
+   * Copy constructor
+   * @param v
+   */
+  SegmentedVector(const SegmentedVector<T> &v): m_size(0)
+  {
+    for(unsigned int k = 0; k < MAX_SEGMENTS; ++k) m_segments[k] = NULL;
+    *this = v;
+  }
+
+  /**
+   * Destructor
+   */
+  ~SegmentedVector() { clear(); }
+
+  /**
+   * Copies a vector
+   * @param v
+   * @return reference to this vector
+   */
+  SegmentedVector<T>& operator=(const SegmentedVector<T> &v)
+  {
+    if(this != &v)
+    {
+      resize(0);
+      resize(v.m_size);
+      for(size_t i = 0; i < m_size; ++i) (*this)[i] = v[i];
+    }
+    return *this;
+  }
+
+  /**
+   * Returns the number of items
+   * @return number of items
+   */
+  inline size_t size() const { return m_size; }
+
+  /**
+   * Returns whether the vector is empty
+   * @return true iff there are no items
+   */
+  inline bool empty() const { return m_size == 0; }
+
+  /**
+   * Returns an item
+   * @param i index of the item (< size())
+   * @return reference to the item
+   */
+  inline T& operator[](size_t i)
+  {
+    size_t offset;
+    const unsigned int k = segment(i, offset);
+    return m_segments[k][offset];
+  }
+
+  /**
+   * Returns an item
+   * @param i index of the item (< size())
+   * @return const reference to the item
+   */
+  inline const T& operator[](size_t i) const
+  {
+    size_t offset;
+    const unsigned int k = segment(i, offset);
+    return m_segments[k][offset];
+  }
+
+  /**
+   * Changes the number of items. New items are default-constructed, and
+   * removed items are reset, but the segments are kept
+   * @param n number of items
+   */
+  void resize(size_t n)
+  {
+    for(size_t i = n; i < m_size; ++i) (*this)[i] = T();
+
+    if(n > 0)
+    {
+      size_t offset;
+      const unsigned int last = segment(n - 1, offset);
+      for(unsigned int k = 0; k <= last; ++k)
+      {
+        if(m_segments[k] == NULL) m_segments[k] = new T[FIRST << k];
+      }
+    }
+
+    m_size = n;
+  }
+
+  /**
+   * Appends an item
+   * @param item
+   */
+  inline void push_back(const T &item)
+  {
+    resize(m_size + 1);
+    (*this)[m_size - 1] = item;
+  }
+
+  /**
+   * Exchanges the items of two vectors, without moving them
+   * @param v
+   */
+  void swap(SegmentedVector<T> &v)
+  {
+    for(unsigned int k = 0; k < MAX_SEGMENTS; ++k)
+      std::swap(m_segments[k], v.m_segments[k]);
+    std::swap(m_size, v.m_size);
+  }
+
+  /**
+   * Removes all the items and frees the memory
+   */
+  void clear()
+  {
+    for(unsigned int k = 0; k < MAX_SEGMENTS; ++k)
+    {
+      delete [] m_segments[k];
+      m_segments[k] = NULL;
+    }
+    m_size = 0;
+  }
+
+protected:
+
+  /**
+   * Finds the segment of an item. Segment k starts at item FIRST * (2^k-1)
+   * @param i index of the item
+   * @param offset (out) index of the item in its segment
+   * @return segment
+   */
+  static inline unsigned int segment(size_t i, size_t &offset)
+  {
+    size_t j = i / FIRST + 1;
+    unsigned int k = 0;
+    while(j >>= 1) ++k;
+
+    offset = i - FIRST * ((static_cast<size_t>(1) << k) - 1);
+    return k;
+  }
+
+protected:
+
+  /// Segments allocated, NULL for the others
+  T *m_segments[MAX_SEGMENTS];
+  /// Number of items
+  size_t m_size;
+};
+
+} // namespace DBoW2
+
+#endif
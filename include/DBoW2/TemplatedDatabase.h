@@ -11,17 +11,38 @@
 #define __D_T_TEMPLATED_DATABASE__
 
 #include <vector>
+#include <algorithm>
 #include <numeric>
 #include <fstream>
 #include <string>
-#include <list>
+#include <cstring>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <limits>
 #include <set>
+#include <map>
+#include <mutex>
+#include <type_traits>
 
 #include "TemplatedVocabulary.h"
 #include "QueryResults.h"
+#include "QueryOptions.h"
+#include "MatchOptions.h"
 #include "ScoringObject.h"
 #include "BowVector.h"
 #include "FeatureVector.h"
+#include "FlatBowVector.h"
+#include "FlatFeatureVector.h"
+#include "PostingList.h"
+#include "DescriptorTraits.h"
+#include "QueryStats.h"
+#include "WeightTraits.h"
+#include "SegmentedVector.h"
+#include "ScoreAccumulator.h"
+#include "ThreadPool.h"
+#include "BinaryIO.h"
+#include "DescriptorMatrix.h"
 
 namespace DBoW2 {
 
@@ -30,8 +51,18 @@ static int MIN_COMMON_WORDS = 5;
 
 /// @param TDescriptor class of descriptor
 /// @param F class of descriptor functions
-template<class TDescriptor, class F>
+/// @param TWeight type the weights of the inverted file are stored as
+///   (see WeightTraits)
+template<class TDescriptor, class F, class TWeight = WordValue>
 /// Generic Database
+/**
+ * One thread (the writer) may add entries while other threads query the
+ * database or retrieve the features of its entries, without locks: an
+ * entry becomes visible to them when it is complete. The writer may remove
+ * entries too. The other functions that modify the database, and save,
+ * must be called from the writer
+ * thread, and are not safe to call while there are readers.
+ */
 class TemplatedDatabase
 {
 public:
@@ -57,10 +88,23 @@ public:
     int di_levels = 0);
 
   /**
-   * Copy constructor. Copies the vocabulary too
+   * Creates a database that shares a vocabulary with other databases, 
+   * without copying it. The vocabulary must not be modified afterwards
+   * @param T class inherited from TemplatedVocabulary<TDescriptor, F>
+   * @param voc vocabulary
+   * @param use_di a direct index is used to store feature indexes
+   * @param di_levels levels to go up the vocabulary tree to select the 
+   *   node id to store in the direct index when adding images
+   */
+  template<class T>
+  explicit TemplatedDatabase(const std::shared_ptr<T> &voc, 
+    bool use_di = true, int di_levels = 0);
+
+  /**
+   * Copy constructor. The vocabulary is shared with db
    * @param db object to copy
    */
-  TemplatedDatabase(const TemplatedDatabase<TDescriptor, F> &db);
+  TemplatedDatabase(const TemplatedDatabase<TDescriptor, F, TWeight> &db);
 
   /** 
    * Creates the database from a file
@@ -80,16 +124,18 @@ public:
   virtual ~TemplatedDatabase(void);
 
   /**
-   * Copies the given database and its vocabulary
+   * Copies the given database, and shares its vocabulary
    * @param db database to copy
    */
-  TemplatedDatabase<TDescriptor,F>& operator=(
-    const TemplatedDatabase<TDescriptor,F> &db);
+  TemplatedDatabase<TDescriptor, F, TWeight>& operator=(
+    const TemplatedDatabase<TDescriptor, F, TWeight> &db);
 
   /**
    * Sets the vocabulary to use and clears the content of the database.
    * @param T class inherited from TemplatedVocabulary<TDescriptor, F>
    * @param voc vocabulary to copy
+   * @throw std::string if TWeight is FixedWordValue and the vocabulary
+   *   uses DOT_PRODUCT scoring
    */
   template<class T>
   inline void setVocabulary(const T &voc);
@@ -102,9 +148,38 @@ public:
    * @param use_di a direct index is used to store feature indexes
    * @param di_levels levels to go up the vocabulary tree to select the 
    *   node id to store in the direct index when adding images
+   * @throw std::string if TWeight is FixedWordValue and the vocabulary
+   *   uses DOT_PRODUCT scoring
    */
   template<class T>
   void setVocabulary(const T& voc, bool use_di, int di_levels = 0);
+
+  /**
+   * Sets a vocabulary shared with other databases, without copying it, 
+   * and clears the content of the database. The vocabulary must not be
+   * modified afterwards
+   * @param T class inherited from TemplatedVocabulary<TDescriptor, F>
+   * @param voc vocabulary
+   * @throw std::string if TWeight is FixedWordValue and the vocabulary
+   *   uses DOT_PRODUCT scoring
+   */
+  template<class T>
+  inline void setVocabulary(const std::shared_ptr<T> &voc);
+
+  /**
+   * Sets a vocabulary shared with other databases and the direct index
+   * parameters, and clears the content of the database
+   * @param T class inherited from TemplatedVocabulary<TDescriptor, F>
+   * @param voc vocabulary
+   * @param use_di a direct index is used to store feature indexes
+   * @param di_levels levels to go up the vocabulary tree to select the 
+   *   node id to store in the direct index when adding images
+   * @throw std::string if TWeight is FixedWordValue and the vocabulary
+   *   uses DOT_PRODUCT scoring
+   */
+  template<class T>
+  void setVocabulary(const std::shared_ptr<T> &voc, bool use_di, 
+    int di_levels = 0);
   
   /**
    * Returns a pointer to the vocabulary used
@@ -112,6 +187,13 @@ public:
    */
   inline const TemplatedVocabulary<TDescriptor,F>* getVocabulary() const;
 
+  /**
+   * Returns the vocabulary used, to share it with other databases
+   * @return vocabulary
+   */
+  inline std::shared_ptr<const TemplatedVocabulary<TDescriptor,F> > 
+    getSharedVocabulary() const;
+
   /** 
    * Allocates some memory for the direct and inverted indexes
    * @param nd number of expected image entries in the database 
@@ -130,6 +212,21 @@ public:
   EntryId add(const std::vector<TDescriptor> &features,
     BowVector *bowvec = NULL, FeatureVector *fvec = NULL);
 
+  /**
+   * Adds an entry with the descriptors stored in the rows of a matrix,
+   * which are read in place (see TemplatedVocabulary::transform)
+   * @param features N rows of DescriptorTraits<F>::bytes bytes, such as
+   *   the cv::Mat computed by an OpenCV extractor
+   * @param bowvec if given, the flat bow vector of these features is
+   *   returned
+   * @param fvec if given, the flat vector of nodes and row indexes is
+   *   returned
+   * @return id of new entry
+   * @throw std::string if the rows are not packed descriptors of F
+   */
+  EntryId add(const DescriptorMatrix &features,
+    FlatBowVector *bowvec = NULL, FlatFeatureVector *fvec = NULL);
+
   /**
    * Adss an entry to the database and returns its index
    * @param vec bow vector
@@ -140,6 +237,103 @@ public:
   EntryId add(const BowVector &vec, 
     const FeatureVector &fec = FeatureVector() );
 
+  /**
+   * Adds an entry to the database and returns its index
+   * @param vec flat bow vector
+   * @param fec flat feature vector to add the entry. Only necessary if 
+   *   using the direct index
+   * @return id of new entry
+   */
+  EntryId add(const FlatBowVector &vec, 
+    const FlatFeatureVector &fec = FlatFeatureVector() );
+
+  /**
+   * Adds several entries to the database at once. This is faster than
+   * adding them one by one: the images are converted in parallel and the
+   * new postings of each word are appended together
+   * @param features features of each new entry
+   * @param pool if given, threads to convert the images and to fill the
+   *   inverted index
+   * @return id of the first new entry. The entries get consecutive ids in
+   *   the order of features
+   */
+  EntryId addBatch(const std::vector<std::vector<TDescriptor> > &features,
+    ThreadPool *pool = NULL);
+
+  /**
+   * Adds several entries to the database at once
+   * @param vecs flat bow vectors of the new entries
+   * @param fvecs flat feature vectors of the new entries. Only necessary if
+   *   using the direct index
+   * @param pool if given, threads to fill the indexes
+   * @return id of the first new entry. The entries get consecutive ids in
+   *   the order of vecs
+   */
+  EntryId addBatch(const std::vector<FlatBowVector> &vecs,
+    const std::vector<FlatFeatureVector> &fvecs = 
+      std::vector<FlatFeatureVector>(), ThreadPool *pool = NULL);
+
+  /**
+   * Removes an entry from the database. The queries do not return it any
+   * longer, but its postings and its features are kept until compact is
+   * called, and its id is not given to other entries
+   * @param id entry id (must be < size())
+   * @throw std::string if the journal cannot be written
+   */
+  void remove(EntryId id);
+
+  /**
+   * Checks if an entry was removed
+   * @param id entry id (must be < size())
+   * @return true iff the entry was removed
+   */
+  inline bool isRemoved(EntryId id) const;
+
+  /**
+   * Returns the number of removed entries
+   * @return number of entries removed since the last renumbering
+   */
+  inline unsigned int removedEntries() const;
+
+  /**
+   * Frees the postings and the features of the removed entries. Only the
+   * rows of the inverted index that have removed entries are rewritten.
+   * This is not safe to call while other threads query the database
+   * @param renumber if true, the remaining entries are given consecutive
+   *   ids again, in the same order, so that size() is the number of
+   *   remaining entries. This increases the generation of the database,
+   *   so the journals written before cannot be replayed on it, nor on the
+   *   files saved after, and databases saved before cannot replay the
+   *   journals opened after
+   * @param pool if given, threads to rewrite the rows
+   * @return new id of each entry that there was before, or REMOVED_ENTRY
+   *   if it was removed
+   * @throw std::string if renumber is true and a journal is open
+   */
+  std::vector<EntryId> compact(bool renumber = false, ThreadPool *pool = NULL);
+
+  /**
+   * Compresses the postings of the inverted index into read-only sealed
+   * segments (see PostingList), e.g. once the entries of a session are
+   * archived. The entry ids of each row are stored as bit-packed
+   * differences, and the weights as they are, so queries return the same
+   * results. The entries added later are appended to uncompressed rows
+   * until the next call. Sealed rows are saved as the others, and
+   * loaded unsealed. This is not safe to call while other threads query
+   * the database
+   * @param pool if given, threads to compress the rows
+   */
+  void seal(ThreadPool *pool = NULL);
+
+  /**
+   * Returns the memory taken by the postings of the inverted index
+   * @return bytes
+   */
+  size_t invertedFileMemory() const;
+
+  /// New id compact gives to the removed entries
+  static const EntryId REMOVED_ENTRY = 0xFFFFFFFF;
+
   /**
    * Empties the database
    */
@@ -170,9 +364,26 @@ public:
    * @param max_results number of results to return. <= 0 means all
    * @param max_id only entries with id <= max_id are returned in ret. 
    *   < 0 means all
+   * @param stats if given, the work of the query (and of the transform of
+   *   the features) is added to it
    */
   void query(const std::vector<TDescriptor> &features, QueryResults &ret,
-    int max_results = 1, int max_id = -1) const;
+    int max_results = 1, int max_id = -1, QueryStats *stats = NULL) const;
+  
+  /**
+   * Queries the database with the descriptors stored in the rows of a
+   * matrix, which are read in place
+   * @param features N rows of DescriptorTraits<F>::bytes bytes
+   * @param ret (out) query results
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned in ret. 
+   *   < 0 means all
+   * @param stats if given, the work of the query (and of the transform of
+   *   the features) is added to it
+   * @throw std::string if the rows are not packed descriptors of F
+   */
+  void query(const DescriptorMatrix &features, QueryResults &ret,
+    int max_results = 1, int max_id = -1, QueryStats *stats = NULL) const;
   
   /**
    * Queries the database with a vector
@@ -181,29 +392,286 @@ public:
    * @param max_results number of results to return. <= 0 means all
    * @param max_id only entries with id <= max_id are returned in ret. 
    *   < 0 means all
+   * @param stats if given, the work of the query is added to it
+   */
+  void query(const BowVector &vec, QueryResults &ret, 
+    int max_results = 1, int max_id = -1, QueryStats *stats = NULL) const;
+
+  /**
+   * Queries the database with a flat vector
+   * @param vec flat bow vector already normalized
+   * @param ret results
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned in ret. 
+   *   < 0 means all
+   * @param stats if given, the work of the query is added to it
+   */
+  void query(const FlatBowVector &vec, QueryResults &ret, 
+    int max_results = 1, int max_id = -1, QueryStats *stats = NULL) const;
+
+  /**
+   * Queries the database with some features and options to visit fewer
+   * postings
+   * @param features query features
+   * @param ret (out) query results
+   * @param options
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned in ret. 
+   *   < 0 means all
+   * @param stats if given, the work of the query (and of the transform of
+   *   the features) is added to it
+   */
+  void query(const std::vector<TDescriptor> &features, QueryResults &ret,
+    const QueryOptions &options, int max_results = 1, 
+    int max_id = -1, QueryStats *stats = NULL) const;
+
+  /**
+   * Queries the database with the descriptors stored in the rows of a
+   * matrix, read in place, and options to visit fewer postings
+   * @param features N rows of DescriptorTraits<F>::bytes bytes
+   * @param ret (out) query results
+   * @param options
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned in ret. 
+   *   < 0 means all
+   * @param stats if given, the work of the query (and of the transform of
+   *   the features) is added to it
+   * @throw std::string if the rows are not packed descriptors of F
+   */
+  void query(const DescriptorMatrix &features, QueryResults &ret,
+    const QueryOptions &options, int max_results = 1, 
+    int max_id = -1, QueryStats *stats = NULL) const;
+
+  /**
+   * Queries the database with a vector and options to visit fewer postings
+   * @param vec bow vector already normalized
+   * @param ret results
+   * @param options
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned in ret. 
+   *   < 0 means all
+   * @param stats if given, the work of the query is added to it
    */
   void query(const BowVector &vec, QueryResults &ret, 
-    int max_results = 1, int max_id = -1) const;
+    const QueryOptions &options, int max_results = 1, 
+    int max_id = -1, QueryStats *stats = NULL) const;
+
+  /**
+   * Queries the database with a flat vector and options to visit fewer
+   * postings
+   * @param vec flat bow vector already normalized
+   * @param ret results
+   * @param options
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned in ret. 
+   *   < 0 means all
+   * @param stats if given, the work of the query is added to it
+   */
+  void query(const FlatBowVector &vec, QueryResults &ret, 
+    const QueryOptions &options, int max_results = 1, 
+    int max_id = -1, QueryStats *stats = NULL) const;
+
+  /**
+   * Queries the database with the features of several images at once.
+   * The images are converted in parallel, and the queries that share 
+   * words are answered in groups that read the rows of their words once
+   * @param features query features of each image
+   * @param ret (out) query results of each image
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned in ret. 
+   *   < 0 means all
+   * @param pool if given, threads to run the queries
+   * @param stats if given, the work of all the queries (and of the 
+   *   transforms of the features) is added to it
+   */
+  void queryBatch(const std::vector<std::vector<TDescriptor> > &features,
+    std::vector<QueryResults> &ret, int max_results = 1, int max_id = -1,
+    ThreadPool *pool = NULL, QueryStats *stats = NULL) const;
+
+  /**
+   * Queries the database with several flat vectors at once
+   * @param vecs flat bow vectors already normalized
+   * @param ret (out) query results of each vector
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned in ret. 
+   *   < 0 means all
+   * @param pool if given, threads to run the queries
+   * @param stats if given, the work of all the queries is added to it
+   */
+  void queryBatch(const std::vector<FlatBowVector> &vecs, 
+    std::vector<QueryResults> &ret, int max_results = 1, int max_id = -1,
+    ThreadPool *pool = NULL, QueryStats *stats = NULL) const;
+
+  /**
+   * Returns the work done by all the queries of the database on its 
+   * inverted file. The transforms of the query features are counted by 
+   * the vocabulary. The counters are only updated if DBOW2_ENABLE_STATS 
+   * is defined
+   * @return cumulative stats
+   */
+  inline QueryStats getStats() const;
+
+  /**
+   * Sets the cumulative stats to 0
+   */
+  inline void resetStats() const;
 
   /**
    * Returns the a feature vector associated with a database entry
+   * @deprecated the direct index is no longer stored as FeatureVector, so
+   *   the FeatureVector of an entry is built from it on the first call and
+   *   kept until the entries change, taking memory. Use
+   *   retrieveFlatFeatures, which returns the direct index itself
    * @param id entry id (must be < size())
-   * @return const reference to map of nodes and their associated features in
-   *   the given entry
+   * @return const reference to the map of nodes and their associated 
+   *   features in the given entry, valid until compact, clear or load are
+   *   called. It is empty for removed entries after compact
    */
   const FeatureVector& retrieveFeatures(EntryId id) const;
 
   /**
-   * Stores the database in a file
+   * Returns the flat feature vector associated with a database entry, as
+   * it is stored in the direct index
+   * @param id entry id (must be < size())
+   * @return const reference to the nodes and their associated features in
+   *   the given entry. It is empty for removed entries after compact
+   */
+  inline const FlatFeatureVector& retrieveFlatFeatures(EntryId id) const;
+
+  /**
+   * Matches the features of a query with those of a database entry. Only
+   * the features in the same direct index node are compared, and each 
+   * query feature is matched to the closest entry feature of its node
+   * @param fv flat feature vector of the query, obtained with the 
+   *   levelsup of the direct index (getDirectIndexLevels)
+   * @param features descriptors of the query
+   * @param id entry id (must be < size())
+   * @param entry_features descriptors of the entry, in the order they 
+   *   were added
+   * @param matches (out) accepted matches, in ascending order of query 
+   *   feature
+   * @param options options to accept the matches
+   * @throw std::string if the direct index is not used, or if the feature
+   *   indexes of the vectors are out of the descriptors given
+   */
+  void matchFeatures(const FlatFeatureVector &fv, 
+    const std::vector<TDescriptor> &features, EntryId id,
+    const std::vector<TDescriptor> &entry_features, 
+    std::vector<FeatureMatch> &matches, 
+    const MatchOptions &options = MatchOptions()) const;
+
+  /**
+   * Matches the features of a query with those of a database entry
+   * @param fv feature vector of the query, obtained with the levelsup of 
+   *   the direct index (getDirectIndexLevels)
+   * @param features descriptors of the query
+   * @param id entry id (must be < size())
+   * @param entry_features descriptors of the entry
+   * @param matches (out) accepted matches, in ascending order of query 
+   *   feature
+   * @param options options to accept the matches
+   * @throw std::string if the direct index is not used, or if the feature
+   *   indexes of the vectors are out of the descriptors given
+   */
+  void matchFeatures(const FeatureVector &fv, 
+    const std::vector<TDescriptor> &features, EntryId id,
+    const std::vector<TDescriptor> &entry_features, 
+    std::vector<FeatureMatch> &matches, 
+    const MatchOptions &options = MatchOptions()) const;
+
+  /**
+   * Matches the features of a query with those of several database 
+   * entries, such as the candidates returned by a query
+   * @param fv flat feature vector of the query, obtained with the 
+   *   levelsup of the direct index (getDirectIndexLevels)
+   * @param features descriptors of the query
+   * @param ids entry ids (each one < size())
+   * @param entry_features descriptors of each entry, which are not copied
+   * @param matches (out) accepted matches with each entry
+   * @param options options to accept the matches
+   * @param pool if given, threads to match the entries in parallel
+   * @throw std::string if the direct index is not used, or if the feature
+   *   indexes of the vectors are out of the descriptors given
+   */
+  void matchFeatures(const FlatFeatureVector &fv, 
+    const std::vector<TDescriptor> &features, 
+    const std::vector<EntryId> &ids,
+    const std::vector<const std::vector<TDescriptor>*> &entry_features, 
+    std::vector<std::vector<FeatureMatch> > &matches, 
+    const MatchOptions &options = MatchOptions(), 
+    ThreadPool *pool = NULL) const;
+
+  /**
+   * Stores the database in a file. If filename ends with .dbow2, it is 
+   * saved as a binary file, and as a cv::FileStorage file otherwise
    * @param filename
    */
   void save(const std::string &filename) const;
   
   /**
-   * Loads the database from a file
+   * Loads the database from a file. If filename ends with .dbow2, it is
+   * read as a binary file, and as a cv::FileStorage file otherwise
    * @param filename
+   * @throw std::string if TWeight is FixedWordValue and the vocabulary
+   *   uses DOT_PRODUCT scoring. The database is not modified then
    */
   void load(const std::string &filename);
+
+  /**
+   * Saves the database and its vocabulary into a binary file, whatever its
+   * extension. The sections are written one after another, so that the 
+   * memory needed besides the database is that of the largest one
+   * @param filename
+   * @throw std::string if the file cannot be written
+   */
+  void saveBinary(const std::string &filename) const;
+
+  /**
+   * Loads the database and its vocabulary from a binary file, whatever its
+   * extension
+   * @param filename
+   * @throw std::string if the file cannot be read or is not valid, or if
+   *   TWeight is FixedWordValue and the vocabulary uses DOT_PRODUCT scoring.
+   *   The database is not modified then
+   */
+  void loadBinary(const std::string &filename);
+
+  /**
+   * Starts writing the entries added from now on to a journal file, so 
+   * that a database saved before can be brought up to date by replaying it.
+   * Each entry is appended and flushed by add, and each removal by remove
+   * @param filename
+   * @param resume if true and the file exists, the database is first 
+   *   updated with its entries (see replayJournal), and the new entries are
+   *   appended to them. Otherwise, a new journal that starts at the current
+   *   size of the database is created. The journal is valid until the
+   *   entries are renumbered by compact
+   * @throw std::string if the file cannot be written, or if it cannot be
+   *   resumed, e.g. because entries were added to the database while the 
+   *   journal was closed
+   */
+  void openJournal(const std::string &filename, bool resume = false);
+
+  /**
+   * Stops writing entries to the journal file
+   */
+  void closeJournal();
+
+  /**
+   * Adds the entries of a journal file that are not in the database yet,
+   * and removes again the entries that were removed. Entries are skipped
+   * if their id is lower than size(), since they are already in the
+   * database. A truncated last record, as the one left if the process died
+   * while writing it, is ignored. The journal must have been opened on the
+   * same generation of the database, i.e. with no renumbering compaction
+   * between them
+   * @param filename
+   * @return number of entries added
+   * @throw std::string if the file cannot be read, it belongs to another
+   *   kind of database, or it does not continue this database. The 
+   *   database is not modified then
+   */
+  unsigned int replayJournal(const std::string &filename);
   
   /** 
    * Stores the database in the given file storage structure
@@ -221,183 +689,846 @@ public:
   virtual void load(const cv::FileStorage &fs, 
     const std::string &name = "database");
 
-protected:
-  
-  /// Query with L1 scoring
-  void queryL1(const BowVector &vec, QueryResults &ret, 
-    int max_results, int max_id) const;
-  
-  /// Query with L2 scoring
-  void queryL2(const BowVector &vec, QueryResults &ret, 
-    int max_results, int max_id) const;
-  
-  /// Query with Chi square scoring
-  void queryChiSquare(const BowVector &vec, QueryResults &ret, 
-    int max_results, int max_id) const;
-  
-  /// Query with Bhattacharyya scoring
-  void queryBhattacharyya(const BowVector &vec, QueryResults &ret, 
-    int max_results, int max_id) const;
-  
-  /// Query with KL divergence scoring  
-  void queryKL(const BowVector &vec, QueryResults &ret, 
-    int max_results, int max_id) const;
-  
-  /// Query with dot product scoring
-  void queryDotProduct(const BowVector &vec, QueryResults &ret, 
-    int max_results, int max_id) const;
-
 protected:
 
-  /* Inverted file declaration */
+  /*
+   * Each kind of scoring is given by a struct with the partial score that
+   * an entry gets for a word in common with the query (operator()), and a
+   * function that turns the accumulated scores into the sorted results.
+   * SUMS tells whether the accumulator must keep the sums of the entries.
+   * Both work with a ScoreAccumulator and with a column of a 
+   * BlockScoreAccumulator.
+   *
+   * For early termination, gain() gives how much better than an entry 
+   * without common words an entry is, and valid() whether results() would
+   * return it. If BOUNDED, the gain of an entry never decreases, and a word
+   * adds at most bound(query_weight, max_entry_weight) to it. The gains of
+   * complete entries are in the order of their results
+   */
   
-  /// Item of IFRow
-  struct IFPair
+  /// L1 scoring
+  struct L1Scoring
   {
-    /// Entry id
-    EntryId entry_id;
-    
-    /// Word weight in this entry
-    WordValue word_weight;
-    
-    /**
-     * Creates an empty pair
-     */
-    IFPair(){}
-    
-    /**
-     * Creates an inverted file pair
-     * @param eid entry id
-     * @param wv word weight
-     */
-    IFPair(EntryId eid, WordValue wv): entry_id(eid), word_weight(wv) {}
-    
-    /**
-     * Compares the entry ids
-     * @param eid
-     * @return true iff this entry id is the same as eid
-     */
-    inline bool operator==(EntryId eid) const { return entry_id == eid; }
-  };
-  
-  /// Row of InvertedFile
-  typedef std::list<IFPair> IFRow;
-  // IFRows are sorted in ascending entry_id order
-  
-  /// Inverted index
-  typedef std::vector<IFRow> InvertedFile; 
-  // InvertedFile[word_id] --> inverted file of that word
-  
-  /* Direct file declaration */
+    static const bool SUMS = false;
 
-  /// Direct index
-  typedef std::vector<FeatureVector> DirectFile;
-  // DirectFile[entry_id] --> [ directentry, ... ]
+    template<class TAccumulator>
+    inline void operator()(TAccumulator &acc, EntryId entry_id,
+      WordValue qvalue, WordValue dvalue) const
+    {
+      acc.add(entry_id, fabs(qvalue - dvalue) - fabs(qvalue) - fabs(dvalue));
+    }
 
-protected:
+    static const bool BOUNDED = true;
 
-  /// Associated vocabulary
-  TemplatedVocabulary<TDescriptor, F> *m_voc;
-  
-  /// Flag to use direct index
-  bool m_use_di;
-  
-  /// Levels to go up the vocabulary tree to select nodes to store
-  /// in the direct index
-  int m_dilevels;
-  
-  /// Inverted file (must have size() == |words|)
-  InvertedFile m_ifile;
-  
-  /// Direct file (resized for allocation)
-  DirectFile m_dfile;
-  
-  /// Number of valid entries in m_dfile
-  int m_nentries;
-  
-};
+    inline double bound(WordValue qvalue, WordValue max_dvalue) const
+    {
+      return 2 * std::min(qvalue, max_dvalue);
+    }
 
-// --------------------------------------------------------------------------
+    template<class TAccumulator>
+    inline double gain(const TAccumulator &acc, EntryId entry_id) const
+    {
+      return -acc.score(entry_id);
+    }
 
-template<class TDescriptor, class F>
-TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
-  (bool use_di, int di_levels)
-  : m_voc(NULL), m_use_di(use_di), m_dilevels(di_levels), m_nentries(0)
-{
-}
+    template<class TAccumulator>
+    inline bool valid(const TAccumulator &, EntryId) const
+    {
+      return true;
+    }
 
-// --------------------------------------------------------------------------
+    template<class TAccumulator>
+    void results(const FlatBowVector &vec, TAccumulator &acc, 
+      QueryResults &ret, int max_results) const;
+  };
+  
+  /// L2 scoring
+  struct L2Scoring
+  {
+    static const bool SUMS = false;
 
-template<class TDescriptor, class F>
-template<class T>
-TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
-  (const T &voc, bool use_di, int di_levels)
-  : m_voc(NULL), m_use_di(use_di), m_dilevels(di_levels)
-{
-  setVocabulary(voc);
-  clear();
-}
+    template<class TAccumulator>
+    inline void operator()(TAccumulator &acc, EntryId entry_id,
+      WordValue qvalue, WordValue dvalue) const
+    {
+      acc.add(entry_id, - qvalue * dvalue); // minus sign for sorting trick
+    }
 
-// --------------------------------------------------------------------------
+    static const bool BOUNDED = true;
 
-template<class TDescriptor, class F>
-TemplatedDatabase<TDescriptor,F>::TemplatedDatabase
-  (const TemplatedDatabase<TDescriptor,F> &db)
-  : m_voc(NULL)
-{
-  *this = db;
-}
+    inline double bound(WordValue qvalue, WordValue max_dvalue) const
+    {
+      return qvalue * max_dvalue;
+    }
 
-// --------------------------------------------------------------------------
+    template<class TAccumulator>
+    inline double gain(const TAccumulator &acc, EntryId entry_id) const
+    {
+      return -acc.score(entry_id);
+    }
 
-template<class TDescriptor, class F>
-TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
-  (const std::string &filename)
-  : m_voc(NULL)
-{
-  load(filename);
-}
+    template<class TAccumulator>
+    inline bool valid(const TAccumulator &, EntryId) const
+    {
+      return true;
+    }
 
-// --------------------------------------------------------------------------
+    template<class TAccumulator>
+    void results(const FlatBowVector &vec, TAccumulator &acc, 
+      QueryResults &ret, int max_results) const;
+  };
+  
+  /// Chi square scoring
+  struct ChiSquareScoring
+  {
+    static const bool SUMS = true;
 
-template<class TDescriptor, class F>
-TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
-  (const char *filename)
-  : m_voc(NULL)
-{
-  load(filename);
-}
+    template<class TAccumulator>
+    inline void operator()(TAccumulator &acc, EntryId entry_id,
+      WordValue qvalue, WordValue dvalue) const
+    {
+      // (v-w)^2/(v+w) - v - w = -4 vw/(v+w)
+      // we move the 4 out
+      double value = 0;
+      if(qvalue + dvalue != 0.0) // words may have weight zero
+        value = - qvalue * dvalue / (qvalue + dvalue);
+
+      // < sum vi, sum wi >
+      acc.add(entry_id, value, qvalue, dvalue);
+    }
+
+    static const bool BOUNDED = true;
+
+    inline double bound(WordValue qvalue, WordValue max_dvalue) const
+    {
+      // vw/(v+w) grows with w
+      if(qvalue + max_dvalue == 0.0) return 0;
+      return qvalue * max_dvalue / (qvalue + max_dvalue);
+    }
+
+    template<class TAccumulator>
+    inline double gain(const TAccumulator &acc, EntryId entry_id) const
+    {
+      return -acc.score(entry_id);
+    }
+
+    template<class TAccumulator>
+    inline bool valid(const TAccumulator &acc, EntryId entry_id) const
+    {
+      return (int)acc.count(entry_id) >= MIN_COMMON_WORDS;
+    }
+
+    template<class TAccumulator>
+    void results(const FlatBowVector &vec, TAccumulator &acc, 
+      QueryResults &ret, int max_results) const;
+  };
+  
+  /// KL divergence scoring
+  struct KLScoring
+  {
+    static const bool SUMS = true;
+
+    template<class TAccumulator>
+    inline void operator()(TAccumulator &acc, EntryId entry_id,
+      WordValue vi, WordValue wi) const
+    {
+      double value = 0;
+      if(vi != 0 && wi != 0) value = vi * log(vi/wi);
+
+      // the first sum keeps the score the word would add if the entry
+      // did not have it
+      double missing = 0;
+      if(vi != 0) missing = vi * (log(vi) - GeneralScoring::LOG_EPS);
+
+      acc.add(entry_id, value, missing, 0);
+    }
+
+    // the score of a word may be negative or positive
+    static const bool BOUNDED = false;
+
+    inline double bound(WordValue, WordValue) const { return 0; }
+
+    template<class TAccumulator>
+    inline double gain(const TAccumulator &, EntryId) const { return 0; }
+
+    template<class TAccumulator>
+    inline bool valid(const TAccumulator &, EntryId) const
+    {
+      return true;
+    }
+
+    template<class TAccumulator>
+    void results(const FlatBowVector &vec, TAccumulator &acc, 
+      QueryResults &ret, int max_results) const;
+  };
+  
+  /// Bhattacharyya scoring
+  struct BhattacharyyaScoring
+  {
+    static const bool SUMS = false;
+
+    template<class TAccumulator>
+    inline void operator()(TAccumulator &acc, EntryId entry_id,
+      WordValue qvalue, WordValue dvalue) const
+    {
+      acc.add(entry_id, sqrt(qvalue * dvalue));
+    }
+
+    static const bool BOUNDED = true;
+
+    inline double bound(WordValue qvalue, WordValue max_dvalue) const
+    {
+      return sqrt(qvalue * max_dvalue);
+    }
+
+    template<class TAccumulator>
+    inline double gain(const TAccumulator &acc, EntryId entry_id) const
+    {
+      return acc.score(entry_id);
+    }
+
+    template<class TAccumulator>
+    inline bool valid(const TAccumulator &acc, EntryId entry_id) const
+    {
+      return (int)acc.count(entry_id) >= MIN_COMMON_WORDS;
+    }
+
+    template<class TAccumulator>
+    void results(const FlatBowVector &vec, TAccumulator &acc, 
+      QueryResults &ret, int max_results) const;
+  };
+  
+  /// Dot product scoring
+  struct DotProductScoring
+  {
+    static const bool SUMS = false;
+
+    /// Whether the vocabulary uses BINARY weighting
+    bool binary;
+
+    explicit DotProductScoring(bool b): binary(b) {}
+
+    template<class TAccumulator>
+    inline void operator()(TAccumulator &acc, EntryId entry_id,
+      WordValue qvalue, WordValue dvalue) const
+    {
+      if(binary)
+        acc.add(entry_id, 1);
+      else
+        acc.add(entry_id, qvalue * dvalue);
+    }
+
+    static const bool BOUNDED = true;
+
+    inline double bound(WordValue qvalue, WordValue max_dvalue) const
+    {
+      return (binary ? 1 : qvalue * max_dvalue);
+    }
+
+    template<class TAccumulator>
+    inline double gain(const TAccumulator &acc, EntryId entry_id) const
+    {
+      return acc.score(entry_id);
+    }
+
+    template<class TAccumulator>
+    inline bool valid(const TAccumulator &, EntryId) const
+    {
+      return true;
+    }
+
+    template<class TAccumulator>
+    void results(const FlatBowVector &vec, TAccumulator &acc, 
+      QueryResults &ret, int max_results) const;
+  };
+
+  /**
+   * Queries the database with a vector and a kind of scoring
+   * @param vec query vector
+   * @param ret (out) results
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned. < 0: all
+   * @param scoring scoring struct
+   * @param stats if given, the work done is added to it
+   */
+  template<class TScoring>
+  void query(const FlatBowVector &vec, QueryResults &ret, int max_results,
+    int max_id, const TScoring &scoring, QueryStats *stats) const;
+
+  /**
+   * Queries the database with a vector, some options and a kind of scoring
+   * @param vec query vector
+   * @param ret (out) results
+   * @param options
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned. < 0: all
+   * @param scoring scoring struct
+   * @param stats if given, the work done is added to it
+   */
+  template<class TScoring>
+  void query(const FlatBowVector &vec, QueryResults &ret, 
+    const QueryOptions &options, int max_results, int max_id, 
+    const TScoring &scoring, QueryStats *stats) const;
+
+  /**
+   * Returns the gain of the k-th best entry that results() would return
+   * and has not been removed, for early termination
+   * @param acc accumulator of the query
+   * @param k
+   * @param scoring scoring struct
+   * @param gains buffer
+   * @return gain, or -infinity if there are less than k such entries
+   */
+  template<class TScoring>
+  double threshold(const ScoreAccumulator &acc, int k, 
+    const TScoring &scoring, std::vector<double> &gains) const;
+
+  /**
+   * Queries the database with several vectors and a kind of scoring
+   * @param vecs query vectors
+   * @param ret (out) results of each vector, already resized
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with id <= max_id are returned. < 0: all
+   * @param scoring scoring struct
+   * @param pool if given, threads to run the queries
+   * @param stats if given, the work done is added to it
+   */
+  template<class TScoring>
+  void queryBatch(const std::vector<FlatBowVector> &vecs,
+    std::vector<QueryResults> &ret, int max_results, int max_id, 
+    const TScoring &scoring, ThreadPool *pool, QueryStats *stats) const;
+
+  /**
+   * Returns the end of the range of entries a query can visit: the entries
+   * added so far (not those being added by the writer), up to max_id
+   * @param max_id only entries with id < max_id are visited (-1: all)
+   * @return id after the last entry to visit
+   */
+  inline EntryId queryEnd(int max_id) const;
+
+  /**
+   * Checks that the weights of the database can store the vectors of a
+   * scoring. Fixed-point weights saturate at 1, so they cannot store the
+   * vectors of DOT_PRODUCT, which are not normalized
+   * @param scoring scoring type of the vocabulary
+   * @throw std::string if TWeight is FixedWordValue and scoring is 
+   *   DOT_PRODUCT
+   */
+  static inline void checkScoring(ScoringType scoring);
+
+  /**
+   * Drops the removed entries from the entries touched by a query
+   * @param acc accumulator of the query, or column of a block accumulator
+   */
+  template<class TAccumulator>
+  inline void skipRemoved(TAccumulator &acc) const;
+
+  /**
+   * Traverses the inverted file rows of the words of a query vector and
+   * lets a functor accumulate the partial score of each posting
+   * @param vec query vector
+   * @param end_id only entries with id < end_id are visited
+   * @param acc accumulator, with room for the entries visited
+   * @param word_score functor called as  
+   *   word_score(acc, entry_id, query_weight, entry_weight)
+   * @return number of postings visited
+   */
+  template<class TWordScore>
+  size_t accumulate(const FlatBowVector &vec, EntryId end_id, 
+    ScoreAccumulator &acc, const TWordScore &word_score) const;
+
+  /**
+   * Lets a functor accumulate the partial scores of the postings of a row
+   * @param row inverted file row
+   * @param qvalue weight of the word in the query
+   * @param end_id only entries with id < end_id are visited
+   * @param acc accumulator, with room for the entries visited
+   * @param word_score functor called as  
+   *   word_score(acc, entry_id, query_weight, entry_weight)
+   * @return number of postings visited
+   */
+  template<class TWordScore>
+  size_t accumulate(const PostingList<TWeight> &row, WordValue qvalue,
+    EntryId end_id, ScoreAccumulator &acc, 
+    const TWordScore &word_score) const;
+
+  /**
+   * Lets a functor accumulate the partial scores of the postings of a row
+   * that are accepted by a filter. The postings out of the ranges are 
+   * skipped with binary searches, without decoding the sealed blocks that
+   * are out of them
+   * @param row inverted file row
+   * @param qvalue weight of the word in the query
+   * @param ranges ranges of the entries to visit, in ascending order
+   * @param mask if given, only the entries of the ranges set in it are 
+   *   visited
+   * @param acc accumulator, with room for the entries visited
+   * @param word_score functor called as  
+   *   word_score(acc, entry_id, query_weight, entry_weight)
+   * @return number of postings visited in the ranges
+   */
+  template<class TWordScore>
+  size_t accumulate(const PostingList<TWeight> &row, WordValue qvalue,
+    const std::vector<QueryFilter::Range> &ranges, 
+    const std::vector<bool> *mask, ScoreAccumulator &acc, 
+    const TWordScore &word_score) const;
+
+  /**
+   * Lets a functor accumulate the partial scores of the postings of a row
+   * that belong to some entries
+   * @param row inverted file row
+   * @param qvalue weight of the word in the query
+   * @param entries ids of the entries, in ascending order
+   * @param acc accumulator, with room for the entries
+   * @param word_score functor called as  
+   *   word_score(acc, entry_id, query_weight, entry_weight)
+   */
+  template<class TWordScore>
+  void accumulate(const PostingList<TWeight> &row, WordValue qvalue, 
+    const std::vector<EntryId> &entries, ScoreAccumulator &acc, 
+    const TWordScore &word_score) const;
+
+  /// Rows of the words of a group of query vectors, traversed tile after
+  /// tile of entries
+  struct GroupRows
+  {
+    /// Word of a query vector of the group
+    struct QueryWord
+    {
+      /// Index of the vector in the group
+      unsigned int query;
+      /// Weight of the word in the vector
+      WordValue value;
+    };
+
+    /// Words of the vectors, row after row, with the vectors of each row in
+    /// order
+    std::vector<QueryWord> words;
+    /// First item of words of each row, and words.size() at the end
+    std::vector<size_t> offsets;
+    /// Reader of each row, at the block of its next posting. A reader must
+    /// not be moved after reading a block
+    std::vector<typename PostingList<TWeight>::Reader> readers;
+    /// Next posting of the current block of each reader
+    std::vector<unsigned int> next;
+  };
+
+  /**
+   * Gets the rows of the words of a group of query vectors, before their
+   * first postings
+   * @param vecs query vectors
+   * @param group indexes of the vectors of the group
+   * @param n number of vectors of the group (<= 
+   *   BlockScoreAccumulator::QUERIES)
+   * @param rows (out) rows of the words of the group
+   */
+  void groupRows(const std::vector<FlatBowVector> &vecs, 
+    const unsigned int *group, size_t n, GroupRows &rows) const;
+
+  /**
+   * Traverses the rows of the words of a group of query vectors up to an
+   * entry, visiting each posting once for all the queries that have its 
+   * word. The rows are left there, so that the next tile goes on from it
+   * @param rows rows of the words of the group
+   * @param end_id only entries with id < end_id are visited
+   * @param acc accumulator, with room for the entries visited, from the 
+   *   first posting of the rows on. Column i gets the scores of the i-th
+   *   vector of the group
+   * @param word_score functor called as  
+   *   word_score(column, entry_id, query_weight, entry_weight)
+   * @return number of postings visited, counted once per query
+   */
+  template<class TWordScore>
+  size_t accumulate(GroupRows &rows, EntryId end_id, 
+    BlockScoreAccumulator &acc, const TWordScore &word_score) const;
+
+  /**
+   * Drops the entries of a tile that cannot be among the best results of a
+   * query, given the best entries of the previous tiles, which have lower 
+   * ids. The scoring must be BOUNDED
+   * @param acc column of the query in the tile, without removed entries
+   * @param k number of results of the query
+   * @param scoring
+   * @param best (in/out) heap with the k greatest gains found so far, or 
+   *   fewer, the least first. The gains of the tile are added to it
+   */
+  template<class TScoring>
+  void keepBest(BlockScoreAccumulator::Column &acc, size_t k, 
+    const TScoring &scoring, std::vector<double> &best) const;
+
+  /**
+   * Splits a batch of query vectors into groups of up to 
+   * BlockScoreAccumulator::QUERIES vectors that share many words, which
+   * are accumulated together. The vectors that share few words with the 
+   * others are left in groups of their own
+   * @param vecs query vectors
+   * @param groups (out) indexes of the vectors, group after group
+   * @param offsets (out) first index of each group in groups, and 
+   *   groups.size() at the end
+   */
+  static void groupQueries(const std::vector<FlatBowVector> &vecs,
+    std::vector<unsigned int> &groups, std::vector<size_t> &offsets);
+
+  /**
+   * Reads a weight of the binary format, stored as double, float or 
+   * FixedWordValue
+   * @param weights weights section
+   * @param bytes bytes of each weight
+   * @param i index of the weight
+   * @return weight converted to TWeight
+   */
+  static inline TWeight storedWeight(const unsigned char *weights, 
+    uint32_t bytes, uint64_t i);
+
+  /**
+   * Exchanges the contents of two databases, but not their journals nor
+   * their counters
+   * @param db
+   */
+  void swapContents(TemplatedDatabase<TDescriptor, F, TWeight> &db);
+
+  /**
+   * Appends an entry to the journal, if it is open
+   * @param entry_id id of the entry, already added
+   * @param vec bow vector of the entry
+   */
+  void journalEntry(EntryId entry_id, const FlatBowVector &vec);
+
+  /**
+   * Appends the removal of an entry to the journal, if it is open
+   * @param entry_id id of the entry removed
+   */
+  void journalRemoval(EntryId entry_id);
+
+  /**
+   * Reads the valid records of a journal file and adds their entries. All
+   * the records are checked before the database is modified
+   * @param filename
+   * @param resume if true, the journal must end at the last entry of the
+   *   database, or after it, so that it can be appended to
+   * @param valid_bytes (out) bytes of the file up to the last valid record
+   * @return number of entries added
+   */
+  unsigned int replayJournal(const std::string &filename, bool resume,
+    uint64_t &valid_bytes);
+
+protected:
+
+  /// Sections of binary database files
+  enum BinarySection
+  {
+    SECTION_HEADER = 0,
+    /// Binary vocabulary (see TemplatedVocabulary::saveBinary)
+    SECTION_VOCABULARY,
+    /// nwords + 1 uint64: first posting of each row
+    SECTION_ROWS,
+    /// npostings EntryId: entries of the postings, row after row
+    SECTION_IDS,
+    /// npostings WordValue: weights of the postings
+    SECTION_WEIGHTS,
+    /// nentries + 1 uint64: first direct index node of each entry
+    SECTION_DI_ENTRIES,
+    /// di_nnodes NodeId: nodes of the direct index, entry after entry
+    SECTION_DI_NODES,
+    /// di_nnodes + 1 uint64: first feature of each direct index node
+    SECTION_DI_FEATURE_OFFSETS,
+    /// di_nfeatures uint32: feature indexes, node after node
+    SECTION_DI_FEATURES,
+    /// nremoved EntryId: removed entries, in ascending order
+    SECTION_REMOVED,
+    NUM_SECTIONS
+  };
+
+  /// Header of binary database files
+  struct BinaryHeader
+  {
+    /// "DBoW2DB" 
+    char magic[8];
+    /// Version of the format
+    uint32_t version;
+    /// 0x01020304, to check the byte order
+    uint32_t byte_order;
+    /// Bytes of the file
+    uint64_t file_size;
+    /// Checksum of the file, calculated with this field set to 0
+    uint64_t checksum;
+    /// Number of entries
+    uint32_t nentries;
+    /// Whether the direct index is used
+    int32_t use_di;
+    /// Direct index levels
+    int32_t di_levels;
+    /// Number of words (rows of the inverted index)
+    uint32_t nwords;
+    /// Bytes of a weight
+    uint32_t weight_bytes;
+    /// Number of removed entries
+    uint32_t nremoved;
+    /// Number of postings in the inverted index
+    uint64_t npostings;
+    /// Number of nodes in the direct index
+    uint64_t di_nnodes;
+    /// Number of features in the direct index
+    uint64_t di_nfeatures;
+    /// Bytes of the vocabulary section, without padding
+    uint64_t vocabulary_size;
+    /// Offset of each section (BinarySection), in file order
+    uint64_t offsets[NUM_SECTIONS];
+    /// Generation of the database (0 in the files written before it was
+    /// stored, in the padding of the header)
+    uint32_t generation;
+    /// Unused
+    uint32_t reserved;
+  };
+
+  /// Header of journal files
+  struct JournalHeader
+  {
+    /// "DBoW2JNL"
+    char magic[8];
+    /// Version of the format
+    uint32_t version;
+    /// 0x01020304, to check the byte order
+    uint32_t byte_order;
+    /// Size of the database when the journal was created
+    uint32_t first_entry;
+    /// Number of words of the vocabulary
+    uint32_t nwords;
+    /// Whether the direct index is used
+    int32_t use_di;
+    /// Direct index levels
+    int32_t di_levels;
+    /// Bytes of a weight
+    uint32_t weight_bytes;
+    /// Generation of the database when the journal was created
+    uint32_t generation;
+  };
+
+  /// Header of each record of a journal file. An added entry is followed 
+  /// by nwords WordValue, nwords WordId, nnodes NodeId, nnodes uint32 with
+  /// the number of features of each node, and nfeatures uint32 feature 
+  /// indexes, so that the weights are aligned. A removal has no data
+  struct JournalRecord
+  {
+    /// Kind of record (JOURNAL_ADD, JOURNAL_REMOVE)
+    uint32_t type;
+    /// Id of the entry
+    uint32_t entry_id;
+    /// Words of the bow vector
+    uint32_t nwords;
+    /// Nodes of the direct index
+    uint32_t nnodes;
+    /// Features of the direct index
+    uint32_t nfeatures;
+    /// Unused
+    uint32_t reserved;
+    /// Checksum of the record and its data, with this field set to 0
+    uint64_t checksum;
+  };
+
+  /// Record of an added entry
+  static const uint32_t JOURNAL_ADD = 1;
+
+  /// Record of a removed entry
+  static const uint32_t JOURNAL_REMOVE = 2;
+
+  /// Version of the binary formats written by saveBinary and openJournal
+  static const uint32_t BINARY_VERSION = 2;
+
+protected:
+
+  /* Inverted file declaration */
+  
+  /// Conversion of the weights stored in the inverted file
+  typedef WeightTraits<TWeight> Weight;
+
+  /// Row of InvertedFile
+  typedef PostingList<TWeight> IFRow;
+  // IFRows are sorted in ascending entry_id order
+  
+  /// Inverted index
+  typedef std::vector<IFRow> InvertedFile; 
+  // InvertedFile[word_id] --> inverted file of that word
+  
+  /* Direct file declaration */
+
+  /// Direct index. Its items are never moved, so that they can be read
+  /// while more entries are added
+  typedef SegmentedVector<FlatFeatureVector> DirectFile;
+  // DirectFile[entry_id] --> [ directentry, ... ]
+
+  /// Mark of a removed entry, which readers can check while it is set
+  struct Tombstone
+  {
+    std::atomic<bool> removed;
+
+    Tombstone(): removed(false) {}
+
+    Tombstone(const Tombstone &t)
+      : removed(t.removed.load(std::memory_order_relaxed)) {}
+
+    inline Tombstone& operator=(const Tombstone &t)
+    {
+      removed.store(t.removed.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+      return *this;
+    }
+  };
+
+protected:
+
+  /// Associated vocabulary. It may be shared with other databases, so it
+  /// is never modified: loading a database replaces it with a new one
+  std::shared_ptr<const TemplatedVocabulary<TDescriptor, F> > m_voc;
+  
+  /// Flag to use direct index
+  bool m_use_di;
+  
+  /// Levels to go up the vocabulary tree to select nodes to store
+  /// in the direct index
+  int m_dilevels;
+  
+  /// Inverted file (must have size() == |words|)
+  InvertedFile m_ifile;
+  
+  /// Direct file (resized for allocation)
+  DirectFile m_dfile;
+  
+  /// Number of valid entries in m_dfile. It is stored after adding each
+  /// entry, so that readers only see complete entries
+  std::atomic<int> m_nentries;
+
+  /// Whether each entry was removed (has size() == m_nentries)
+  SegmentedVector<Tombstone> m_removed;
+
+  /// Number of removed entries
+  std::atomic<unsigned int> m_nremoved;
+
+  /// Number of times the entries were renumbered by compact. Journals
+  /// are only replayed on the generation they were created on
+  uint32_t m_generation;
+
+  /// Journal the added entries are written to, if any
+  std::ofstream *m_journal;
+
+  /// Work done by the queries on the inverted file. It is not part of
+  /// the contents of the database, so it is not copied
+  mutable QueryCounters m_counters;
+
+  /// Feature vectors returned by retrieveFeatures, built from the direct
+  /// index. They are not part of the contents either
+  mutable std::map<EntryId, FeatureVector> m_features;
+
+  /// Protects m_features from the threads that query the database
+  mutable std::mutex m_features_mutex;
+  
+};
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+TemplatedDatabase<TDescriptor, F, TWeight>::TemplatedDatabase
+  (bool use_di, int di_levels)
+  : m_use_di(use_di), m_dilevels(di_levels), m_nentries(0),
+  m_nremoved(0), m_generation(0), m_journal(NULL)
+{
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class T>
+TemplatedDatabase<TDescriptor, F, TWeight>::TemplatedDatabase
+  (const T &voc, bool use_di, int di_levels)
+  : m_use_di(use_di), m_dilevels(di_levels), m_nentries(0),
+  m_nremoved(0), m_generation(0), m_journal(NULL)
+{
+  setVocabulary(voc);
+  clear();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class T>
+TemplatedDatabase<TDescriptor, F, TWeight>::TemplatedDatabase
+  (const std::shared_ptr<T> &voc, bool use_di, int di_levels)
+  : m_use_di(use_di), m_dilevels(di_levels), m_nentries(0),
+  m_nremoved(0), m_generation(0), m_journal(NULL)
+{
+  setVocabulary(voc);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+TemplatedDatabase<TDescriptor, F, TWeight>::TemplatedDatabase
+  (const TemplatedDatabase<TDescriptor, F, TWeight> &db)
+  : m_nentries(0), m_nremoved(0), m_generation(0), m_journal(NULL)
+{
+  *this = db;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+TemplatedDatabase<TDescriptor, F, TWeight>::TemplatedDatabase
+  (const std::string &filename)
+  : m_use_di(false), m_dilevels(0), m_nentries(0), m_nremoved(0), 
+  m_generation(0), m_journal(NULL)
+{
+  load(filename);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+TemplatedDatabase<TDescriptor, F, TWeight>::TemplatedDatabase
+  (const char *filename)
+  : m_use_di(false), m_dilevels(0), m_nentries(0), m_nremoved(0), 
+  m_generation(0), m_journal(NULL)
+{
+  load(filename);
+}
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-TemplatedDatabase<TDescriptor, F>::~TemplatedDatabase(void)
+template<class TDescriptor, class F, class TWeight>
+TemplatedDatabase<TDescriptor, F, TWeight>::~TemplatedDatabase(void)
 {
-  delete m_voc;
+  delete m_journal;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-TemplatedDatabase<TDescriptor,F>& TemplatedDatabase<TDescriptor,F>::operator=
-  (const TemplatedDatabase<TDescriptor,F> &db)
+template<class TDescriptor, class F, class TWeight>
+TemplatedDatabase<TDescriptor, F, TWeight>& 
+TemplatedDatabase<TDescriptor, F, TWeight>::operator=(
+  const TemplatedDatabase<TDescriptor, F, TWeight> &db)
 {
   if(this != &db)
   {
+    // the journal of db is not shared
+    closeJournal();
+
     m_dfile = db.m_dfile;
     m_dilevels = db.m_dilevels;
     m_ifile = db.m_ifile;
-    m_nentries = db.m_nentries;
+    m_nentries.store(db.m_nentries.load());
+    m_removed = db.m_removed;
+    m_nremoved.store(db.m_nremoved.load());
+    m_generation = db.m_generation;
     m_use_di = db.m_use_di;
-    setVocabulary(*db.m_voc);
+    m_voc = db.m_voc;
+    m_features.clear();
   }
   return *this;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-EntryId TemplatedDatabase<TDescriptor, F>::add(
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedDatabase<TDescriptor, F, TWeight>::add(
   const std::vector<TDescriptor> &features,
   BowVector *bowvec, FeatureVector *fvec)
 {
@@ -429,13 +1560,75 @@ EntryId TemplatedDatabase<TDescriptor, F>::add(
 
 // ---------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-EntryId TemplatedDatabase<TDescriptor, F>::add(const BowVector &v,
-  const FeatureVector &fv)
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedDatabase<TDescriptor, F, TWeight>::add(
+  const DescriptorMatrix &features,
+  FlatBowVector *bowvec, FlatFeatureVector *fvec)
 {
-  EntryId entry_id = m_nentries++;
+  FlatBowVector aux;
+  FlatBowVector& v = (bowvec ? *bowvec : aux);
+  
+  if(m_use_di || fvec != NULL)
+  {
+    FlatFeatureVector fv_aux;
+    FlatFeatureVector& fv = (fvec ? *fvec : fv_aux);
+    m_voc->transform(features, v, fv, m_dilevels); // with features
+    return (m_use_di ? add(v, fv) : add(v));
+  }
+  else
+  {
+    m_voc->transform(features, v);
+    return add(v);
+  }
+}
 
-  BowVector::const_iterator vit;
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedDatabase<TDescriptor, F, TWeight>::add(const BowVector &v,
+  const FeatureVector &fv)
+{
+  const EntryId entry_id = m_nentries.load(std::memory_order_relaxed);
+
+  BowVector::const_iterator vit;
+
+  if(m_use_di)
+  {
+    // update direct file
+    if(entry_id == m_dfile.size())
+    {
+      m_dfile.push_back(FlatFeatureVector());
+    }
+    m_dfile[entry_id].fromFeatureVector(fv);
+  }
+  
+  // update inverted file
+  for(vit = v.begin(); vit != v.end(); ++vit)
+  {
+    const WordId& word_id = vit->first;
+    const WordValue& word_weight = vit->second;
+    
+    IFRow& ifrow = m_ifile[word_id];
+    ifrow.push_back(entry_id, Weight::encode(word_weight));
+  }
+
+  m_removed.resize(entry_id + 1);
+
+  // publish the entry
+  m_nentries.store(entry_id + 1, std::memory_order_release);
+
+  if(m_journal) journalEntry(entry_id, FlatBowVector(v));
+  
+  return entry_id;
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedDatabase<TDescriptor, F, TWeight>::add(const FlatBowVector &v,
+  const FlatFeatureVector &fv)
+{
+  const EntryId entry_id = m_nentries.load(std::memory_order_relaxed);
 
   if(m_use_di)
   {
@@ -451,857 +1644,2993 @@ EntryId TemplatedDatabase<TDescriptor, F>::add(const BowVector &v,
   }
   
   // update inverted file
-  for(vit = v.begin(); vit != v.end(); ++vit)
+  for(size_t i = 0; i < v.size(); ++i)
+  {
+    IFRow& ifrow = m_ifile[v.id(i)];
+    ifrow.push_back(entry_id, Weight::encode(v.value(i)));
+  }
+
+  m_removed.resize(entry_id + 1);
+
+  // publish the entry
+  m_nentries.store(entry_id + 1, std::memory_order_release);
+
+  if(m_journal) journalEntry(entry_id, v);
+  
+  return entry_id;
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedDatabase<TDescriptor, F, TWeight>::addBatch(
+  const std::vector<std::vector<TDescriptor> > &features, ThreadPool *pool)
+{
+  std::vector<FlatBowVector> vecs(features.size());
+  std::vector<FlatFeatureVector> fvecs(m_use_di ? features.size() : 0);
+
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+  {
+    for(size_t i = begin; i < end; ++i)
+    {
+      if(m_use_di)
+        m_voc->transform(features[i], vecs[i], fvecs[i], m_dilevels);
+      else
+        m_voc->transform(features[i], vecs[i]);
+    }
+  };
+
+  if(pool) pool->parallelFor(features.size(), f, 1);
+  else f(0, features.size());
+
+  return addBatch(vecs, fvecs, pool);
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedDatabase<TDescriptor, F, TWeight>::addBatch(
+  const std::vector<FlatBowVector> &vecs, 
+  const std::vector<FlatFeatureVector> &fvecs, ThreadPool *pool)
+{
+  const EntryId first_id = m_nentries.load(std::memory_order_relaxed);
+  const size_t N = vecs.size();
+
+  if(m_use_di)
+  {
+    // update direct file
+    if(m_dfile.size() < first_id + N) m_dfile.resize(first_id + N);
+
+    std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+    {
+      for(size_t i = begin; i < end; ++i)
+      {
+        if(i < fvecs.size()) m_dfile[first_id + i] = fvecs[i];
+        else m_dfile[first_id + i].clear();
+      }
+    };
+
+    if(pool) pool->parallelFor(N, f, 16);
+    else f(0, N);
+  }
+
+  /// New posting of a word
+  struct Posting
+  {
+    WordId word_id;
+    EntryId entry_id;
+    WordValue weight;
+
+    inline bool operator<(const Posting &p) const 
+    { 
+      return word_id < p.word_id;
+    }
+  };
+
+  // the new postings are grouped by word. The stable sort keeps them in
+  // ascending entry_id order
+  std::vector<Posting> postings;
+  for(size_t i = 0; i < N; ++i)
+  {
+    for(size_t j = 0; j < vecs[i].size(); ++j)
+    {
+      Posting p;
+      p.word_id = vecs[i].id(j);
+      p.entry_id = first_id + i;
+      p.weight = vecs[i].value(j);
+      postings.push_back(p);
+    }
+  }
+  std::stable_sort(postings.begin(), postings.end());
+
+  // first posting of each word
+  std::vector<size_t> groups;
+  for(size_t i = 0; i < postings.size(); ++i)
+  {
+    if(i == 0 || postings[i].word_id != postings[i-1].word_id)
+      groups.push_back(i);
+  }
+  groups.push_back(postings.size());
+
+  // update inverted file. Each row is only modified by one thread
+  std::function<void(size_t, size_t)> g = [&](size_t begin, size_t end)
+  {
+    for(size_t k = begin; k < end; ++k)
+    {
+      IFRow& ifrow = m_ifile[postings[groups[k]].word_id];
+      ifrow.reserve(ifrow.size() + groups[k+1] - groups[k]);
+
+      for(size_t i = groups[k]; i < groups[k+1]; ++i)
+        ifrow.push_back(postings[i].entry_id, 
+          Weight::encode(postings[i].weight));
+    }
+  };
+
+  if(pool) pool->parallelFor(groups.size() - 1, g, 64);
+  else g(0, groups.size() - 1);
+
+  m_removed.resize(first_id + N);
+
+  // publish the entries
+  m_nentries.store(first_id + N, std::memory_order_release);
+
+  if(m_journal)
+  {
+    for(size_t i = 0; i < N; ++i) journalEntry(first_id + i, vecs[i]);
+  }
+
+  return first_id;
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+const EntryId TemplatedDatabase<TDescriptor, F, TWeight>::REMOVED_ENTRY;
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::remove(EntryId id)
+{
+  assert(id < size());
+
+  Tombstone &t = m_removed[id];
+  if(t.removed.load(std::memory_order_relaxed)) return;
+
+  t.removed.store(true, std::memory_order_relaxed);
+  m_nremoved.fetch_add(1, std::memory_order_relaxed);
+
+  if(m_journal) journalRemoval(id);
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline bool TemplatedDatabase<TDescriptor, F, TWeight>::isRemoved(EntryId id)
+  const
+{
+  assert(id < size());
+  return m_removed[id].removed.load(std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline unsigned int TemplatedDatabase<TDescriptor, F, TWeight>::removedEntries()
+  const
+{
+  return m_nremoved.load(std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+std::vector<EntryId> TemplatedDatabase<TDescriptor, F, TWeight>::compact(
+  bool renumber, ThreadPool *pool)
+{
+  if(renumber && m_journal)
+    throw std::string("Entries cannot be renumbered while a journal is open");
+
+  const EntryId N = m_nentries.load(std::memory_order_relaxed);
+
+  // new id of each entry
+  std::vector<EntryId> new_ids(N);
+  EntryId next_id = 0;
+  for(EntryId e = 0; e < N; ++e)
+  {
+    if(m_removed[e].removed.load(std::memory_order_relaxed))
+      new_ids[e] = REMOVED_ENTRY;
+    else
+      new_ids[e] = (renumber ? next_id++ : e);
+  }
+
+  if(m_nremoved.load(std::memory_order_relaxed) == 0) return new_ids;
+
+  // update inverted file. Rows whose postings all keep their ids are not
+  // rewritten
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+  {
+    for(size_t w = begin; w < end; ++w)
+    {
+      IFRow& ifrow = m_ifile[w];
+
+      size_t kept = 0, kept_sealed = 0;
+      bool changed = false;
+      for(typename IFRow::Reader r(ifrow); r.next(); )
+      {
+        const EntryId *ids = r.ids();
+        for(unsigned int k = 0; k < r.size(); ++k)
+        {
+          const EntryId id = new_ids[ids[k]];
+          if(id != REMOVED_ENTRY) 
+          {
+            ++kept;
+            if(r.sealed()) ++kept_sealed;
+          }
+          if(id != ids[k]) changed = true;
+        }
+      }
+      if(!changed) continue;
+
+      // the order of the ids is kept, and the postings of the sealed
+      // segment are sealed again
+      IFRow compacted;
+      compacted.reserve(kept_sealed > 0 ? kept_sealed : kept);
+      bool sealing = (kept_sealed > 0);
+      for(typename IFRow::Reader r(ifrow); r.next(); )
+      {
+        if(sealing && !r.sealed())
+        {
+          compacted.seal();
+          compacted.reserve(kept);
+          sealing = false;
+        }
+
+        const EntryId *ids = r.ids();
+        for(unsigned int k = 0; k < r.size(); ++k)
+        {
+          const EntryId id = new_ids[ids[k]];
+          if(id != REMOVED_ENTRY) compacted.push_back(id, r.weights()[k]);
+        }
+      }
+      if(sealing) compacted.seal();
+      ifrow.swap(compacted);
+    }
+  };
+
+  if(pool) pool->parallelFor(m_ifile.size(), f, 256);
+  else f(0, m_ifile.size());
+
+  // update direct file. Entries only move to lower ids, whose slots have
+  // been emptied already
+  if(m_use_di)
+  {
+    m_features.clear();
+
+    for(EntryId e = 0; e < N; ++e)
+    {
+      if(new_ids[e] == REMOVED_ENTRY)
+        FlatFeatureVector().swap(m_dfile[e]);
+      else if(new_ids[e] != e)
+        m_dfile[new_ids[e]].swap(m_dfile[e]);
+    }
+  }
+
+  if(renumber)
+  {
+    if(m_dfile.size() > next_id) m_dfile.resize(next_id);
+    m_removed.resize(0);
+    m_removed.resize(next_id);
+    m_nremoved = 0;
+    m_nentries = next_id;
+
+    // the ids of the journals written before are no longer valid
+    ++m_generation;
+  }
+
+  return new_ids;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::seal(ThreadPool *pool)
+{
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+  {
+    for(size_t w = begin; w < end; ++w) m_ifile[w].seal();
+  };
+
+  if(pool) pool->parallelFor(m_ifile.size(), f, 256);
+  else f(0, m_ifile.size());
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+size_t TemplatedDatabase<TDescriptor, F, TWeight>::invertedFileMemory() const
+{
+  size_t bytes = 0;
+  for(size_t w = 0; w < m_ifile.size(); ++w) bytes += m_ifile[w].memory();
+  return bytes;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class T>
+inline void TemplatedDatabase<TDescriptor, F, TWeight>::setVocabulary
+  (const T& voc)
+{
+  checkScoring(voc.getScoringType());
+  m_voc.reset(new T(voc));
+  clear();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class T>
+inline void TemplatedDatabase<TDescriptor, F, TWeight>::setVocabulary
+  (const T& voc, bool use_di, int di_levels)
+{
+  checkScoring(voc.getScoringType());
+  m_use_di = use_di;
+  m_dilevels = di_levels;
+  m_voc.reset(new T(voc));
+  clear();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class T>
+inline void TemplatedDatabase<TDescriptor, F, TWeight>::setVocabulary
+  (const std::shared_ptr<T> &voc)
+{
+  if(voc) checkScoring(voc->getScoringType());
+  m_voc = voc;
+  clear();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class T>
+void TemplatedDatabase<TDescriptor, F, TWeight>::setVocabulary
+  (const std::shared_ptr<T> &voc, bool use_di, int di_levels)
+{
+  if(voc) checkScoring(voc->getScoringType());
+  m_use_di = use_di;
+  m_dilevels = di_levels;
+  m_voc = voc;
+  clear();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline const TemplatedVocabulary<TDescriptor,F>* 
+TemplatedDatabase<TDescriptor, F, TWeight>::getVocabulary() const
+{
+  return m_voc.get();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline std::shared_ptr<const TemplatedVocabulary<TDescriptor,F> > 
+TemplatedDatabase<TDescriptor, F, TWeight>::getSharedVocabulary() const
+{
+  return m_voc;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::swapContents(
+  TemplatedDatabase<TDescriptor, F, TWeight> &db)
+{
+  m_voc.swap(db.m_voc);
+  std::swap(m_use_di, db.m_use_di);
+  std::swap(m_dilevels, db.m_dilevels);
+  m_ifile.swap(db.m_ifile);
+  m_dfile.swap(db.m_dfile);
+  m_removed.swap(db.m_removed);
+  std::swap(m_generation, db.m_generation);
+
+  m_nentries.store(db.m_nentries.exchange(m_nentries.load()));
+  m_nremoved.store(db.m_nremoved.exchange(m_nremoved.load()));
+
+  m_features.clear();
+  db.m_features.clear();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline void TemplatedDatabase<TDescriptor, F, TWeight>::clear()
+{
+  // the entries of the journal are no longer valid
+  closeJournal();
+
+  // resize vectors
+  m_ifile.resize(0);
+  m_ifile.resize(m_voc->size());
+  m_dfile.resize(0);
+  m_features.clear();
+  m_removed.resize(0);
+  m_nremoved = 0;
+  m_nentries = 0;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::allocate(int nd, int ni)
+{
+  // m_ifile already contains |words| items
+  if(ni > 0)
+  {
+    typename std::vector<IFRow>::iterator rit;
+    for(rit = m_ifile.begin(); rit != m_ifile.end(); ++rit)
+    {
+      if(ni > (int)rit->size())
+      {
+        rit->reserve(ni);
+      }
+    }
+  }
+  
+  if(m_use_di && (int)m_dfile.size() < nd)
+  {
+    m_dfile.resize(nd);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline unsigned int TemplatedDatabase<TDescriptor, F, TWeight>::size() const
+{
+  return m_nentries.load(std::memory_order_acquire);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline bool TemplatedDatabase<TDescriptor, F, TWeight>::usingDirectIndex() const
+{
+  return m_use_di;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline int TemplatedDatabase<TDescriptor, F, TWeight>::getDirectIndexLevels()
+  const
+{
+  return m_dilevels;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::query(
+  const std::vector<TDescriptor> &features,
+  QueryResults &ret, int max_results, int max_id, QueryStats *stats) const
+{
+  FlatBowVector vec;
+  m_voc->transform(features, vec, NULL, stats);
+  query(vec, ret, max_results, max_id, stats);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::query(
+  const DescriptorMatrix &features,
+  QueryResults &ret, int max_results, int max_id, QueryStats *stats) const
+{
+  FlatBowVector vec;
+  m_voc->transform(features, vec, NULL, stats);
+  query(vec, ret, max_results, max_id, stats);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::query(
+  const BowVector &vec, 
+  QueryResults &ret, int max_results, int max_id, QueryStats *stats) const
+{
+  query(FlatBowVector(vec), ret, max_results, max_id, stats);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::query(
+  const FlatBowVector &vec, 
+  QueryResults &ret, int max_results, int max_id, QueryStats *stats) const
+{
+  ret.resize(0);
+  StatsScope scope(m_counters, stats);
+  
+  switch(m_voc->getScoringType())
+  {
+    case L1_NORM:
+      query(vec, ret, max_results, max_id, L1Scoring(), scope.stats());
+      break;
+      
+    case L2_NORM:
+      query(vec, ret, max_results, max_id, L2Scoring(), scope.stats());
+      break;
+      
+    case CHI_SQUARE:
+      query(vec, ret, max_results, max_id, ChiSquareScoring(), 
+        scope.stats());
+      break;
+      
+    case KL:
+      query(vec, ret, max_results, max_id, KLScoring(), scope.stats());
+      break;
+      
+    case BHATTACHARYYA:
+      query(vec, ret, max_results, max_id, BhattacharyyaScoring(), 
+        scope.stats());
+      break;
+      
+    case DOT_PRODUCT:
+      query(vec, ret, max_results, max_id, 
+        DotProductScoring(m_voc->getWeightingType() == BINARY), 
+        scope.stats());
+      break;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::query(
+  const std::vector<TDescriptor> &features, QueryResults &ret, 
+  const QueryOptions &options, int max_results, int max_id, 
+  QueryStats *stats) const
+{
+  FlatBowVector vec;
+  m_voc->transform(features, vec, NULL, stats);
+  query(vec, ret, options, max_results, max_id, stats);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::query(
+  const DescriptorMatrix &features, QueryResults &ret, 
+  const QueryOptions &options, int max_results, int max_id, 
+  QueryStats *stats) const
+{
+  FlatBowVector vec;
+  m_voc->transform(features, vec, NULL, stats);
+  query(vec, ret, options, max_results, max_id, stats);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::query(
+  const BowVector &vec, QueryResults &ret, 
+  const QueryOptions &options, int max_results, int max_id, 
+  QueryStats *stats) const
+{
+  query(FlatBowVector(vec), ret, options, max_results, max_id, stats);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::query(
+  const FlatBowVector &vec, QueryResults &ret, 
+  const QueryOptions &options, int max_results, int max_id, 
+  QueryStats *stats) const
+{
+  ret.resize(0);
+  StatsScope scope(m_counters, stats);
+  
+  switch(m_voc->getScoringType())
+  {
+    case L1_NORM:
+      query(vec, ret, options, max_results, max_id, L1Scoring(), 
+        scope.stats());
+      break;
+      
+    case L2_NORM:
+      query(vec, ret, options, max_results, max_id, L2Scoring(), 
+        scope.stats());
+      break;
+      
+    case CHI_SQUARE:
+      query(vec, ret, options, max_results, max_id, ChiSquareScoring(), 
+        scope.stats());
+      break;
+      
+    case KL:
+      query(vec, ret, options, max_results, max_id, KLScoring(), 
+        scope.stats());
+      break;
+      
+    case BHATTACHARYYA:
+      query(vec, ret, options, max_results, max_id, BhattacharyyaScoring(), 
+        scope.stats());
+      break;
+      
+    case DOT_PRODUCT:
+      query(vec, ret, options, max_results, max_id, 
+        DotProductScoring(m_voc->getWeightingType() == BINARY), 
+        scope.stats());
+      break;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::queryBatch(
+  const std::vector<std::vector<TDescriptor> > &features,
+  std::vector<QueryResults> &ret, int max_results, int max_id,
+  ThreadPool *pool, QueryStats *stats) const
+{
+  std::vector<FlatBowVector> vecs(features.size());
+
+  // each transform counts its work apart
+  std::vector<QueryStats> tstats;
+  DBOW2_STATS( if(stats) tstats.resize(features.size()); )
+
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+  {
+    for(size_t i = begin; i < end; ++i)
+    {
+      m_voc->transform(features[i], vecs[i], NULL, 
+        tstats.empty() ? NULL : &tstats[i]);
+    }
+  };
+
+  if(pool) pool->parallelFor(features.size(), f, 1);
+  else f(0, features.size());
+
+  for(size_t i = 0; i < tstats.size(); ++i) *stats += tstats[i];
+
+  queryBatch(vecs, ret, max_results, max_id, pool, stats);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::queryBatch(
+  const std::vector<FlatBowVector> &vecs, 
+  std::vector<QueryResults> &ret, int max_results, int max_id,
+  ThreadPool *pool, QueryStats *stats) const
+{
+  ret.resize(vecs.size());
+  for(size_t i = 0; i < ret.size(); ++i) ret[i].resize(0);
+
+  StatsScope scope(m_counters, stats);
+
+  switch(m_voc->getScoringType())
+  {
+    case L1_NORM:
+      queryBatch(vecs, ret, max_results, max_id, L1Scoring(), pool, 
+        scope.stats());
+      break;
+      
+    case L2_NORM:
+      queryBatch(vecs, ret, max_results, max_id, L2Scoring(), pool, 
+        scope.stats());
+      break;
+      
+    case CHI_SQUARE:
+      queryBatch(vecs, ret, max_results, max_id, ChiSquareScoring(), pool, 
+        scope.stats());
+      break;
+      
+    case KL:
+      queryBatch(vecs, ret, max_results, max_id, KLScoring(), pool, 
+        scope.stats());
+      break;
+      
+    case BHATTACHARYYA:
+      queryBatch(vecs, ret, max_results, max_id, BhattacharyyaScoring(), 
+        pool, scope.stats());
+      break;
+      
+    case DOT_PRODUCT:
+      queryBatch(vecs, ret, max_results, max_id, 
+        DotProductScoring(m_voc->getWeightingType() == BINARY), pool, 
+        scope.stats());
+      break;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline QueryStats TemplatedDatabase<TDescriptor, F, TWeight>::getStats() 
+  const
+{
+  return m_counters.get();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline void TemplatedDatabase<TDescriptor, F, TWeight>::resetStats() const
+{
+  m_counters.reset();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TScoring>
+void TemplatedDatabase<TDescriptor, F, TWeight>::query(
+  const FlatBowVector &vec, QueryResults &ret, int max_results, int max_id, 
+  const TScoring &scoring, QueryStats *stats) const
+{
+  (void)stats; // unused if stats are not enabled
+  DBOW2_STATS( StatsTimer timer; )
+
+  const EntryId end_id = queryEnd(max_id);
+
+  LocalScoreAccumulator acc(end_id, TScoring::SUMS);
+  const size_t postings = accumulate(vec, end_id, *acc, scoring);
+  (void)postings;
+  skipRemoved(*acc);
+
+  DBOW2_STATS(
+    if(stats)
+    {
+      stats->queries += 1;
+      stats->lists += vec.size();
+      stats->postings += postings;
+      stats->candidates += acc->size();
+      stats->scoring_time += timer.lap();
+    }
+  )
+
+  scoring.results(vec, *acc, ret, max_results);
+
+  DBOW2_STATS(
+    if(stats)
+    {
+      stats->results += ret.size();
+      stats->sorting_time += timer.lap();
+    }
+  )
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TScoring>
+void TemplatedDatabase<TDescriptor, F, TWeight>::query(
+  const FlatBowVector &vec, QueryResults &ret, const QueryOptions &options,
+  int max_results, int max_id, const TScoring &scoring, 
+  QueryStats *stats) const
+{
+  // margin for the rounding errors of the bounds
+  const double SLACK = 1e-9;
+
+  (void)stats; // unused if stats are not enabled
+  DBOW2_STATS( StatsTimer timer; )
+
+  const EntryId end_id = queryEnd(max_id);
+  const bool prune = options.early_termination && TScoring::BOUNDED && 
+    max_results > 0;
+
+  // entries that can be returned
+  std::vector<QueryFilter::Range> ranges;
+  options.filter.clip(end_id, ranges);
+  const std::vector<bool> *mask = options.filter.mask();
+
+  /// Word of the query to visit
+  struct QueryWord
+  {
+    WordId id;
+    WordValue value;
+    /// Most the word can add to the gain of an entry
+    double bound;
+    /// Postings of its row
+    size_t postings;
+
+    inline bool operator<(const QueryWord &w) const { return bound > w.bound; }
+  };
+
+  std::vector<QueryWord> words;
+  words.reserve(vec.size());
+  for(size_t i = 0; i < vec.size(); ++i)
+  {
+    const IFRow& row = m_ifile[vec.id(i)];
+
+    QueryWord w;
+    w.id = vec.id(i);
+    w.value = vec.value(i);
+    w.bound = scoring.bound(w.value, Weight::decode(row.maxWeight()));
+    w.postings = 0;
+    if(options.max_df < 1 || prune)
+    {
+      for(typename IFRow::Reader r(row); r.next(); )
+        w.postings += r.size();
+    }
+
+    if(options.max_df < 1 && w.postings > options.max_df * end_id) continue;
+    words.push_back(w);
+  }
+
+  if(options.sort_words || prune) std::stable_sort(words.begin(), words.end());
+
+  // most the words from i on can add to the gain of an entry
+  std::vector<double> remaining(words.size() + 1, 0);
+  for(size_t i = words.size(); i > 0; --i)
+    remaining[i-1] = remaining[i] + words[i-1].bound;
+
+  LocalScoreAccumulator acc(end_id, TScoring::SUMS);
+
+  // gain of the max_results-th best entry so far. Updating it costs as
+  // much as visiting acc->size() postings, so it is only done when a few
+  // times as many postings have been visited since the last time
+  double theta = -std::numeric_limits<double>::infinity();
+  std::vector<double> gains;
+  size_t visited = 0;
+
+  // once the entries not visited yet cannot get into the best results, 
+  // only the scores of the candidates (the entries kept in acc) are 
+  // completed. Rows much longer than the candidates are searched for them,
+  // so the candidates are kept in ascending order
+  bool completing = false;
+  std::vector<EntryId> candidates;
+
+  /// Word score that only completes the candidates
+  struct CandidateScoring
+  {
+    const TScoring &scoring;
+
+    inline void operator()(ScoreAccumulator &acc, EntryId entry_id,
+      WordValue qvalue, WordValue dvalue) const
+    {
+      if(acc.count(entry_id) > 0) scoring(acc, entry_id, qvalue, dvalue);
+    }
+  };
+  const CandidateScoring complete = { scoring };
+
+  for(size_t i = 0; i < words.size(); ++i)
+  {
+    const IFRow& row = m_ifile[words[i].id];
+    const size_t postings = words[i].postings;
+
+    if(!completing)
+    {
+      // no entry can have a gain above the bounds of the words visited
+      if(prune && visited + postings >= 4 * acc->size() &&
+        remaining[i] + SLACK < remaining[0] - remaining[i])
+      {
+        theta = threshold(*acc, max_results, scoring, gains);
+        completing = (remaining[i] + SLACK < theta);
+        visited = 0;
+      }
+
+      if(!completing)
+      {
+        const size_t n = accumulate(row, words[i].value, ranges, mask, *acc,
+          scoring);
+        visited += n;
+        DBOW2_STATS( if(stats) stats->postings += n; )
+        continue;
+      }
+    }
+
+    if(candidates.empty() || visited >= 2 * acc->size())
+    {
+      // drop the entries that cannot be among the best any longer
+      if(visited > 0)
+        theta = threshold(*acc, max_results, scoring, gains);
+      visited = 0;
+
+      acc->erase([&](EntryId id)
+      {
+        return scoring.gain(*acc, id) + remaining[i] + SLACK < theta;
+      });
+
+      size_t n = 0;
+      if(candidates.empty())
+      {
+        // the entries kept, sorted in O(c log c) instead of looking for
+        // them among all the ids
+        n = acc->size();
+        candidates.resize(n);
+        for(size_t k = 0; k < n; ++k) candidates[k] = acc->entry(k);
+        std::sort(candidates.begin(), candidates.end());
+      }
+      else
+      {
+        for(size_t k = 0; k < candidates.size(); ++k)
+          if(acc->count(candidates[k]) > 0) candidates[n++] = candidates[k];
+      }
+      candidates.resize(n);
+    }
+
+    // a search costs a few comparisons per candidate
+    if(postings > 16 * candidates.size())
+    {
+      accumulate(row, words[i].value, candidates, *acc, scoring);
+      visited += candidates.size();
+      DBOW2_STATS( if(stats) stats->postings += candidates.size(); )
+    }
+    else
+    {
+      const size_t n = accumulate(row, words[i].value, ranges, mask, *acc,
+        complete);
+      visited += n;
+      DBOW2_STATS( if(stats) stats->postings += n; )
+    }
+  }
+
+  skipRemoved(*acc);
+
+  DBOW2_STATS(
+    if(stats)
+    {
+      stats->queries += 1;
+      stats->lists += words.size();
+      stats->candidates += acc->size();
+      stats->scoring_time += timer.lap();
+    }
+  )
+
+  scoring.results(vec, *acc, ret, max_results);
+
+  DBOW2_STATS(
+    if(stats)
+    {
+      stats->results += ret.size();
+      stats->sorting_time += timer.lap();
+    }
+  )
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TScoring>
+double TemplatedDatabase<TDescriptor, F, TWeight>::threshold(
+  const ScoreAccumulator &acc, int k, const TScoring &scoring, 
+  std::vector<double> &gains) const
+{
+  const bool removed = (m_nremoved.load(std::memory_order_relaxed) > 0);
+
+  gains.clear();
+  for(size_t i = 0; i < acc.size(); ++i)
+  {
+    const EntryId id = acc.entry(i);
+    if(scoring.valid(acc, id) && 
+      !(removed && m_removed[id].removed.load(std::memory_order_relaxed)))
+      gains.push_back(scoring.gain(acc, id));
+  }
+
+  if(gains.size() < (size_t)k) return -std::numeric_limits<double>::infinity();
+
+  std::nth_element(gains.begin(), gains.begin() + (k - 1), gains.end(),
+    std::greater<double>());
+  return gains[k - 1];
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TScoring>
+void TemplatedDatabase<TDescriptor, F, TWeight>::queryBatch(
+  const std::vector<FlatBowVector> &vecs, std::vector<QueryResults> &ret, 
+  int max_results, int max_id, const TScoring &scoring, 
+  ThreadPool *pool, QueryStats *stats) const
+{
+  // all the queries see the same entries
+  const EntryId end_id = queryEnd(max_id);
+
+  // the queries that share words are accumulated together, and the others
+  // as single queries
+  std::vector<unsigned int> groups;
+  std::vector<size_t> offsets;
+  groupQueries(vecs, groups, offsets);
+
+  // order of the final scores, to select the best ones of the tiles
+  const bool ascending = (m_voc->getScoringType() == KL);
+
+  (void)stats; // unused if stats are not enabled
+  DBOW2_STATS( std::mutex mutex; )
+
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+  {
+    // each task counts its work apart
+    DBOW2_STATS(
+      QueryStats local;
+      StatsTimer timer;
+    )
+
+    // results() gets all the entries touched before selecting the best
+    // ones, so its buffer is reused by the queries of the task, and only
+    // the best ones are copied
+    QueryResults results;
+    GroupRows rows;
+    std::vector<double> best[BlockScoreAccumulator::QUERIES];
+
+    for(size_t g = begin; g < end; ++g)
+    {
+      const unsigned int *group = &groups[offsets[g]];
+      const size_t n = offsets[g + 1] - offsets[g];
+
+      // a single query only goes through tiles if the entries of each tile
+      // can be pruned with the best ones of the previous tiles
+      if(n == 1 && !(TScoring::BOUNDED && max_results > 0))
+      {
+        const FlatBowVector &vec = vecs[group[0]];
+
+        LocalScoreAccumulator acc(end_id, TScoring::SUMS);
+        const size_t postings = accumulate(vec, end_id, *acc, scoring);
+        (void)postings;
+        skipRemoved(*acc);
+
+        DBOW2_STATS(
+          local.queries += 1;
+          local.lists += vec.size();
+          local.postings += postings;
+          local.candidates += acc->size();
+          local.scoring_time += timer.lap();
+        )
+
+        results.clear();
+        scoring.results(vec, *acc, results, max_results);
+        ret[group[0]] = results;
+
+        DBOW2_STATS(
+          local.results += ret[group[0]].size();
+          local.sorting_time += timer.lap();
+        )
+        continue;
+      }
+
+      // the tiles of entries are visited in order, and the best results of 
+      // each tile are kept
+      groupRows(vecs, group, n, rows);
+      for(size_t i = 0; i < n; ++i)
+      {
+        ret[group[i]].clear();
+        best[i].clear();
+      }
+
+      const EntryId tile = BlockScoreAccumulator::ENTRIES;
+      LocalBlockScoreAccumulator acc(0, std::min(end_id, tile), 
+        TScoring::SUMS);
+
+      for(EntryId first = 0; first < end_id; )
+      {
+        const EntryId last = 
+          (end_id - first > tile ? first + tile : end_id);
+        acc->reset(first, last - first, TScoring::SUMS);
+
+        const size_t postings = accumulate(rows, last, *acc, scoring);
+        (void)postings;
+
+        DBOW2_STATS(
+          local.postings += postings;
+          local.scoring_time += timer.lap();
+        )
+
+        for(size_t i = 0; i < n; ++i)
+        {
+          BlockScoreAccumulator::Column column = acc->column(i);
+          skipRemoved(column);
+          DBOW2_STATS( local.candidates += column.size(); )
+
+          if(TScoring::BOUNDED && max_results > 0)
+            keepBest(column, max_results, scoring, best[i]);
+
+          results.clear();
+          scoring.results(vecs[group[i]], column, results, max_results);
+          ret[group[i]].insert(ret[group[i]].end(), results.begin(), 
+            results.end());
+        }
+
+        DBOW2_STATS( local.sorting_time += timer.lap(); )
+        first = last;
+      }
+
+      for(size_t i = 0; i < n; ++i)
+      {
+        ret[group[i]].selectBest(max_results, ascending);
+        DBOW2_STATS(
+          local.queries += 1;
+          local.lists += vecs[group[i]].size();
+          local.results += ret[group[i]].size();
+        )
+      }
+
+      DBOW2_STATS( local.sorting_time += timer.lap(); )
+    }
+
+    DBOW2_STATS(
+      if(stats)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        *stats += local;
+      }
+    )
+  };
+
+  if(pool) pool->parallelFor(offsets.size() - 1, f, 1);
+  else f(0, offsets.size() - 1);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TScoring>
+void TemplatedDatabase<TDescriptor, F, TWeight>::keepBest(
+  BlockScoreAccumulator::Column &acc, size_t k, const TScoring &scoring,
+  std::vector<double> &best) const
+{
+  // the entries of the tile with the same gain as the k-th best one lose
+  // the tie, but they are kept since the gains are rounded
+  if(best.size() == k)
+  {
+    const double theta = best.front();
+    acc.erase([&](EntryId id)
+    {
+      return scoring.gain(acc, id) < theta;
+    });
+  }
+
+  for(size_t i = 0; i < acc.size(); ++i)
+  {
+    const EntryId id = acc.entry(i);
+    if(!scoring.valid(acc, id)) continue;
+
+    const double gain = scoring.gain(acc, id);
+    if(best.size() < k)
+    {
+      best.push_back(gain);
+      std::push_heap(best.begin(), best.end(), std::greater<double>());
+    }
+    else if(gain > best.front())
+    {
+      std::pop_heap(best.begin(), best.end(), std::greater<double>());
+      best.back() = gain;
+      std::push_heap(best.begin(), best.end(), std::greater<double>());
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::groupQueries(
+  const std::vector<FlatBowVector> &vecs, std::vector<unsigned int> &groups,
+  std::vector<size_t> &offsets)
+{
+  // a vector joins a group if it has at least this fraction of the words
+  // of its first vector. Otherwise, the rows of the words it does not 
+  // share would slow down the traversal of the tiles of the group
+  const size_t SHARED = 4; // 1/4
+
+  // words of each vector whose sharing is counted, evenly spaced, and
+  // queries of each of those words looked at, out of twice as many pairs
+  // at most, so that the grouping costs O(vectors) even if many vectors 
+  // share the same words
+  const size_t SAMPLE = 64;
+  const size_t SCAN = 64;
+
+  const unsigned int N = vecs.size();
+  const size_t B = BlockScoreAccumulator::QUERIES;
+
+  groups.clear();
+  offsets.clear();
+
+  // vectors of each word w, in ascending order, in 
+  // queries[word_begin[w]..word_end[w]), sorted by counting
+  WordId max_word = 0;
+  for(unsigned int q = 0; q < N; ++q)
+  {
+    for(size_t i = 0; i < vecs[q].size(); ++i)
+      max_word = std::max(max_word, vecs[q].id(i));
+  }
+
+  std::vector<size_t> word_begin((size_t)max_word + 2, 0);
+  for(unsigned int q = 0; q < N; ++q)
+  {
+    for(size_t i = 0; i < vecs[q].size(); ++i) ++word_begin[vecs[q].id(i) + 1];
+  }
+  for(size_t w = 0; w + 1 < word_begin.size(); ++w)
+    word_begin[w + 1] += word_begin[w];
+
+  std::vector<size_t> word_end(word_begin.begin(), word_begin.end() - 1);
+  std::vector<unsigned int> queries(word_begin.back());
+  for(unsigned int q = 0; q < N; ++q)
+  {
+    for(size_t i = 0; i < vecs[q].size(); ++i) 
+      queries[word_end[vecs[q].id(i)]++] = q;
+  }
+
+  std::vector<bool> grouped(N, false);
+  std::vector<unsigned int> shared(N, 0);
+  std::vector<unsigned int> candidates;
+
+  for(unsigned int s = 0; s < N; ++s)
+  {
+    if(grouped[s]) continue;
+    grouped[s] = true;
+    offsets.push_back(groups.size());
+    groups.push_back(s);
+
+    // words shared with the vectors not grouped yet. The vectors up to s 
+    // are grouped, so they are dropped from the front of the lists, and
+    // only a window of each list is looked at
+    const size_t nwords = vecs[s].size();
+    const size_t step = (nwords + SAMPLE - 1) / SAMPLE;
+    size_t sampled = 0;
+
+    candidates.clear();
+    for(size_t k = 0; k < nwords; k += step, ++sampled)
+    {
+      const WordId w = vecs[s].id(k);
+      while(word_begin[w] < word_end[w] && grouped[queries[word_begin[w]]])
+        ++word_begin[w];
+
+      const size_t end = std::min(word_end[w], word_begin[w] + 2 * SCAN);
+      size_t scanned = 0;
+      for(size_t j = word_begin[w]; j < end && scanned < SCAN; ++j)
+      {
+        const unsigned int q = queries[j];
+        if(grouped[q]) continue;
+
+        if(shared[q]++ == 0) candidates.push_back(q);
+        ++scanned;
+      }
+    }
+
+    // the vectors that share most words join the group
+    const size_t min_shared = (sampled + SHARED - 1) / SHARED;
+
+    size_t n = 0;
+    for(size_t i = 0; i < candidates.size(); ++i)
+    {
+      if(shared[candidates[i]] >= min_shared)
+        candidates[n++] = candidates[i];
+      else
+        shared[candidates[i]] = 0;
+    }
+    candidates.resize(n);
+
+    const size_t m = std::min(candidates.size(), B - 1);
+    std::partial_sort(candidates.begin(), candidates.begin() + m, 
+      candidates.end(), [&](unsigned int a, unsigned int b)
+      {
+        return shared[a] > shared[b] || (shared[a] == shared[b] && a < b);
+      });
+
+    for(size_t i = 0; i < candidates.size(); ++i)
+    {
+      if(i < m)
+      {
+        grouped[candidates[i]] = true;
+        groups.push_back(candidates[i]);
+      }
+      shared[candidates[i]] = 0;
+    }
+  }
+
+  offsets.push_back(groups.size());
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline EntryId TemplatedDatabase<TDescriptor, F, TWeight>::queryEnd(int max_id)
+  const
+{
+  // entries are complete once they are counted
+  EntryId end_id = m_nentries.load(std::memory_order_acquire);
+  if(max_id != -1)
+    end_id = (max_id <= 0 ? 0 : std::min(end_id, (EntryId)max_id));
+  return end_id;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline void TemplatedDatabase<TDescriptor, F, TWeight>::checkScoring
+  (ScoringType scoring)
+{
+  if(std::is_same<TWeight, FixedWordValue>::value && scoring == DOT_PRODUCT)
+    throw std::string("Fixed-point weights cannot be used with the "
+      "DOT_PRODUCT scoring, whose vectors are not normalized");
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TAccumulator>
+inline void TemplatedDatabase<TDescriptor, F, TWeight>::skipRemoved
+  (TAccumulator &acc) const
+{
+  // the entries touched are complete, so their marks exist
+  if(m_nremoved.load(std::memory_order_relaxed) == 0) return;
+
+  acc.erase([this](EntryId id)
+  {
+    return m_removed[id].removed.load(std::memory_order_relaxed);
+  });
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TWordScore>
+size_t TemplatedDatabase<TDescriptor, F, TWeight>::accumulate(
+  const FlatBowVector &vec, EntryId end_id, ScoreAccumulator &acc, 
+  const TWordScore &word_score) const
+{
+  size_t visited = 0;
+  for(size_t i = 0; i < vec.size(); ++i)
+  {
+    visited += accumulate(m_ifile[vec.id(i)], vec.value(i), end_id, acc, 
+      word_score);
+  }
+  return visited;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TWordScore>
+size_t TemplatedDatabase<TDescriptor, F, TWeight>::accumulate(
+  const PostingList<TWeight> &row, WordValue qvalue, EntryId end_id, 
+  ScoreAccumulator &acc, const TWordScore &word_score) const
+{
+  size_t visited = 0;
+
+  // IFRows are sorted in ascending entry_id order, so the entries to 
+  // skip are at the end of the row
+  for(typename IFRow::Reader r(row); r.next(); )
+  {
+    // postings appended from now on are not seen
+    const unsigned int size = r.size();
+    if(size == 0) continue;
+
+    const EntryId *ids = r.ids();
+    const TWeight *weights = r.weights();
+    const EntryId *last = ids + size;
+
+    bool stop = false;
+    if(last[-1] >= end_id)
+    {
+      last = std::lower_bound(ids, last, end_id);
+      stop = true;
+    }
+
+    for(const EntryId *it = ids; it != last; ++it)
+      word_score(acc, *it, qvalue, Weight::decode(weights[it - ids]));
+    visited += last - ids;
+
+    if(stop) break;
+  }
+
+  return visited;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TWordScore>
+size_t TemplatedDatabase<TDescriptor, F, TWeight>::accumulate(
+  const PostingList<TWeight> &row, WordValue qvalue, 
+  const std::vector<QueryFilter::Range> &ranges, 
+  const std::vector<bool> *mask, ScoreAccumulator &acc, 
+  const TWordScore &word_score) const
+{
+  size_t visited = 0;
+
+  // both the row and the ranges are in ascending order, so each block is
+  // searched from the current range on
+  size_t k = 0;
+  for(typename IFRow::Reader r(row); k < ranges.size() && r.next(); )
+  {
+    // postings appended from now on are not seen
+    const unsigned int size = r.size();
+    if(size == 0) continue;
+
+    // the blocks between the ranges are not decoded
+    while(k < ranges.size() && ranges[k].second <= r.first()) ++k;
+    if(k == ranges.size()) break;
+    if(r.last() < ranges[k].first) continue;
+
+    const EntryId *ids = r.ids();
+    const TWeight *weights = r.weights();
+    const EntryId *last = ids + size;
+    const EntryId *it = ids;
+
+    for(;;)
+    {
+      it = std::lower_bound(it, last, ranges[k].first);
+      const EntryId *stop = std::lower_bound(it, last, ranges[k].second);
+      visited += stop - it;
+
+      for(; it != stop; ++it)
+      {
+        if(mask && !(*mask)[*it]) continue;
+        word_score(acc, *it, qvalue, Weight::decode(weights[it - ids]));
+      }
+
+      // the range may go on in the next block
+      if(stop == last || ++k == ranges.size()) break;
+    }
+  }
+
+  return visited;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TWordScore>
+void TemplatedDatabase<TDescriptor, F, TWeight>::accumulate(
+  const PostingList<TWeight> &row, WordValue qvalue, 
+  const std::vector<EntryId> &entries, ScoreAccumulator &acc, 
+  const TWordScore &word_score) const
+{
+  // both the row and the entries are in ascending order, so each chunk is
+  // searched from the last posting found
+  // the blocks before the next entry are not decoded
+  size_t e = 0;
+  for(typename IFRow::Reader r(row); e < entries.size() && r.next(); )
+  {
+    const unsigned int size = r.size();
+    if(size == 0 || entries[e] > r.last()) continue;
+
+    const EntryId *ids = r.ids();
+    const EntryId *last = ids + size;
+    const EntryId *it = ids;
+
+    for(; e < entries.size() && entries[e] <= last[-1]; ++e)
+    {
+      it = std::lower_bound(it, last, entries[e]);
+      if(*it == entries[e])
+      {
+        word_score(acc, entries[e], qvalue, 
+          Weight::decode(r.weights()[it - ids]));
+      }
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::groupRows(
+  const std::vector<FlatBowVector> &vecs, const unsigned int *group, 
+  size_t n, GroupRows &rows) const
+{
+  // (word, query word) pairs, sorted by word. The stable sort keeps the 
+  // vectors of each word in order
+  std::vector<std::pair<WordId, typename GroupRows::QueryWord> > pairs;
+  for(size_t q = 0; q < n; ++q)
+  {
+    const FlatBowVector &vec = vecs[group[q]];
+    for(size_t i = 0; i < vec.size(); ++i)
+    {
+      typename GroupRows::QueryWord w;
+      w.query = q;
+      w.value = vec.value(i);
+      pairs.push_back(std::make_pair(vec.id(i), w));
+    }
+  }
+  std::stable_sort(pairs.begin(), pairs.end(), 
+    [](const std::pair<WordId, typename GroupRows::QueryWord> &a,
+       const std::pair<WordId, typename GroupRows::QueryWord> &b)
+    {
+      return a.first < b.first;
+    });
+
+  rows.words.clear();
+  rows.offsets.clear();
+  rows.readers.clear();
+  rows.next.clear();
+
+  size_t nrows = 0;
+  for(size_t i = 0; i < pairs.size(); ++i)
+    if(i == 0 || pairs[i].first != pairs[i-1].first) ++nrows;
+
+  // the readers are not moved once created
+  rows.readers.reserve(nrows);
+
+  for(size_t i = 0; i < pairs.size(); ++i)
+  {
+    if(i == 0 || pairs[i].first != pairs[i-1].first)
+    {
+      rows.offsets.push_back(i);
+      rows.readers.emplace_back(m_ifile[pairs[i].first]);
+    }
+    rows.words.push_back(pairs[i].second);
+  }
+  rows.offsets.push_back(rows.words.size());
+  rows.next.resize(nrows, 0);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TWordScore>
+size_t TemplatedDatabase<TDescriptor, F, TWeight>::accumulate(
+  GroupRows &rows, EntryId end_id, BlockScoreAccumulator &acc, 
+  const TWordScore &word_score) const
+{
+  // postings visited, once per query
+  size_t visited = 0;
+
+  BlockScoreAccumulator::Column columns[BlockScoreAccumulator::QUERIES];
+  for(unsigned int q = 0; q < BlockScoreAccumulator::QUERIES; ++q) 
+    columns[q] = acc.column(q);
+
+  // each column gets its values in the same order as with a single query,
+  // since the rows are visited in order of word
+  for(size_t row = 0; row < rows.readers.size(); ++row)
+  {
+    typename IFRow::Reader &r = rows.readers[row];
+    const typename GroupRows::QueryWord *wbegin = &rows.words[0] + 
+      rows.offsets[row];
+    const typename GroupRows::QueryWord *wend = &rows.words[0] +
+      rows.offsets[row + 1];
+
+    // IFRows are sorted in ascending entry_id order, so the row goes on 
+    // until an entry >= end_id
+    unsigned int i = rows.next[row];
+    for(;;)
+    {
+      if(i == r.size())
+      {
+        // postings appended from now on are not seen
+        if(!r.next()) break;
+        i = 0;
+        continue;
+      }
+
+      const EntryId *ids = r.ids();
+      const TWeight *weights = r.weights();
+      const unsigned int size = r.size();
+
+      const unsigned int first = i;
+      unsigned int last = size;
+      if(ids[size - 1] >= end_id)
+        last = std::lower_bound(ids + i, ids + size, end_id) - ids;
+
+      for(; i < last; ++i)
+      {
+        const WordValue dvalue = Weight::decode(weights[i]);
+        for(const typename GroupRows::QueryWord *w = wbegin; w != wend; ++w)
+          word_score(columns[w->query], ids[i], w->value, dvalue);
+      }
+      visited += (last - first) * (wend - wbegin);
+
+      if(last < size) break;
+    }
+    rows.next[row] = i;
+  }
+
+  return visited;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TAccumulator>
+void TemplatedDatabase<TDescriptor, F, TWeight>::L1Scoring::results(
+  const FlatBowVector &, TAccumulator &acc, QueryResults &ret, 
+  int max_results) const
+{
+  // move to vector
+  ret.reserve(acc.size());
+  for(size_t i = 0; i < acc.size(); ++i)
+  {
+    const EntryId entry_id = acc.entry(i);
+    ret.push_back(Result(entry_id, acc.score(entry_id)));
+    ret.back().nWords = (int)acc.count(entry_id);
+  }
+	
+  // resulting "scores" are now in [-2 best .. 0 worst]	
+  
+  // sort vector in ascending order of score and cut it
+  ret.selectBest(max_results, true);
+  // (ret is inverted now --the lower the better--)
+  
+  // complete and scale score to [0 worst .. 1 best]
+  // ||v - w||_{L1} = 2 + Sum(|v_i - w_i| - |v_i| - |w_i|) 
+  //		for all i | v_i != 0 and w_i != 0 
+  // (Nister, 2006)
+  // scaled_||v - w||_{L1} = 1 - 0.5 * ||v - w||_{L1}
+  QueryResults::iterator qit;
+  for(qit = ret.begin(); qit != ret.end(); qit++) 
+    qit->Score = -qit->Score/2.0;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TAccumulator>
+void TemplatedDatabase<TDescriptor, F, TWeight>::L2Scoring::results(
+  const FlatBowVector &, TAccumulator &acc, QueryResults &ret, 
+  int max_results) const
+{
+  // move to vector
+  ret.reserve(acc.size());
+  for(size_t i = 0; i < acc.size(); ++i)
+  {
+    const EntryId entry_id = acc.entry(i);
+    ret.push_back(Result(entry_id, acc.score(entry_id)));
+    ret.back().nWords = (int)acc.count(entry_id);
+  }
+	
+  // resulting "scores" are now in [-1 best .. 0 worst]	
+  
+  // sort vector in ascending order of score and cut it
+  ret.selectBest(max_results, true);
+  // (ret is inverted now --the lower the better--)
+
+  // complete and scale score to [0 worst .. 1 best]
+  // ||v - w||_{L2} = sqrt( 2 - 2 * Sum(v_i * w_i) 
+	//		for all i | v_i != 0 and w_i != 0 )
+	// (Nister, 2006)
+	QueryResults::iterator qit;
+  for(qit = ret.begin(); qit != ret.end(); qit++) 
+  {
+    if(qit->Score <= -1.0) // rounding error
+      qit->Score = 1.0;
+    else
+      qit->Score = 1.0 - sqrt(1.0 + qit->Score); // [0..1]
+      // the + sign is ok, it is due to - sign in 
+      // value = - qvalue * dvalue
+  }
+  
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TAccumulator>
+void TemplatedDatabase<TDescriptor, F, TWeight>::ChiSquareScoring::results(
+  const FlatBowVector &, TAccumulator &acc, QueryResults &ret, 
+  int max_results) const
+{
+  // In the current implementation, we suppose vec is not normalized
+
+  // move to vector
+  ret.reserve(acc.size());
+  for(size_t i = 0; i < acc.size(); ++i)
+  {
+    const EntryId entry_id = acc.entry(i);
+    const int nwords = (int)acc.count(entry_id);
+
+    if(nwords >= MIN_COMMON_WORDS)
+    {
+      ret.push_back(Result(entry_id, acc.score(entry_id)));
+      ret.back().nWords = nwords;
+      ret.back().sumCommonVi = acc.sumA(entry_id);
+      ret.back().sumCommonWi = acc.sumB(entry_id);
+      ret.back().expectedChiScore = 
+        2 * acc.sumB(entry_id) / (1 + acc.sumB(entry_id));
+    }
+  }
+	
+  // resulting "scores" are now in [-2 best .. 0 worst]	
+  // we have to add +2 to the scores to obtain the chi square score
+  
+  // sort vector in ascending order of score and cut it
+  ret.selectBest(max_results, true);
+  // (ret is inverted now --the lower the better--)
+
+  // complete and scale score to [0 worst .. 1 best]
+  QueryResults::iterator qit;
+  for(qit = ret.begin(); qit != ret.end(); qit++)
+  {
+    // this takes the 4 into account
+    qit->Score = - 2. * qit->Score; // [0..1]
+    
+    qit->chiScore = qit->Score;
+  }
+  
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TAccumulator>
+void TemplatedDatabase<TDescriptor, F, TWeight>::KLScoring::results(
+  const FlatBowVector &vec, TAccumulator &acc, QueryResults &ret, 
+  int max_results) const
+{
+  // resulting "scores" are now in [-X worst .. 0 best .. X worst]
+  // but we cannot make sure which ones are better without calculating
+  // the complete score
+
+  // score if no word was in common
+  double missing = 0.0;
+  for(size_t i = 0; i < vec.size(); ++i)
+  {
+    const WordValue &vi = vec.value(i);
+    if(vi != 0) missing += vi * (log(vi) - GeneralScoring::LOG_EPS);
+  }
+
+  // complete scores and move to vector
+  ret.reserve(acc.size());
+  for(size_t i = 0; i < acc.size(); ++i)
+  {
+    const EntryId entry_id = acc.entry(i);
+    ret.push_back(Result(entry_id, 
+      acc.score(entry_id) + (missing - acc.sumA(entry_id))));
+    ret.back().nWords = (int)acc.count(entry_id);
+  }
+  
+  // real scores are now in [0 best .. X worst]
+
+  // sort vector in ascending order and cut it
+  // (scores are inverted now --the lower the better--)
+  ret.selectBest(max_results, true);
+
+  // cannot scale scores
+    
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TAccumulator>
+void TemplatedDatabase<TDescriptor, F, TWeight>::BhattacharyyaScoring::results(
+  const FlatBowVector &, TAccumulator &acc, QueryResults &ret, 
+  int max_results) const
+{
+  // move to vector
+  ret.reserve(acc.size());
+  for(size_t i = 0; i < acc.size(); ++i)
+  {
+    const EntryId entry_id = acc.entry(i);
+    const int nwords = (int)acc.count(entry_id);
+
+    if(nwords >= MIN_COMMON_WORDS)
+    {
+      ret.push_back(Result(entry_id, acc.score(entry_id)));
+      ret.back().nWords = nwords;
+      ret.back().bhatScore = acc.score(entry_id);
+    }
+  }
+	
+  // scores are already in [0..1]
+
+  // sort vector in descending order and cut it
+  ret.selectBest(max_results, false);
+
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class TAccumulator>
+void TemplatedDatabase<TDescriptor, F, TWeight>::DotProductScoring::results(
+  const FlatBowVector &, TAccumulator &acc, QueryResults &ret, 
+  int max_results) const
+{
+  // move to vector
+  ret.reserve(acc.size());
+  for(size_t i = 0; i < acc.size(); ++i)
+  {
+    const EntryId entry_id = acc.entry(i);
+    ret.push_back(Result(entry_id, acc.score(entry_id)));
+    ret.back().nWords = (int)acc.count(entry_id);
+  }
+	
+  // scores are the greater the better
+
+  // sort vector in descending order and cut it
+  ret.selectBest(max_results, false);
+
+  // these scores cannot be scaled
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+const FeatureVector& 
+TemplatedDatabase<TDescriptor, F, TWeight>::retrieveFeatures(EntryId id) const
+{
+  assert(id < size());
+
+  std::lock_guard<std::mutex> lock(m_features_mutex);
+
+  // the nodes of the map do not move when others are inserted
+  typename std::map<EntryId, FeatureVector>::iterator it = 
+    m_features.lower_bound(id);
+  if(it == m_features.end() || it->first != id)
+  {
+    it = m_features.insert(it, std::make_pair(id, FeatureVector()));
+    m_dfile[id].toFeatureVector(it->second);
+  }
+  return it->second;
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline const FlatFeatureVector& 
+TemplatedDatabase<TDescriptor, F, TWeight>::retrieveFlatFeatures(EntryId id)
+  const
+{
+  assert(id < size());
+  return m_dfile[id];
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::matchFeatures(
+  const FlatFeatureVector &fv, const std::vector<TDescriptor> &features, 
+  EntryId id, const std::vector<TDescriptor> &entry_features, 
+  std::vector<FeatureMatch> &matches, const MatchOptions &options) const
+{
+  if(!m_use_di)
+    throw std::string("Features cannot be matched without direct index");
+
+  assert(id < size());
+  const FlatFeatureVector &efv = m_dfile[id];
+
+  const bool packed = DescriptorTraits<F>::packed;
+  const size_t bytes = DescriptorTraits<F>::bytes;
+
+  // entry features of a node, packed contiguously, and their distances 
+  // to a query feature
+  std::vector<uint64_t> blocks;
+  std::vector<double> distances;
+  uint64_t buffer[(DescriptorTraits<F>::bytes + sizeof(uint64_t) - 1) / 
+    sizeof(uint64_t) + 1];
+
+  matches.resize(0);
+
+  // both vectors are sorted by node id
+  size_t i = 0, j = 0;
+  while(i < fv.size() && j < efv.size())
+  {
+    if(fv.nodeId(i) < efv.nodeId(j))
+    {
+      ++i;
+      continue;
+    }
+    else if(fv.nodeId(i) > efv.nodeId(j))
+    {
+      ++j;
+      continue;
+    }
+
+    const unsigned int *qf = fv.features(i);
+    const size_t nq = fv.nfeatures(i);
+    const unsigned int *ef = efv.features(j);
+    const size_t ne = efv.nfeatures(j);
+    ++i;
+    ++j;
+
+    if(nq == 0 || ne == 0) continue;
+
+    for(size_t k = 0; k < nq; ++k)
+    {
+      if(qf[k] >= features.size())
+        throw std::string("Query feature out of the descriptors given");
+    }
+    for(size_t k = 0; k < ne; ++k)
+    {
+      if(ef[k] >= entry_features.size())
+        throw std::string("Entry feature out of the descriptors given");
+    }
+
+    unsigned char *b = NULL;
+    if(packed)
+    {
+      blocks.resize((ne * bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+      b = reinterpret_cast<unsigned char*>(&blocks[0]);
+      for(size_t k = 0; k < ne; ++k)
+        DescriptorTraits<F>::pack(entry_features[ef[k]], b + k * bytes);
+    }
+    distances.resize(ne);
+
+    for(size_t k = 0; k < nq; ++k)
+    {
+      const TDescriptor &q = features[qf[k]];
+
+      if(packed)
+      {
+        DescriptorTraits<F>::distances(DescriptorTraits<F>::view(q, 
+          reinterpret_cast<unsigned char*>(buffer)), b, ne, &distances[0]);
+      }
+      else
+      {
+        for(size_t l = 0; l < ne; ++l)
+          distances[l] = F::distance(q, entry_features[ef[l]]);
+      }
+
+      // closest and second closest entry features
+      size_t best = 0;
+      double second = std::numeric_limits<double>::max();
+      for(size_t l = 1; l < ne; ++l)
+      {
+        if(distances[l] < distances[best])
+        {
+          second = distances[best];
+          best = l;
+        }
+        else if(distances[l] < second)
+        {
+          second = distances[l];
+        }
+      }
+
+      const double d = distances[best];
+      if(d <= options.max_distance && 
+        (options.ratio >= 1 || d < options.ratio * second))
+      {
+        matches.push_back(FeatureMatch(qf[k], ef[best], d));
+      }
+    }
+  }
+
+  if(options.unique)
+  {
+    // keep the closest query feature of each entry feature, or the first
+    // one if there are ties
+    std::sort(matches.begin(), matches.end(), 
+      [](const FeatureMatch &a, const FeatureMatch &b)
+      {
+        if(a.entry != b.entry) return a.entry < b.entry;
+        if(a.distance != b.distance) return a.distance < b.distance;
+        return a.query < b.query;
+      });
+
+    size_t n = 0;
+    for(size_t k = 0; k < matches.size(); ++k)
+    {
+      if(n == 0 || matches[k].entry != matches[n-1].entry)
+        matches[n++] = matches[k];
+    }
+    matches.resize(n);
+  }
+
+  std::sort(matches.begin(), matches.end(), 
+    [](const FeatureMatch &a, const FeatureMatch &b)
+    {
+      return a.query < b.query;
+    });
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::matchFeatures(
+  const FeatureVector &fv, const std::vector<TDescriptor> &features, 
+  EntryId id, const std::vector<TDescriptor> &entry_features, 
+  std::vector<FeatureMatch> &matches, const MatchOptions &options) const
+{
+  matchFeatures(FlatFeatureVector(fv), features, id, entry_features, 
+    matches, options);
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::matchFeatures(
+  const FlatFeatureVector &fv, const std::vector<TDescriptor> &features, 
+  const std::vector<EntryId> &ids,
+  const std::vector<const std::vector<TDescriptor>*> &entry_features, 
+  std::vector<std::vector<FeatureMatch> > &matches, 
+  const MatchOptions &options, ThreadPool *pool) const
+{
+  if(entry_features.size() != ids.size())
+    throw std::string("The descriptors of each entry are needed");
+
+  matches.resize(ids.size());
+
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+  {
+    for(size_t i = begin; i < end; ++i)
+    {
+      matchFeatures(fv, features, ids[i], *entry_features[i], matches[i], 
+        options);
+    }
+  };
+
+  if(pool) pool->parallelFor(ids.size(), f, 1);
+  else f(0, ids.size());
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::save(
+  const std::string &filename) const
+{
+  if(isBinaryFile(filename))
+  {
+    saveBinary(filename);
+    return;
+  }
+
+  cv::FileStorage fs(filename.c_str(), cv::FileStorage::WRITE);
+  if(!fs.isOpened()) throw std::string("Could not open file ") + filename;
+  
+  save(fs);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::save(cv::FileStorage &fs,
+  const std::string &name) const
+{
+  // Format YAML:
+  // vocabulary { ... see TemplatedVocabulary::save }
+  // database 
+  // {
+  //   nEntries: 
+  //   generation: 
+  //   usingDI: 
+  //   diLevels: 
+  //   invertedIndex
+  //   [
+  //     [
+  //        { 
+  //          imageId: 
+  //          weight: 
+  //        }
+  //     ]
+  //   ]
+  //   directIndex
+  //   [
+  //      [
+  //        {
+  //          nodeId:
+  //          features: [ ]
+  //        }
+  //      ]
+  //   ]
+  //   removedEntries: [ ]
+  // }
+
+  // invertedIndex[i] is for the i-th word
+  // directIndex[i] is for the i-th entry
+  // directIndex may be empty if not using direct index
+  // removedEntries may be missing if there are none, and generation if
+  // the entries were never renumbered
+  //
+  // imageId's and nodeId's must be stored in ascending order
+  // (according to the construction of the indexes)
+
+  m_voc->save(fs);
+ 
+  fs << name << "{";
+  
+  fs << "nEntries" << (int)m_nentries;
+  fs << "generation" << (int)m_generation;
+  fs << "usingDI" << (m_use_di ? 1 : 0);
+  fs << "diLevels" << m_dilevels;
+  
+  fs << "invertedIndex" << "[";
+  
+  typename InvertedFile::const_iterator iit;
+  for(iit = m_ifile.begin(); iit != m_ifile.end(); ++iit)
+  {
+    fs << "["; // word of IF
+    for(typename IFRow::Reader r(*iit); r.next(); )
+    {
+      const EntryId *ids = r.ids();
+      for(unsigned int k = 0; k < r.size(); ++k)
+      {
+        fs << "{:" 
+          << "imageId" << (int)ids[k]
+          << "weight" << Weight::decode(r.weights()[k])
+          << "}";
+      }
+    }
+    fs << "]"; // word of IF
+  }
+  
+  fs << "]"; // invertedIndex
+  
+  fs << "directIndex" << "[";
+  
+  for(size_t eid = 0; eid < m_dfile.size(); ++eid)
+  {
+    const FlatFeatureVector &fv = m_dfile[eid];
+
+    fs << "["; // entry of DF
+    
+    for(size_t i = 0; i < fv.size(); ++i)
+    {
+      NodeId nid = fv.nodeId(i);
+      const std::vector<int> features(fv.features(i), 
+        fv.features(i) + fv.nfeatures(i));
+      
+      // save info of last_nid
+      fs << "{";
+      fs << "nodeId" << (int)nid;
+      // msvc++ 2010 with opencv 2.3.1 does not allow FileStorage::operator<<
+      // with vectors of unsigned int
+      fs << "features" << "[" << features << "]";
+      fs << "}";
+    }
+    
+    fs << "]"; // entry of DF
+  }
+  
+  fs << "]"; // directIndex
+
+  fs << "removedEntries" << "[:";
+  for(EntryId eid = 0; eid < (EntryId)m_nentries; ++eid)
   {
-    const WordId& word_id = vit->first;
-    const WordValue& word_weight = vit->second;
-    
-    IFRow& ifrow = m_ifile[word_id];
-    ifrow.push_back(IFPair(entry_id, word_weight));
+    if(m_removed[eid].removed) fs << (int)eid;
   }
+  fs << "]"; // removedEntries
   
-  return entry_id;
+  fs << "}"; // database
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-template<class T>
-inline void TemplatedDatabase<TDescriptor, F>::setVocabulary
-  (const T& voc)
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::load(
+  const std::string &filename)
 {
-  delete m_voc;
-  m_voc = new T(voc);
-  clear();
+  if(isBinaryFile(filename))
+  {
+    loadBinary(filename);
+    return;
+  }
+
+  cv::FileStorage fs(filename.c_str(), cv::FileStorage::READ);
+  if(!fs.isOpened()) throw std::string("Could not open file ") + filename;
+  
+  load(fs);
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-template<class T>
-inline void TemplatedDatabase<TDescriptor, F>::setVocabulary
-  (const T& voc, bool use_di, int di_levels)
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::load(const cv::FileStorage &fs,
+  const std::string &name)
 {
-  m_use_di = use_di;
-  m_dilevels = di_levels;
-  delete m_voc;
-  m_voc = new T(voc);
-  clear();
-}
+  // load voc first, into a new one, since m_voc may be shared
+  std::shared_ptr<TemplatedVocabulary<TDescriptor, F> > voc(
+    new TemplatedVocabulary<TDescriptor, F>);
 
-// --------------------------------------------------------------------------
+  voc->load(fs);
+  checkScoring(voc->getScoringType());
 
-template<class TDescriptor, class F>
-inline const TemplatedVocabulary<TDescriptor,F>* 
-TemplatedDatabase<TDescriptor, F>::getVocabulary() const
-{
-  return m_voc;
-}
+  // load database now, aside, so that this one is not modified if
+  // something throws
+  cv::FileNode fdb = fs[name];
 
-// --------------------------------------------------------------------------
+  TemplatedDatabase<TDescriptor, F, TWeight> db(voc,
+    (int)fdb["usingDI"] != 0, (int)fdb["diLevels"]);
 
-template<class TDescriptor, class F>
-inline void TemplatedDatabase<TDescriptor, F>::clear()
-{
-  // resize vectors
-  m_ifile.resize(0);
-  m_ifile.resize(m_voc->size());
-  m_dfile.resize(0);
-  m_nentries = 0;
-}
+  db.m_nentries = (int)fdb["nEntries"];
+  db.m_generation = (int)fdb["generation"];
 
-// --------------------------------------------------------------------------
+  cv::FileNode fn = fdb["invertedIndex"];
+  WordId wid = 0;
+  for (cv::FileNodeIterator fit = fn.begin(); fit != fn.end(); ++fit, ++wid)
+  {
+    cv::FileNode fw = *fit;
+    for (cv::FileNodeIterator fwit = fw.begin(); fwit != fw.end(); ++fwit)
+    {
+      EntryId eid = (int)(*fwit)["imageId"];
+      WordValue v = (*fwit)["weight"];
+      db.m_ifile[wid].push_back(eid, Weight::encode(v));
+    }
+  }
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::allocate(int nd, int ni)
-{
-  // m_ifile already contains |words| items
-  if(ni > 0)
+  if (db.m_use_di)
   {
-    typename std::vector<IFRow>::iterator rit;
-    for(rit = m_ifile.begin(); rit != m_ifile.end(); ++rit)
+    fn = fdb["directIndex"];
+    db.m_dfile.resize(fn.size());
+    assert(db.m_nentries == (int)fn.size());
+
+    EntryId eid = 0;
+    FeatureVector fv;
+    for (cv::FileNodeIterator fit = fn.begin(); fit != fn.end(); ++fit, ++eid)
     {
-      int n = (int)rit->size();
-      if(ni > n)
+      cv::FileNode fe = *fit;
+      fv.clear();
+      for (cv::FileNodeIterator feit = fe.begin(); feit != fe.end(); ++feit)
       {
-        rit->resize(ni);
-        rit->resize(n);
+        NodeId nid = (int)(*feit)["nodeId"];
+        FeatureVector::iterator dit = fv.insert(fv.end(),
+          make_pair(nid, std::vector<unsigned int>()));
+
+        cv::FileNode ff = (*feit)["features"][0];
+        dit->second.reserve(ff.size());
+        for (cv::FileNodeIterator ffit = ff.begin(); ffit != ff.end(); ++ffit)
+        {
+          dit->second.push_back((int)*ffit);
+        }
       }
+      // the nodes are sorted by the map
+      db.m_dfile[eid].fromFeatureVector(fv);
     }
   }
-  
-  if(m_use_di && (int)m_dfile.size() < nd)
+
+  db.m_removed.resize(db.m_nentries);
+
+  fn = fdb["removedEntries"];
+  for (cv::FileNodeIterator fit = fn.begin(); fit != fn.end(); ++fit)
   {
-    m_dfile.resize(nd);
+    EntryId eid = (int)*fit;
+    if(eid < (EntryId)db.m_nentries && !db.m_removed[eid].removed)
+    {
+      db.m_removed[eid].removed = true;
+      db.m_nremoved++;
+    }
   }
+
+  // the entries of the journal are no longer valid
+  closeJournal();
+  swapContents(db);
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-inline unsigned int TemplatedDatabase<TDescriptor, F>::size() const
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::saveBinary
+  (const std::string &filename) const
 {
-  return m_nentries;
-}
+  // Format:
+  // header (BinaryHeader)
+  // sections (BinarySection) in order, each starting at a multiple of 64
+  //   bytes. The direct index sections are empty if it is not used
+  //
+  // The inverted index is stored by columns: the entry ids of all the rows
+  // first, and then their weights
+  //
 
-// --------------------------------------------------------------------------
+  const uint32_t NWords = m_ifile.size();
+  const uint32_t NEntries = m_nentries;
 
-template<class TDescriptor, class F>
-inline bool TemplatedDatabase<TDescriptor, F>::usingDirectIndex() const
-{
-  return m_use_di;
-}
+  BinaryHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "DBoW2DB", 7);
+  h.version = BINARY_VERSION;
+  h.byte_order = 0x01020304;
+  h.nentries = NEntries;
+  h.use_di = (m_use_di ? 1 : 0);
+  h.di_levels = m_dilevels;
+  h.nwords = NWords;
+  h.weight_bytes = sizeof(TWeight);
+  h.nremoved = m_nremoved;
+  h.generation = m_generation;
 
-// --------------------------------------------------------------------------
+  for(uint32_t i = 0; i < NWords; ++i) h.npostings += m_ifile[i].size();
 
-template<class TDescriptor, class F>
-inline int TemplatedDatabase<TDescriptor, F>::getDirectIndexLevels() const
-{
-  return m_dilevels;
-}
+  if(m_use_di)
+  {
+    for(uint32_t i = 0; i < NEntries; ++i)
+    {
+      h.di_nnodes += m_dfile[i].size();
+      h.di_nfeatures += m_dfile[i].totalFeatures();
+    }
+  }
 
-// --------------------------------------------------------------------------
+  std::vector<unsigned char> vocabulary;
+  m_voc->saveBinary(vocabulary);
+  h.vocabulary_size = vocabulary.size();
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::query(
-  const std::vector<TDescriptor> &features,
-  QueryResults &ret, int max_results, int max_id) const
-{
-  BowVector vec;
-  m_voc->transform(features, vec);
-  query(vec, ret, max_results, max_id);
-}
+  // bytes of each section
+  uint64_t sizes[NUM_SECTIONS];
+  sizes[SECTION_HEADER] = sizeof(h);
+  sizes[SECTION_VOCABULARY] = vocabulary.size();
+  sizes[SECTION_ROWS] = (NWords + 1) * sizeof(uint64_t);
+  sizes[SECTION_IDS] = h.npostings * sizeof(EntryId);
+  sizes[SECTION_WEIGHTS] = h.npostings * sizeof(TWeight);
+  sizes[SECTION_DI_ENTRIES] = (m_use_di ? 
+    (NEntries + 1) * sizeof(uint64_t) : 0);
+  sizes[SECTION_DI_NODES] = h.di_nnodes * sizeof(NodeId);
+  sizes[SECTION_DI_FEATURE_OFFSETS] = (m_use_di ?
+    (h.di_nnodes + 1) * sizeof(uint64_t) : 0);
+  sizes[SECTION_DI_FEATURES] = h.di_nfeatures * sizeof(unsigned int);
+  sizes[SECTION_REMOVED] = h.nremoved * sizeof(EntryId);
 
-// --------------------------------------------------------------------------
+  h.offsets[0] = 0;
+  for(int i = 1; i < NUM_SECTIONS; ++i)
+    h.offsets[i] = (h.offsets[i-1] + sizes[i-1] + 63) / 64 * 64;
+  h.file_size = h.offsets[NUM_SECTIONS - 1] + sizes[NUM_SECTIONS - 1];
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::query(
-  const BowVector &vec, 
-  QueryResults &ret, int max_results, int max_id) const
-{
-  ret.resize(0);
-  
-  switch(m_voc->getScoringType())
-  {
-    case L1_NORM:
-      queryL1(vec, ret, max_results, max_id);
-      break;
-      
-    case L2_NORM:
-      queryL2(vec, ret, max_results, max_id);
-      break;
-      
-    case CHI_SQUARE:
-      queryChiSquare(vec, ret, max_results, max_id);
-      break;
-      
-    case KL:
-      queryKL(vec, ret, max_results, max_id);
-      break;
-      
-    case BHATTACHARYYA:
-      queryBhattacharyya(vec, ret, max_results, max_id);
-      break;
-      
-    case DOT_PRODUCT:
-      queryDotProduct(vec, ret, max_results, max_id);
-      break;
-  }
-}
+  std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+  if(!f.is_open()) throw std::string("Could not open file ") + filename;
 
-// --------------------------------------------------------------------------
+  // the checksum is chained over the sections, which are built and 
+  // written one at a time
+  uint64_t sum = 0;
+  std::vector<unsigned char> buffer;
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::queryL1(const BowVector &vec, 
-  QueryResults &ret, int max_results, int max_id) const
-{
-  BowVector::const_iterator vit;
-  typename IFRow::const_iterator rit;
-    
-  std::map<EntryId, double> pairs;
-  std::map<EntryId, double>::iterator pit;
-  
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
+  for(int i = 0; i < NUM_SECTIONS; ++i)
   {
-    const WordId word_id = vit->first;
-    const WordValue& qvalue = vit->second;
-        
-    const IFRow& row = m_ifile[word_id];
-    
-    // IFRows are sorted in ascending entry_id order
-    
-    for(rit = row.begin(); rit != row.end(); ++rit)
+    buffer.clear();
+
+    switch(i)
     {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
-      
-      if((int)entry_id < max_id || max_id == -1)
+      case SECTION_HEADER:
+        appendArray(buffer, reinterpret_cast<const unsigned char*>(&h),
+          sizeof(h));
+        break;
+
+      case SECTION_VOCABULARY:
+        buffer.swap(vocabulary);
+        break;
+
+      case SECTION_ROWS:
       {
-        double value = fabs(qvalue - dvalue) - fabs(qvalue) - fabs(dvalue);
-        
-        pit = pairs.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
+        uint64_t first = 0;
+        for(uint32_t w = 0; w < NWords; ++w)
         {
-          pit->second += value;
+          appendArray(buffer, &first, 1);
+          first += m_ifile[w].size();
         }
-        else
+        appendArray(buffer, &first, 1);
+        break;
+      }
+
+      case SECTION_IDS:
+      case SECTION_WEIGHTS:
+      {
+        buffer.reserve(sizes[i]);
+        for(uint32_t w = 0; w < NWords; ++w)
         {
-          pairs.insert(pit, 
-            std::map<EntryId, double>::value_type(entry_id, value));
+          for(typename IFRow::Reader r(m_ifile[w]); r.next(); )
+          {
+            if(i == SECTION_IDS) appendArray(buffer, r.ids(), r.size());
+            else appendArray(buffer, r.weights(), r.size());
+          }
         }
+        break;
       }
-      
-    } // for each inverted row
-  } // for each query word
-	
-  // move to vector
-  ret.reserve(pairs.size());
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)
-  {
-    ret.push_back(Result(pit->first, pit->second));
-  }
-	
-  // resulting "scores" are now in [-2 best .. 0 worst]	
-  
-  // sort vector in ascending order of score
-  std::sort(ret.begin(), ret.end());
-  // (ret is inverted now --the lower the better--)
-
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
-  
-  // complete and scale score to [0 worst .. 1 best]
-  // ||v - w||_{L1} = 2 + Sum(|v_i - w_i| - |v_i| - |w_i|) 
-  //		for all i | v_i != 0 and w_i != 0 
-  // (Nister, 2006)
-  // scaled_||v - w||_{L1} = 1 - 0.5 * ||v - w||_{L1}
-  QueryResults::iterator qit;
-  for(qit = ret.begin(); qit != ret.end(); qit++) 
-    qit->Score = -qit->Score/2.0;
-}
 
-// --------------------------------------------------------------------------
+      case SECTION_DI_ENTRIES:
+        if(m_use_di)
+        {
+          uint64_t first = 0;
+          for(uint32_t e = 0; e < NEntries; ++e)
+          {
+            appendArray(buffer, &first, 1);
+            first += m_dfile[e].size();
+          }
+          appendArray(buffer, &first, 1);
+        }
+        break;
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::queryL2(const BowVector &vec, 
-  QueryResults &ret, int max_results, int max_id) const
-{
-  BowVector::const_iterator vit;
-  typename IFRow::const_iterator rit;
-  
-  std::map<EntryId, double> pairs;
-  std::map<EntryId, double>::iterator pit;
-  
-  //map<EntryId, int> counters;
-  //map<EntryId, int>::iterator cit;
-  
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
-  {
-    const WordId word_id = vit->first;
-    const WordValue& qvalue = vit->second;
-    
-    const IFRow& row = m_ifile[word_id];
-    
-    // IFRows are sorted in ascending entry_id order
-    
-    for(rit = row.begin(); rit != row.end(); ++rit)
-    {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
-      
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        double value = - qvalue * dvalue; // minus sign for sorting trick
-        
-        pit = pairs.lower_bound(entry_id);
-        //cit = counters.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
+      case SECTION_DI_NODES:
+      case SECTION_DI_FEATURE_OFFSETS:
+      case SECTION_DI_FEATURES:
+        if(m_use_di)
         {
-          pit->second += value; 
-          //cit->second += 1;
+          buffer.reserve(sizes[i]);
+          uint64_t first = 0;
+          for(uint32_t e = 0; e < NEntries; ++e)
+          {
+            const FlatFeatureVector &fv = m_dfile[e];
+            for(size_t n = 0; n < fv.size(); ++n)
+            {
+              if(i == SECTION_DI_NODES)
+              {
+                const NodeId nid = fv.nodeId(n);
+                appendArray(buffer, &nid, 1);
+              }
+              else if(i == SECTION_DI_FEATURE_OFFSETS)
+              {
+                appendArray(buffer, &first, 1);
+                first += fv.nfeatures(n);
+              }
+              else
+              {
+                appendArray(buffer, fv.features(n), fv.nfeatures(n));
+              }
+            }
+          }
+          if(i == SECTION_DI_FEATURE_OFFSETS) appendArray(buffer, &first, 1);
         }
-        else
+        break;
+
+      case SECTION_REMOVED:
+        for(EntryId e = 0; e < NEntries; ++e)
         {
-          pairs.insert(pit, 
-            std::map<EntryId, double>::value_type(entry_id, value));
-          
-          //counters.insert(cit, 
-          //  map<EntryId, int>::value_type(entry_id, 1));
+          if(m_removed[e].removed) appendArray(buffer, &e, 1);
         }
-      }
-      
-    } // for each inverted row
-  } // for each query word
-	
-  // move to vector
-  ret.reserve(pairs.size());
-  //cit = counters.begin();
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)//, ++cit)
-  {
-    ret.push_back(Result(pit->first, pit->second));// / cit->second));
-  }
-	
-  // resulting "scores" are now in [-1 best .. 0 worst]	
-  
-  // sort vector in ascending order of score
-  std::sort(ret.begin(), ret.end());
-  // (ret is inverted now --the lower the better--)
+        break;
+    }
 
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
+    if(i + 1 < NUM_SECTIONS) buffer.resize(h.offsets[i+1] - h.offsets[i], 0);
 
-  // complete and scale score to [0 worst .. 1 best]
-  // ||v - w||_{L2} = sqrt( 2 - 2 * Sum(v_i * w_i) 
-	//		for all i | v_i != 0 and w_i != 0 )
-	// (Nister, 2006)
-	QueryResults::iterator qit;
-  for(qit = ret.begin(); qit != ret.end(); qit++) 
-  {
-    if(qit->Score <= -1.0) // rounding error
-      qit->Score = 1.0;
-    else
-      qit->Score = 1.0 - sqrt(1.0 + qit->Score); // [0..1]
-      // the + sign is ok, it is due to - sign in 
-      // value = - qvalue * dvalue
+    sum = checksum(buffer.data(), buffer.size(), sum);
+    f.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
   }
-  
+
+  // the header is written again with the checksum
+  h.checksum = sum;
+  f.seekp(0);
+  f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  f.close();
+  if(f.fail()) throw std::string("Could not write file ") + filename;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::queryChiSquare(const BowVector &vec, 
-  QueryResults &ret, int max_results, int max_id) const
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::loadBinary
+  (const std::string &filename)
 {
-  BowVector::const_iterator vit;
-  typename IFRow::const_iterator rit;
-  
-  std::map<EntryId, std::pair<double, int> > pairs;
-  std::map<EntryId, std::pair<double, int> >::iterator pit;
-  
-  std::map<EntryId, std::pair<double, double> > sums; // < sum vi, sum wi >
-  std::map<EntryId, std::pair<double, double> >::iterator sit;
-  
-  // In the current implementation, we suppose vec is not normalized
-  
-  //map<EntryId, double> expected;
-  //map<EntryId, double>::iterator eit;
-  
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
-  {
-    const WordId word_id = vit->first;
-    const WordValue& qvalue = vit->second;
-    
-    const IFRow& row = m_ifile[word_id];
-    
-    // IFRows are sorted in ascending entry_id order
-    
-    for(rit = row.begin(); rit != row.end(); ++rit)
-    {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
-      
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        // (v-w)^2/(v+w) - v - w = -4 vw/(v+w)
-        // we move the 4 out
-        double value = 0;
-        if(qvalue + dvalue != 0.0) // words may have weight zero
-          value = - qvalue * dvalue / (qvalue + dvalue);
-        
-        pit = pairs.lower_bound(entry_id);
-        sit = sums.lower_bound(entry_id);
-        //eit = expected.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second.first += value;
-          pit->second.second += 1;
-          //eit->second += dvalue;
-          sit->second.first += qvalue;
-          sit->second.second += dvalue;
-        }
-        else
-        {
-          pairs.insert(pit, 
-            std::map<EntryId, std::pair<double, int> >::value_type(entry_id,
-              std::make_pair(value, 1) ));
-          //expected.insert(eit, 
-          //  map<EntryId, double>::value_type(entry_id, dvalue));
-          
-          sums.insert(sit, 
-            std::map<EntryId, std::pair<double, double> >::value_type(entry_id,
-              std::make_pair(qvalue, dvalue) ));
-        }
-      }
-      
-    } // for each inverted row
-  } // for each query word
-	
-  // move to vector
-  ret.reserve(pairs.size());
-  sit = sums.begin();
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit, ++sit)
+  std::shared_ptr<const MappedFile> file(new MappedFile(filename));
+  const unsigned char *data = file->data();
+
+  // check the header
+  BinaryHeader h;
+  if(file->size() < sizeof(h) || memcmp(data, "DBoW2DB", 8) != 0)
+    throw std::string("File ") + filename + " is not a binary database";
+
+  memcpy(&h, data, sizeof(h));
+
+  // the weights may have been stored as another type
+  if(h.version != BINARY_VERSION || h.byte_order != 0x01020304 ||
+    (h.weight_bytes != sizeof(double) && h.weight_bytes != sizeof(float) &&
+    h.weight_bytes != sizeof(FixedWordValue)))
+    throw std::string("Unsupported version or byte order of binary "
+      "database ") + filename;
+
+  if(h.file_size != file->size())
+    throw std::string("Truncated binary database ") + filename;
+
+  // sections must be in order, aligned, and large enough
+  uint64_t sizes[NUM_SECTIONS];
+  sizes[SECTION_HEADER] = sizeof(h);
+  sizes[SECTION_VOCABULARY] = h.vocabulary_size;
+  sizes[SECTION_ROWS] = ((uint64_t)h.nwords + 1) * sizeof(uint64_t);
+  sizes[SECTION_IDS] = h.npostings * sizeof(EntryId);
+  sizes[SECTION_WEIGHTS] = h.npostings * h.weight_bytes;
+  sizes[SECTION_DI_ENTRIES] = (h.use_di ? 
+    ((uint64_t)h.nentries + 1) * sizeof(uint64_t) : 0);
+  sizes[SECTION_DI_NODES] = h.di_nnodes * sizeof(NodeId);
+  sizes[SECTION_DI_FEATURE_OFFSETS] = (h.use_di ?
+    (h.di_nnodes + 1) * sizeof(uint64_t) : 0);
+  sizes[SECTION_DI_FEATURES] = h.di_nfeatures * sizeof(unsigned int);
+  sizes[SECTION_REMOVED] = (uint64_t)h.nremoved * sizeof(EntryId);
+
+  const uint64_t S = h.file_size;
+  if(h.offsets[0] != 0 || h.offsets[1] < sizeof(h) || h.npostings > S ||
+    h.di_nnodes > S || h.di_nfeatures > S || h.vocabulary_size > S ||
+    h.nremoved > h.nentries)
+    throw std::string("Wrong sections in binary database ") + filename;
+
+  for(int i = 0; i < NUM_SECTIONS; ++i)
   {
-    if(pit->second.second >= MIN_COMMON_WORDS)
-    {
-      ret.push_back(Result(pit->first, pit->second.first));
-      ret.back().nWords = pit->second.second;
-      ret.back().sumCommonVi = sit->second.first;
-      ret.back().sumCommonWi = sit->second.second;
-      ret.back().expectedChiScore = 
-        2 * sit->second.second / (1 + sit->second.second);
-    }
-  
-    //ret.push_back(Result(pit->first, pit->second));
+    const uint64_t end = (i + 1 < NUM_SECTIONS ? h.offsets[i+1] : S);
+    if(h.offsets[i] % 64 != 0 || h.offsets[i] > end || end > S ||
+      sizes[i] > end - h.offsets[i])
+      throw std::string("Wrong sections in binary database ") + filename;
   }
-	
-  // resulting "scores" are now in [-2 best .. 0 worst]	
-  // we have to add +2 to the scores to obtain the chi square score
-  
-  // sort vector in ascending order of score
-  std::sort(ret.begin(), ret.end());
-  // (ret is inverted now --the lower the better--)
 
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
+  // the first section is the header with the checksum set to 0 and its
+  // padding
+  const uint64_t file_checksum = h.checksum;
+  h.checksum = 0;
 
-  // complete and scale score to [0 worst .. 1 best]
-  QueryResults::iterator qit;
-  for(qit = ret.begin(); qit != ret.end(); qit++)
+  std::vector<unsigned char> first(data, data + h.offsets[1]);
+  memcpy(&first[0], &h, sizeof(h));
+  uint64_t sum = checksum(first.data(), first.size());
+
+  for(int i = 1; i < NUM_SECTIONS; ++i)
   {
-    // this takes the 4 into account
-    qit->Score = - 2. * qit->Score; // [0..1]
-    
-    qit->chiScore = qit->Score;
+    const uint64_t end = (i + 1 < NUM_SECTIONS ? h.offsets[i+1] : S);
+    sum = checksum(data + h.offsets[i], end - h.offsets[i], sum);
   }
-  
-}
-
-// --------------------------------------------------------------------------
+  if(sum != file_checksum)
+    throw std::string("Corrupted binary database ") + filename;
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::queryKL(const BowVector &vec, 
-  QueryResults &ret, int max_results, int max_id) const
-{
-  BowVector::const_iterator vit;
-  typename IFRow::const_iterator rit;
-  
-  std::map<EntryId, double> pairs;
-  std::map<EntryId, double>::iterator pit;
+  // vocabulary, into a new one, since m_voc may be shared
+  std::shared_ptr<TemplatedVocabulary<TDescriptor, F> > voc(
+    new TemplatedVocabulary<TDescriptor, F>);
   
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
+  voc->loadBinary(file, h.offsets[SECTION_VOCABULARY], h.vocabulary_size,
+    filename);
+
+  if(voc->size() != h.nwords)
+    throw std::string("Wrong vocabulary in binary database ") + filename;
+  checkScoring(voc->getScoringType());
+
+  // database, aside, so that this one is not modified if the file is
+  // wrong
+  TemplatedDatabase<TDescriptor, F, TWeight> db(voc, h.use_di != 0,
+    h.di_levels);
+
+  const uint64_t *rows = 
+    reinterpret_cast<const uint64_t*>(data + h.offsets[SECTION_ROWS]);
+  const EntryId *ids = 
+    reinterpret_cast<const EntryId*>(data + h.offsets[SECTION_IDS]);
+  const unsigned char *weights = data + h.offsets[SECTION_WEIGHTS];
+
+  for(uint32_t w = 0; w < h.nwords; ++w)
   {
-    const WordId word_id = vit->first;
-    const WordValue& vi = vit->second;
-    
-    const IFRow& row = m_ifile[word_id];
-    
-    // IFRows are sorted in ascending entry_id order
-    
-    for(rit = row.begin(); rit != row.end(); ++rit)
-    {    
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& wi = rit->word_weight;
-      
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        double value = 0;
-        if(vi != 0 && wi != 0) value = vi * log(vi/wi);
-        
-        pit = pairs.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second += value;
-        }
-        else
-        {
-          pairs.insert(pit, 
-            std::map<EntryId, double>::value_type(entry_id, value));
-        }
-      }
+    if(rows[w] > rows[w+1] || rows[w+1] > h.npostings)
+      throw std::string("Wrong inverted index in binary database ") + 
+        filename;
+
+    IFRow &row = db.m_ifile[w];
+    row.reserve(rows[w+1] - rows[w]);
+    for(uint64_t i = rows[w]; i < rows[w+1]; ++i)
+    {
+      // entries must be valid and in ascending order
+      if(ids[i] >= h.nentries || (i > rows[w] && ids[i] <= ids[i-1]))
+        throw std::string("Wrong inverted index in binary database ") + 
+          filename;
       
-    } // for each inverted row
-  } // for each query word
-	
-  // resulting "scores" are now in [-X worst .. 0 best .. X worst]
-  // but we cannot make sure which ones are better without calculating
-  // the complete score
+      row.push_back(ids[i], storedWeight(weights, h.weight_bytes, i));
+    }
+  }
 
-  // complete scores and move to vector
-  ret.reserve(pairs.size());
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)
+  if(db.m_use_di)
   {
-    EntryId eid = pit->first;
-    double value = 0.0;
+    const uint64_t *entries = reinterpret_cast<const uint64_t*>
+      (data + h.offsets[SECTION_DI_ENTRIES]);
+    const NodeId *nodes = reinterpret_cast<const NodeId*>
+      (data + h.offsets[SECTION_DI_NODES]);
+    const uint64_t *feature_offsets = reinterpret_cast<const uint64_t*>
+      (data + h.offsets[SECTION_DI_FEATURE_OFFSETS]);
+    const unsigned int *features = reinterpret_cast<const unsigned int*>
+      (data + h.offsets[SECTION_DI_FEATURES]);
+
+    // the features of the nodes must be in order and in the file before
+    // the vectors are reserved with them
+    for(uint64_t n = 0; n < h.di_nnodes; ++n)
+    {
+      if(feature_offsets[n] > feature_offsets[n+1] || 
+        feature_offsets[n+1] > h.di_nfeatures)
+        throw std::string("Wrong direct index in binary database ") + 
+          filename;
+    }
 
-    for(vit = vec.begin(); vit != vec.end(); ++vit)
+    db.m_dfile.resize(h.nentries);
+    for(uint32_t e = 0; e < h.nentries; ++e)
     {
-      const WordValue &vi = vit->second;
-      const IFRow& row = m_ifile[vit->first];
+      if(entries[e] > entries[e+1] || entries[e+1] > h.di_nnodes)
+        throw std::string("Wrong direct index in binary database ") + 
+          filename;
 
-      if(vi != 0)
+      FlatFeatureVector &fv = db.m_dfile[e];
+      fv.clear();
+      fv.reserve(entries[e+1] - entries[e], 
+        feature_offsets[entries[e+1]] - feature_offsets[entries[e]]);
+
+      for(uint64_t n = entries[e]; n < entries[e+1]; ++n)
       {
-        if(row.end() == find(row.begin(), row.end(), eid ))
-        {
-          value += vi * (log(vi) - GeneralScoring::LOG_EPS);
-        }
+        // nodes must be in ascending order
+        const uint64_t a = feature_offsets[n];
+        const uint64_t b = feature_offsets[n+1];
+        if(n > entries[e] && nodes[n] <= nodes[n-1])
+          throw std::string("Wrong direct index in binary database ") + 
+            filename;
+
+        fv.push_back(nodes[n], features + a, b - a);
       }
     }
-    
-    pit->second += value;
-    
-    // to vector
-    ret.push_back(Result(pit->first, pit->second));
   }
-  
-  // real scores are now in [0 best .. X worst]
 
-  // sort vector in ascending order
-  // (scores are inverted now --the lower the better--)
-  std::sort(ret.begin(), ret.end());
+  const EntryId *removed = 
+    reinterpret_cast<const EntryId*>(data + h.offsets[SECTION_REMOVED]);
+
+  db.m_removed.resize(h.nentries);
+  for(uint32_t i = 0; i < h.nremoved; ++i)
+  {
+    // entries must be valid and in ascending order
+    if(removed[i] >= h.nentries || (i > 0 && removed[i] <= removed[i-1]))
+      throw std::string("Wrong removed entries in binary database ") + 
+        filename;
 
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
+    db.m_removed[removed[i]].removed = true;
+  }
+  db.m_nremoved = h.nremoved;
+  db.m_generation = h.generation;
 
-  // cannot scale scores
-    
+  db.m_nentries = h.nentries;
+
+  // the entries of the journal are no longer valid
+  closeJournal();
+  swapContents(db);
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::queryBhattacharyya(
-  const BowVector &vec, QueryResults &ret, int max_results, int max_id) const
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::openJournal
+  (const std::string &filename, bool resume)
 {
-  BowVector::const_iterator vit;
-  typename IFRow::const_iterator rit;
-  
-  //map<EntryId, double> pairs;
-  //map<EntryId, double>::iterator pit;
-  
-  std::map<EntryId, std::pair<double, int> > pairs; // <eid, <score, counter> >
-  std::map<EntryId, std::pair<double, int> >::iterator pit;
-  
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
-  {
-    const WordId word_id = vit->first;
-    const WordValue& qvalue = vit->second;
-    
-    const IFRow& row = m_ifile[word_id];
-    
-    // IFRows are sorted in ascending entry_id order
-    
-    for(rit = row.begin(); rit != row.end(); ++rit)
-    {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
-      
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        double value = sqrt(qvalue * dvalue);
-        
-        pit = pairs.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second.first += value;
-          pit->second.second += 1;
-        }
-        else
-        {
-          pairs.insert(pit, 
-            std::map<EntryId, std::pair<double, int> >::value_type(entry_id,
-              std::make_pair(value, 1)));
-        }
-      }
-      
-    } // for each inverted row
-  } // for each query word
-	
-  // move to vector
-  ret.reserve(pairs.size());
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)
+  closeJournal();
+
+  uint64_t valid_bytes = 0;
+  if(resume)
   {
-    if(pit->second.second >= MIN_COMMON_WORDS)
+    std::ifstream test(filename.c_str(), std::ios::in | std::ios::binary);
+    if(test.is_open())
     {
-      ret.push_back(Result(pit->first, pit->second.first));
-      ret.back().nWords = pit->second.second;
-      ret.back().bhatScore = pit->second.first;
+      test.close();
+      replayJournal(filename, true, valid_bytes);
     }
   }
-	
-  // scores are already in [0..1]
 
-  // sort vector in descending order
-  std::sort(ret.begin(), ret.end(), Result::gt);
+  std::ofstream *f = NULL;
 
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
+  if(valid_bytes > 0)
+  {
+    // the journal is kept without the truncated record it may have, by
+    // writing it again if needed
+    std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+    in.seekg(0, std::ios::end);
+    const uint64_t file_bytes = in.tellg();
 
-}
+    if(file_bytes != valid_bytes)
+    {
+      std::vector<char> content(valid_bytes);
+      in.seekg(0);
+      in.read(&content[0], valid_bytes);
+      in.close();
+      if(in.fail()) throw std::string("Could not read file ") + filename;
 
-// ---------------------------------------------------------------------------
+      std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary |
+        std::ios::trunc);
+      out.write(&content[0], content.size());
+      out.close();
+      if(out.fail()) throw std::string("Could not write file ") + filename;
+    }
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::queryDotProduct(
-  const BowVector &vec, QueryResults &ret, int max_results, int max_id) const
-{
-  BowVector::const_iterator vit;
-  typename IFRow::const_iterator rit;
-  
-  std::map<EntryId, double> pairs;
-  std::map<EntryId, double>::iterator pit;
-  
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
-  {
-    const WordId word_id = vit->first;
-    const WordValue& qvalue = vit->second;
-    
-    const IFRow& row = m_ifile[word_id];
-    
-    // IFRows are sorted in ascending entry_id order
-    
-    for(rit = row.begin(); rit != row.end(); ++rit)
-    {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
-      
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        double value; 
-        if(this->m_voc->getWeightingType() == BINARY)
-          value = 1;
-        else
-          value = qvalue * dvalue;
-        
-        pit = pairs.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second += value;
-        }
-        else
-        {
-          pairs.insert(pit, 
-            std::map<EntryId, double>::value_type(entry_id, value));
-        }
-      }
-      
-    } // for each inverted row
-  } // for each query word
-	
-  // move to vector
-  ret.reserve(pairs.size());
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)
-  {
-    ret.push_back(Result(pit->first, pit->second));
+    f = new std::ofstream(filename.c_str(), std::ios::out | 
+      std::ios::binary | std::ios::app);
   }
-	
-  // scores are the greater the better
+  else
+  {
+    JournalHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "DBoW2JNL", sizeof(h.magic));
+    h.version = BINARY_VERSION;
+    h.byte_order = 0x01020304;
+    h.first_entry = m_nentries;
+    h.nwords = m_voc->size();
+    h.use_di = (m_use_di ? 1 : 0);
+    h.di_levels = m_dilevels;
+    h.weight_bytes = sizeof(WordValue);
+    h.generation = m_generation;
 
-  // sort vector in descending order
-  std::sort(ret.begin(), ret.end(), Result::gt);
+    f = new std::ofstream(filename.c_str(), std::ios::out | 
+      std::ios::binary | std::ios::trunc);
+    f->write(reinterpret_cast<const char*>(&h), sizeof(h));
+    f->flush();
+  }
 
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
+  if(!f->is_open() || f->fail())
+  {
+    delete f;
+    throw std::string("Could not write file ") + filename;
+  }
 
-  // these scores cannot be scaled
+  m_journal = f;
 }
 
-// ---------------------------------------------------------------------------
+// --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-const FeatureVector& TemplatedDatabase<TDescriptor, F>::retrieveFeatures
-  (EntryId id) const
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::closeJournal()
 {
-  assert(id < size());
-  return m_dfile[id];
+  delete m_journal;
+  m_journal = NULL;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::save(const std::string &filename) const
+template<class TDescriptor, class F, class TWeight>
+inline TWeight TemplatedDatabase<TDescriptor, F, TWeight>::storedWeight(
+  const unsigned char *weights, uint32_t bytes, uint64_t i)
 {
-  cv::FileStorage fs(filename.c_str(), cv::FileStorage::WRITE);
-  if(!fs.isOpened()) throw std::string("Could not open file ") + filename;
-  
-  save(fs);
+  TWeight w;
+  if(bytes == sizeof(TWeight))
+  {
+    memcpy(&w, weights + i * bytes, sizeof(w));
+  }
+  else if(bytes == sizeof(double))
+  {
+    double v;
+    memcpy(&v, weights + i * bytes, sizeof(v));
+    w = Weight::encode(v);
+  }
+  else if(bytes == sizeof(float))
+  {
+    float v;
+    memcpy(&v, weights + i * bytes, sizeof(v));
+    w = Weight::encode(v);
+  }
+  else
+  {
+    FixedWordValue v;
+    memcpy(&v, weights + i * bytes, sizeof(v));
+    w = Weight::encode(WeightTraits<FixedWordValue>::decode(v));
+  }
+  return w;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::save(cv::FileStorage &fs,
-  const std::string &name) const
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::journalEntry(EntryId entry_id,
+  const FlatBowVector &vec)
 {
-  // Format YAML:
-  // vocabulary { ... see TemplatedVocabulary::save }
-  // database 
-  // {
-  //   nEntries: 
-  //   usingDI: 
-  //   diLevels: 
-  //   invertedIndex
-  //   [
-  //     [
-  //        { 
-  //          imageId: 
-  //          weight: 
-  //        }
-  //     ]
-  //   ]
-  //   directIndex
-  //   [
-  //      [
-  //        {
-  //          nodeId:
-  //          features: [ ]
-  //        }
-  //      ]
-  //   ]
+  JournalRecord r;
+  memset(&r, 0, sizeof(r));
+  r.type = JOURNAL_ADD;
+  r.entry_id = entry_id;
+  r.nwords = vec.size();
 
-  // invertedIndex[i] is for the i-th word
-  // directIndex[i] is for the i-th entry
-  // directIndex may be empty if not using direct index
-  //
-  // imageId's and nodeId's must be stored in ascending order
-  // (according to the construction of the indexes)
+  std::vector<unsigned char> buffer(sizeof(r));
+  appendArray(buffer, vec.values(), vec.size());
+  appendArray(buffer, vec.ids(), vec.size());
 
-  m_voc->save(fs);
- 
-  fs << name << "{";
-  
-  fs << "nEntries" << m_nentries;
-  fs << "usingDI" << (m_use_di ? 1 : 0);
-  fs << "diLevels" << m_dilevels;
-  
-  fs << "invertedIndex" << "[";
-  
-  typename InvertedFile::const_iterator iit;
-  typename IFRow::const_iterator irit;
-  for(iit = m_ifile.begin(); iit != m_ifile.end(); ++iit)
+  if(m_use_di)
   {
-    fs << "["; // word of IF
-    for(irit = iit->begin(); irit != iit->end(); ++irit)
+    const FlatFeatureVector &fv = m_dfile[entry_id];
+    r.nnodes = fv.size();
+
+    for(size_t i = 0; i < fv.size(); ++i)
     {
-      fs << "{:" 
-        << "imageId" << (int)irit->entry_id
-        << "weight" << irit->word_weight
-        << "}";
+      const NodeId nid = fv.nodeId(i);
+      appendArray(buffer, &nid, 1);
     }
-    fs << "]"; // word of IF
-  }
-  
-  fs << "]"; // invertedIndex
-  
-  fs << "directIndex" << "[";
-  
-  typename DirectFile::const_iterator dit;
-  typename FeatureVector::const_iterator drit;
-  for(dit = m_dfile.begin(); dit != m_dfile.end(); ++dit)
-  {
-    fs << "["; // entry of DF
-    
-    for(drit = dit->begin(); drit != dit->end(); ++drit)
+    for(size_t i = 0; i < fv.size(); ++i)
     {
-      NodeId nid = drit->first;
-      const std::vector<unsigned int>& features = drit->second;
-      
-      // save info of last_nid
-      fs << "{";
-      fs << "nodeId" << (int)nid;
-      // msvc++ 2010 with opencv 2.3.1 does not allow FileStorage::operator<<
-      // with vectors of unsigned int
-      fs << "features" << "[" 
-        << *(const std::vector<int>*)(&features) << "]";
-      fs << "}";
+      const uint32_t n = fv.nfeatures(i);
+      appendArray(buffer, &n, 1);
+      r.nfeatures += n;
     }
-    
-    fs << "]"; // entry of DF
+    for(size_t i = 0; i < fv.size(); ++i)
+      appendArray(buffer, fv.features(i), fv.nfeatures(i));
   }
-  
-  fs << "]"; // directIndex
-  
-  fs << "}"; // database
+
+  memcpy(&buffer[0], &r, sizeof(r));
+  r.checksum = checksum(buffer.data(), buffer.size());
+  memcpy(&buffer[0], &r, sizeof(r));
+
+  m_journal->write(reinterpret_cast<const char*>(buffer.data()), 
+    buffer.size());
+  m_journal->flush();
+  if(m_journal->fail()) throw std::string("Could not write the journal");
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::load(const std::string &filename)
+template<class TDescriptor, class F, class TWeight>
+void TemplatedDatabase<TDescriptor, F, TWeight>::journalRemoval(
+  EntryId entry_id)
 {
-  cv::FileStorage fs(filename.c_str(), cv::FileStorage::READ);
-  if(!fs.isOpened()) throw std::string("Could not open file ") + filename;
-  
-  load(fs);
+  JournalRecord r;
+  memset(&r, 0, sizeof(r));
+  r.type = JOURNAL_REMOVE;
+  r.entry_id = entry_id;
+  r.checksum = checksum(reinterpret_cast<const unsigned char*>(&r), 
+    sizeof(r));
+
+  m_journal->write(reinterpret_cast<const char*>(&r), sizeof(r));
+  m_journal->flush();
+  if(m_journal->fail()) throw std::string("Could not write the journal");
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedDatabase<TDescriptor, F>::load(const cv::FileStorage &fs,
-  const std::string &name)
+template<class TDescriptor, class F, class TWeight>
+unsigned int TemplatedDatabase<TDescriptor, F, TWeight>::replayJournal
+  (const std::string &filename)
+{
+  uint64_t valid_bytes;
+  return replayJournal(filename, false, valid_bytes);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+unsigned int TemplatedDatabase<TDescriptor, F, TWeight>::replayJournal
+  (const std::string &filename, bool resume, uint64_t &valid_bytes)
 {
-  // load voc first
-  // subclasses must instantiate m_voc before calling this ::load
-  if(!m_voc) m_voc = new TemplatedVocabulary<TDescriptor, F>;
+  std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary);
+  if(!f.is_open()) throw std::string("Could not open file ") + filename;
 
-  m_voc->load(fs);
+  JournalHeader h;
+  f.read(reinterpret_cast<char*>(&h), sizeof(h));
+  if(f.fail() || memcmp(h.magic, "DBoW2JNL", sizeof(h.magic)) != 0)
+    throw std::string("File ") + filename + " is not a journal";
 
-  // load database now
-  clear(); // resizes inverted file
+  if(h.version != BINARY_VERSION || h.byte_order != 0x01020304 ||
+    h.weight_bytes != sizeof(WordValue))
+    throw std::string("Unsupported version or byte order of journal ") +
+      filename;
 
-  cv::FileNode fdb = fs[name];
+  if(h.nwords != m_voc->size() || h.use_di != (m_use_di ? 1 : 0) ||
+    h.di_levels != m_dilevels)
+    throw std::string("Journal ") + filename + 
+      " belongs to another database";
 
-  m_nentries = (int)fdb["nEntries"];
-  m_use_di = (int)fdb["usingDI"] != 0;
-  m_dilevels = (int)fdb["diLevels"];
+  if(h.generation != m_generation)
+    throw std::string("Journal ") + filename + 
+      " was written before or after the entries of the database were "
+      "renumbered";
 
-  cv::FileNode fn = fdb["invertedIndex"];
-  WordId wid = 0;
-  for (cv::FileNodeIterator fit = fn.begin(); fit != fn.end(); ++fit, ++wid)
+  if(h.first_entry > (uint32_t)m_nentries)
+    throw std::string("Journal ") + filename + 
+      " does not continue the database";
+
+  // the valid records are read and checked first, so that the database is
+  // not modified if any of them is wrong
+  valid_bytes = sizeof(h);
+  std::vector<unsigned char> buffer;
+  std::vector<uint64_t> records; // offset of each record in buffer
+
+  // id of the next entry of the journal
+  uint32_t end_entry = h.first_entry;
+
+  for(;;)
   {
-    cv::FileNode fw = *fit;
-    for (cv::FileNodeIterator fwit = fw.begin(); fwit != fw.end(); ++fwit)
+    JournalRecord r;
+    f.read(reinterpret_cast<char*>(&r), sizeof(r));
+    if(f.fail()) break;
+
+    const uint64_t bytes = (uint64_t)r.nwords * 
+      (sizeof(WordId) + sizeof(WordValue)) + 
+      (uint64_t)r.nnodes * (sizeof(NodeId) + sizeof(uint32_t)) + 
+      (uint64_t)r.nfeatures * sizeof(unsigned int);
+
+    if((r.type != JOURNAL_ADD && r.type != JOURNAL_REMOVE) || 
+      (r.type == JOURNAL_REMOVE && bytes > 0) || 
+      bytes > ((uint64_t)1 << 32)) break;
+
+    // records are aligned, as the weights need
+    const uint64_t offset = (buffer.size() + 7) & ~(uint64_t)7;
+    buffer.resize(offset + sizeof(r) + bytes);
+    f.read(reinterpret_cast<char*>(&buffer[offset + sizeof(r)]), bytes);
+    if(f.fail())
     {
-      EntryId eid = (int)(*fwit)["imageId"];
-      WordValue v = (*fwit)["weight"];
-      m_ifile[wid].push_back(IFPair(eid, v));
+      buffer.resize(offset);
+      break;
+    }
+
+    const uint64_t record_checksum = r.checksum;
+    r.checksum = 0;
+    memcpy(&buffer[offset], &r, sizeof(r));
+    if(checksum(&buffer[offset], sizeof(r) + bytes) != record_checksum)
+    {
+      buffer.resize(offset);
+      break;
+    }
+
+    // the record is complete
+    valid_bytes += sizeof(r) + bytes;
+
+    if(r.type == JOURNAL_REMOVE)
+    {
+      // only entries that existed when it was written can be removed
+      if(r.entry_id >= end_entry)
+        throw std::string("Journal ") + filename + 
+          " does not continue the database";
+
+      records.push_back(offset);
+      continue;
+    }
+
+    // the journal has all the entries added since it was created
+    if(r.entry_id != end_entry)
+      throw std::string("Journal ") + filename + 
+        " does not continue the database";
+    ++end_entry;
+
+    const unsigned char *p = &buffer[offset + sizeof(r)];
+    const WordId *words = reinterpret_cast<const WordId*>
+      (p + r.nwords * sizeof(WordValue));
+    p += r.nwords * (sizeof(WordId) + sizeof(WordValue));
+
+    for(uint32_t i = 0; i < r.nwords; ++i)
+    {
+      if(words[i] >= m_ifile.size())
+        throw std::string("Wrong entry in journal ") + filename;
+    }
+
+    const NodeId *nodes = reinterpret_cast<const NodeId*>(p);
+    const uint32_t *counts = reinterpret_cast<const uint32_t*>
+      (p + r.nnodes * sizeof(NodeId));
+
+    // nodes must be in ascending order, with all the features
+    uint64_t nfeatures = 0;
+    for(uint32_t n = 0; n < r.nnodes; ++n)
+    {
+      if(n > 0 && nodes[n] <= nodes[n-1])
+        throw std::string("Wrong entry in journal ") + filename;
+      nfeatures += counts[n];
     }
+    if(nfeatures != r.nfeatures)
+      throw std::string("Wrong entry in journal ") + filename;
+
+    records.push_back(offset);
   }
 
-  if (m_use_di)
+  // the entries added to the database without the journal would be
+  // missing from it if it were appended to
+  if(resume && end_entry < (uint32_t)m_nentries)
+    throw std::string("Journal ") + filename + 
+      " does not end at the last entry of the database";
+
+  unsigned int added = 0;
+
+  for(size_t k = 0; k < records.size(); ++k)
   {
-    fn = fdb["directIndex"];
-    m_dfile.resize(fn.size());
-    assert(m_nentries == (int)fn.size());
+    JournalRecord r;
+    memcpy(&r, &buffer[records[k]], sizeof(r));
 
-    EntryId eid = 0;
-    for (cv::FileNodeIterator fit = fn.begin(); fit != fn.end(); ++fit, ++eid)
+    if(r.type == JOURNAL_REMOVE)
     {
-      cv::FileNode fe = *fit;
-      m_dfile[eid].clear();
-      for (cv::FileNodeIterator feit = fe.begin(); feit != fe.end(); ++feit)
+      // removing an entry again changes nothing
+      Tombstone &t = m_removed[r.entry_id];
+      if(!t.removed)
       {
-        NodeId nid = (int)(*feit)["nodeId"];
-        FeatureVector::iterator dit = m_dfile[eid].insert(m_dfile[eid].end(),
-          make_pair(nid, std::vector<unsigned int>()));
+        t.removed = true;
+        m_nremoved++;
+      }
+      continue;
+    }
 
-        cv::FileNode ff = (*feit)["features"][0];
-        dit->second.reserve(ff.size());
-        for (cv::FileNodeIterator ffit = ff.begin(); ffit != ff.end(); ++ffit)
-        {
-          dit->second.push_back((int)*ffit);
-        }
+    if(r.entry_id < (uint32_t)m_nentries) continue;
+
+    const unsigned char *p = &buffer[records[k] + sizeof(r)];
+    const WordValue *values = reinterpret_cast<const WordValue*>(p);
+    const WordId *words = reinterpret_cast<const WordId*>
+      (p + r.nwords * sizeof(WordValue));
+    p += r.nwords * (sizeof(WordId) + sizeof(WordValue));
+
+    const NodeId *nodes = reinterpret_cast<const NodeId*>(p);
+    const uint32_t *counts = reinterpret_cast<const uint32_t*>
+      (p + r.nnodes * sizeof(NodeId));
+    const unsigned int *features = reinterpret_cast<const unsigned int*>
+      (p + r.nnodes * (sizeof(NodeId) + sizeof(uint32_t)));
+
+    const EntryId entry_id = m_nentries.load(std::memory_order_relaxed);
+
+    for(uint32_t i = 0; i < r.nwords; ++i)
+      m_ifile[words[i]].push_back(entry_id, Weight::encode(values[i]));
+
+    if(m_use_di)
+    {
+      if(entry_id == m_dfile.size()) m_dfile.push_back(FlatFeatureVector());
+      FlatFeatureVector &fv = m_dfile[entry_id];
+      fv.clear();
+      fv.reserve(r.nnodes, r.nfeatures);
+
+      for(uint32_t n = 0; n < r.nnodes; ++n)
+      {
+        fv.push_back(nodes[n], features, counts[n]);
+        features += counts[n];
       }
     }
+
+    m_removed.resize(entry_id + 1);
+    m_nentries.store(entry_id + 1, std::memory_order_release);
+    ++added;
   }
 
+  return added;
 }
 
 // --------------------------------------------------------------------------
@@ -1311,9 +4640,9 @@ void TemplatedDatabase<TDescriptor, F>::load(const cv::FileStorage &fs,
  * @param os stream to write to
  * @param db
  */
-template<class TDescriptor, class F>
+template<class TDescriptor, class F, class TWeight>
 std::ostream& operator<<(std::ostream &os, 
-  const TemplatedDatabase<TDescriptor,F> &db)
+  const TemplatedDatabase<TDescriptor, F, TWeight> &db)
 {
   os << "Database: Entries = " << db.size() << ", "
     "Using direct index = " << (db.usingDirectIndex() ? "yes" : "no");
@@ -0,0 +1,693 @@
+/**
+ * File: TemplatedPipeline.h
+ * Date: October 2026
+ * Description: asynchronous pipeline that transforms, queries, adds and
+ *   verifies the frames of a sequence with a database
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_TEMPLATED_PIPELINE__
+#define __D_T_TEMPLATED_PIPELINE__
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <memory>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+
+#include "TemplatedDatabase.h"
+#include "PipelineOptions.h"
+#include "BoundedQueue.h"
+#include "SegmentedVector.h"
+#include "ThreadPool.h"
+
+namespace DBoW2 {
+
+/// @param TDescriptor class of descriptor
+/// @param F class of descriptor functions
+/// @param TWeight type the word weights of the database are stored as
+/// Place recognition of a sequence of frames in stages that overlap
+/**
+ * Each submitted frame goes through three stages, each one run by its own
+ * thread and fed by a BoundedQueue:
+ *  - transform: the features are converted with the vocabulary of the
+ *    database, keeping the nodes of the direct index,
+ *  - query: the database is queried with the frame, and the frame is
+ *    added to it afterwards,
+ *  - verify: the features of the frame are matched with those of its best
+ *    candidates (see TemplatedDatabase::matchFeatures).
+ * So the transform of a frame runs while the previous one is queried and
+ * the one before is verified. The transforms and the matches use the
+ * ThreadPool given, if any. Results are returned through a future or a
+ * callback, in the order the frames were submitted. If the first stage is
+ * full, submit either waits or drops the frame (PipelineOptions). The
+ * results of the dropped frames are also delivered by the last stage, right
+ * after that of the frame before them, so the callbacks are never called
+ * at the same time.
+ *
+ * The query stage is the thread that adds entries to the database, so no
+ * other thread can add or remove them while the pipeline runs, but other
+ * threads can query the database (see TemplatedDatabase). Frames must be
+ * submitted from a single thread.
+ */
+template<class TDescriptor, class F, class TWeight = WordValue>
+class TemplatedPipeline
+{
+public:
+
+  /// Function that receives the result of a frame
+  typedef std::function<void(const FrameResult&)> Callback;
+
+  /**
+   * Starts the stages of a pipeline on a database
+   * @param db database, which must outlive the pipeline
+   * @param options
+   * @param pool if given, threads to transform and verify each frame,
+   *   which must outlive the pipeline
+   * @throw std::string if the database has no vocabulary, or if the
+   *   candidates must be verified but the frames are not added or the
+   *   database does not use the direct index
+   */
+  TemplatedPipeline(TemplatedDatabase<TDescriptor, F, TWeight> &db,
+    const PipelineOptions &options = PipelineOptions(),
+    ThreadPool *pool = NULL);
+
+  /**
+   * Finishes the frames submitted and stops the stages
+   */
+  virtual ~TemplatedPipeline();
+
+  /**
+   * Submits a frame
+   * @param features features of the frame
+   * @return future result of the frame
+   */
+  std::future<FrameResult> submit(const std::vector<TDescriptor> &features);
+
+  /**
+   * Submits a frame whose result is given to a callback. The callback is
+   * called from the thread of the last stage, so it should return soon;
+   * exceptions thrown by it are ignored
+   * @param features features of the frame
+   * @param callback function to call with the result of the frame, even if
+   *   it is dropped
+   * @return false iff the frame was dropped
+   */
+  bool submit(const std::vector<TDescriptor> &features,
+    const Callback &callback);
+
+  /**
+   * Waits until the results of all the frames submitted are ready
+   */
+  void flush();
+
+  /**
+   * Returns the number of frames submitted whose results are not ready
+   * @return number of frames
+   */
+  unsigned int pending() const;
+
+  /**
+   * Returns the options of the pipeline
+   * @return options
+   */
+  inline const PipelineOptions& getOptions() const;
+
+protected:
+
+  /// Frame going through the stages
+  struct Frame
+  {
+    /// Features of the frame
+    std::vector<TDescriptor> features;
+    /// Features to match, either features or the ones kept for its entry
+    const std::vector<TDescriptor> *descriptors;
+    /// Bow vector
+    FlatBowVector bow;
+    /// Nodes of the direct index
+    FlatFeatureVector fv;
+    /// Entries whose features were kept when the frame was queried
+    size_t nkept;
+    /// Result
+    FrameResult result;
+    /// Time it was submitted
+    std::chrono::steady_clock::time_point start;
+    /// Receives the result if there is no callback
+    std::promise<FrameResult> promise;
+    /// Receives the result, if given
+    Callback callback;
+  };
+
+  /// Frame owned by the stage that works on it
+  typedef std::unique_ptr<Frame> FramePtr;
+
+  /**
+   * Creates a frame
+   * @param features
+   * @return new frame
+   */
+  FramePtr newFrame(const std::vector<TDescriptor> &features);
+
+  /**
+   * Gives a frame to the first stage, or drops it
+   * @param frame
+   * @return false iff dropped
+   */
+  bool enqueue(FramePtr &frame);
+
+  /**
+   * Delivers the result of a frame, and those of the dropped frames that
+   * follow it. Only the last stage can call it
+   * @param frame
+   */
+  void finish(Frame &frame);
+
+  /**
+   * Delivers the result of a single frame
+   * @param frame
+   */
+  void deliver(Frame &frame);
+
+  /**
+   * Marks a frame as failed with the exception being handled
+   * @param frame
+   */
+  static void fail(Frame &frame);
+
+  /**
+   * Main loops of the stages
+   */
+  void transformStage();
+  void queryStage();
+  void verifyStage();
+
+  /**
+   * Queries the database with some frames and adds them
+   * @param frames frames, which have not failed
+   */
+  void query(const std::vector<Frame*> &frames);
+
+  /**
+   * Matches the features of a frame with those of its best candidates
+   * @param frame
+   */
+  void verify(Frame &frame);
+
+private:
+
+  TemplatedPipeline(const TemplatedPipeline &);
+  TemplatedPipeline& operator=(const TemplatedPipeline &);
+
+protected:
+
+  /// Database
+  TemplatedDatabase<TDescriptor, F, TWeight> *m_db;
+
+  /// Vocabulary of the database
+  std::shared_ptr<const TemplatedVocabulary<TDescriptor, F> > m_voc;
+
+  /// Options
+  PipelineOptions m_options;
+
+  /// Frames queried at once, at most
+  unsigned int m_max_batch;
+
+  /// Threads to transform and verify, or NULL
+  ThreadPool *m_pool;
+
+  /// Id of the first entry added by the pipeline
+  EntryId m_first_entry;
+
+  /// Features of the entries added by the pipeline, from m_first_entry,
+  /// if they have to be verified. Those of the entries below
+  /// m_first_entry + m_evicted were freed
+  SegmentedVector<std::vector<TDescriptor> > m_features;
+
+  /// Entries added by the pipeline whose features were freed
+  size_t m_evicted;
+
+  /// Frames submitted
+  unsigned int m_nframes;
+
+  /// Frames whose results are not ready
+  unsigned int m_pending;
+
+  /// Frames dropped, waiting for the result of the frame before them
+  std::deque<FramePtr> m_dropped;
+
+  /// Protects m_pending and m_dropped
+  mutable std::mutex m_mutex;
+
+  /// Signals that there are no frames pending
+  std::condition_variable m_idle;
+
+  /// Input of each stage
+  BoundedQueue<FramePtr> m_transform_queue;
+  BoundedQueue<FramePtr> m_query_queue;
+  BoundedQueue<FramePtr> m_verify_queue;
+
+  /// Threads of the stages
+  std::thread m_transform_thread;
+  std::thread m_query_thread;
+  std::thread m_verify_thread;
+};
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+TemplatedPipeline<TDescriptor, F, TWeight>::TemplatedPipeline(
+  TemplatedDatabase<TDescriptor, F, TWeight> &db,
+  const PipelineOptions &options, ThreadPool *pool)
+  : m_db(&db), m_voc(db.getSharedVocabulary()), m_options(options),
+    m_max_batch(1), m_pool(pool), m_first_entry(db.size()), m_evicted(0),
+    m_nframes(0), m_pending(0), m_transform_queue(options.queue_size),
+    m_query_queue(options.queue_size), m_verify_queue(options.queue_size)
+{
+  if(!m_voc)
+    throw std::string("TemplatedPipeline: the database has no vocabulary");
+  if(options.verify > 0 && !options.add)
+    throw std::string("TemplatedPipeline: the candidates cannot be "
+      "verified if the frames are not added");
+  if(options.verify > 0 && !db.usingDirectIndex())
+    throw std::string("TemplatedPipeline: the candidates cannot be "
+      "verified without direct index");
+
+  // queryBatch has no options
+  const QueryOptions &q = options.query;
+  if(options.max_batch > 1 && q.max_df >= 1 && !q.sort_words &&
+    !q.early_termination && q.filter.all())
+  {
+    m_max_batch = options.max_batch;
+    if(options.add && options.exclude_recent < m_max_batch - 1)
+      m_max_batch = options.exclude_recent + 1;
+  }
+
+  m_transform_thread = std::thread(&TemplatedPipeline::transformStage, this);
+  m_query_thread = std::thread(&TemplatedPipeline::queryStage, this);
+  m_verify_thread = std::thread(&TemplatedPipeline::verifyStage, this);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+TemplatedPipeline<TDescriptor, F, TWeight>::~TemplatedPipeline()
+{
+  // each stage closes the queue of the next one when it is done
+  m_transform_queue.close();
+  m_transform_thread.join();
+  m_query_thread.join();
+  m_verify_thread.join();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+std::future<FrameResult> TemplatedPipeline<TDescriptor, F, TWeight>::submit(
+  const std::vector<TDescriptor> &features)
+{
+  FramePtr frame = newFrame(features);
+  std::future<FrameResult> future = frame->promise.get_future();
+  enqueue(frame);
+  return future;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+bool TemplatedPipeline<TDescriptor, F, TWeight>::submit(
+  const std::vector<TDescriptor> &features, const Callback &callback)
+{
+  FramePtr frame = newFrame(features);
+  frame->callback = callback;
+  return enqueue(frame);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedPipeline<TDescriptor, F, TWeight>::flush()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while(m_pending > 0) m_idle.wait(lock);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+unsigned int TemplatedPipeline<TDescriptor, F, TWeight>::pending() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_pending;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline const PipelineOptions&
+  TemplatedPipeline<TDescriptor, F, TWeight>::getOptions() const
+{
+  return m_options;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+typename TemplatedPipeline<TDescriptor, F, TWeight>::FramePtr
+TemplatedPipeline<TDescriptor, F, TWeight>::newFrame(
+  const std::vector<TDescriptor> &features)
+{
+  FramePtr frame(new Frame);
+  frame->features = features;
+  frame->descriptors = &frame->features;
+  frame->nkept = 0;
+  frame->result.frame = m_nframes++;
+  frame->start = std::chrono::steady_clock::now();
+  return frame;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+bool TemplatedPipeline<TDescriptor, F, TWeight>::enqueue(FramePtr &frame)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  ++m_pending;
+
+  if(!m_options.drop_frames)
+  {
+    lock.unlock();
+    m_transform_queue.push(frame);
+    return true;
+  }
+
+  // if the queue is full, the last frame pushed is still in it, and the
+  // frames after it were dropped too. The lock keeps that frame from being
+  // finished before this one is kept to be delivered after it
+  if(m_transform_queue.tryPush(frame)) return true;
+
+  frame->result.status = FRAME_DROPPED;
+  m_dropped.push_back(std::move(frame));
+  return false;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedPipeline<TDescriptor, F, TWeight>::finish(Frame &frame)
+{
+  deliver(frame);
+
+  unsigned int next = frame.result.frame + 1;
+  for(;;)
+  {
+    FramePtr dropped;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(m_dropped.empty() || m_dropped.front()->result.frame != next)
+        return;
+      dropped = std::move(m_dropped.front());
+      m_dropped.pop_front();
+    }
+
+    deliver(*dropped);
+    ++next;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedPipeline<TDescriptor, F, TWeight>::deliver(Frame &frame)
+{
+  frame.result.latency = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - frame.start).count();
+
+  if(frame.callback)
+  {
+    try { frame.callback(frame.result); } catch(...) {}
+  }
+  else
+    frame.promise.set_value(frame.result);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(--m_pending == 0) m_idle.notify_all();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedPipeline<TDescriptor, F, TWeight>::fail(Frame &frame)
+{
+  frame.result.status = FRAME_FAILED;
+  try
+  {
+    throw;
+  }
+  catch(const std::string &e)
+  {
+    frame.result.error = e;
+  }
+  catch(const std::exception &e)
+  {
+    frame.result.error = e.what();
+  }
+  catch(...)
+  {
+    frame.result.error = "unknown exception";
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedPipeline<TDescriptor, F, TWeight>::transformStage()
+{
+  const bool use_di = m_db->usingDirectIndex();
+  const int levelsup = m_db->getDirectIndexLevels();
+
+  FramePtr frame;
+  while(m_transform_queue.pop(frame))
+  {
+    try
+    {
+      if(use_di)
+        m_voc->transform(frame->features, frame->bow, frame->fv, levelsup,
+          m_pool);
+      else
+        m_voc->transform(frame->features, frame->bow, m_pool);
+    }
+    catch(...)
+    {
+      fail(*frame);
+    }
+
+    m_query_queue.push(frame);
+  }
+
+  m_query_queue.close();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedPipeline<TDescriptor, F, TWeight>::queryStage()
+{
+  std::vector<FramePtr> batch;
+  std::vector<Frame*> frames;
+
+  FramePtr frame;
+  while(m_query_queue.pop(frame))
+  {
+    // the frames that are already waiting join the batch
+    batch.clear();
+    batch.push_back(std::move(frame));
+    while(batch.size() < m_max_batch && m_query_queue.tryPop(frame))
+      batch.push_back(std::move(frame));
+
+    frames.clear();
+    for(size_t i = 0; i < batch.size(); ++i)
+    {
+      if(batch[i]->result.status == FRAME_DONE)
+        frames.push_back(batch[i].get());
+    }
+
+    try
+    {
+      query(frames);
+    }
+    catch(...)
+    {
+      for(size_t i = 0; i < frames.size(); ++i)
+        if(!frames[i]->result.added) fail(*frames[i]);
+    }
+
+    for(size_t i = 0; i < batch.size(); ++i) m_verify_queue.push(batch[i]);
+  }
+
+  m_verify_queue.close();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedPipeline<TDescriptor, F, TWeight>::verifyStage()
+{
+  FramePtr frame;
+  while(m_verify_queue.pop(frame))
+  {
+    if(frame->result.status == FRAME_DONE && m_options.verify > 0)
+    {
+      try
+      {
+        verify(*frame);
+      }
+      catch(...)
+      {
+        fail(*frame);
+      }
+    }
+
+    finish(*frame);
+    frame.reset();
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedPipeline<TDescriptor, F, TWeight>::query(
+  const std::vector<Frame*> &frames)
+{
+  if(frames.empty()) return;
+
+  // frame i is going to be entry n + i, and the entries of the previous
+  // frames of the batch are too recent to be returned. The queries return
+  // the entries below max_id
+  const unsigned int n = m_db->size();
+  const unsigned int exclude = m_options.exclude_recent;
+  std::vector<int> max_ids(frames.size(), 0);
+  std::vector<size_t> queried;
+  for(size_t i = 0; i < frames.size(); ++i)
+  {
+    const unsigned int next = n + (m_options.add ? (unsigned int)i : 0);
+    if(next > exclude)
+    {
+      max_ids[i] = (int)(next - exclude);
+      queried.push_back(i);
+    }
+  }
+
+  if(queried.size() == 1)
+  {
+    const size_t i = queried[0];
+    m_db->query(frames[i]->bow, frames[i]->result.candidates,
+      m_options.query, m_options.max_results, max_ids[i]);
+  }
+  else if(queried.size() > 1)
+  {
+    // all are queried with the entries that the last frame can get, and
+    // the others drop the entries after theirs
+    const int max_id = max_ids[queried.back()];
+    const int max_results = (m_options.max_results > 0 ?
+      m_options.max_results + (int)queried.size() - 1 : 0);
+
+    std::vector<FlatBowVector> vecs(queried.size());
+    for(size_t k = 0; k < queried.size(); ++k)
+      vecs[k] = frames[queried[k]]->bow;
+
+    std::vector<QueryResults> ret;
+    m_db->queryBatch(vecs, ret, max_results, max_id, m_pool);
+
+    for(size_t k = 0; k < queried.size(); ++k)
+    {
+      QueryResults &candidates = frames[queried[k]]->result.candidates;
+      const EntryId end = (EntryId)max_ids[queried[k]];
+      for(size_t r = 0; r < ret[k].size(); ++r)
+      {
+        if(ret[k][r].Id >= end) continue;
+        if(m_options.max_results > 0 &&
+          (int)candidates.size() == m_options.max_results) break;
+        candidates.push_back(ret[k][r]);
+      }
+    }
+  }
+
+  for(size_t i = 0; i < frames.size(); ++i)
+  {
+    Frame &frame = *frames[i];
+    frame.nkept = m_features.size();
+
+    if(!m_options.add) continue;
+
+    frame.result.entry = m_db->add(frame.bow, frame.fv);
+    frame.result.added = true;
+
+    if(m_options.verify > 0)
+    {
+      // the frame is matched with the features kept for its entry, which
+      // are read by the verify stage of the following frames
+      const size_t k = frame.result.entry - m_first_entry;
+      if(m_features.size() <= k) m_features.resize(k + 1);
+      m_features[k].swap(frame.features);
+      frame.descriptors = &m_features[k];
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedPipeline<TDescriptor, F, TWeight>::verify(Frame &frame)
+{
+  const QueryResults &candidates = frame.result.candidates;
+  const size_t n = std::min<size_t>(m_options.verify, candidates.size());
+
+  // only the last entries added before the frame was queried have their
+  // features kept. The frames after this one keep the same entries or
+  // newer ones, so the features of the older ones can be freed. This is
+  // done here because this is the only stage that reads them
+  const size_t keep = m_options.keep_features;
+  const size_t begin = (keep > 0 && frame.nkept > keep ?
+    frame.nkept - keep : 0);
+  for(; m_evicted < begin; ++m_evicted)
+    std::vector<TDescriptor>().swap(m_features[m_evicted]);
+
+  std::vector<EntryId> ids;
+  std::vector<const std::vector<TDescriptor>*> entry_features;
+  std::vector<size_t> which;
+  for(size_t i = 0; i < n; ++i)
+  {
+    const EntryId id = candidates[i].Id;
+    if(id < m_first_entry + begin || id - m_first_entry >= frame.nkept)
+      continue;
+
+    const std::vector<TDescriptor> &f = m_features[id - m_first_entry];
+    if(f.empty()) continue;
+
+    ids.push_back(id);
+    entry_features.push_back(&f);
+    which.push_back(i);
+  }
+
+  std::vector<std::vector<FeatureMatch> > matches;
+  m_db->matchFeatures(frame.fv, *frame.descriptors, ids, entry_features,
+    matches, m_options.match, m_pool);
+
+  frame.result.matches.resize(n);
+  for(size_t j = 0; j < which.size(); ++j)
+    frame.result.matches[which[j]].swap(matches[j]);
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,848 @@
+/**
+ * File: TemplatedShardedDatabase.h
+ * Date: October 2026
+ * Description: image database split into several shards that are queried
+ *   together
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_TEMPLATED_SHARDED_DATABASE__
+#define __D_T_TEMPLATED_SHARDED_DATABASE__
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "TemplatedDatabase.h"
+#include "QueryResults.h"
+#include "QueryStats.h"
+#include "SegmentedVector.h"
+#include "ThreadPool.h"
+
+namespace DBoW2 {
+
+/// @param TDescriptor class of descriptor
+/// @param F class of descriptor functions
+/// @param TWeight type the word weights of the shards are stored as
+/// Database whose entries are partitioned among several databases
+/**
+ * Each shard is a TemplatedDatabase with its own inverted and direct
+ * files. Entries get global ids in the order they are added, and are put
+ * in a shard by id range (entries_per_shard consecutive ids per shard) or
+ * in the shard given to add, e.g. one per robot or session. Queries are
+ * run on every shard, in parallel if a ThreadPool is given, and the best
+ * results of each one are merged. Since the shards use the same
+ * vocabulary, the scores are comparable, and the results are the same as
+ * those of a single database with all the entries (results with the same
+ * score may come in another order). The shards share the vocabulary.
+ *
+ * As with TemplatedDatabase, one thread may add and remove entries while
+ * others query the database.
+ */
+template<class TDescriptor, class F, class TWeight = WordValue>
+class TemplatedShardedDatabase
+{
+public:
+
+  /**
+   * Creates an empty database with the given vocabulary
+   * @param T class inherited from TemplatedVocabulary<TDescriptor, F>
+   * @param voc vocabulary
+   * @param nshards number of shards (> 0)
+   * @param entries_per_shard if > 0, the entries added without a shard
+   *   fill the shards in order, this many each. If 0, the shard must be
+   *   given to add
+   * @param use_di a direct index is used to store feature indexes
+   * @param di_levels levels to go up the vocabulary tree to select the
+   *   node id to store in the direct index when adding images
+   * @throw std::string if nshards is 0
+   */
+  template<class T>
+  TemplatedShardedDatabase(const T &voc, unsigned int nshards,
+    unsigned int entries_per_shard = 0, bool use_di = true,
+    int di_levels = 0);
+
+  /**
+   * Creates an empty database with a vocabulary shared with other
+   * databases. The vocabulary must not be modified afterwards
+   * @param T class inherited from TemplatedVocabulary<TDescriptor, F>
+   * @param voc vocabulary
+   * @param nshards number of shards (> 0)
+   * @param entries_per_shard if > 0, the entries added without a shard
+   *   fill the shards in order, this many each. If 0, the shard must be
+   *   given to add
+   * @param use_di a direct index is used to store feature indexes
+   * @param di_levels levels to go up the vocabulary tree to select the
+   *   node id to store in the direct index when adding images
+   * @throw std::string if nshards is 0
+   */
+  template<class T>
+  TemplatedShardedDatabase(const std::shared_ptr<T> &voc,
+    unsigned int nshards, unsigned int entries_per_shard = 0,
+    bool use_di = true, int di_levels = 0);
+
+  /**
+   * Destructor
+   */
+  virtual ~TemplatedShardedDatabase();
+
+  /**
+   * Returns the vocabulary used
+   * @return vocabulary
+   */
+  inline const TemplatedVocabulary<TDescriptor,F>* getVocabulary() const;
+
+  /**
+   * Returns the number of shards
+   * @return number of shards
+   */
+  inline unsigned int shards() const;
+
+  /**
+   * Returns a shard. The ids of its entries are local to it
+   * @param i shard index (< shards())
+   * @return shard
+   */
+  inline const TemplatedDatabase<TDescriptor, F, TWeight>& 
+    shard(unsigned int i) const;
+
+  /**
+   * Adds an entry to the shard its id falls in. If the shard fails to add
+   * it, the database is not changed
+   * @param features features of the new entry
+   * @param bowvec if given, the bow vector of these features is returned
+   * @param fvec if given, the vector of nodes and feature indexes is returned
+   * @return global id of the new entry
+   * @throw std::string if the database was not created with
+   *   entries_per_shard, or if all the shards are full
+   */
+  EntryId add(const std::vector<TDescriptor> &features,
+    BowVector *bowvec = NULL, FeatureVector *fvec = NULL);
+
+  /**
+   * Adds an entry to the given shard. If the shard fails to add it, the
+   * database is not changed
+   * @param shard shard index (< shards())
+   * @param features features of the new entry
+   * @param bowvec if given, the bow vector of these features is returned
+   * @param fvec if given, the vector of nodes and feature indexes is returned
+   * @return global id of the new entry
+   * @throw std::string if the shard does not exist
+   */
+  EntryId add(unsigned int shard, const std::vector<TDescriptor> &features,
+    BowVector *bowvec = NULL, FeatureVector *fvec = NULL);
+
+  /**
+   * Adds an entry to the given shard. If the shard fails to add it, the
+   * database is not changed
+   * @param shard shard index (< shards())
+   * @param vec flat bow vector
+   * @param fec flat feature vector to add the entry. Only necessary if
+   *   using the direct index
+   * @return global id of the new entry
+   * @throw std::string if the shard does not exist
+   */
+  EntryId add(unsigned int shard, const FlatBowVector &vec,
+    const FlatFeatureVector &fec = FlatFeatureVector());
+
+  /**
+   * Compresses the inverted index of a shard (see TemplatedDatabase::seal),
+   * e.g. once the session it holds is archived. Entries can still be
+   * added to it. This is not safe to call while other threads query the
+   * database
+   * @param shard shard index (< shards())
+   * @param pool if given, threads to compress the rows
+   * @throw std::string if the shard does not exist
+   */
+  void seal(unsigned int shard, ThreadPool *pool = NULL);
+
+  /**
+   * Removes an entry from its shard. The queries do not return it any
+   * longer
+   * @param id global entry id (must be < size())
+   */
+  void remove(EntryId id);
+
+  /**
+   * Checks if an entry was removed
+   * @param id global entry id (must be < size())
+   * @return true iff the entry was removed
+   */
+  inline bool isRemoved(EntryId id) const;
+
+  /**
+   * Returns the number of entries in all the shards
+   * @return number of entries
+   */
+  inline unsigned int size() const;
+
+  /**
+   * Returns the shard of an entry
+   * @param id global entry id (must be < size())
+   * @return shard index
+   */
+  inline unsigned int shardOf(EntryId id) const;
+
+  /**
+   * Returns the id of an entry in its shard
+   * @param id global entry id (must be < size())
+   * @return local entry id
+   */
+  inline EntryId localId(EntryId id) const;
+
+  /**
+   * Returns the global id of an entry of a shard
+   * @param shard shard index (< shards())
+   * @param id local entry id (must be < shard(shard).size())
+   * @return global entry id
+   */
+  inline EntryId globalId(unsigned int shard, EntryId id) const;
+
+  /**
+   * Returns the feature vector associated with an entry
+   * @deprecated it is built and kept by its shard (see 
+   *   TemplatedDatabase::retrieveFeatures); use retrieveFlatFeatures
+   * @param id global entry id (must be < size())
+   * @return const reference to the map of nodes and their associated 
+   *   features
+   */
+  inline const FeatureVector& retrieveFeatures(EntryId id) const;
+
+  /**
+   * Returns the flat feature vector associated with an entry
+   * @param id global entry id (must be < size())
+   * @return const reference to the nodes and their associated features
+   */
+  inline const FlatFeatureVector& retrieveFlatFeatures(EntryId id) const;
+
+  /**
+   * Matches the features of a query with those of an entry, as 
+   * TemplatedDatabase::matchFeatures
+   * @param fv flat feature vector of the query, obtained with the 
+   *   levelsup of the direct index of the shards
+   * @param features descriptors of the query
+   * @param id global entry id (must be < size())
+   * @param entry_features descriptors of the entry
+   * @param matches (out) accepted matches, in ascending order of query 
+   *   feature
+   * @param options options to accept the matches
+   * @throw std::string if the direct index is not used, or if the feature
+   *   indexes of the vectors are out of the descriptors given
+   */
+  void matchFeatures(const FlatFeatureVector &fv, 
+    const std::vector<TDescriptor> &features, EntryId id,
+    const std::vector<TDescriptor> &entry_features, 
+    std::vector<FeatureMatch> &matches, 
+    const MatchOptions &options = MatchOptions()) const;
+
+  /**
+   * Matches the features of a query with those of several entries
+   * @param fv flat feature vector of the query, obtained with the 
+   *   levelsup of the direct index of the shards
+   * @param features descriptors of the query
+   * @param ids global entry ids (each one < size())
+   * @param entry_features descriptors of each entry, which are not copied
+   * @param matches (out) accepted matches with each entry
+   * @param options options to accept the matches
+   * @param pool if given, threads to match the entries in parallel
+   * @throw std::string if the direct index is not used, or if the feature
+   *   indexes of the vectors are out of the descriptors given
+   */
+  void matchFeatures(const FlatFeatureVector &fv, 
+    const std::vector<TDescriptor> &features, 
+    const std::vector<EntryId> &ids,
+    const std::vector<const std::vector<TDescriptor>*> &entry_features, 
+    std::vector<std::vector<FeatureMatch> > &matches, 
+    const MatchOptions &options = MatchOptions(), 
+    ThreadPool *pool = NULL) const;
+
+  /**
+   * Queries all the shards with some features
+   * @param features query features
+   * @param ret (out) query results, with global ids
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with global id <= max_id are returned.
+   *   < 0 means all
+   * @param pool if given, threads to query the shards in parallel
+   * @param stats if given, the work of the transform and of the
+   *   shards is added to it. The
+   *   results counted are those of the shards, before merging them
+   */
+  void query(const std::vector<TDescriptor> &features, QueryResults &ret,
+    int max_results = 1, int max_id = -1, ThreadPool *pool = NULL, 
+    QueryStats *stats = NULL) const;
+
+  /**
+   * Queries all the shards with a vector
+   * @param vec bow vector already normalized
+   * @param ret (out) query results, with global ids
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with global id <= max_id are returned.
+   *   < 0 means all
+   * @param pool if given, threads to query the shards in parallel
+   * @param stats if given, the work of the shards is added to it. The
+   *   results counted are those of the shards, before merging them
+   */
+  void query(const BowVector &vec, QueryResults &ret, int max_results = 1,
+    int max_id = -1, ThreadPool *pool = NULL, QueryStats *stats = NULL) 
+    const;
+
+  /**
+   * Queries all the shards with a flat vector
+   * @param vec flat bow vector already normalized
+   * @param ret (out) query results, with global ids
+   * @param max_results number of results to return. <= 0 means all
+   * @param max_id only entries with global id <= max_id are returned.
+   *   < 0 means all
+   * @param pool if given, threads to query the shards in parallel
+   * @param stats if given, the work of the shards is added to it. The
+   *   results counted are those of the shards, before merging them
+   */
+  void query(const FlatBowVector &vec, QueryResults &ret,
+    int max_results = 1, int max_id = -1, ThreadPool *pool = NULL, 
+    QueryStats *stats = NULL) const;
+
+  /**
+   * Merges the results of each shard, with local ids, into the best
+   * results of the database, with global ids. This is used to merge the
+   * results of shards queried elsewhere (e.g. in other processes, sent
+   * with QueryResults::serialize)
+   * @param parts results of each shard (one per shard, in order). Their
+   *   ids are changed to the global ones
+   * @param ret (out) merged results
+   * @param max_results number of results to return. <= 0 means all
+   */
+  void merge(std::vector<QueryResults> &parts, QueryResults &ret,
+    int max_results) const;
+
+  /**
+   * Returns the work done by the queries of all the shards on their 
+   * inverted files
+   * @return cumulative stats of the shards
+   */
+  QueryStats getStats() const;
+
+  /**
+   * Sets the cumulative stats of all the shards to 0
+   */
+  void resetStats() const;
+
+protected:
+
+  /// Place of an entry
+  struct Location
+  {
+    /// Shard index
+    unsigned int shard;
+    /// Id in the shard
+    EntryId id;
+
+    Location(): shard(0), id(0) {}
+  };
+
+  /**
+   * Gives a global id to the next entry of a shard, and stores its
+   * location before the shard publishes the entry. The entry must be
+   * added to the shard then, and m_nentries updated
+   * @param shard shard index
+   * @return global id of the new entry
+   */
+  EntryId newEntry(unsigned int shard);
+
+  /**
+   * Undoes newEntry when the shard could not add the entry, so that the
+   * global id is given to the next one. If the shard did add it before
+   * failing, the entry is kept and published
+   * @param shard shard index
+   */
+  void cancelEntry(unsigned int shard);
+
+  /**
+   * Creates the shards
+   * @param voc vocabulary
+   * @param nshards number of shards
+   * @param use_di
+   * @param di_levels
+   * @throw std::string if nshards is 0
+   */
+  void createShards(
+    const std::shared_ptr<const TemplatedVocabulary<TDescriptor, F> > &voc,
+    unsigned int nshards, bool use_di, int di_levels);
+
+  /**
+   * Returns the number of entries of a shard whose global id is lower than
+   * end_id
+   * @param shard shard index
+   * @param end_id global id
+   * @return number of local entries
+   */
+  EntryId localEnd(unsigned int shard, EntryId end_id) const;
+
+private:
+
+  TemplatedShardedDatabase(const TemplatedShardedDatabase &);
+  TemplatedShardedDatabase& operator=(const TemplatedShardedDatabase &);
+
+protected:
+
+  /// Shards
+  std::vector<TemplatedDatabase<TDescriptor, F, TWeight>*> m_shards;
+
+  /// Entries per shard when they are placed by id, or 0
+  unsigned int m_entries_per_shard;
+
+  /// Place of each entry, by global id
+  SegmentedVector<Location> m_locations;
+
+  /// Global id of the entries of each shard, by local id. They are in
+  /// ascending order
+  std::vector<SegmentedVector<EntryId> > m_global;
+
+  /// Entries added, published after their locations
+  std::atomic<unsigned int> m_nentries;
+};
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class T>
+TemplatedShardedDatabase<TDescriptor, F, TWeight>::TemplatedShardedDatabase
+  (const T &voc, unsigned int nshards, unsigned int entries_per_shard,
+  bool use_di, int di_levels)
+  : m_entries_per_shard(entries_per_shard), m_global(nshards),
+    m_nentries(0)
+{
+  // the shards share a single copy of the vocabulary
+  std::shared_ptr<const TemplatedVocabulary<TDescriptor, F> > 
+    shared(new T(voc));
+  createShards(shared, nshards, use_di, di_levels);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+template<class T>
+TemplatedShardedDatabase<TDescriptor, F, TWeight>::TemplatedShardedDatabase
+  (const std::shared_ptr<T> &voc, unsigned int nshards, 
+  unsigned int entries_per_shard, bool use_di, int di_levels)
+  : m_entries_per_shard(entries_per_shard), m_global(nshards),
+    m_nentries(0)
+{
+  createShards(voc, nshards, use_di, di_levels);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+TemplatedShardedDatabase<TDescriptor, F, TWeight>::~TemplatedShardedDatabase()
+{
+  for(size_t i = 0; i < m_shards.size(); ++i) delete m_shards[i];
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline const TemplatedVocabulary<TDescriptor,F>*
+TemplatedShardedDatabase<TDescriptor, F, TWeight>::getVocabulary() const
+{
+  return m_shards[0]->getVocabulary();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline unsigned int TemplatedShardedDatabase<TDescriptor, F, TWeight>::shards()
+  const
+{
+  return (unsigned int)m_shards.size();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline const TemplatedDatabase<TDescriptor, F, TWeight>&
+TemplatedShardedDatabase<TDescriptor, F, TWeight>::shard(unsigned int i) const
+{
+  return *m_shards[i];
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedShardedDatabase<TDescriptor, F, TWeight>::add(
+  const std::vector<TDescriptor> &features,
+  BowVector *bowvec, FeatureVector *fvec)
+{
+  if(m_entries_per_shard == 0)
+    throw std::string("TemplatedShardedDatabase: a shard must be given");
+
+  const unsigned int shard =
+    m_nentries.load(std::memory_order_relaxed) / m_entries_per_shard;
+  if(shard >= m_shards.size())
+    throw std::string("TemplatedShardedDatabase: all the shards are full");
+
+  return add(shard, features, bowvec, fvec);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedShardedDatabase<TDescriptor, F, TWeight>::add(
+  unsigned int shard, const std::vector<TDescriptor> &features, 
+  BowVector *bowvec, FeatureVector *fvec)
+{
+  if(shard >= m_shards.size())
+    throw std::string("TemplatedShardedDatabase: shard out of range");
+
+  const EntryId id = newEntry(shard);
+  try
+  {
+    m_shards[shard]->add(features, bowvec, fvec);
+  }
+  catch(...)
+  {
+    cancelEntry(shard);
+    throw;
+  }
+  m_nentries.store(id + 1, std::memory_order_release);
+  return id;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedShardedDatabase<TDescriptor, F, TWeight>::add(
+  unsigned int shard, const FlatBowVector &vec, const FlatFeatureVector &fec)
+{
+  if(shard >= m_shards.size())
+    throw std::string("TemplatedShardedDatabase: shard out of range");
+
+  const EntryId id = newEntry(shard);
+  try
+  {
+    m_shards[shard]->add(vec, fec);
+  }
+  catch(...)
+  {
+    cancelEntry(shard);
+    throw;
+  }
+  m_nentries.store(id + 1, std::memory_order_release);
+  return id;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::seal(
+  unsigned int shard, ThreadPool *pool)
+{
+  if(shard >= m_shards.size())
+    throw std::string("TemplatedShardedDatabase: shard out of range");
+
+  m_shards[shard]->seal(pool);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedShardedDatabase<TDescriptor, F, TWeight>::newEntry(
+  unsigned int shard)
+{
+  const EntryId id = m_nentries.load(std::memory_order_relaxed);
+
+  // the readers of the shard must find the global id of the new entry as
+  // soon as the shard publishes it
+  Location loc;
+  loc.shard = shard;
+  loc.id = m_shards[shard]->size();
+  m_locations.push_back(loc);
+  m_global[shard].push_back(id);
+
+  return id;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::cancelEntry(
+  unsigned int shard)
+{
+  const EntryId id = (EntryId)m_locations.size() - 1;
+
+  if(m_shards[shard]->size() > m_locations[id].id)
+  {
+    m_nentries.store(id + 1, std::memory_order_release);
+  }
+  else
+  {
+    // the shard never published the entry, so no reader found its id
+    m_locations.resize(id);
+    m_global[shard].resize(m_global[shard].size() - 1);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::remove(EntryId id)
+{
+  const Location &loc = m_locations[id];
+  m_shards[loc.shard]->remove(loc.id);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline bool TemplatedShardedDatabase<TDescriptor, F, TWeight>::isRemoved(
+  EntryId id) const
+{
+  const Location &loc = m_locations[id];
+  return m_shards[loc.shard]->isRemoved(loc.id);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline unsigned int TemplatedShardedDatabase<TDescriptor, F, TWeight>::size()
+  const
+{
+  return m_nentries.load(std::memory_order_acquire);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline unsigned int TemplatedShardedDatabase<TDescriptor, F, TWeight>::shardOf(
+  EntryId id) const
+{
+  return m_locations[id].shard;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline EntryId TemplatedShardedDatabase<TDescriptor, F, TWeight>::localId(
+  EntryId id) const
+{
+  return m_locations[id].id;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline EntryId TemplatedShardedDatabase<TDescriptor, F, TWeight>::globalId(
+  unsigned int shard, EntryId id) const
+{
+  return m_global[shard][id];
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline const FeatureVector&
+TemplatedShardedDatabase<TDescriptor, F, TWeight>::retrieveFeatures(
+  EntryId id) const
+{
+  const Location &loc = m_locations[id];
+  return m_shards[loc.shard]->retrieveFeatures(loc.id);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+inline const FlatFeatureVector&
+TemplatedShardedDatabase<TDescriptor, F, TWeight>::retrieveFlatFeatures(
+  EntryId id) const
+{
+  const Location &loc = m_locations[id];
+  return m_shards[loc.shard]->retrieveFlatFeatures(loc.id);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::matchFeatures(
+  const FlatFeatureVector &fv, const std::vector<TDescriptor> &features, 
+  EntryId id, const std::vector<TDescriptor> &entry_features, 
+  std::vector<FeatureMatch> &matches, const MatchOptions &options) const
+{
+  const Location &loc = m_locations[id];
+  m_shards[loc.shard]->matchFeatures(fv, features, loc.id, entry_features,
+    matches, options);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::matchFeatures(
+  const FlatFeatureVector &fv, const std::vector<TDescriptor> &features, 
+  const std::vector<EntryId> &ids,
+  const std::vector<const std::vector<TDescriptor>*> &entry_features, 
+  std::vector<std::vector<FeatureMatch> > &matches, 
+  const MatchOptions &options, ThreadPool *pool) const
+{
+  if(entry_features.size() != ids.size())
+    throw std::string("The descriptors of each entry are needed");
+
+  matches.resize(ids.size());
+
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+  {
+    for(size_t i = begin; i < end; ++i)
+    {
+      matchFeatures(fv, features, ids[i], *entry_features[i], matches[i], 
+        options);
+    }
+  };
+
+  if(pool) pool->parallelFor(ids.size(), f, 1);
+  else f(0, ids.size());
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::query(
+  const std::vector<TDescriptor> &features, QueryResults &ret,
+  int max_results, int max_id, ThreadPool *pool, QueryStats *stats) const
+{
+  // the features are converted once for all the shards
+  FlatBowVector vec;
+  getVocabulary()->transform(features, vec, NULL, stats);
+  query(vec, ret, max_results, max_id, pool, stats);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::query(
+  const BowVector &vec, QueryResults &ret, int max_results, int max_id,
+  ThreadPool *pool, QueryStats *stats) const
+{
+  query(FlatBowVector(vec), ret, max_results, max_id, pool, stats);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::query(
+  const FlatBowVector &vec, QueryResults &ret, int max_results, int max_id,
+  ThreadPool *pool, QueryStats *stats) const
+{
+  // all the shards see the same entries, bounded by max_id as in a 
+  // single database
+  EntryId end_id = size();
+  if(max_id != -1)
+    end_id = (max_id <= 0 ? 0 : std::min(end_id, (EntryId)max_id));
+
+  std::vector<QueryResults> parts(m_shards.size());
+
+  // each shard counts its work apart
+  std::vector<QueryStats> shard_stats(stats ? m_shards.size() : 0);
+
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+  {
+    for(size_t i = begin; i < end; ++i)
+    {
+      // max_id -1 would mean all the entries of the shard
+      const EntryId n = localEnd((unsigned int)i, end_id);
+      if(n > 0)
+      {
+        m_shards[i]->query(vec, parts[i], max_results, (int)n,
+          stats ? &shard_stats[i] : NULL);
+      }
+    }
+  };
+
+  if(pool && m_shards.size() > 1) pool->parallelFor(m_shards.size(), f, 1);
+  else f(0, m_shards.size());
+
+  for(size_t i = 0; i < shard_stats.size(); ++i) *stats += shard_stats[i];
+
+  merge(parts, ret, max_results);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::merge(
+  std::vector<QueryResults> &parts, QueryResults &ret,
+  int max_results) const
+{
+  for(size_t i = 0; i < parts.size() && i < m_shards.size(); ++i)
+  {
+    QueryResults::iterator rit;
+    for(rit = parts[i].begin(); rit != parts[i].end(); ++rit)
+      rit->Id = m_global[i][rit->Id];
+  }
+
+  // only the KL scores are better the lower they are
+  const bool ascending = (getVocabulary()->getScoringType() == KL);
+  QueryResults::merge(parts, ret, max_results, ascending);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+QueryStats TemplatedShardedDatabase<TDescriptor, F, TWeight>::getStats() 
+  const
+{
+  QueryStats s;
+  for(size_t i = 0; i < m_shards.size(); ++i) s += m_shards[i]->getStats();
+  return s;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::resetStats() const
+{
+  for(size_t i = 0; i < m_shards.size(); ++i) m_shards[i]->resetStats();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+void TemplatedShardedDatabase<TDescriptor, F, TWeight>::createShards(
+  const std::shared_ptr<const TemplatedVocabulary<TDescriptor, F> > &voc,
+  unsigned int nshards, bool use_di, int di_levels)
+{
+  if(nshards == 0)
+    throw std::string("TemplatedShardedDatabase: no shards");
+
+  m_shards.reserve(nshards);
+  for(unsigned int i = 0; i < nshards; ++i)
+  {
+    m_shards.push_back(
+      new TemplatedDatabase<TDescriptor, F, TWeight>(voc, use_di, di_levels));
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TWeight>
+EntryId TemplatedShardedDatabase<TDescriptor, F, TWeight>::localEnd(
+  unsigned int shard, EntryId end_id) const
+{
+  // the global ids of a shard ascend, so the first local entry with a
+  // global id >= end_id is searched for
+  EntryId lo = 0, hi = m_shards[shard]->size();
+  while(lo < hi)
+  {
+    const EntryId mid = lo + (hi - lo) / 2;
+    if(m_global[shard][mid] < end_id) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
+
+#endif
@@ -12,16 +12,34 @@
 
 #include <cassert>
 #include <cstdlib>
+#include <cstdio>
 #include <vector>
 #include <numeric>
 #include <fstream>
 #include <string>
+#include <cstring>
+#include <memory>
 #include <algorithm>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <mutex>
 #include <opencv2/core.hpp>
 
 #include "FeatureVector.h"
 #include "BowVector.h"
+#include "FlatBowVector.h"
+#include "FlatFeatureVector.h"
 #include "ScoringObject.h"
+#include "DescriptorTraits.h"
+#include "DistanceKernels.h"
+#include "ThreadPool.h"
+#include "BinaryIO.h"
+#include "DescriptorDump.h"
+#include "QueryStats.h"
+#include "GpuTree.h"
+#include "DescriptorMatrix.h"
+#include "KMeansOptions.h"
 
 namespace DBoW2 {
 
@@ -103,6 +121,65 @@ public:
     (const std::vector<std::vector<TDescriptor> > &training_features,
       int k, int L, WeightingType weighting, ScoringType scoring);
 
+  /**
+   * Creates a vocabulary from the training features with the already 
+   * defined parameters, building the tree in parallel. Sibling subtrees are
+   * clustered as separate tasks, and the descriptors of large nodes are
+   * assigned to their clusters in parallel. Each node draws its random 
+   * choices from its own generator, seeded from rand(), so that the tree 
+   * depends on the seed of rand() but not on the number of threads. Node 
+   * ids are given in the same order as in the serial version, but the 
+   * tree is not the same as the one it creates with the same seed
+   * @param training_features
+   * @param pool threads to use
+   */
+  void create(const std::vector<std::vector<TDescriptor> > &training_features,
+    ThreadPool &pool);
+
+  /**
+   * Creates a vocabulary with the already defined parameters from the 
+   * images of a descriptor file, keeping at most max_descriptors 
+   * descriptors in memory. The first levels of the tree are clustered with
+   * a random sample of the descriptors. All the descriptors are then split
+   * into temporary files by the leaf of those levels they reach, and the 
+   * subtree of each leaf is clustered on its own, with a sample of its 
+   * descriptors if they are too many. The idf weights are computed from all
+   * the images. The random choices are seeded from rand()
+   * @param source training images
+   * @param max_descriptors descriptors to keep in memory at a time
+   * @param tmp_prefix prefix of the names of the temporary files, which
+   *   are removed when this returns or throws
+   * @param pool if given, threads to use
+   * @throw std::string if the files cannot be read or written
+   */
+  void create(TemplatedDescriptorReader<TDescriptor, F> &source,
+    size_t max_descriptors, const std::string &tmp_prefix, 
+    ThreadPool *pool = NULL);
+
+  /**
+   * Recomputes the idf weights of the words from a new set of images, 
+   * without changing the tree. Words that do not occur in any image get 
+   * weight 0. With TF or BINARY weighting, all the weights are set to 1
+   * @param features descriptors of each image
+   * @param pool if given, threads to quantize the images with
+   */
+  void recomputeWeights
+    (const std::vector<std::vector<TDescriptor> > &features, 
+      ThreadPool *pool = NULL);
+
+  /**
+   * Updates the idf weights of the words by adding a new set of images to
+   * those the weights were computed from. The document frequencies are not
+   * saved in the vocabulary files, so this is only possible after create or
+   * recomputeWeights. With TF or BINARY weighting, nothing changes
+   * @param features descriptors of each new image
+   * @param pool if given, threads to quantize the images with
+   * @throw std::string if the document frequencies are unknown
+   */
+  void extendWeights
+    (const std::vector<std::vector<TDescriptor> > &features, 
+      ThreadPool *pool = NULL);
+
   /**
    * Returns the number of words in the vocabulary
    * @return number of words
@@ -133,12 +210,175 @@ public:
   virtual void transform(const std::vector<TDescriptor>& features,
     BowVector &v, FeatureVector &fv, int levelsup) const;
 
+  /**
+   * Transforms a set of descriptors into a bow vector, quantizing them in
+   * parallel. The result is identical to that of the serial version
+   * @param features
+   * @param v (out) bow vector of weighted words
+   * @param pool threads to quantize the descriptors with
+   */
+  virtual void transform(const std::vector<TDescriptor>& features, 
+    BowVector &v, ThreadPool &pool) const;
+
+  /**
+   * Transforms a set of descriptors into a bow vector and a feature vector,
+   * quantizing them in parallel. The result is identical to that of the 
+   * serial version
+   * @param features
+   * @param v (out) bow vector
+   * @param fv (out) feature vector of nodes and feature indexes
+   * @param levelsup levels to go up the vocabulary tree to get the node index
+   * @param pool threads to quantize the descriptors with
+   */
+  virtual void transform(const std::vector<TDescriptor>& features,
+    BowVector &v, FeatureVector &fv, int levelsup, ThreadPool &pool) const;
+
+  /**
+   * Transforms a set of descriptors into a flat bow vector. The words and
+   * values are the same as those of the BowVector version
+   * @param features
+   * @param v (out) flat bow vector
+   * @param pool if given, threads to quantize the descriptors with
+   * @param stats if given, the work of the transform is added to it
+   */
+  void transform(const std::vector<TDescriptor>& features, 
+    FlatBowVector &v, ThreadPool *pool = NULL, QueryStats *stats = NULL) 
+    const;
+
+  /**
+   * Transforms a set of descriptors into a flat bow vector and a flat
+   * feature vector. The content is the same as that of the BowVector and 
+   * FeatureVector version
+   * @param features
+   * @param v (out) flat bow vector
+   * @param fv (out) flat feature vector of nodes and feature indexes
+   * @param levelsup levels to go up the vocabulary tree to get the node index
+   * @param pool if given, threads to quantize the descriptors with
+   * @param stats if given, the work of the transform is added to it
+   */
+  void transform(const std::vector<TDescriptor>& features,
+    FlatBowVector &v, FlatFeatureVector &fv, int levelsup, 
+    ThreadPool *pool = NULL, QueryStats *stats = NULL) const;
+
+  /**
+   * Transforms the descriptors stored in the rows of a matrix into a bow
+   * vector, reading them in place. The vector is the same as that of the
+   * transform of the std::vector of these descriptors. Only descriptors
+   * with a packed representation can be read from a matrix
+   * @param features N rows of DescriptorTraits<F>::bytes bytes, such as
+   *   the cv::Mat computed by an OpenCV extractor
+   * @param v (out) bow vector of weighted words
+   * @param pool if given, threads to quantize the descriptors with
+   * @param stats if given, the work of the transform is added to it
+   * @throw std::string if the rows are not packed descriptors of F
+   */
+  void transform(const DescriptorMatrix &features, BowVector &v, 
+    ThreadPool *pool = NULL, QueryStats *stats = NULL) const;
+
+  /**
+   * Transforms the descriptors stored in the rows of a matrix into a bow
+   * vector and a feature vector, reading them in place
+   * @param features N rows of DescriptorTraits<F>::bytes bytes
+   * @param v (out) bow vector
+   * @param fv (out) feature vector of nodes and row indexes
+   * @param levelsup levels to go up the vocabulary tree to get the node index
+   * @param pool if given, threads to quantize the descriptors with
+   * @param stats if given, the work of the transform is added to it
+   * @throw std::string if the rows are not packed descriptors of F
+   */
+  void transform(const DescriptorMatrix &features, BowVector &v, 
+    FeatureVector &fv, int levelsup, ThreadPool *pool = NULL, 
+    QueryStats *stats = NULL) const;
+
+  /**
+   * Transforms the descriptors stored in the rows of a matrix into a flat
+   * bow vector, reading them in place
+   * @param features N rows of DescriptorTraits<F>::bytes bytes
+   * @param v (out) flat bow vector
+   * @param pool if given, threads to quantize the descriptors with
+   * @param stats if given, the work of the transform is added to it
+   * @throw std::string if the rows are not packed descriptors of F
+   */
+  void transform(const DescriptorMatrix &features, FlatBowVector &v, 
+    ThreadPool *pool = NULL, QueryStats *stats = NULL) const;
+
+  /**
+   * Transforms the descriptors stored in the rows of a matrix into a flat
+   * bow vector and a flat feature vector, reading them in place
+   * @param features N rows of DescriptorTraits<F>::bytes bytes
+   * @param v (out) flat bow vector
+   * @param fv (out) flat feature vector of nodes and row indexes
+   * @param levelsup levels to go up the vocabulary tree to get the node index
+   * @param pool if given, threads to quantize the descriptors with
+   * @param stats if given, the work of the transform is added to it
+   * @throw std::string if the rows are not packed descriptors of F
+   */
+  void transform(const DescriptorMatrix &features, FlatBowVector &v, 
+    FlatFeatureVector &fv, int levelsup, ThreadPool *pool = NULL, 
+    QueryStats *stats = NULL) const;
+
   /**
    * Transforms a single feature into a word (without weight)
    * @param feature
    * @return word id
    */
   virtual WordId transform(const TDescriptor& feature) const;
+
+  /**
+   * Copies the tree to the GPU, to quantize large batches of descriptors
+   * with it. The descriptors must be binary (DescriptorTraits<F>::hamming),
+   * as those of FORB, FBrief and FBRISK. The tree must be uploaded again
+   * if the vocabulary changes
+   * @param gpu (out) tree in GPU memory
+   * @throw std::string if the vocabulary is empty, its descriptors are not
+   *   binary or the GPU backend is not available
+   */
+  void uploadTree(GpuTree &gpu) const;
+
+  /**
+   * Quantizes a batch of descriptors on the GPU. The results are the same
+   * as those of the CPU transform
+   * @param features
+   * @param ids (out) word id of each feature
+   * @param weights (out) word weight of each feature
+   * @param nids (out) if given, id of the node "levelsup" levels up of each
+   *   feature
+   * @param levelsup
+   * @param gpu tree uploaded from this vocabulary
+   * @throw std::string if the GPU fails
+   */
+  void quantize(const std::vector<TDescriptor> &features,
+    std::vector<WordId> &ids, std::vector<WordValue> &weights,
+    std::vector<NodeId> *nids, int levelsup, const GpuTree &gpu) const;
+
+  /**
+   * Transforms the descriptors of many images with a single batch on the
+   * GPU. The vectors are the same as those of the CPU transform
+   * @param features descriptors of each image
+   * @param v (out) bow vector of each image
+   * @param fv (out) if given, feature vector of each image
+   * @param levelsup levels to go up the vocabulary tree to get the nodes of
+   *   the feature vectors
+   * @param gpu tree uploaded from this vocabulary
+   * @throw std::string if the GPU fails
+   */
+  void transform(const std::vector<std::vector<TDescriptor> > &features,
+    std::vector<BowVector> &v, std::vector<FeatureVector> *fv, int levelsup,
+    const GpuTree &gpu) const;
+
+  /**
+   * Returns the work done by all the transforms of the vocabulary, 
+   * including those of the queries of the databases that use it. The
+   * counters are only updated if DBOW2_ENABLE_STATS is defined
+   * @return cumulative stats
+   */
+  inline QueryStats getStats() const;
+
+  /**
+   * Sets the cumulative stats to 0. They are not part of the contents of
+   * the vocabulary, so this can be done on a shared vocabulary
+   */
+  inline void resetStats() const;
   
   /**
    * Returns the score of two vectors
@@ -148,6 +388,15 @@ public:
    * @note the vectors must be already sorted and normalized if necessary
    */
   inline double score(const BowVector &a, const BowVector &b) const;
+
+  /**
+   * Returns the score of two flat vectors
+   * @param a vector
+   * @param b vector
+   * @return score between vectors
+   * @note the vectors must be already normalized if necessary
+   */
+  inline double score(const FlatBowVector &a, const FlatBowVector &b) const;
   
   /**
    * Returns the id of the node that is "levelsup" levels from the word given
@@ -221,18 +470,69 @@ public:
    * @param type new scoring type
    */
   void setScoringType(ScoringType type);
+
+  /**
+   * Returns the options of the kmeans run by create
+   * @return kmeans options
+   */
+  inline const KMeansOptions& getKMeansOptions() const { return m_kmeans; }
+
+  /**
+   * Changes the options of the kmeans run by create. They only affect the
+   * next vocabularies created, and they are not saved
+   * @param options new kmeans options
+   */
+  inline void setKMeansOptions(const KMeansOptions &options)
+  {
+    m_kmeans = options;
+  }
   
   /**
-   * Saves the vocabulary into a file
+   * Saves the vocabulary into a file. If filename ends with .dbow2, the
+   * binary format is used, and a cv::FileStorage file otherwise
    * @param filename
    */
   void save(const std::string &filename) const;
   
   /**
-   * Loads the vocabulary from a file
+   * Loads the vocabulary from a file. If filename ends with .dbow2, it is
+   * read as a binary file, and as a cv::FileStorage file otherwise
    * @param filename
    */
   void load(const std::string &filename);
+
+  /**
+   * Saves the vocabulary into a binary file, whatever its extension
+   * @param filename
+   */
+  void saveBinary(const std::string &filename) const;
+
+  /**
+   * Writes the content of a binary vocabulary file into a buffer
+   * @param buffer (out) file content
+   */
+  void saveBinary(std::vector<unsigned char> &buffer) const;
+
+  /**
+   * Loads the vocabulary from a binary file, whatever its extension. The
+   * file is mapped in memory, and the packed descriptors are used from
+   * there without copying them, so that the processes that load the same
+   * file share them
+   * @param filename
+   */
+  void loadBinary(const std::string &filename);
+
+  /**
+   * Loads the vocabulary from a binary vocabulary stored in a region of a
+   * mapped file (e.g. embedded in a binary database file). The mapping is
+   * kept as long as the vocabulary uses its descriptors
+   * @param file mapped file
+   * @param offset offset of the vocabulary in the file, multiple of 64
+   * @param size bytes of the vocabulary
+   * @param filename name of the file, for the error messages
+   */
+  void loadBinary(const std::shared_ptr<const MappedFile> &file, 
+    size_t offset, size_t size, const std::string &filename);
   
   /** 
    * Saves the vocabulary to a file storage structure
@@ -304,6 +604,131 @@ protected:
     inline bool isLeaf() const { return children.empty(); }
   };
 
+  /// Buffers used by the kmeans of a node, kept for the next nodes of the
+  /// same tree level, so that training does not allocate memory again for
+  /// every node and iteration
+  struct KMeansLevel
+  {
+    /// Descriptors of the node, if it is not the first one clustered
+    std::vector<pDescriptor> descriptors;
+    /// Clusters of the node
+    std::vector<TDescriptor> clusters;
+    /// Cluster of each descriptor
+    std::vector<int> association;
+    /// Association of the previous iteration
+    std::vector<int> last_association;
+    /// Indexes of the descriptors sorted by cluster, in the same order
+    /// within each cluster. The descriptors of cluster c are 
+    /// order[offsets[c]] .. order[offsets[c+1] - 1]
+    std::vector<unsigned int> order;
+    /// First index in order of each cluster, plus the end
+    std::vector<unsigned int> offsets;
+    /// Descriptors of a cluster, to calculate its mean
+    std::vector<pDescriptor> cluster_descriptors;
+    /// Leaf reached by each descriptor of a child
+    std::vector<NodeId> leaves;
+    /// Random descriptors of the node, to seed the clusters with or as
+    /// the batch of a mini-batch kmeans iteration
+    std::vector<pDescriptor> sample;
+    /// Cluster of each descriptor of the batch
+    std::vector<int> sample_association;
+  };
+
+  /// Frozen version of the tree used to transform features. 
+  /// Nodes are stored in breadth-first order, so that the children of a node
+  /// are contiguous, and their data are kept in parallel arrays. The index 
+  /// of a node in these arrays (its frozen index) is not its node id
+  struct FrozenTree
+  {
+    /// Frozen index of the first child of each node
+    std::vector<unsigned int> first_child;
+    /// Number of children of each node (0 for words)
+    std::vector<unsigned int> nchildren;
+    /// Node id of each node
+    std::vector<NodeId> node_id;
+    /// Word id of each node (only valid for words)
+    std::vector<WordId> word_id;
+    /// Weight of each node (only valid for words)
+    std::vector<WordValue> weight;
+    /// Packed descriptors (DescriptorTraits<F>::bytes each), if F supports it
+    std::vector<uint64_t> packed;
+    /// Binary file with the packed descriptors, used instead of packed if set
+    std::shared_ptr<const MappedFile> mapping;
+    /// Offset of the packed descriptors in mapping
+    size_t packed_offset;
+    /// Descriptors, if F does not support packing
+    std::vector<TDescriptor> descriptors;
+    /// Frozen index of each node id
+    std::vector<unsigned int> index;
+
+    /**
+     * Creates an empty frozen tree
+     */
+    FrozenTree(): packed_offset(0) {}
+
+    /**
+     * Returns whether the frozen tree has not been built
+     * @return true iff there is no data
+     */
+    inline bool empty() const { return node_id.empty(); }
+
+    /**
+     * Returns the packed descriptor of a node
+     * @param i frozen index
+     * @return pointer to the packed descriptor
+     */
+    inline const unsigned char* packedDescriptor(unsigned int i) const
+    {
+      const unsigned char *base = mapping ? mapping->data() + packed_offset :
+        reinterpret_cast<const unsigned char*>(&packed[0]);
+      return base + (size_t)i * DescriptorTraits<F>::bytes;
+    }
+  };
+
+  /// Header of binary vocabulary files
+  struct BinaryHeader
+  {
+    /// "DBoW2VOC"
+    char magic[8];
+    /// Version of the format
+    uint32_t version;
+    /// 0x01020304, to check the byte order
+    uint32_t byte_order;
+    /// Bytes of the file
+    uint64_t file_size;
+    /// Checksum of the file, calculated with this field set to 0
+    uint64_t checksum;
+    /// Branching factor
+    int32_t k;
+    /// Depth levels
+    int32_t L;
+    /// Weighting type
+    int32_t weighting;
+    /// Scoring type
+    int32_t scoring;
+    /// Number of nodes, including the root
+    uint32_t nnodes;
+    /// Number of words
+    uint32_t nwords;
+    /// Bytes of a packed descriptor, or 0 if they are stored as strings
+    uint32_t descriptor_bytes;
+    /// Bytes of a weight
+    uint32_t weight_bytes;
+    /// Name of the descriptor (DescriptorTraits<F>::name)
+    char descriptor[16];
+    /// Offset of the node section
+    uint64_t nodes_offset;
+    /// Offset of the weight section
+    uint64_t weights_offset;
+    /// Offset of the descriptor section
+    uint64_t descriptors_offset;
+    /// Bytes of the descriptor section
+    uint64_t descriptors_size;
+  };
+
+  /// Version of the binary format written by saveBinary
+  static const uint32_t BINARY_VERSION = 1;
+
 protected:
 
   /**
@@ -331,12 +756,115 @@ protected:
   virtual void transform(const TDescriptor &feature, 
     WordId &id, WordValue &weight, NodeId* nid = NULL, int levelsup = 0) const;
 
+  /**
+   * Returns the word id associated to a feature, as above, counting the
+   * distances computed and the levels descended
+   * @param feature
+   * @param id (out) word id
+   * @param weight (out) word weight
+   * @param nid (out) if given, id of the node "levelsup" levels up
+   * @param levelsup
+   * @param stats if given, the work done is added to it
+   */
+  void transform(const TDescriptor &feature, WordId &id, WordValue &weight, 
+    NodeId* nid, int levelsup, QueryStats *stats) const;
+
   /**
    * Returns the word id associated to a feature
    * @param feature
    * @param id (out) word id
    */
   virtual void transform(const TDescriptor &feature, WordId &id) const;
+
+  /**
+   * Returns the word id associated to a packed feature, as the transform
+   * of the descriptor does
+   * @param q packed feature (DescriptorTraits<F>::bytes bytes)
+   * @param id (out) word id
+   * @param weight (out) word weight
+   * @param nid (out) if given, id of the node "levelsup" levels up
+   * @param levelsup
+   * @param stats if given, the work done is added to it
+   */
+  void transformPacked(const unsigned char *q, WordId &id, 
+    WordValue &weight, NodeId *nid, int levelsup, QueryStats *stats) const;
+
+  /**
+   * Quantizes a set of features in parallel
+   * @param features
+   * @param ids (out) word id of each feature
+   * @param weights (out) word weight of each feature
+   * @param nids (out) if given, id of the node "levelsup" levels up of each
+   *   feature
+   * @param levelsup
+   * @param pool if given, threads to quantize with. Otherwise, the features
+   *   are quantized in the calling thread
+   * @param stats if given, the work done is added to it
+   */
+  void quantize(const std::vector<TDescriptor> &features,
+    std::vector<WordId> &ids, std::vector<WordValue> &weights,
+    std::vector<NodeId> *nids, int levelsup, ThreadPool *pool, 
+    QueryStats *stats = NULL) const;
+
+  /**
+   * Quantizes the rows of a descriptor matrix in parallel
+   * @param features N rows of DescriptorTraits<F>::bytes bytes
+   * @param ids (out) word id of each row
+   * @param weights (out) word weight of each row
+   * @param nids (out) if given, id of the node "levelsup" levels up of each
+   *   row
+   * @param levelsup
+   * @param pool if given, threads to quantize with. Otherwise, the rows
+   *   are quantized in the calling thread
+   * @param stats if given, the work done is added to it
+   * @throw std::string if the rows are not packed descriptors of F
+   */
+  void quantize(const DescriptorMatrix &features,
+    std::vector<WordId> &ids, std::vector<WordValue> &weights,
+    std::vector<NodeId> *nids, int levelsup, ThreadPool *pool, 
+    QueryStats *stats) const;
+
+  /**
+   * Builds the bow vector (and the feature vector) of a set of quantized
+   * features by adding them in order, as the serial transform does
+   * @param ids word id of each feature
+   * @param weights word weight of each feature
+   * @param nids if given, node id of each feature
+   * @param v (out) bow vector
+   * @param fv (out) if given, feature vector
+   */
+  void buildVectors(const std::vector<WordId> &ids, 
+    const std::vector<WordValue> &weights, const std::vector<NodeId> *nids,
+    BowVector &v, FeatureVector *fv) const;
+
+  /**
+   * Builds the flat bow vector (and the flat feature vector) of a set of
+   * quantized features. The values of repeated words are added in feature
+   * order, so that they are the same as those of buildVectors
+   * @param ids word id of each feature
+   * @param weights word weight of each feature
+   * @param nids if given, node id of each feature
+   * @param v (out) flat bow vector
+   * @param fv (out) if given, flat feature vector
+   */
+  void buildFlatVectors(const std::vector<WordId> &ids, 
+    const std::vector<WordValue> &weights, const std::vector<NodeId> *nids,
+    FlatBowVector &v, FlatFeatureVector *fv) const;
+
+  /**
+   * Quantizes packed descriptors on the GPU
+   * @param packed n packed descriptors (DescriptorTraits<F>::bytes each)
+   * @param n number of descriptors
+   * @param ids (out) word id of each descriptor
+   * @param weights (out) word weight of each descriptor
+   * @param nids (out) if given, id of the node "levelsup" levels up of each
+   *   descriptor
+   * @param levelsup
+   * @param gpu tree uploaded from this vocabulary
+   */
+  void quantizePacked(const unsigned char *packed, size_t n,
+    std::vector<WordId> &ids, std::vector<WordValue> &weights,
+    std::vector<NodeId> *nids, int levelsup, const GpuTree &gpu) const;
       
   /**
    * Creates a level in the tree, under the parent, by running kmeans with
@@ -344,9 +872,102 @@ protected:
    * @param parent_id id of parent node
    * @param descriptors descriptors to run the kmeans on
    * @param current_level current level in the tree
+   * @param leaves (out) if given, leaf node reached by each descriptor
    */
   void HKmeansStep(NodeId parent_id, const std::vector<pDescriptor> &descriptors,
-    int current_level);
+    int current_level, std::vector<NodeId> *leaves = NULL);
+
+  /**
+   * Creates a level in the tree of the given nodes, as HKmeansStep above.
+   * If a generator is given, it is used instead of rand(), and the 
+   * subtrees are built with generators seeded from it
+   * @param nodes tree to add the nodes to
+   * @param parent_id id of parent node in nodes
+   * @param descriptors descriptors to run the kmeans on
+   * @param current_level current level in the tree
+   * @param leaves (out) if given, leaf node reached by each descriptor
+   * @param rng if given, random generator of this node
+   * @param pool if given, threads to build the subtrees and to cluster large
+   *   nodes with. It requires rng
+   * @param max_level last level to create
+   */
+  void HKmeansStep(std::vector<Node> &nodes, NodeId parent_id, 
+    const std::vector<pDescriptor> &descriptors, int current_level, 
+    std::vector<NodeId> *leaves, std::mt19937 *rng, ThreadPool *pool,
+    int max_level);
+
+  /**
+   * Creates a level in the tree of the given nodes, as HKmeansStep above,
+   * with the buffers of a workspace. The descriptors of each child are
+   * copied into the workspace level below, so they may already be there
+   * @param nodes tree to add the nodes to
+   * @param parent_id id of parent node in nodes
+   * @param descriptors descriptors to run the kmeans on
+   * @param current_level current level in the tree
+   * @param leaves (out) if given, leaf node reached by each descriptor
+   * @param rng if given, random generator of this node
+   * @param pool if given, threads to build the subtrees and to cluster large
+   *   nodes with. It requires rng
+   * @param max_level last level to create
+   * @param workspace buffers of levels current_level..max_level
+   */
+  void HKmeansStep(std::vector<Node> &nodes, NodeId parent_id, 
+    const std::vector<pDescriptor> &descriptors, int current_level, 
+    std::vector<NodeId> *leaves, std::mt19937 *rng, ThreadPool *pool,
+    int max_level, std::vector<KMeansLevel> &workspace);
+
+  /**
+   * Associates each descriptor with its closest cluster. Ties are resolved 
+   * in favour of the first cluster, as in transform
+   * @param descriptors
+   * @param clusters
+   * @param association (out) index of the cluster of each descriptor
+   * @param pool if given, threads to split the descriptors among
+   */
+  void assignClusters(const std::vector<pDescriptor> &descriptors,
+    const std::vector<TDescriptor> &clusters, 
+    std::vector<int> &association, ThreadPool *pool = NULL) const;
+
+  /**
+   * Sorts the indexes of the descriptors by cluster, keeping the order of
+   * the descriptors of each cluster
+   * @param association cluster of each descriptor
+   * @param nclusters number of clusters
+   * @param order (out) indexes of the descriptors sorted by cluster
+   * @param offsets (out) first index in order of each cluster, plus the end
+   */
+  static void sortByCluster(const std::vector<int> &association,
+    unsigned int nclusters, std::vector<unsigned int> &order,
+    std::vector<unsigned int> &offsets);
+
+  /**
+   * Seeds the clusters of a node with initiateClusters, giving it a random
+   * sample of the descriptors if they are more than the seeding sample of
+   * the kmeans options
+   * @param descriptors descriptors of the node
+   * @param clusters resulting clusters
+   * @param rng if given, random generator to use instead of rand()
+   * @param pool if given, threads of the seeding
+   * @param level buffers of the node
+   */
+  void seedClusters(const std::vector<pDescriptor> &descriptors,
+    std::vector<TDescriptor> &clusters, std::mt19937 *rng, ThreadPool *pool,
+    KMeansLevel &level) const;
+
+  /**
+   * Moves the seeded clusters of a node with mini-batch kmeans. Each batch
+   * of random descriptors is assigned to the clusters, and each centre is 
+   * replaced by the mean of its batch descriptors and of the old centre, 
+   * which weighs as many descriptors as it had got before (up to a batch)
+   * @param descriptors descriptors of the node
+   * @param clusters (in/out) clusters
+   * @param rng if given, random generator to use instead of rand()
+   * @param pool if given, threads of the assignments and of the means
+   * @param level buffers of the node
+   */
+  void miniBatchClusters(const std::vector<pDescriptor> &descriptors,
+    std::vector<TDescriptor> &clusters, std::mt19937 *rng, ThreadPool *pool,
+    KMeansLevel &level) const;
 
   /**
    * Creates k clusters from the given descriptors with some seeding algorithm.
@@ -355,15 +976,31 @@ protected:
    */
   virtual void initiateClusters(const std::vector<pDescriptor> &descriptors,
     std::vector<TDescriptor> &clusters) const;
+
+  /**
+   * Creates k clusters from the given descriptors with some seeding 
+   * algorithm, drawing the random numbers from the given generator. This 
+   * is used by the parallel create. By default, it runs kmeans++
+   * @param descriptors
+   * @param clusters resulting clusters
+   * @param rng random generator
+   * @param pool if given, threads to compute distances with
+   */
+  virtual void initiateClusters(const std::vector<pDescriptor> &descriptors,
+    std::vector<TDescriptor> &clusters, std::mt19937 &rng, 
+    ThreadPool *pool) const;
   
   /**
    * Creates k clusters from the given descriptor sets by running the
    * initial step of kmeans++
    * @param descriptors 
    * @param clusters resulting clusters
+   * @param rng if given, random generator to use instead of rand()
+   * @param pool if given, threads to compute distances with
    */
   void initiateClustersKMpp(const std::vector<pDescriptor> &descriptors,
-    std::vector<TDescriptor> &clusters) const;
+    std::vector<TDescriptor> &clusters, std::mt19937 *rng = NULL, 
+    ThreadPool *pool = NULL) const;
   
   /**
    * Create the words of the vocabulary once the tree has been built
@@ -375,9 +1012,63 @@ protected:
    * Before calling this function, the nodes and the words must be already
    * created (by calling HKmeansStep and createWords)
    * @param features
+   * @param leaves if given, leaf node of each feature, so that the features
+   *   are not transformed again
+   * @param pool if given, threads to count the words with
    */
-  void setNodeWeights(const std::vector<std::vector<TDescriptor> > &features);
-  
+  void setNodeWeights(const std::vector<std::vector<TDescriptor> > &features,
+    const std::vector<NodeId> *leaves = NULL, ThreadPool *pool = NULL);
+
+  /**
+   * Counts the number of images where each word occurs. The images are 
+   * split into ranges with their own counters, which are added up at the 
+   * end
+   * @param features descriptors of each image
+   * @param leaves if given, leaf node of each descriptor, in image order.
+   *   Otherwise, the descriptors are transformed
+   * @param Ni (out) number of images of each word
+   * @param pool if given, threads to count with
+   */
+  void countDocuments(const std::vector<std::vector<TDescriptor> > &features,
+    const std::vector<NodeId> *leaves, std::vector<unsigned int> &Ni, 
+    ThreadPool *pool) const;
+
+  /**
+   * Adds the number of images where each word occurs to the document 
+   * frequencies, which must have the same size as m_words
+   * @param features descriptors of each image
+   * @param pool if given, threads to count with
+   */
+  void addDocuments(const std::vector<std::vector<TDescriptor> > &features,
+    ThreadPool *pool);
+
+  /**
+   * Sets the weight of each word to ln(N/Ni) from the document frequencies
+   */
+  void setIdfWeights();
+
+  /**
+   * Builds the frozen tree from the current nodes. This must be called 
+   * after modifying the structure of m_nodes. If the frozen tree is empty, 
+   * the slower m_nodes traversal is used to transform features
+   */
+  void freeze();
+
+  /**
+   * Copies the weights of the words into the frozen tree. This must be 
+   * called after changing the weights of m_nodes
+   */
+  void updateFrozenWeights();
+
+  /**
+   * Returns the descriptor of a node. It is read from the frozen tree when
+   * there is one, since the nodes loaded from binary files do not keep 
+   * their descriptors
+   * @param id node id
+   * @return descriptor
+   */
+  TDescriptor nodeDescriptor(NodeId id) const;
+
   /**
    * Returns a random number in the range [min..max]
    * @param min
@@ -400,6 +1091,31 @@ protected:
       return int(((double)rand()/((double)RAND_MAX + 1.0)) * d) + min;
   }
 
+  /**
+   * Returns a random number in the range [min..max] from a generator
+   * @param min
+   * @param max
+   * @param rng
+   * @return random T number in [min..max]
+   */
+  template <class T>
+  static T RandomValue(T min, T max, std::mt19937 &rng){
+      return ((T)rng()/(T)std::mt19937::max()) * (max - min) + min;
+  }
+
+  /**
+   * Returns a random int in the range [min..max] from a generator
+   * @param min
+   * @param max
+   * @param rng
+   * @return random int in [min..max]
+   */
+  static int RandomInt(int min, int max, std::mt19937 &rng){
+      int d = max - min + 1;
+      return int(((double)rng()/((double)std::mt19937::max() + 1.0)) * d) 
+        + min;
+  }
+
 protected:
 
   /// Branching factor
@@ -416,13 +1132,30 @@ protected:
   
   /// Object for computing scores
   GeneralScoring* m_scoring_object;
+
+  /// Options of the kmeans of the training
+  KMeansOptions m_kmeans;
   
-  /// Tree nodes
+  /// Tree nodes. Their descriptors are not set if the vocabulary was
+  /// loaded from a binary file
   std::vector<Node> m_nodes;
   
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Frozen tree used by transform
+  FrozenTree m_frozen;
+
+  /// Number of images the idf weights were computed from
+  unsigned int m_ndocs;
+
+  /// Number of those images where each word occurs. Empty if unknown 
+  /// (e.g. the vocabulary was loaded from a file)
+  std::vector<unsigned int> m_doc_freq;
+
+  /// Cumulative stats of the transforms. They are not copied
+  mutable QueryCounters m_counters;
   
 };
 
@@ -432,7 +1165,7 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
   (int k, int L, WeightingType weighting, ScoringType scoring)
   : m_k(k), m_L(L), m_weighting(weighting), m_scoring(scoring),
-  m_scoring_object(NULL)
+  m_scoring_object(NULL), m_ndocs(0)
 {
   createScoringObject();
 }
@@ -441,7 +1174,7 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const std::string &filename): m_scoring_object(NULL)
+  (const std::string &filename): m_scoring_object(NULL), m_ndocs(0)
 {
   load(filename);
 }
@@ -450,7 +1183,7 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const char *filename): m_scoring_object(NULL)
+  (const char *filename): m_scoring_object(NULL), m_ndocs(0)
 {
   load(filename);
 }
@@ -514,7 +1247,7 @@ void TemplatedVocabulary<TDescriptor,F>::setWeightingType(WeightingType type)
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary(
   const TemplatedVocabulary<TDescriptor, F> &voc)
-  : m_scoring_object(NULL)
+  : m_scoring_object(NULL), m_ndocs(0)
 {
   *this = voc;
 }
@@ -538,6 +1271,7 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   this->m_L = voc.m_L;
   this->m_scoring = voc.m_scoring;
   this->m_weighting = voc.m_weighting;
+  this->m_kmeans = voc.m_kmeans;
 
   this->createScoringObject();
   
@@ -546,6 +1280,9 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   
   this->m_nodes = voc.m_nodes;
   this->createWords();
+  this->m_frozen = voc.m_frozen;
+  this->m_ndocs = voc.m_ndocs;
+  this->m_doc_freq = voc.m_doc_freq;
   
   return *this;
 }
@@ -558,6 +1295,9 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 {
   m_nodes.clear();
   m_words.clear();
+  m_frozen = FrozenTree();
+  m_ndocs = 0;
+  m_doc_freq.clear();
   
   // expected_nodes = Sum_{i=0..L} ( k^i )
 	int expected_nodes = 
@@ -573,14 +1313,18 @@ void TemplatedVocabulary<TDescriptor,F>::create(
   // create root  
   m_nodes.push_back(Node(0)); // root
   
-  // create the tree
-  HKmeansStep(0, features, 1);
+  // create the tree, keeping the leaf of each feature
+  std::vector<NodeId> leaves;
+  HKmeansStep(0, features, 1, &leaves);
 
   // create the words
   createWords();
 
   // and set the weight of each node of the tree
-  setNodeWeights(training_features);
+  setNodeWeights(training_features, &leaves);
+
+  // and compile the tree for transform
+  freeze();
   
 }
 
@@ -616,55 +1360,433 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-void TemplatedVocabulary<TDescriptor,F>::getFeatures(
+void TemplatedVocabulary<TDescriptor,F>::create(
   const std::vector<std::vector<TDescriptor> > &training_features,
-  std::vector<pDescriptor> &features) const
+  ThreadPool &pool)
 {
-  features.resize(0);
+  m_nodes.clear();
+  m_words.clear();
+  m_frozen = FrozenTree();
+  m_ndocs = 0;
+  m_doc_freq.clear();
   
-  typename std::vector<std::vector<TDescriptor> >::const_iterator vvit;
-  typename std::vector<TDescriptor>::const_iterator vit;
-  for(vvit = training_features.begin(); vvit != training_features.end(); ++vvit)
-  {
-    features.reserve(features.size() + vvit->size());
-    for(vit = vvit->begin(); vit != vvit->end(); ++vit)
-    {
-      features.push_back(&(*vit));
-    }
-  }
+  // expected_nodes = Sum_{i=0..L} ( k^i )
+  int expected_nodes = 
+    (int)((pow((double)m_k, (double)m_L + 1) - 1)/(m_k - 1));
+
+  m_nodes.reserve(expected_nodes);
+  
+  std::vector<pDescriptor> features;
+  getFeatures(training_features, features);
+
+  // create root  
+  m_nodes.push_back(Node(0)); // root
+  
+  // create the tree, keeping the leaf of each feature
+  std::mt19937 rng(rand());
+  std::vector<NodeId> leaves;
+  HKmeansStep(m_nodes, 0, features, 1, &leaves, &rng, &pool, m_L);
+
+  // create the words
+  createWords();
+
+  // and set the weight of each node of the tree
+  setNodeWeights(training_features, &leaves, &pool);
+
+  // and compile the tree for transform
+  freeze();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::create(
+  TemplatedDescriptorReader<TDescriptor, F> &source, size_t max_descriptors,
+  const std::string &tmp_prefix, ThreadPool *pool)
+{
+  const size_t bytes = DescriptorTraits<F>::bytes;
+  if(max_descriptors < (size_t)m_k) max_descriptors = m_k;
+
+  m_nodes.clear();
+  m_words.clear();
+  m_frozen = FrozenTree();
+  m_ndocs = 0;
+  m_doc_freq.clear();
+
+  std::mt19937 rng(rand());
+
+  // 1. Take a uniform sample of the descriptors (reservoir sampling)
+
+  std::vector<TDescriptor> sample;
+  std::vector<TDescriptor> image;
+  uint64_t ndescriptors = 0;
+
+  source.rewind();
+  while(source.read(image))
+  {
+    for(size_t i = 0; i < image.size(); ++i, ++ndescriptors)
+    {
+      if(sample.size() < max_descriptors)
+      {
+        sample.push_back(image[i]);
+      }
+      else
+      {
+        const uint64_t r = ((uint64_t)rng() << 32) | rng();
+        const uint64_t j = r % (ndescriptors + 1);
+        if(j < max_descriptors) sample[j] = image[i];
+      }
+    }
+  }
+
+  // 2. Cluster the first levels with the sample. There are as many as 
+  // needed for the descriptors of each leaf to fit in memory on average
+
+  int top_levels = m_L;
+  if(ndescriptors > max_descriptors)
+  {
+    top_levels = 1;
+    double leaves = m_k;
+    while(top_levels < m_L - 1 && ndescriptors / leaves > max_descriptors)
+    {
+      ++top_levels;
+      leaves *= m_k;
+    }
+  }
+
+  std::vector<pDescriptor> features(sample.size());
+  for(size_t i = 0; i < sample.size(); ++i) features[i] = &sample[i];
+  
+  m_nodes.push_back(Node(0)); // root
+  HKmeansStep(m_nodes, 0, features, 1, NULL, &rng, pool, top_levels);
+
+  std::vector<pDescriptor>().swap(features);
+  std::vector<TDescriptor>().swap(sample);
+
+  if(top_levels < m_L)
+  {
+    // 3. Split all the descriptors by the leaf they reach
+
+    std::vector<NodeId> partitions;
+    std::vector<int> depth(m_nodes.size(), 0);
+    std::vector<unsigned int> partition_of(m_nodes.size(), 0);
+
+    for(NodeId id = 1; id < m_nodes.size(); ++id)
+    {
+      depth[id] = depth[m_nodes[id].parent] + 1;
+      if(m_nodes[id].isLeaf())
+      {
+        partition_of[id] = partitions.size();
+        partitions.push_back(id);
+      }
+    }
+
+    std::vector<std::string> files(partitions.size());
+    for(size_t p = 0; p < partitions.size(); ++p)
+    {
+      std::stringstream ss;
+      ss << tmp_prefix << "." << p;
+      files[p] = ss.str();
+    }
+
+    // descriptors are packed in memory until max_descriptors are waiting
+    std::vector<std::vector<unsigned char> > buffers(partitions.size());
+    std::vector<uint64_t> sizes(partitions.size(), 0);
+    std::vector<bool> created(partitions.size(), false);
+    size_t buffered = 0;
+
+    /// Removes the files created and not removed yet when the function
+    /// ends, also if it throws
+    struct FileRemover
+    {
+      const std::vector<std::string> &files;
+      const std::vector<bool> &created;
+
+      ~FileRemover()
+      {
+        for(size_t p = 0; p < files.size(); ++p)
+          if(created[p]) std::remove(files[p].c_str());
+      }
+    } remover = { files, created };
+    (void)remover;
+
+    std::vector<NodeId> reached;
+
+    // the descriptors go down the top levels frozen, comparing the packed
+    // children of each node with one call, as transform does
+    freeze();
+    const FrozenTree &t = m_frozen;
+
+    std::function<void(size_t, size_t)> descend = 
+      [&](size_t begin, size_t end)
+    {
+      uint64_t buffer[(DescriptorTraits<F>::bytes + sizeof(uint64_t) - 1) / 
+        sizeof(uint64_t) + 1];
+
+      for(size_t i = begin; i < end; ++i)
+      {
+        const unsigned char *q = DescriptorTraits<F>::view(image[i],
+          reinterpret_cast<unsigned char*>(buffer));
+
+        unsigned int n = 0; // root
+        do
+        {
+          const unsigned int c = t.first_child[n];
+          n = c + DescriptorTraits<F>::nearest(q, t.packedDescriptor(c), 
+            t.nchildren[n]);
+        } while(t.nchildren[n] > 0);
+
+        reached[i] = t.node_id[n];
+      }
+    };
+
+    source.rewind();
+    bool more = true;
+    while(more)
+    {
+      more = source.read(image);
+      
+      if(more)
+      {
+        reached.resize(image.size());
+        if(pool) pool->parallelFor(image.size(), descend, 64);
+        else descend(0, image.size());
+
+        for(size_t i = 0; i < image.size(); ++i)
+        {
+          const unsigned int p = partition_of[reached[i]];
+          std::vector<unsigned char> &buffer = buffers[p];
+          buffer.resize(buffer.size() + bytes);
+          DescriptorTraits<F>::pack(image[i], &buffer[buffer.size() - bytes]);
+          sizes[p]++;
+        }
+        buffered += image.size();
+      }
+
+      if(buffered >= max_descriptors || (!more && buffered > 0))
+      {
+        for(size_t p = 0; p < partitions.size(); ++p)
+        {
+          if(buffers[p].empty()) continue;
+
+          std::ofstream f(files[p].c_str(), std::ios::out | std::ios::binary |
+            (created[p] ? std::ios::app : std::ios::trunc));
+          created[p] = true;
+          f.write(reinterpret_cast<const char*>(&buffers[p][0]), 
+            buffers[p].size());
+          f.close();
+          if(f.fail()) throw std::string("Could not write file ") + files[p];
+
+          std::vector<unsigned char>().swap(buffers[p]);
+        }
+        buffered = 0;
+      }
+    }
+
+    // 4. Cluster the subtree of each leaf with its descriptors 
+
+    // the subtrees change the tree, which is frozen again at the end
+    m_frozen = FrozenTree();
+
+    std::vector<std::mt19937::result_type> seeds(partitions.size());
+    for(size_t p = 0; p < partitions.size(); ++p) seeds[p] = rng();
+
+    std::vector<unsigned char> packed(bytes);
+    for(size_t p = 0; p < partitions.size(); ++p)
+    {
+      if(!created[p]) continue;
+
+      std::mt19937 partition_rng(seeds[p]);
+
+      std::ifstream f(files[p].c_str(), std::ios::in | std::ios::binary);
+      if(!f.is_open()) throw std::string("Could not open file ") + files[p];
+
+      sample.clear();
+      sample.reserve(std::min<uint64_t>(sizes[p], max_descriptors));
+      for(uint64_t i = 0; i < sizes[p]; ++i)
+      {
+        f.read(reinterpret_cast<char*>(&packed[0]), bytes);
+        if(f.fail()) throw std::string("Could not read file ") + files[p];
+
+        if(sample.size() < max_descriptors)
+        {
+          sample.push_back(TDescriptor());
+          DescriptorTraits<F>::unpack(&packed[0], sample.back());
+        }
+        else
+        {
+          const uint64_t r = ((uint64_t)partition_rng() << 32) | 
+            partition_rng();
+          const uint64_t j = r % (i + 1);
+          if(j < max_descriptors) 
+            DescriptorTraits<F>::unpack(&packed[0], sample[j]);
+        }
+      }
+      f.close();
+      std::remove(files[p].c_str());
+      created[p] = false;
+
+      if(sample.size() > 1)
+      {
+        features.resize(sample.size());
+        for(size_t i = 0; i < sample.size(); ++i) features[i] = &sample[i];
+
+        HKmeansStep(m_nodes, partitions[p], features, 
+          depth[partitions[p]] + 1, NULL, &partition_rng, pool, m_L);
+      }
+    }
+
+    std::vector<pDescriptor>().swap(features);
+    std::vector<TDescriptor>().swap(sample);
+  }
+
+  // create the words and compile the tree for transform
+  createWords();
+  freeze();
+
+  // 5. Set the weights with all the images, in batches of max_descriptors
+
+  if(m_weighting == TF || m_weighting == BINARY)
+  {
+    setNodeWeights(std::vector<std::vector<TDescriptor> >(), NULL, pool);
+  }
+  else
+  {
+    m_doc_freq.assign(m_words.size(), 0);
+
+    std::vector<std::vector<TDescriptor> > batch;
+    size_t batch_size = 0;
+
+    source.rewind();
+    bool more = true;
+    while(more)
+    {
+      batch.push_back(std::vector<TDescriptor>());
+      more = source.read(batch.back());
+      if(!more) batch.pop_back();
+      else batch_size += batch.back().size();
+
+      if(batch_size >= max_descriptors || (!more && !batch.empty()))
+      {
+        addDocuments(batch, pool);
+        batch.clear();
+        batch_size = 0;
+      }
+    }
+
+    setIdfWeights();
+  }
+
+  updateFrozenWeights();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::getFeatures(
+  const std::vector<std::vector<TDescriptor> > &training_features,
+  std::vector<pDescriptor> &features) const
+{
+  features.resize(0);
+  
+  typename std::vector<std::vector<TDescriptor> >::const_iterator vvit;
+  typename std::vector<TDescriptor>::const_iterator vit;
+  for(vvit = training_features.begin(); vvit != training_features.end(); ++vvit)
+  {
+    features.reserve(features.size() + vvit->size());
+    for(vit = vvit->begin(); vit != vvit->end(); ++vit)
+    {
+      features.push_back(&(*vit));
+    }
+  }
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(NodeId parent_id, 
-  const std::vector<pDescriptor> &descriptors, int current_level)
+  const std::vector<pDescriptor> &descriptors, int current_level,
+  std::vector<NodeId> *leaves)
+{
+  HKmeansStep(m_nodes, parent_id, descriptors, current_level, leaves, 
+    NULL, NULL, m_L);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(std::vector<Node> &nodes,
+  NodeId parent_id, const std::vector<pDescriptor> &descriptors, 
+  int current_level, std::vector<NodeId> *leaves, std::mt19937 *rng, 
+  ThreadPool *pool, int max_level)
+{
+  std::vector<KMeansLevel> workspace(std::max(current_level, max_level) + 1);
+  HKmeansStep(nodes, parent_id, descriptors, current_level, leaves, rng, 
+    pool, max_level, workspace);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(std::vector<Node> &nodes,
+  NodeId parent_id, const std::vector<pDescriptor> &descriptors, 
+  int current_level, std::vector<NodeId> *leaves, std::mt19937 *rng, 
+  ThreadPool *pool, int max_level, std::vector<KMeansLevel> &workspace)
 {
   if(descriptors.empty()) return;
+
+  // descriptors from which the work of a node is split among threads
+  const size_t parallel_size = 1024;
+  if(descriptors.size() < parallel_size) pool = NULL;
+
+  KMeansLevel &level = workspace[current_level];
         
   // features associated to each cluster
-  std::vector<TDescriptor> clusters;
-  std::vector<std::vector<unsigned int> > groups; // groups[i] = [j1, j2, ...]
-	// j1, j2, ... indices of descriptors associated to cluster i
+  std::vector<TDescriptor> &clusters = level.clusters;
+  // the indexes of the descriptors of cluster c are 
+  // order[offsets[c]..offsets[c+1])
+  std::vector<unsigned int> &order = level.order;
+  std::vector<unsigned int> &offsets = level.offsets;
 
+  clusters.clear();
   clusters.reserve(m_k);
-	groups.reserve(m_k);
   
   //const int msizes[] = { m_k, descriptors.size() };
   //cv::SparseMat assoc(2, msizes, CV_8U);
   //cv::SparseMat last_assoc(2, msizes, CV_8U);  
   //// assoc.row(cluster_idx).col(descriptor_idx) = 1 iif associated
+
+  // cluster of each descriptor
+  std::vector<int> &current_association = level.association;
+  current_association.clear();
   
   if((int)descriptors.size() <= m_k)
   {
     // trivial case: one cluster per feature
-    groups.resize(descriptors.size());
+    order.resize(descriptors.size());
+    offsets.resize(descriptors.size() + 1);
 
     for(unsigned int i = 0; i < descriptors.size(); i++)
     {
-      groups[i].push_back(i);
+      order[i] = i;
+      offsets[i] = i;
       clusters.push_back(*descriptors[i]);
     }
+    offsets[descriptors.size()] = descriptors.size();
+
+    // repeated descriptors are taken by transform to the first of their
+    // clusters
+    if(leaves) assignClusters(descriptors, clusters, current_association);
+  }
+  else if(current_level <= m_kmeans.minibatch_levels &&
+    descriptors.size() > m_kmeans.minibatch_size)
+  {
+    // select clusters with mini-batch kmeans, and groups with them
+    seedClusters(descriptors, clusters, rng, pool, level);
+    miniBatchClusters(descriptors, clusters, rng, pool, level);
+
+    assignClusters(descriptors, clusters, current_association, pool);
+    sortByCluster(current_association, clusters.size(), order, offsets);
   }
   else
   {
@@ -672,9 +1794,14 @@ void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(NodeId parent_id,
     
     bool first_time = true;
     bool goon = true;
+    unsigned int iterations = 0;
+
+    // the iterations stop when at most these descriptors change their
+    // cluster
+    const double max_changed = m_kmeans.tolerance * descriptors.size();
     
     // to check if clusters move after iterations
-    std::vector<int> last_association, current_association;
+    std::vector<int> &last_association = level.last_association;
 
     while(goon)
     {
@@ -683,70 +1810,46 @@ void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(NodeId parent_id,
 			if(first_time)
 			{
         // random sample 
-        initiateClusters(descriptors, clusters);
+        seedClusters(descriptors, clusters, rng, pool, level);
       }
       else
       {
         // calculate cluster centres
+        ++iterations;
 
-        for(unsigned int c = 0; c < clusters.size(); ++c)
+        std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
         {
-          std::vector<pDescriptor> cluster_descriptors;
-          cluster_descriptors.reserve(groups[c].size());
-          
-          /*
-          for(unsigned int d = 0; d < descriptors.size(); ++d)
+          // the buffer of the level is reused if there is only one task
+          std::vector<pDescriptor> local;
+          std::vector<pDescriptor> &cluster_descriptors = 
+            (pool ? local : level.cluster_descriptors);
+
+          for(size_t c = begin; c < end; ++c)
           {
-            if( assoc.find<unsigned char>(c, d) )
+            // a cluster left without descriptors (e.g. if it is the same
+            // as another one) keeps its centre
+            if(offsets[c] == offsets[c + 1]) continue;
+
+            cluster_descriptors.clear();
+            for(unsigned int j = offsets[c]; j < offsets[c + 1]; ++j)
             {
-              cluster_descriptors.push_back(descriptors[d]);
+              cluster_descriptors.push_back(descriptors[order[j]]);
             }
+            
+            F::meanValue(cluster_descriptors, clusters[c]);
           }
-          */
-          
-          std::vector<unsigned int>::const_iterator vit;
-          for(vit = groups[c].begin(); vit != groups[c].end(); ++vit)
-          {
-            cluster_descriptors.push_back(descriptors[*vit]);
-          }
-          
-          
-          F::meanValue(cluster_descriptors, clusters[c]);
-        }
+        };
+
+        if(pool) pool->parallelFor(clusters.size(), f, 1);
+        else f(0, clusters.size());
         
       } // if(!first_time)
 
       // 2. Associate features with clusters
 
       // calculate distances to cluster centers
-      groups.clear();
-      groups.resize(clusters.size(), std::vector<unsigned int>());
-      current_association.resize(descriptors.size());
-
-      //assoc.clear();
-
-      typename std::vector<pDescriptor>::const_iterator fit;
-      //unsigned int d = 0;
-      for(fit = descriptors.begin(); fit != descriptors.end(); ++fit)//, ++d)
-      {
-        double best_dist = F::distance(*(*fit), clusters[0]);
-        unsigned int icluster = 0;
-        
-        for(unsigned int c = 1; c < clusters.size(); ++c)
-        {
-          double dist = F::distance(*(*fit), clusters[c]);
-          if(dist < best_dist)
-          {
-            best_dist = dist;
-            icluster = c;
-          }
-        }
-
-        //assoc.ref<unsigned char>(icluster, d) = 1;
-
-        groups[icluster].push_back(fit - descriptors.begin());
-        current_association[ fit - descriptors.begin() ] = icluster;
-      }
+      assignClusters(descriptors, clusters, current_association, pool);
+      sortByCluster(current_association, clusters.size(), order, offsets);
       
       // kmeans++ ensures all the clusters has any feature associated with them
 
@@ -760,13 +1863,18 @@ void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(NodeId parent_id,
         //goon = !eqUChar(last_assoc, assoc);
         
         goon = false;
+        size_t changed = 0;
         for(unsigned int i = 0; i < current_association.size(); i++)
         {
-          if(current_association[i] != last_association[i]){
+          if(current_association[i] != last_association[i] &&
+            ++changed > max_changed){
             goon = true;
             break;
           }
         }
+
+        if(m_kmeans.max_iterations > 0 && 
+          iterations >= m_kmeans.max_iterations) goon = false;
       }
 
 			if(goon)
@@ -780,38 +1888,127 @@ void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(NodeId parent_id,
     
   } // if must run kmeans
   
-  // create nodes
-  for(unsigned int i = 0; i < clusters.size(); ++i)
+  // create nodes, moving the clusters into them. Their ids are consecutive
+  const unsigned int nclusters = clusters.size();
+  const NodeId first_child = nodes.size();
+  nodes[parent_id].children.reserve(nclusters);
+  using std::swap; // found by ADL for descriptors such as std::array
+  for(unsigned int i = 0; i < nclusters; ++i)
+  {
+    NodeId id = nodes.size();
+    nodes.push_back(Node(id));
+    swap(nodes.back().descriptor, clusters[i]);
+    nodes.back().parent = parent_id;
+    nodes[parent_id].children.push_back(id);
+  }
+
+  if(leaves)
   {
-    NodeId id = m_nodes.size();
-    m_nodes.push_back(Node(id));
-    m_nodes.back().descriptor = clusters[i];
-    m_nodes.back().parent = parent_id;
-    m_nodes[parent_id].children.push_back(id);
+    // the children are leaves unless they are split below
+    leaves->resize(descriptors.size());
+    for(unsigned int i = 0; i < descriptors.size(); ++i)
+    {
+      (*leaves)[i] = first_child + current_association[i];
+    }
   }
   
   // go on with the next level
-  if(current_level < m_L)
+  if(current_level < max_level)
   {
+    // each subtree gets its own generator, seeded in cluster order
+    std::vector<std::mt19937::result_type> seeds;
+    if(rng)
+    {
+      seeds.resize(nclusters);
+      for(unsigned int i = 0; i < nclusters; ++i) seeds[i] = (*rng)();
+    }
+
+    // subtrees are built apart, with local node ids, and then appended in 
+    // cluster order, so that ids are the same as if they were built one 
+    // after another
+    std::vector<std::vector<Node> > subtrees(pool ? nclusters : 0);
+    std::vector<std::vector<NodeId> > subtree_leaves(subtrees.size());
+
     // iterate again with the resulting clusters
-    const std::vector<NodeId> &children_ids = m_nodes[parent_id].children;
-    for(unsigned int i = 0; i < clusters.size(); ++i)
+    std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+    {
+      // subtrees built in parallel have their own workspace
+      std::vector<KMeansLevel> local;
+      if(pool) local.resize(workspace.size());
+      std::vector<KMeansLevel> &w = (pool ? local : workspace);
+
+      std::vector<pDescriptor> &child_features = 
+        w[current_level + 1].descriptors;
+
+      for(size_t i = begin; i < end; ++i)
+      {
+        if(offsets[i + 1] - offsets[i] <= 1) continue;
+
+        child_features.clear();
+        for(unsigned int j = offsets[i]; j < offsets[i + 1]; ++j)
+        {
+          child_features.push_back(descriptors[order[j]]);
+        }
+
+        std::mt19937 child_rng(rng ? seeds[i] : 0);
+
+        if(pool)
+        {
+          subtrees[i].push_back(Node(0));
+          HKmeansStep(subtrees[i], 0, child_features, current_level + 1,
+            (leaves ? &subtree_leaves[i] : NULL), &child_rng, pool, 
+            max_level, w);
+        }
+        else
+        {
+          std::vector<NodeId> &child_leaves = level.leaves;
+          HKmeansStep(nodes, first_child + i, child_features, 
+            current_level + 1, (leaves ? &child_leaves : NULL), 
+            (rng ? &child_rng : NULL), NULL, max_level, w);
+
+          if(leaves)
+          {
+            for(unsigned int j = offsets[i]; j < offsets[i + 1]; ++j)
+              (*leaves)[order[j]] = child_leaves[j - offsets[i]];
+          }
+        }
+      }
+    };
+
+    if(pool) pool->parallelFor(nclusters, f, 1);
+    else f(0, nclusters);
+
+    for(size_t i = 0; i < subtrees.size(); ++i)
     {
-      NodeId id = children_ids[i];
+      std::vector<Node> &sub = subtrees[i];
+      if(sub.empty()) continue;
 
-      std::vector<pDescriptor> child_features;
-      child_features.reserve(groups[i].size());
+      // local id j > 0 becomes base + j, and 0 is the child itself
+      const NodeId id = first_child + i;
+      const NodeId base = nodes.size() - 1;
 
-      std::vector<unsigned int>::const_iterator vit;
-      for(vit = groups[i].begin(); vit != groups[i].end(); ++vit)
+      nodes[id].children.reserve(sub[0].children.size());
+      for(size_t c = 0; c < sub[0].children.size(); ++c)
+        nodes[id].children.push_back(base + sub[0].children[c]);
+
+      for(size_t j = 1; j < sub.size(); ++j)
       {
-        child_features.push_back(descriptors[*vit]);
+        Node &node = sub[j];
+        node.id = base + j;
+        node.parent = (node.parent == 0 ? id : base + node.parent);
+        for(size_t c = 0; c < node.children.size(); ++c)
+          node.children[c] += base;
+        nodes.push_back(std::move(node));
       }
 
-      if(child_features.size() > 1)
+      if(leaves)
       {
-        HKmeansStep(id, child_features, current_level + 1);
+        const std::vector<NodeId> &child_leaves = subtree_leaves[i];
+        for(unsigned int j = offsets[i]; j < offsets[i + 1]; ++j)
+          (*leaves)[order[j]] = base + child_leaves[j - offsets[i]];
       }
+
+      std::vector<Node>().swap(sub);
     }
   }
 }
@@ -819,73 +2016,360 @@ void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(NodeId parent_id,
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-void TemplatedVocabulary<TDescriptor, F>::initiateClusters
-  (const std::vector<pDescriptor> &descriptors,
-   std::vector<TDescriptor> &clusters) const
+void TemplatedVocabulary<TDescriptor,F>::assignClusters(
+  const std::vector<pDescriptor> &descriptors, 
+  const std::vector<TDescriptor> &clusters, 
+  std::vector<int> &association, ThreadPool *pool) const
 {
-  initiateClustersKMpp(descriptors, clusters);  
-}
+  association.resize(descriptors.size());
 
-// --------------------------------------------------------------------------
+  // packed descriptors are compared with all the clusters in one call
+  const bool packed = DescriptorTraits<F>::packed;
+  const size_t bytes = DescriptorTraits<F>::bytes;
+  std::vector<uint64_t> packed_clusters;
 
-template<class TDescriptor, class F>
-void TemplatedVocabulary<TDescriptor,F>::initiateClustersKMpp(
-  const std::vector<pDescriptor> &pfeatures,
-    std::vector<TDescriptor> &clusters) const
-{
-  // Implements kmeans++ seeding algorithm
-  // Algorithm:
-  // 1. Choose one center uniformly at random from among the data points.
-  // 2. For each data point x, compute D(x), the distance between x and the nearest 
-  //    center that has already been chosen.
-  // 3. Add one new data point as a center. Each point x is chosen with probability 
-  //    proportional to D(x)^2.
-  // 4. Repeat Steps 2 and 3 until k centers have been chosen.
-  // 5. Now that the initial centers have been chosen, proceed using standard k-means 
-  //    clustering.
+  if(packed)
+  {
+    packed_clusters.resize((clusters.size() * bytes + sizeof(uint64_t) - 1)
+      / sizeof(uint64_t));
+    unsigned char *p = reinterpret_cast<unsigned char*>(&packed_clusters[0]);
+    for(unsigned int c = 0; c < clusters.size(); ++c, p += bytes)
+      DescriptorTraits<F>::pack(clusters[c], p);
+  }
 
-  clusters.resize(0);
-  clusters.reserve(m_k);
-  std::vector<double> min_dists(pfeatures.size(), std::numeric_limits<double>::max());
-  
-  // 1.
-  
-  int ifeature = RandomInt(0, pfeatures.size()-1);
-  
-  // create first cluster
-  clusters.push_back(*pfeatures[ifeature]);
+  // the squared distances |a|^2 + |c|^2 - 2 a.c of a block of descriptors
+  // to all the clusters are ranked by |c|^2 - 2 a.c, with a matrix product
+  const bool product = packed && DescriptorTraits<F>::squared_l2 &&
+    clusters.size() > 1;
+  const int dims = (int)(bytes / sizeof(float));
+  cv::Mat cluster_mat;
+  std::vector<double> cluster_norms;
+  double max_norm = 0;
 
-  // compute the initial distances
-  typename std::vector<pDescriptor>::const_iterator fit;
-  std::vector<double>::iterator dit;
-  dit = min_dists.begin();
-  for(fit = pfeatures.begin(); fit != pfeatures.end(); ++fit, ++dit)
+  if(product)
   {
-    *dit = F::distance(*(*fit), clusters.back());
-  }  
+    cluster_mat = cv::Mat((int)clusters.size(), dims, CV_32F,
+      &packed_clusters[0]);
+    cluster_norms.resize(clusters.size());
+    for(unsigned int c = 0; c < clusters.size(); ++c)
+    {
+      cluster_norms[c] = squaredL2Norm(cluster_mat.ptr<float>(c), dims);
+      max_norm = std::max(max_norm, cluster_norms[c]);
+    }
+  }
 
-  while((int)clusters.size() < m_k)
+  // each task writes the associations of its own descriptors only
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
   {
-    // 2.
-    dit = min_dists.begin();
-    for(fit = pfeatures.begin(); fit != pfeatures.end(); ++fit, ++dit)
+    uint64_t buffer[(DescriptorTraits<F>::bytes + sizeof(uint64_t) - 1) / 
+      sizeof(uint64_t) + 1];
+
+    if(product)
     {
-      if(*dit > 0)
+      const size_t block = 256;
+      cv::Mat block_mat, products;
+
+      for(size_t b = begin; b < end; b += block)
       {
-        double dist = F::distance(*(*fit), clusters.back());
-        if(dist < *dit) *dit = dist;
-      }
-    }
-    
-    // 3.
-    double dist_sum = std::accumulate(min_dists.begin(), min_dists.end(), 0.0);
+        const int m = (int)std::min(block, end - b);
+        block_mat.create(m, dims, CV_32F);
+        for(int r = 0; r < m; ++r)
+          DescriptorTraits<F>::pack(*descriptors[b + r], block_mat.ptr(r));
 
-    if(dist_sum > 0)
+        cv::gemm(block_mat, cluster_mat, 1, cv::noArray(), 0, products,
+          cv::GEMM_2_T);
+
+        for(int r = 0; r < m; ++r)
+        {
+          const float *ac = products.ptr<float>(r);
+          unsigned int best = 0;
+          double best_s = cluster_norms[0] - 2. * ac[0];
+          double second_s = std::numeric_limits<double>::max();
+          for(unsigned int c = 1; c < clusters.size(); ++c)
+          {
+            const double sc = cluster_norms[c] - 2. * ac[c];
+            if(sc < best_s)
+            {
+              second_s = best_s;
+              best_s = sc;
+              best = c;
+            }
+            else if(sc < second_s)
+            {
+              second_s = sc;
+            }
+          }
+
+          // the float product is not exact: if the two closest clusters
+          // are too close, the exact distances decide, so that the
+          // associations are the same as those of transform
+          const double an = squaredL2Norm(block_mat.ptr<float>(r), dims);
+          if(second_s - best_s <= 1e-4 * (an + max_norm))
+          {
+            best = DescriptorTraits<F>::nearest(block_mat.ptr(r),
+              reinterpret_cast<const unsigned char*>(&packed_clusters[0]),
+              clusters.size());
+          }
+          association[b + r] = best;
+        }
+      }
+      return;
+    }
+
+    for(size_t i = begin; i < end; ++i)
+    {
+      unsigned int icluster = 0;
+
+      if(packed)
+      {
+        const unsigned char *q = DescriptorTraits<F>::view(*descriptors[i],
+          reinterpret_cast<unsigned char*>(buffer));
+        icluster = DescriptorTraits<F>::nearest(q, 
+          reinterpret_cast<const unsigned char*>(&packed_clusters[0]),
+          clusters.size());
+      }
+      else
+      {
+        double best_dist = F::distance(*descriptors[i], clusters[0]);
+      
+        for(unsigned int c = 1; c < clusters.size(); ++c)
+        {
+          double dist = F::distance(*descriptors[i], clusters[c]);
+          if(dist < best_dist)
+          {
+            best_dist = dist;
+            icluster = c;
+          }
+        }
+      }
+
+      association[i] = icluster;
+    }
+  };
+
+  // descriptors per task
+  const size_t grain = 256;
+
+  if(pool) pool->parallelFor(descriptors.size(), f, grain);
+  else f(0, descriptors.size());
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::sortByCluster(
+  const std::vector<int> &association, unsigned int nclusters,
+  std::vector<unsigned int> &order, std::vector<unsigned int> &offsets)
+{
+  // counting sort
+  offsets.assign(nclusters + 1, 0);
+  for(unsigned int i = 0; i < association.size(); ++i)
+  {
+    ++offsets[association[i] + 1];
+  }
+  for(unsigned int c = 0; c < nclusters; ++c)
+  {
+    offsets[c + 1] += offsets[c];
+  }
+  order.resize(association.size());
+  for(unsigned int i = 0; i < association.size(); ++i)
+  {
+    order[offsets[association[i]]++] = i;
+  }
+  // offsets[c] is now the end of cluster c
+  for(size_t c = nclusters; c > 0; --c) offsets[c] = offsets[c - 1];
+  offsets[0] = 0;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::seedClusters(
+  const std::vector<pDescriptor> &descriptors,
+  std::vector<TDescriptor> &clusters, std::mt19937 *rng, ThreadPool *pool,
+  KMeansLevel &level) const
+{
+  const size_t n = descriptors.size();
+  const size_t m = std::max<size_t>(m_kmeans.seeding_sample, m_k);
+
+  if(m_kmeans.seeding_sample == 0 || n <= m)
+  {
+    if(rng) initiateClusters(descriptors, clusters, *rng, pool);
+    else initiateClusters(descriptors, clusters);
+    return;
+  }
+
+  // m distinct descriptors, with a partial Fisher-Yates shuffle
+  std::vector<unsigned int> &indexes = level.order;
+  indexes.resize(n);
+  for(unsigned int i = 0; i < n; ++i) indexes[i] = i;
+
+  std::vector<pDescriptor> &sample = level.sample;
+  sample.resize(m);
+  for(size_t i = 0; i < m; ++i)
+  {
+    const int j = (rng ? RandomInt(i, n - 1, *rng) : RandomInt(i, n - 1));
+    std::swap(indexes[i], indexes[j]);
+    sample[i] = descriptors[indexes[i]];
+  }
+
+  if(rng) initiateClusters(sample, clusters, *rng, pool);
+  else initiateClusters(sample, clusters);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::miniBatchClusters(
+  const std::vector<pDescriptor> &descriptors,
+  std::vector<TDescriptor> &clusters, std::mt19937 *rng, ThreadPool *pool,
+  KMeansLevel &level) const
+{
+  const size_t n = descriptors.size();
+  const size_t b = m_kmeans.minibatch_size;
+  const unsigned int nclusters = clusters.size();
+
+  std::vector<pDescriptor> &batch = level.sample;
+  std::vector<int> &association = level.sample_association;
+  std::vector<unsigned int> &order = level.order;
+  std::vector<unsigned int> &offsets = level.offsets;
+
+  // old centres, and the number of descriptors each one has got
+  std::vector<TDescriptor> previous(nclusters);
+  std::vector<size_t> counts(nclusters, 0);
+
+  for(unsigned int it = 0; it < m_kmeans.minibatch_iterations; ++it)
+  {
+    // random descriptors, drawn with replacement
+    batch.resize(b);
+    for(size_t i = 0; i < b; ++i)
+    {
+      batch[i] = descriptors[rng ? RandomInt(0, n - 1, *rng) : 
+        RandomInt(0, n - 1)];
+    }
+
+    assignClusters(batch, clusters, association, pool);
+    sortByCluster(association, nclusters, order, offsets);
+
+    std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+    {
+      std::vector<pDescriptor> local;
+      std::vector<pDescriptor> &cluster_descriptors = 
+        (pool ? local : level.cluster_descriptors);
+
+      using std::swap; // found by ADL for descriptors such as std::array
+      for(size_t c = begin; c < end; ++c)
+      {
+        if(offsets[c] == offsets[c + 1]) continue;
+
+        // the mean is written into a fresh descriptor, since descriptors
+        // such as cv::Mat share their data when copied
+        swap(previous[c], clusters[c]);
+        clusters[c] = TDescriptor();
+
+        cluster_descriptors.assign(std::min(counts[c], b), &previous[c]);
+        for(unsigned int j = offsets[c]; j < offsets[c + 1]; ++j)
+        {
+          cluster_descriptors.push_back(batch[order[j]]);
+        }
+
+        F::meanValue(cluster_descriptors, clusters[c]);
+        counts[c] += offsets[c + 1] - offsets[c];
+      }
+    };
+
+    if(pool) pool->parallelFor(nclusters, f, 1);
+    else f(0, nclusters);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor, F>::initiateClusters
+  (const std::vector<pDescriptor> &descriptors,
+   std::vector<TDescriptor> &clusters) const
+{
+  initiateClustersKMpp(descriptors, clusters);  
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor, F>::initiateClusters
+  (const std::vector<pDescriptor> &descriptors,
+   std::vector<TDescriptor> &clusters, std::mt19937 &rng, 
+   ThreadPool *pool) const
+{
+  initiateClustersKMpp(descriptors, clusters, &rng, pool);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::initiateClustersKMpp(
+  const std::vector<pDescriptor> &pfeatures,
+    std::vector<TDescriptor> &clusters, std::mt19937 *rng, 
+    ThreadPool *pool) const
+{
+  // Implements kmeans++ seeding algorithm
+  // Algorithm:
+  // 1. Choose one center uniformly at random from among the data points.
+  // 2. For each data point x, compute D(x), the distance between x and the nearest 
+  //    center that has already been chosen.
+  // 3. Add one new data point as a center. Each point x is chosen with probability 
+  //    proportional to D(x)^2.
+  // 4. Repeat Steps 2 and 3 until k centers have been chosen.
+  // 5. Now that the initial centers have been chosen, proceed using standard k-means 
+  //    clustering.
+
+  clusters.resize(0);
+  clusters.reserve(m_k);
+  std::vector<double> min_dists(pfeatures.size(), std::numeric_limits<double>::max());
+  
+  // 1.
+  
+  int ifeature = (rng ? RandomInt(0, pfeatures.size()-1, *rng) :
+    RandomInt(0, pfeatures.size()-1));
+  
+  // create first cluster
+  clusters.push_back(*pfeatures[ifeature]);
+
+  // distances to the last cluster, split by ranges among the threads
+  std::function<void(size_t, size_t)> update = [&](size_t begin, size_t end)
+  {
+    for(size_t i = begin; i < end; ++i)
+    {
+      if(min_dists[i] > 0)
+      {
+        double dist = F::distance(*pfeatures[i], clusters.back());
+        if(dist < min_dists[i]) min_dists[i] = dist;
+      }
+    }
+  };
+
+  // descriptors per task
+  const size_t grain = 256;
+
+  std::vector<double>::iterator dit;
+
+  while((int)clusters.size() < m_k)
+  {
+    // 2. only the distances to the last cluster are computed, since the
+    // others are already in min_dists
+    if(pool) pool->parallelFor(pfeatures.size(), update, grain);
+    else update(0, pfeatures.size());
+    
+    // 3.
+    double dist_sum = std::accumulate(min_dists.begin(), min_dists.end(), 0.0);
+
+    if(dist_sum > 0)
     {
       double cut_d;
       do
       {
-        cut_d = RandomValue<double>(0, dist_sum);
+        cut_d = (rng ? RandomValue<double>(0, dist_sum, *rng) :
+          RandomValue<double>(0, dist_sum));
       } while(cut_d == 0.0);
 
       double d_up_now = 0;
@@ -939,16 +2423,19 @@ void TemplatedVocabulary<TDescriptor,F>::createWords()
 
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
-  (const std::vector<std::vector<TDescriptor> > &training_features)
+  (const std::vector<std::vector<TDescriptor> > &training_features,
+  const std::vector<NodeId> *leaves, ThreadPool *pool)
 {
   const unsigned int NWords = m_words.size();
-  const unsigned int NDocs = training_features.size();
 
   if(m_weighting == TF || m_weighting == BINARY)
   {
     // idf part must be 1 always
     for(unsigned int i = 0; i < NWords; i++)
       m_words[i]->weight = 1;
+
+    m_ndocs = 0;
+    m_doc_freq.clear();
   }
   else if(m_weighting == IDF || m_weighting == TF_IDF)
   {
@@ -957,135 +2444,370 @@ void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
     // Note: this actually calculates the idf part of the tf-idf score.
     // The complete tf-idf score is calculated in ::transform
 
-    std::vector<unsigned int> Ni(NWords, 0);
-    std::vector<bool> counted(NWords, false);
-    
-    typename std::vector<std::vector<TDescriptor> >::const_iterator mit;
-    typename std::vector<TDescriptor>::const_iterator fit;
+    countDocuments(training_features, leaves, m_doc_freq, pool);
+    m_ndocs = training_features.size();
+
+    setIdfWeights();
+  }
+
+}
+
+// --------------------------------------------------------------------------
 
-    for(mit = training_features.begin(); mit != training_features.end(); ++mit)
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::countDocuments
+  (const std::vector<std::vector<TDescriptor> > &features,
+  const std::vector<NodeId> *leaves, std::vector<unsigned int> &Ni, 
+  ThreadPool *pool) const
+{
+  const size_t NWords = m_words.size();
+  const size_t NDocs = features.size();
+
+  // position of the first descriptor of each image in leaves
+  std::vector<size_t> offsets(NDocs + 1, 0);
+  for(size_t d = 0; d < NDocs; ++d)
+    offsets[d + 1] = offsets[d] + features[d].size();
+
+  // one range of images per thread
+  size_t P = (pool ? pool->size() + 1 : 1);
+  if(P > NDocs) P = NDocs;
+
+  Ni.assign(NWords, 0);
+  if(P == 0) return;
+
+  std::vector<std::vector<unsigned int> > counts(P);
+
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+  {
+    for(size_t p = begin; p < end; ++p)
     {
-      fill(counted.begin(), counted.end(), false);
+      std::vector<unsigned int> &count = counts[p];
+      count.assign(NWords, 0);
 
-      for(fit = mit->begin(); fit < mit->end(); ++fit)
+      // last image (+1) where each word was counted, so that the counters
+      // do not have to be reset for each image
+      std::vector<unsigned int> last(NWords, 0);
+
+      const size_t dbegin = NDocs * p / P;
+      const size_t dend = NDocs * (p + 1) / P;
+
+      for(size_t d = dbegin; d < dend; ++d)
       {
-        WordId word_id;
-        transform(*fit, word_id);
+        const unsigned int stamp = d + 1;
 
-        if(!counted[word_id])
+        for(size_t j = 0; j < features[d].size(); ++j)
         {
-          Ni[word_id]++;
-          counted[word_id] = true;
+          WordId word_id;
+          if(leaves) word_id = m_nodes[(*leaves)[offsets[d] + j]].word_id;
+          else transform(features[d][j], word_id);
+
+          if(last[word_id] != stamp)
+          {
+            last[word_id] = stamp;
+            count[word_id]++;
+          }
         }
       }
     }
+  };
 
-    // set ln(N/Ni)
-    for(unsigned int i = 0; i < NWords; i++)
+  if(pool) pool->parallelFor(P, f, 1);
+  else f(0, P);
+
+  Ni.swap(counts[0]);
+
+  if(P > 1)
+  {
+    // add up the counters of the other ranges
+    std::function<void(size_t, size_t)> g = [&](size_t begin, size_t end)
     {
-      if(Ni[i] > 0)
+      for(size_t p = 1; p < P; ++p)
       {
-        m_words[i]->weight = log((double)NDocs / (double)Ni[i]);
-      }// else // This cannot occur if using kmeans++
-    }
-  
-  }
+        const std::vector<unsigned int> &count = counts[p];
+        for(size_t i = begin; i < end; ++i) Ni[i] += count[i];
+      }
+    };
 
+    if(pool) pool->parallelFor(NWords, g, 4096);
+    else g(0, NWords);
+  }
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
+void TemplatedVocabulary<TDescriptor,F>::setIdfWeights()
 {
-  return m_words.size();
+  const unsigned int NWords = m_words.size();
+
+  // set ln(N/Ni)
+  for(unsigned int i = 0; i < NWords; i++)
+  {
+    if(m_doc_freq[i] > 0)
+    {
+      m_words[i]->weight = log((double)m_ndocs / (double)m_doc_freq[i]);
+    }
+    else
+    {
+      // this cannot occur with the training images if using kmeans++
+      m_words[i]->weight = 0;
+    }
+  }
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-inline bool TemplatedVocabulary<TDescriptor,F>::empty() const
+void TemplatedVocabulary<TDescriptor,F>::recomputeWeights
+  (const std::vector<std::vector<TDescriptor> > &features, ThreadPool *pool)
 {
-  return m_words.empty();
+  setNodeWeights(features, NULL, pool);
+  updateFrozenWeights();
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-float TemplatedVocabulary<TDescriptor,F>::getEffectiveLevels() const
+void TemplatedVocabulary<TDescriptor,F>::extendWeights
+  (const std::vector<std::vector<TDescriptor> > &features, ThreadPool *pool)
 {
-  long sum = 0;
-  typename std::vector<Node*>::const_iterator wit;
-  for(wit = m_words.begin(); wit != m_words.end(); ++wit)
-  {
-    const Node *p = *wit;
-    
-    for(; p->id != 0; sum++) p = &m_nodes[p->parent];
-  }
-  
-  return (float)((double)sum / (double)m_words.size());
+  if(m_weighting == TF || m_weighting == BINARY) return;
+
+  if(m_doc_freq.size() != m_words.size())
+    throw std::string("The document frequencies of the vocabulary are "
+      "unknown");
+
+  addDocuments(features, pool);
+
+  setIdfWeights();
+  updateFrozenWeights();
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-TDescriptor TemplatedVocabulary<TDescriptor,F>::getWord(WordId wid) const
+void TemplatedVocabulary<TDescriptor,F>::addDocuments
+  (const std::vector<std::vector<TDescriptor> > &features, ThreadPool *pool)
 {
-  return m_words[wid]->descriptor;
+  std::vector<unsigned int> Ni;
+  countDocuments(features, NULL, Ni, pool);
+
+  for(size_t i = 0; i < Ni.size(); ++i) m_doc_freq[i] += Ni[i];
+  m_ndocs += features.size();
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-WordValue TemplatedVocabulary<TDescriptor, F>::getWordWeight(WordId wid) const
+void TemplatedVocabulary<TDescriptor,F>::freeze()
 {
-  return m_words[wid]->weight;
+  m_frozen = FrozenTree();
+  if(m_nodes.empty()) return;
+
+  FrozenTree &t = m_frozen;
+  const size_t N = m_nodes.size();
+
+  t.first_child.reserve(N);
+  t.nchildren.reserve(N);
+  t.node_id.reserve(N);
+  t.word_id.reserve(N);
+  t.weight.reserve(N);
+  t.index.resize(N);
+
+  // breadth-first traversal, node_id is the queue
+  t.node_id.push_back(0); // root
+  for(size_t i = 0; i < t.node_id.size(); ++i)
+  {
+    const Node &node = m_nodes[t.node_id[i]];
+
+    t.index[node.id] = i;
+    t.first_child.push_back(node.isLeaf() ? 0 : t.node_id.size());
+    t.nchildren.push_back(node.children.size());
+    t.word_id.push_back(node.word_id);
+    t.weight.push_back(node.weight);
+
+    t.node_id.insert(t.node_id.end(), node.children.begin(), 
+      node.children.end());
+  }
+
+  const size_t M = t.node_id.size();
+
+  if(DescriptorTraits<F>::packed)
+  {
+    const size_t bytes = DescriptorTraits<F>::bytes;
+    t.packed.resize((M * bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+    unsigned char *p = reinterpret_cast<unsigned char*>(&t.packed[0]);
+
+    // the root has no descriptor
+    for(size_t i = 1; i < M; ++i)
+    {
+      DescriptorTraits<F>::pack(m_nodes[t.node_id[i]].descriptor, 
+        p + i * bytes);
+    }
+  }
+  else
+  {
+    t.descriptors.resize(M);
+    for(size_t i = 1; i < M; ++i)
+    {
+      t.descriptors[i] = m_nodes[t.node_id[i]].descriptor;
+    }
+  }
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-WordId TemplatedVocabulary<TDescriptor, F>::transform
-  (const TDescriptor& feature) const
+void TemplatedVocabulary<TDescriptor,F>::updateFrozenWeights()
 {
-  if(empty())
+  for(size_t i = 0; i < m_frozen.node_id.size(); ++i)
   {
-    return 0;
+    m_frozen.weight[i] = m_nodes[m_frozen.node_id[i]].weight;
   }
-  
-  WordId wid;
-  transform(feature, wid);
-  return wid;
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-void TemplatedVocabulary<TDescriptor,F>::transform(
-  const std::vector<TDescriptor>& features, BowVector &v) const
+TDescriptor TemplatedVocabulary<TDescriptor,F>::nodeDescriptor(NodeId id) const
 {
-  v.clear();
-  
-  if(empty())
+  if(m_frozen.empty()) return m_nodes[id].descriptor;
+
+  const unsigned int i = m_frozen.index[id];
+  if(DescriptorTraits<F>::packed)
   {
-    return;
+    TDescriptor d;
+    if(i > 0) // the root has no descriptor
+      DescriptorTraits<F>::unpack(m_frozen.packedDescriptor(i), d);
+    return d;
   }
+  else
+  {
+    return m_frozen.descriptors[i];
+  }
+}
 
-  // normalize 
-  LNorm norm;
-  bool must = m_scoring_object->mustNormalize(norm);
-
-  typename std::vector<TDescriptor>::const_iterator fit;
+// --------------------------------------------------------------------------
 
-  if(m_weighting == TF || m_weighting == TF_IDF)
-  {
+template<class TDescriptor, class F>
+inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
+{
+  return m_words.size();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+inline bool TemplatedVocabulary<TDescriptor,F>::empty() const
+{
+  return m_words.empty();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+float TemplatedVocabulary<TDescriptor,F>::getEffectiveLevels() const
+{
+  long sum = 0;
+  typename std::vector<Node*>::const_iterator wit;
+  for(wit = m_words.begin(); wit != m_words.end(); ++wit)
+  {
+    const Node *p = *wit;
+    
+    for(; p->id != 0; sum++) p = &m_nodes[p->parent];
+  }
+  
+  return (float)((double)sum / (double)m_words.size());
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+TDescriptor TemplatedVocabulary<TDescriptor,F>::getWord(WordId wid) const
+{
+  return nodeDescriptor(m_words[wid]->id);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+WordValue TemplatedVocabulary<TDescriptor, F>::getWordWeight(WordId wid) const
+{
+  return m_words[wid]->weight;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+WordId TemplatedVocabulary<TDescriptor, F>::transform
+  (const TDescriptor& feature) const
+{
+  if(empty())
+  {
+    return 0;
+  }
+  
+  StatsScope scope(m_counters, NULL);
+  DBOW2_STATS(StatsTimer timer;)
+
+  WordId wid;
+  WordValue weight;
+  transform(feature, wid, weight, NULL, 0, scope.stats());
+
+  DBOW2_STATS(
+    scope.stats()->descriptors = 1;
+    scope.stats()->transform_time = timer.lap();
+  )
+  return wid;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+inline QueryStats TemplatedVocabulary<TDescriptor, F>::getStats() const
+{
+  return m_counters.get();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+inline void TemplatedVocabulary<TDescriptor, F>::resetStats() const
+{
+  m_counters.reset();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const std::vector<TDescriptor>& features, BowVector &v) const
+{
+  v.clear();
+  
+  if(empty())
+  {
+    return;
+  }
+
+  StatsScope scope(m_counters, NULL);
+  DBOW2_STATS(StatsTimer timer;)
+
+  // normalize 
+  LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
+
+  typename std::vector<TDescriptor>::const_iterator fit;
+
+  if(m_weighting == TF || m_weighting == TF_IDF)
+  {
     for(fit = features.begin(); fit < features.end(); ++fit)
     {
       WordId id;
       WordValue w; 
       // w is the idf value if TF_IDF, 1 if TF
       
-      transform(*fit, id, w);
+      transform(*fit, id, w, NULL, 0, scope.stats());
       
       // not stopped
       if(w > 0) v.addWeight(id, w);
@@ -1108,7 +2830,7 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
       WordValue w;
       // w is idf if IDF, or 1 if BINARY
       
-      transform(*fit, id, w);
+      transform(*fit, id, w, NULL, 0, scope.stats());
       
       // not stopped
       if(w > 0) v.addIfNotExist(id, w);
@@ -1117,14 +2839,440 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   } // if m_weighting == ...
   
   if(must) v.normalize(norm);
+
+  DBOW2_STATS(
+    scope.stats()->descriptors = features.size();
+    scope.stats()->transform_time = timer.lap();
+  )
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F> 
 void TemplatedVocabulary<TDescriptor,F>::transform(
-  const std::vector<TDescriptor>& features,
-  BowVector &v, FeatureVector &fv, int levelsup) const
+  const std::vector<TDescriptor>& features,
+  BowVector &v, FeatureVector &fv, int levelsup) const
+{
+  v.clear();
+  fv.clear();
+  
+  if(empty()) // safe for subclasses
+  {
+    return;
+  }
+  
+  StatsScope scope(m_counters, NULL);
+  DBOW2_STATS(StatsTimer timer;)
+
+  // normalize 
+  LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
+  
+  typename std::vector<TDescriptor>::const_iterator fit;
+  
+  if(m_weighting == TF || m_weighting == TF_IDF)
+  {
+    unsigned int i_feature = 0;
+    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    {
+      WordId id;
+      NodeId nid;
+      WordValue w; 
+      // w is the idf value if TF_IDF, 1 if TF
+      
+      transform(*fit, id, w, &nid, levelsup, scope.stats());
+      
+      if(w > 0) // not stopped
+      { 
+        v.addWeight(id, w);
+        fv.addFeature(nid, i_feature);
+      }
+    }
+    
+    if(!v.empty() && !must)
+    {
+      // unnecessary when normalizing
+      const double nd = v.size();
+      for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++) 
+        vit->second /= nd;
+    }
+  
+  }
+  else // IDF || BINARY
+  {
+    unsigned int i_feature = 0;
+    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    {
+      WordId id;
+      NodeId nid;
+      WordValue w;
+      // w is idf if IDF, or 1 if BINARY
+      
+      transform(*fit, id, w, &nid, levelsup, scope.stats());
+      
+      if(w > 0) // not stopped
+      {
+        v.addIfNotExist(id, w);
+        fv.addFeature(nid, i_feature);
+      }
+    }
+  } // if m_weighting == ...
+  
+  if(must) v.normalize(norm);
+
+  DBOW2_STATS(
+    scope.stats()->descriptors = features.size();
+    scope.stats()->transform_time = timer.lap();
+  )
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const std::vector<TDescriptor>& features, BowVector &v, 
+  ThreadPool &pool) const
+{
+  v.clear();
+  
+  if(empty())
+  {
+    return;
+  }
+
+  StatsScope scope(m_counters, NULL);
+
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  quantize(features, ids, weights, NULL, 0, &pool, scope.stats());
+  buildVectors(ids, weights, NULL, v, NULL);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const std::vector<TDescriptor>& features,
+  BowVector &v, FeatureVector &fv, int levelsup, ThreadPool &pool) const
+{
+  v.clear();
+  fv.clear();
+  
+  if(empty()) // safe for subclasses
+  {
+    return;
+  }
+
+  StatsScope scope(m_counters, NULL);
+
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  std::vector<NodeId> nids;
+  quantize(features, ids, weights, &nids, levelsup, &pool, scope.stats());
+  buildVectors(ids, weights, &nids, v, &fv);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::quantize(
+  const std::vector<TDescriptor> &features,
+  std::vector<WordId> &ids, std::vector<WordValue> &weights,
+  std::vector<NodeId> *nids, int levelsup, ThreadPool *pool, 
+  QueryStats *stats) const
+{
+  // descriptors per task
+  const size_t grain = 64;
+
+  (void)stats; // unused if stats are not enabled
+  DBOW2_STATS(
+    StatsTimer timer;
+    std::mutex mutex;
+  )
+
+  ids.resize(features.size());
+  weights.resize(features.size());
+  if(nids) nids->resize(features.size());
+
+  // each task writes the results of its own features only
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
+  {
+    // and counts its work apart
+    QueryStats *task_stats = NULL;
+    DBOW2_STATS(
+      QueryStats local;
+      if(stats) task_stats = &local;
+    )
+
+    for(size_t i = begin; i < end; ++i)
+    {
+      transform(features[i], ids[i], weights[i], 
+        (nids ? &(*nids)[i] : NULL), levelsup, task_stats);
+    }
+
+    DBOW2_STATS(
+      if(stats)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        *stats += local;
+      }
+    )
+  };
+
+  if(pool) pool->parallelFor(features.size(), f, grain);
+  else f(0, features.size());
+
+  DBOW2_STATS(
+    if(stats)
+    {
+      stats->descriptors += features.size();
+      stats->transform_time += timer.lap();
+    }
+  )
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::buildVectors(
+  const std::vector<WordId> &ids, const std::vector<WordValue> &weights, 
+  const std::vector<NodeId> *nids, BowVector &v, FeatureVector *fv) const
+{
+  // normalize 
+  LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
+
+  // features are added in order, so that words get the same values as
+  // with the serial transform
+  if(m_weighting == TF || m_weighting == TF_IDF)
+  {
+    for(unsigned int i_feature = 0; i_feature < ids.size(); ++i_feature)
+    {
+      if(weights[i_feature] > 0) // not stopped
+      {
+        v.addWeight(ids[i_feature], weights[i_feature]);
+        if(fv) fv->addFeature((*nids)[i_feature], i_feature);
+      }
+    }
+    
+    if(!v.empty() && !must)
+    {
+      // unnecessary when normalizing
+      const double nd = v.size();
+      for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++) 
+        vit->second /= nd;
+    }
+  }
+  else // IDF || BINARY
+  {
+    for(unsigned int i_feature = 0; i_feature < ids.size(); ++i_feature)
+    {
+      if(weights[i_feature] > 0) // not stopped
+      {
+        v.addIfNotExist(ids[i_feature], weights[i_feature]);
+        if(fv) fv->addFeature((*nids)[i_feature], i_feature);
+      }
+    }
+  } // if m_weighting == ...
+  
+  if(must) v.normalize(norm);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const std::vector<TDescriptor>& features, FlatBowVector &v, 
+  ThreadPool *pool, QueryStats *stats) const
+{
+  v.clear();
+  
+  if(empty())
+  {
+    return;
+  }
+
+  StatsScope scope(m_counters, stats);
+
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  quantize(features, ids, weights, NULL, 0, pool, scope.stats());
+  buildFlatVectors(ids, weights, NULL, v, NULL);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const std::vector<TDescriptor>& features,
+  FlatBowVector &v, FlatFeatureVector &fv, int levelsup, 
+  ThreadPool *pool, QueryStats *stats) const
+{
+  v.clear();
+  fv.clear();
+  
+  if(empty()) // safe for subclasses
+  {
+    return;
+  }
+
+  StatsScope scope(m_counters, stats);
+
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  std::vector<NodeId> nids;
+  quantize(features, ids, weights, &nids, levelsup, pool, scope.stats());
+  buildFlatVectors(ids, weights, &nids, v, &fv);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::buildFlatVectors(
+  const std::vector<WordId> &ids, const std::vector<WordValue> &weights, 
+  const std::vector<NodeId> *nids, FlatBowVector &v, 
+  FlatFeatureVector *fv) const
+{
+  // sort (id, feature index) keys of the features not stopped, so that
+  // repeated words keep the feature order
+  std::vector<uint64_t> keys;
+  keys.reserve(ids.size());
+  for(unsigned int i_feature = 0; i_feature < ids.size(); ++i_feature)
+  {
+    if(weights[i_feature] > 0)
+      keys.push_back(((uint64_t)ids[i_feature] << 32) | i_feature);
+  }
+  std::sort(keys.begin(), keys.end());
+
+  // normalize 
+  LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
+
+  // TF and TF_IDF add the weights of repeated words, IDF and BINARY keep
+  // the first one
+  const bool accumulate = (m_weighting == TF || m_weighting == TF_IDF);
+
+  v.reserve(keys.size());
+  std::vector<uint64_t>::const_iterator kit;
+  for(kit = keys.begin(); kit != keys.end(); ++kit)
+  {
+    const WordId id = (WordId)(*kit >> 32);
+    const WordValue w = weights[*kit & 0xffffffff];
+
+    if(!v.empty() && v.id(v.size() - 1) == id)
+    {
+      if(accumulate) v.value(v.size() - 1) += w;
+    }
+    else
+    {
+      v.push_back(id, w);
+    }
+  }
+
+  if(accumulate && !v.empty() && !must)
+  {
+    // unnecessary when normalizing
+    const double nd = v.size();
+    for(size_t i = 0; i < v.size(); ++i)
+      v.value(i) /= nd;
+  }
+
+  if(must) v.normalize(norm);
+
+  if(fv)
+  {
+    // the same with (node id, feature index) keys
+    keys.clear();
+    for(unsigned int i_feature = 0; i_feature < ids.size(); ++i_feature)
+    {
+      if(weights[i_feature] > 0)
+        keys.push_back(((uint64_t)(*nids)[i_feature] << 32) | i_feature);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    fv->reserve(keys.size(), keys.size());
+    for(kit = keys.begin(); kit != keys.end(); ++kit)
+    {
+      fv->push_back((NodeId)(*kit >> 32), 
+        (unsigned int)(*kit & 0xffffffff));
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const DescriptorMatrix &features, BowVector &v, ThreadPool *pool,
+  QueryStats *stats) const
+{
+  v.clear();
+  
+  if(empty())
+  {
+    return;
+  }
+
+  StatsScope scope(m_counters, stats);
+
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  quantize(features, ids, weights, NULL, 0, pool, scope.stats());
+  buildVectors(ids, weights, NULL, v, NULL);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const DescriptorMatrix &features, BowVector &v, FeatureVector &fv, 
+  int levelsup, ThreadPool *pool, QueryStats *stats) const
+{
+  v.clear();
+  fv.clear();
+  
+  if(empty()) // safe for subclasses
+  {
+    return;
+  }
+
+  StatsScope scope(m_counters, stats);
+
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  std::vector<NodeId> nids;
+  quantize(features, ids, weights, &nids, levelsup, pool, scope.stats());
+  buildVectors(ids, weights, &nids, v, &fv);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const DescriptorMatrix &features, FlatBowVector &v, ThreadPool *pool,
+  QueryStats *stats) const
+{
+  v.clear();
+  
+  if(empty())
+  {
+    return;
+  }
+
+  StatsScope scope(m_counters, stats);
+
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  quantize(features, ids, weights, NULL, 0, pool, scope.stats());
+  buildFlatVectors(ids, weights, NULL, v, NULL);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const DescriptorMatrix &features, FlatBowVector &v, FlatFeatureVector &fv,
+  int levelsup, ThreadPool *pool, QueryStats *stats) const
 {
   v.clear();
   fv.clear();
@@ -1133,62 +3281,227 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   {
     return;
   }
-  
-  // normalize 
-  LNorm norm;
-  bool must = m_scoring_object->mustNormalize(norm);
-  
-  typename std::vector<TDescriptor>::const_iterator fit;
-  
-  if(m_weighting == TF || m_weighting == TF_IDF)
+
+  StatsScope scope(m_counters, stats);
+
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  std::vector<NodeId> nids;
+  quantize(features, ids, weights, &nids, levelsup, pool, scope.stats());
+  buildFlatVectors(ids, weights, &nids, v, &fv);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::quantize(
+  const DescriptorMatrix &features,
+  std::vector<WordId> &ids, std::vector<WordValue> &weights,
+  std::vector<NodeId> *nids, int levelsup, ThreadPool *pool, 
+  QueryStats *stats) const
+{
+  if(!DescriptorTraits<F>::packed)
+    throw std::string("TemplatedVocabulary: these descriptors have no "
+      "packed representation to be read from a matrix");
+  if(!features.empty() && 
+    features.rowBytes() != (size_t)DescriptorTraits<F>::bytes)
+    throw std::string("TemplatedVocabulary: the rows of the matrix are not ")
+      + "descriptors of type " + DescriptorTraits<F>::name();
+
+  // descriptors per task
+  const size_t grain = 64;
+  const size_t n = features.rows();
+
+  (void)stats; // unused if stats are not enabled
+  DBOW2_STATS(
+    StatsTimer timer;
+    std::mutex mutex;
+  )
+
+  ids.resize(n);
+  weights.resize(n);
+  if(nids) nids->resize(n);
+
+  std::function<void(size_t, size_t)> f = [&](size_t begin, size_t end)
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    QueryStats *task_stats = NULL;
+    DBOW2_STATS(
+      QueryStats local;
+      if(stats) task_stats = &local;
+    )
+
+    // rows that are not aligned as the descriptors of F are copied, so
+    // that the kernels can read their words
+    uint64_t buffer[(DescriptorTraits<F>::bytes + sizeof(uint64_t) - 1) / 
+      sizeof(uint64_t) + 1];
+
+    for(size_t i = begin; i < end; ++i)
     {
-      WordId id;
-      NodeId nid;
-      WordValue w; 
-      // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w, &nid, levelsup);
-      
-      if(w > 0) // not stopped
-      { 
-        v.addWeight(id, w);
-        fv.addFeature(nid, i_feature);
+      const unsigned char *q = features.row(i);
+      if(reinterpret_cast<uintptr_t>(q) % sizeof(uint64_t) != 0)
+      {
+        std::memcpy(buffer, q, DescriptorTraits<F>::bytes);
+        q = reinterpret_cast<const unsigned char*>(buffer);
       }
+
+      transformPacked(q, ids[i], weights[i], (nids ? &(*nids)[i] : NULL), 
+        levelsup, task_stats);
     }
-    
-    if(!v.empty() && !must)
+
+    DBOW2_STATS(
+      if(stats)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        *stats += local;
+      }
+    )
+  };
+
+  if(pool) pool->parallelFor(n, f, grain);
+  else f(0, n);
+
+  DBOW2_STATS(
+    if(stats)
     {
-      // unnecessary when normalizing
-      const double nd = v.size();
-      for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++) 
-        vit->second /= nd;
+      stats->descriptors += n;
+      stats->transform_time += timer.lap();
     }
-  
+  )
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::uploadTree(GpuTree &gpu) const
+{
+  if(!DescriptorTraits<F>::hamming)
+    throw std::string("TemplatedVocabulary: only the trees of binary "
+      "descriptors can be uploaded to the GPU");
+  if(empty() || m_frozen.empty())
+    throw std::string("TemplatedVocabulary: the vocabulary is empty");
+
+  const FrozenTree &t = m_frozen;
+  gpu.upload(&t.first_child[0], &t.nchildren[0], 
+    (unsigned int)t.node_id.size(), t.packedDescriptor(0),
+    DescriptorTraits<F>::bytes);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::quantize(
+  const std::vector<TDescriptor> &features,
+  std::vector<WordId> &ids, std::vector<WordValue> &weights,
+  std::vector<NodeId> *nids, int levelsup, const GpuTree &gpu) const
+{
+  StatsScope scope(m_counters, NULL);
+  DBOW2_STATS(StatsTimer timer;)
+
+  const size_t bytes = DescriptorTraits<F>::bytes;
+  std::vector<uint64_t> packed((features.size() * bytes + 
+    sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  unsigned char *p = reinterpret_cast<unsigned char*>(packed.data());
+  for(size_t i = 0; i < features.size(); ++i)
+    DescriptorTraits<F>::pack(features[i], p + i * bytes);
+
+  quantizePacked(p, features.size(), ids, weights, nids, levelsup, gpu);
+
+  DBOW2_STATS(
+    scope.stats()->descriptors += features.size();
+    scope.stats()->transform_time = timer.lap();
+  )
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const std::vector<std::vector<TDescriptor> > &features,
+  std::vector<BowVector> &v, std::vector<FeatureVector> *fv, int levelsup,
+  const GpuTree &gpu) const
+{
+  v.clear();
+  v.resize(features.size());
+  if(fv)
+  {
+    fv->clear();
+    fv->resize(features.size());
   }
-  else // IDF || BINARY
+
+  if(empty()) return;
+
+  StatsScope scope(m_counters, NULL);
+  DBOW2_STATS(StatsTimer timer;)
+
+  // the descriptors of all the images are quantized together
+  const size_t bytes = DescriptorTraits<F>::bytes;
+  size_t n = 0;
+  for(size_t i = 0; i < features.size(); ++i) n += features[i].size();
+
+  std::vector<uint64_t> packed((n * bytes + sizeof(uint64_t) - 1) / 
+    sizeof(uint64_t));
+  unsigned char *p = reinterpret_cast<unsigned char*>(packed.data());
+  for(size_t i = 0, k = 0; i < features.size(); ++i)
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
-    {
-      WordId id;
-      NodeId nid;
-      WordValue w;
-      // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w, &nid, levelsup);
-      
-      if(w > 0) // not stopped
-      {
-        v.addIfNotExist(id, w);
-        fv.addFeature(nid, i_feature);
-      }
-    }
-  } // if m_weighting == ...
-  
-  if(must) v.normalize(norm);
+    for(size_t j = 0; j < features[i].size(); ++j, ++k)
+      DescriptorTraits<F>::pack(features[i][j], p + k * bytes);
+  }
+
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  std::vector<NodeId> nids;
+  quantizePacked(p, n, ids, weights, (fv ? &nids : NULL), levelsup, gpu);
+
+  // and the vectors are built image by image
+  std::vector<WordId> image_ids;
+  std::vector<WordValue> image_weights;
+  std::vector<NodeId> image_nids;
+  for(size_t i = 0, k = 0; i < features.size(); k += features[i].size(), ++i)
+  {
+    const size_t m = features[i].size();
+    image_ids.assign(ids.begin() + k, ids.begin() + k + m);
+    image_weights.assign(weights.begin() + k, weights.begin() + k + m);
+    if(fv) image_nids.assign(nids.begin() + k, nids.begin() + k + m);
+
+    buildVectors(image_ids, image_weights, (fv ? &image_nids : NULL), v[i],
+      (fv ? &(*fv)[i] : NULL));
+  }
+
+  DBOW2_STATS(
+    scope.stats()->descriptors += n;
+    scope.stats()->transform_time = timer.lap();
+  )
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::quantizePacked(
+  const unsigned char *packed, size_t n, 
+  std::vector<WordId> &ids, std::vector<WordValue> &weights,
+  std::vector<NodeId> *nids, int levelsup, const GpuTree &gpu) const
+{
+  if(gpu.empty() || gpu.nodes() != m_frozen.node_id.size() || 
+    gpu.bytes() != DescriptorTraits<F>::bytes)
+    throw std::string("TemplatedVocabulary: the GPU tree was not uploaded "
+      "from this vocabulary");
+
+  std::vector<unsigned int> leaves(n);
+  std::vector<unsigned int> ancestors(nids ? n : 0);
+  gpu.quantize(packed, n, m_L - levelsup, leaves.data(), 
+    (nids ? ancestors.data() : NULL));
+
+  // frozen indexes to words and nodes
+  const FrozenTree &t = m_frozen;
+  ids.resize(n);
+  weights.resize(n);
+  if(nids) nids->resize(n);
+  for(size_t i = 0; i < n; ++i)
+  {
+    ids[i] = t.word_id[leaves[i]];
+    weights[i] = t.weight[leaves[i]];
+    if(nids) (*nids)[i] = t.node_id[ancestors[i]];
+  }
 }
 
 // --------------------------------------------------------------------------
@@ -1202,6 +3515,15 @@ inline double TemplatedVocabulary<TDescriptor,F>::score
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F> 
+inline double TemplatedVocabulary<TDescriptor,F>::score
+  (const FlatBowVector &v1, const FlatBowVector &v2) const
+{
+  return m_scoring_object->score(v1, v2);
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform
   (const TDescriptor &feature, WordId &id) const
@@ -1215,15 +3537,79 @@ void TemplatedVocabulary<TDescriptor,F>::transform
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
+{
+  transform(feature, word_id, weight, nid, levelsup, NULL);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
+  WordId &word_id, WordValue &weight, NodeId *nid, int levelsup,
+  QueryStats *stats) const
 { 
-  // propagate the feature down the tree
-  std::vector<NodeId> nodes;
-  typename std::vector<NodeId>::const_iterator nit;
+  (void)stats; // unused if stats are not enabled
+
+  if(DescriptorTraits<F>::packed && !m_frozen.empty())
+  {
+    uint64_t buffer[(DescriptorTraits<F>::bytes + sizeof(uint64_t) - 1) / 
+      sizeof(uint64_t) + 1];
+    const unsigned char *q = DescriptorTraits<F>::view(feature, 
+      reinterpret_cast<unsigned char*>(buffer));
+
+    transformPacked(q, word_id, weight, nid, levelsup, stats);
+    return;
+  }
 
   // level at which the node must be stored in nid, if given
   const int nid_level = m_L - levelsup;
   if(nid_level <= 0 && nid != NULL) *nid = 0; // root
 
+  if(!m_frozen.empty())
+  {
+    // propagate the feature down the frozen tree: the children of each
+    // node are contiguous in memory
+    const FrozenTree &t = m_frozen;
+
+    unsigned int i = 0; // root
+    int current_level = 0;
+
+    do
+    {
+      ++current_level;
+      unsigned int c = t.first_child[i];
+      const unsigned int cend = c + t.nchildren[i];
+      DBOW2_STATS(if(stats) stats->distances += cend - c;)
+
+      i = c;
+      double best_d = F::distance(feature, t.descriptors[c]);
+
+      for(++c; c < cend; ++c)
+      {
+        double d = F::distance(feature, t.descriptors[c]);
+        if(d < best_d)
+        {
+          best_d = d;
+          i = c;
+        }
+      }
+
+      if(nid != NULL && current_level == nid_level)
+        *nid = t.node_id[i];
+
+    } while(t.nchildren[i] > 0);
+
+    DBOW2_STATS(if(stats) stats->levels += current_level;)
+
+    word_id = t.word_id[i];
+    weight = t.weight[i];
+    return;
+  }
+
+  // propagate the feature down the tree
+  std::vector<NodeId> nodes;
+  typename std::vector<NodeId>::const_iterator nit;
+
   NodeId final_id = 0; // root
   int current_level = 0;
 
@@ -1232,6 +3618,7 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
     ++current_level;
     nodes = m_nodes[final_id].children;
     final_id = nodes[0];
+    DBOW2_STATS(if(stats) stats->distances += nodes.size();)
  
     double best_d = F::distance(feature, m_nodes[final_id].descriptor);
 
@@ -1251,6 +3638,8 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
     
   } while( !m_nodes[final_id].isLeaf() );
 
+  DBOW2_STATS(if(stats) stats->levels += current_level;)
+
   // turn node id into word id
   word_id = m_nodes[final_id].word_id;
   weight = m_nodes[final_id].weight;
@@ -1258,6 +3647,55 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transformPacked(
+  const unsigned char *q, WordId &word_id, WordValue &weight, NodeId *nid, 
+  int levelsup, QueryStats *stats) const
+{
+  (void)stats; // unused if stats are not enabled
+
+  if(m_frozen.empty())
+  {
+    // only subclasses that change the tree can get here
+    TDescriptor feature;
+    DescriptorTraits<F>::unpack(q, feature);
+    transform(feature, word_id, weight, nid, levelsup, stats);
+    return;
+  }
+
+  // level at which the node must be stored in nid, if given
+  const int nid_level = m_L - levelsup;
+  if(nid_level <= 0 && nid != NULL) *nid = 0; // root
+
+  // propagate the feature down the frozen tree: the children of each node
+  // are contiguous in memory, and compared with one call
+  const FrozenTree &t = m_frozen;
+
+  unsigned int i = 0; // root
+  int current_level = 0;
+
+  do
+  {
+    ++current_level;
+    const unsigned int c = t.first_child[i];
+    const unsigned int cend = c + t.nchildren[i];
+    DBOW2_STATS(if(stats) stats->distances += cend - c;)
+
+    i = c + DescriptorTraits<F>::nearest(q, t.packedDescriptor(c), cend - c);
+
+    if(nid != NULL && current_level == nid_level)
+      *nid = t.node_id[i];
+
+  } while(t.nchildren[i] > 0);
+
+  DBOW2_STATS(if(stats) stats->levels += current_level;)
+
+  word_id = t.word_id[i];
+  weight = t.weight[i];
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 NodeId TemplatedVocabulary<TDescriptor,F>::getParentNode
   (WordId wid, int levelsup) const
@@ -1327,6 +3765,7 @@ int TemplatedVocabulary<TDescriptor,F>::stopWords(double minWeight)
       (*wit)->weight = 0;
     }
   }
+  updateFrozenWeights();
   return c;
 }
 
@@ -1335,6 +3774,12 @@ int TemplatedVocabulary<TDescriptor,F>::stopWords(double minWeight)
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::save(const std::string &filename) const
 {
+  if(isBinaryFile(filename))
+  {
+    saveBinary(filename);
+    return;
+  }
+
   cv::FileStorage fs(filename.c_str(), cv::FileStorage::WRITE);
   if(!fs.isOpened()) throw std::string("Could not open file ") + filename;
   
@@ -1346,6 +3791,12 @@ void TemplatedVocabulary<TDescriptor,F>::save(const std::string &filename) const
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::load(const std::string &filename)
 {
+  if(isBinaryFile(filename))
+  {
+    loadBinary(filename);
+    return;
+  }
+
   cv::FileStorage fs(filename.c_str(), cv::FileStorage::READ);
   if(!fs.isOpened()) throw std::string("Could not open file ") + filename;
   
@@ -1417,7 +3868,7 @@ void TemplatedVocabulary<TDescriptor,F>::save(cv::FileStorage &f,
       f << "nodeId" << (int)child.id;
       f << "parentId" << (int)pid;
       f << "weight" << (double)child.weight;
-      f << "descriptor" << F::toString(child.descriptor);
+      f << "descriptor" << F::toString(nodeDescriptor(*pit));
       f << "}";
       
       // add to parent list
@@ -1457,6 +3908,9 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
 {
   m_words.clear();
   m_nodes.clear();
+  m_frozen = FrozenTree();
+  m_ndocs = 0;
+  m_doc_freq.clear();
   
   cv::FileNode fvoc = fs[name];
   
@@ -1503,6 +3957,260 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  freeze();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::saveBinary
+  (const std::string &filename) const
+{
+  std::vector<unsigned char> buffer;
+  saveBinary(buffer);
+  writeFile(filename, buffer);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::saveBinary
+  (std::vector<unsigned char> &buffer) const
+{
+  // Format:
+  // header (BinaryHeader)
+  // nodes: node id, first child, number of children and word id of the
+  //   nodes of the frozen tree, in breadth-first order (nnodes uint32 each)
+  // weights: weight of each node (nnodes WordValue)
+  // descriptors: nnodes packed descriptors, or, if F cannot pack them, 
+  //   nnodes + 1 uint64 offsets followed by the F::toString of each one
+  //
+  // Sections start at multiples of 64 bytes, and the root is included
+  // (with an empty descriptor)
+  //
+
+  const FrozenTree &t = m_frozen;
+  const bool packed = DescriptorTraits<F>::packed;
+  const size_t M = t.node_id.size();
+
+  BinaryHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "DBoW2VOC", sizeof(h.magic));
+  h.version = BINARY_VERSION;
+  h.byte_order = 0x01020304;
+  h.k = m_k;
+  h.L = m_L;
+  h.weighting = m_weighting;
+  h.scoring = m_scoring;
+  h.nnodes = M;
+  h.nwords = m_words.size();
+  h.descriptor_bytes = packed ? DescriptorTraits<F>::bytes : 0;
+  h.weight_bytes = sizeof(WordValue);
+  strncpy(h.descriptor, DescriptorTraits<F>::name(), sizeof(h.descriptor) - 1);
+
+  buffer.assign(sizeof(h), 0);
+  
+  alignBuffer(buffer, 64);
+  h.nodes_offset = buffer.size();
+  appendArray(buffer, t.node_id.data(), M);
+  appendArray(buffer, t.first_child.data(), M);
+  appendArray(buffer, t.nchildren.data(), M);
+  appendArray(buffer, t.word_id.data(), M);
+
+  alignBuffer(buffer, 64);
+  h.weights_offset = buffer.size();
+  appendArray(buffer, t.weight.data(), M);
+
+  alignBuffer(buffer, 64);
+  h.descriptors_offset = buffer.size();
+  if(packed)
+  {
+    if(M > 0)
+      appendArray(buffer, t.packedDescriptor(0), 
+        M * DescriptorTraits<F>::bytes);
+  }
+  else
+  {
+    std::vector<std::string> strings(M);
+    std::vector<uint64_t> offsets(M + 1, 0);
+    for(size_t i = 0; i < M; ++i)
+    {
+      if(i > 0) strings[i] = F::toString(t.descriptors[i]);
+      offsets[i+1] = offsets[i] + strings[i].size();
+    }
+
+    appendArray(buffer, offsets.data(), offsets.size());
+    for(size_t i = 0; i < M; ++i)
+      appendArray(buffer, strings[i].data(), strings[i].size());
+  }
+  h.descriptors_size = buffer.size() - h.descriptors_offset;
+  h.file_size = buffer.size();
+
+  h.checksum = checksum(reinterpret_cast<const unsigned char*>(&h), sizeof(h));
+  h.checksum = checksum(&buffer[sizeof(h)], buffer.size() - sizeof(h), 
+    h.checksum);
+  memcpy(&buffer[0], &h, sizeof(h));
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::loadBinary
+  (const std::string &filename)
+{
+  std::shared_ptr<const MappedFile> file(new MappedFile(filename));
+  loadBinary(file, 0, file->size(), filename);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::loadBinary
+  (const std::shared_ptr<const MappedFile> &file, size_t offset, size_t size,
+  const std::string &filename)
+{
+  if(offset % 64 != 0 || offset > file->size() || 
+    size > file->size() - offset)
+    throw std::string("Wrong binary vocabulary in ") + filename;
+
+  const unsigned char *data = file->data() + offset;
+  const bool packed = DescriptorTraits<F>::packed;
+
+  // check the header
+  BinaryHeader h;
+  if(size < sizeof(h) ||
+    memcmp(data, "DBoW2VOC", sizeof(h.magic)) != 0)
+    throw std::string("File ") + filename + " is not a binary vocabulary";
+
+  memcpy(&h, data, sizeof(h));
+
+  if(h.version != BINARY_VERSION || h.byte_order != 0x01020304)
+    throw std::string("Unsupported version or byte order of binary "
+      "vocabulary ") + filename;
+
+  if(h.file_size != size)
+    throw std::string("Truncated binary vocabulary ") + filename;
+
+  const uint64_t file_checksum = h.checksum;
+  h.checksum = 0;
+  h.checksum = checksum(reinterpret_cast<const unsigned char*>(&h), sizeof(h));
+  h.checksum = checksum(data + sizeof(h), size - sizeof(h), h.checksum);
+  if(h.checksum != file_checksum)
+    throw std::string("Corrupted binary vocabulary ") + filename;
+
+  h.descriptor[sizeof(h.descriptor) - 1] = '\0';
+  if(strcmp(h.descriptor, DescriptorTraits<F>::name()) != 0 ||
+    h.descriptor_bytes != (uint32_t)(packed ? DescriptorTraits<F>::bytes : 0)
+    || h.weight_bytes != sizeof(WordValue))
+    throw std::string("Binary vocabulary ") + filename + 
+      " was created with another type of descriptor (" + h.descriptor + ")";
+
+  // sections must be aligned and within the file
+  const size_t M = h.nnodes;
+  const uint64_t S = h.file_size;
+  if(h.nodes_offset % sizeof(uint32_t) != 0 || h.nodes_offset > S ||
+    4 * M * sizeof(uint32_t) > S - h.nodes_offset ||
+    h.weights_offset % sizeof(WordValue) != 0 || h.weights_offset > S ||
+    M * sizeof(WordValue) > S - h.weights_offset ||
+    h.descriptors_offset % sizeof(uint64_t) != 0 || 
+    h.descriptors_offset > S || h.descriptors_size > S - h.descriptors_offset ||
+    (packed && h.descriptors_size != M * DescriptorTraits<F>::bytes) ||
+    (!packed && h.descriptors_size < (M + 1) * sizeof(uint64_t)))
+    throw std::string("Wrong sections in binary vocabulary ") + filename;
+
+  m_k = h.k;
+  m_L = h.L;
+  m_weighting = (WeightingType)h.weighting;
+  m_scoring = (ScoringType)h.scoring;
+  createScoringObject();
+
+  m_words.clear();
+  m_nodes.clear();
+  m_frozen = FrozenTree();
+  m_ndocs = 0;
+  m_doc_freq.clear();
+
+  // frozen tree
+  FrozenTree &t = m_frozen;
+
+  const uint32_t *u = reinterpret_cast<const uint32_t*>(data + h.nodes_offset);
+  t.node_id.assign(u, u + M);
+  t.first_child.assign(u + M, u + 2 * M);
+  t.nchildren.assign(u + 2 * M, u + 3 * M);
+  t.word_id.assign(u + 3 * M, u + 4 * M);
+
+  const WordValue *w = 
+    reinterpret_cast<const WordValue*>(data + h.weights_offset);
+  t.weight.assign(w, w + M);
+
+  if(packed)
+  {
+    t.mapping = file;
+    t.packed_offset = offset + h.descriptors_offset;
+  }
+  else
+  {
+    const uint64_t *offsets = 
+      reinterpret_cast<const uint64_t*>(data + h.descriptors_offset);
+    const char *chars = reinterpret_cast<const char*>(offsets + M + 1);
+
+    if(offsets[M] > h.descriptors_size - (M + 1) * sizeof(uint64_t))
+      throw std::string("Wrong sections in binary vocabulary ") + filename;
+
+    t.descriptors.resize(M);
+    for(size_t i = 1; i < M; ++i)
+    {
+      if(offsets[i] > offsets[i+1])
+        throw std::string("Wrong descriptors in binary vocabulary ") + 
+          filename;
+
+      F::fromString(t.descriptors[i], 
+        std::string(chars + offsets[i], chars + offsets[i+1]));
+    }
+  }
+
+  // nodes and words
+  for(size_t i = 0; i < M; ++i)
+  {
+    const size_t c = t.first_child[i];
+    const size_t n = t.nchildren[i];
+
+    if(t.node_id[i] >= M || (i == 0 && t.node_id[i] != 0) || 
+      (n > 0 && (c <= i || c + n > M)) ||
+      (n == 0 && i > 0 && t.word_id[i] >= h.nwords))
+      throw std::string("Wrong tree in binary vocabulary ") + filename;
+  }
+
+  m_nodes.resize(M);
+  m_words.resize(h.nwords, NULL);
+  t.index.resize(M);
+
+  for(size_t i = 0; i < M; ++i)
+  {
+    const NodeId nid = t.node_id[i];
+    const size_t c = t.first_child[i];
+    const size_t n = t.nchildren[i];
+
+    Node &node = m_nodes[nid];
+    node.id = nid;
+    node.weight = t.weight[i];
+    node.word_id = t.word_id[i];
+    node.children.assign(t.node_id.begin() + c, t.node_id.begin() + c + n);
+
+    for(size_t j = c; j < c + n; ++j)
+      m_nodes[t.node_id[j]].parent = nid;
+
+    if(n == 0 && i > 0) m_words[node.word_id] = &node;
+
+    t.index[nid] = i;
+  }
+
+  for(size_t i = 0; i < m_words.size(); ++i)
+  {
+    if(m_words[i] == NULL)
+      throw std::string("Missing words in binary vocabulary ") + filename;
+  }
 }
 
 // --------------------------------------------------------------------------
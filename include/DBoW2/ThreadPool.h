@@ -0,0 +1,106 @@
+/**
+ * File: ThreadPool.h
+ * Date: October 2026
+ * Description: pool of worker threads to parallelize vocabulary and
+ *   database operations
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_THREAD_POOL__
+#define __D_T_THREAD_POOL__
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace DBoW2 {
+
+/// Fixed set of worker threads that run queued tasks
+/**
+ * The same pool can be shared by several vocabularies and databases, and
+ * used from several threads at the same time. A thread waiting for a
+ * parallelFor to finish runs pending tasks in the meantime, so parallelFor
+ * can be nested.
+ */
+class ThreadPool
+{
+public:
+
+  /**
+   * Starts the worker threads
+   * @param nthreads number of workers. If 0, one less than the number of
+   *   hardware threads, since the caller of parallelFor works as well
+   */
+  explicit ThreadPool(unsigned int nthreads = 0);
+
+  /**
+   * Waits for the queued tasks to finish and stops the workers
+   */
+  ~ThreadPool();
+
+  /**
+   * Returns the number of worker threads
+   * @return number of workers
+   */
+  inline unsigned int size() const
+  {
+    return static_cast<unsigned int>(m_workers.size());
+  }
+
+  /**
+   * Queues a task to be run by some worker. Exceptions thrown by the task
+   * are ignored
+   * @param task
+   */
+  void enqueue(const std::function<void()> &task);
+
+  /**
+   * Splits the range [0, n) into chunks of grain items and calls
+   * f(begin, end) on each of them from the workers and the calling thread.
+   * It returns when all the chunks are done. If f throws, the first
+   * exception is rethrown here once all the chunks have finished
+   * @param n number of items
+   * @param f function to run on each chunk
+   * @param grain number of items per chunk
+   */
+  void parallelFor(size_t n, const std::function<void(size_t, size_t)> &f,
+    size_t grain = 1);
+
+  /**
+   * Runs a queued task in the calling thread, if there is any
+   * @return true iff a task was run
+   */
+  bool runPendingTask();
+
+private:
+
+  ThreadPool(const ThreadPool &);
+  ThreadPool& operator=(const ThreadPool &);
+
+  /**
+   * Main loop of the workers
+   */
+  void work();
+
+private:
+
+  /// Worker threads
+  std::vector<std::thread> m_workers;
+  /// Queued tasks
+  std::deque<std::function<void()> > m_tasks;
+  /// Protects m_tasks and m_stop
+  std::mutex m_mutex;
+  /// Signals new tasks or stop
+  std::condition_variable m_condition;
+  /// Whether the workers must finish
+  bool m_stop;
+};
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * File: WeightTraits.h
+ * Date: October 2026
+ * Description: types the word weights of a database can be stored as
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_WEIGHT_TRAITS__
+#define __D_T_WEIGHT_TRAITS__
+
+#include <stdint.h>
+
+#include "BowVector.h"
+
+namespace DBoW2 {
+
+/// 16-bit fixed-point weight in [0..1], with steps of 1/65535
+typedef uint16_t FixedWordValue;
+
+/// Converts word weights to the type they are stored as and back
+/**
+ * By default, weights are stored as floating point values, such as float
+ * or WordValue.
+ * @param TWeight type the weights are stored as
+ */
+template<class TWeight>
+struct WeightTraits
+{
+  /**
+   * Returns the stored value of a weight
+   * @param w weight
+   * @return stored value
+   */
+  static inline TWeight encode(WordValue w)
+  {
+    return static_cast<TWeight>(w);
+  }
+
+  /**
+   * Returns the weight of a stored value
+   * @param v stored value
+   * @return weight
+   */
+  static inline WordValue decode(TWeight v)
+  {
+    return static_cast<WordValue>(v);
+  }
+};
+
+/// Fixed-point weights
+/**
+ * Only weights in [0..1] can be stored, as those of normalized vectors;
+ * the others are saturated, so it cannot be used with DOT_PRODUCT
+ * scoring, whose vectors are not normalized (databases throw if they are
+ * given such a vocabulary). Weights above 0 are never stored as 0, so
+ * that the scores that divide by them or take their logarithm are
+ * defined.
+ */
+template<>
+struct WeightTraits<FixedWordValue>
+{
+  /// Stored value of a weight of 1
+  static const unsigned int ONE = 65535;
+
+  /**
+   * Returns the stored value of a weight
+   * @param w weight
+   * @return stored value
+   */
+  static inline FixedWordValue encode(WordValue w)
+  {
+    if(w <= 0) return 0;
+    if(w >= 1) return ONE;
+
+    const unsigned int v = static_cast<unsigned int>(w * ONE + 0.5);
+    return static_cast<FixedWordValue>(v > 0 ? v : 1);
+  }
+
+  /**
+   * Returns the weight of a stored value
+   * @param v stored value
+   * @return weight
+   */
+  static inline WordValue decode(FixedWordValue v)
+  {
+    return v * (1.0 / ONE);
+  }
+};
+
+} // namespace DBoW2
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * File: BinaryIO.cpp
+ * Date: October 2026
+ * Description: helpers to read and write the binary file formats
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "BinaryIO.h"
+
+namespace DBoW2 {
+
+// ---------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &filename)
+  : m_data(NULL), m_size(0), m_mapping(NULL)
+{
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+    NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(file == INVALID_HANDLE_VALUE)
+    throw std::string("Could not open file ") + filename;
+
+  LARGE_INTEGER size;
+  if(!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+  {
+    CloseHandle(file);
+    throw std::string("Could not map empty file ") + filename;
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if(mapping == NULL) throw std::string("Could not map file ") + filename;
+
+  void *p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if(p == NULL)
+  {
+    CloseHandle(mapping);
+    throw std::string("Could not map file ") + filename;
+  }
+
+  m_mapping = mapping;
+  m_data = static_cast<const unsigned char*>(p);
+  m_size = static_cast<size_t>(size.QuadPart);
+}
+
+// ---------------------------------------------------------------------------
+
+MappedFile::~MappedFile()
+{
+  UnmapViewOfFile(m_data);
+  CloseHandle(m_mapping);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &filename)
+  : m_data(NULL), m_size(0)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0) throw std::string("Could not open file ") + filename;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    throw std::string("Could not map empty file ") + filename;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping keeps its own reference to the file
+  if(p == MAP_FAILED) throw std::string("Could not map file ") + filename;
+
+  m_data = static_cast<const unsigned char*>(p);
+  m_size = static_cast<size_t>(st.st_size);
+}
+
+// ---------------------------------------------------------------------------
+
+MappedFile::~MappedFile()
+{
+  munmap(const_cast<unsigned char*>(m_data), m_size);
+}
+
+#endif
+
+// ---------------------------------------------------------------------------
+
+bool isBinaryFile(const std::string &filename)
+{
+  const std::string ext = ".dbow2";
+  return filename.size() >= ext.size() &&
+    filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+// ---------------------------------------------------------------------------
+
+uint64_t checksum(const unsigned char *data, size_t bytes, uint64_t seed)
+{
+  // 64-bit words are mixed with multiplications and rotations
+  const uint64_t K1 = 0x9E3779B185EBCA87ULL;
+  const uint64_t K2 = 0xC2B2AE3D27D4EB4FULL;
+
+  uint64_t h = seed ^ (bytes * K1);
+
+  size_t i = 0;
+  for(; i + 8 <= bytes; i += 8)
+  {
+    uint64_t w;
+    memcpy(&w, data + i, 8);
+    h ^= w * K2;
+    h = (h << 31) | (h >> 33);
+    h *= K1;
+  }
+
+  if(i < bytes)
+  {
+    uint64_t w = 0;
+    memcpy(&w, data + i, bytes - i);
+    h ^= w * K2;
+    h = (h << 31) | (h >> 33);
+    h *= K1;
+  }
+
+  h ^= h >> 33;
+  h *= K2;
+  h ^= h >> 29;
+  return h;
+}
+
+// ---------------------------------------------------------------------------
+
+void writeFile(const std::string &filename,
+  const std::vector<unsigned char> &buffer)
+{
+  std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+  if(!f.is_open()) throw std::string("Could not open file ") + filename;
+
+  f.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+  f.close();
+  if(f.fail()) throw std::string("Could not write file ") + filename;
+}
+
+// ---------------------------------------------------------------------------
+
+} // namespace DBoW2
+
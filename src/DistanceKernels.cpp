@@ -0,0 +1,805 @@
+/**
+ * File: DistanceKernels.cpp
+ * Date: October 2026
+ * Description: vectorized distance functions for packed descriptors
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+#include <limits.h>
+#include <limits>
+
+#include "DistanceKernels.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+  #define DBOW2_X86_KERNELS
+  // some versions of gcc warn about the undefined values used inside the
+  // avx-512 intrinsics
+  #if !defined(__clang__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wuninitialized"
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+  #endif
+  #include <immintrin.h>
+  #if !defined(__clang__)
+    #pragma GCC diagnostic pop
+  #endif
+  #if (defined(__clang__) && __clang_major__ >= 6) || \
+      (!defined(__clang__) && __GNUC__ >= 8)
+    #define DBOW2_AVX512_KERNELS
+  #endif
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #define DBOW2_NEON_KERNELS
+  #include <arm_neon.h>
+#endif
+
+using namespace std;
+
+namespace DBoW2 {
+
+namespace {
+
+// --------------------------------------------------------------------------
+
+typedef unsigned int (*DistanceFunction)(const unsigned char *a,
+  const unsigned char *b, int bytes);
+
+typedef void (*DistancesFunction)(const unsigned char *q,
+  const unsigned char *blocks, unsigned int n, int bytes,
+  unsigned int *distances);
+
+typedef double (*L2DistanceFunction)(const float *a, const float *b,
+  int dims);
+
+typedef void (*L2DistancesFunction)(const float *q, const float *blocks,
+  unsigned int n, int dims, double *distances);
+
+/// Set of functions implemented with some instruction set. The batch
+/// functions are instantiated for the lengths of ORB/BRIEF (32 bytes) and
+/// BRISK (48 bytes) descriptors, and of SURF64 (64 floats) descriptors,
+/// so that their loops are fully unrolled
+struct Kernels
+{
+  const char *name;
+  bool (*available)();
+  DistanceFunction distance;
+  DistancesFunction distances32;
+  DistancesFunction distances48;
+  DistancesFunction distances;
+  L2DistanceFunction l2distance;
+  L2DistancesFunction l2distances64;
+  L2DistancesFunction l2distances;
+};
+
+// --------------------------------------------------------------------------
+// Squared L2 distances between float vectors are added up in double, in
+// 8 partial sums: s_k gets the squares of dimensions k, k + 8, k + 16...,
+// and the result is ((s0 + s4) + (s1 + s5)) + ((s2 + s6) + (s3 + s7)),
+// plus the squares of the last dims % 8 dimensions. Each square is
+// computed in float. All the kernels follow this order, so that they
+// return exactly the same distances and the same vocabularies are built
+// on any CPU
+
+/// Returns the squared L2 distance between the last dims - i dimensions
+/// of a and b, added to sum
+static inline double l2Tail(const float *a, const float *b, int i,
+  int dims, double sum)
+{
+  for(; i < dims; ++i)
+  {
+    const float d = a[i] - b[i];
+    sum += (double)(d * d);
+  }
+  return sum;
+}
+
+// --------------------------------------------------------------------------
+
+static inline uint64_t load64(const unsigned char *p)
+{
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// --------------------------------------------------------------------------
+// generic
+
+static inline unsigned int popcountGeneric(uint64_t v)
+{
+  // Bit count function got from:
+  // http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
+  v = v - ((v >> 1) & (uint64_t)~(uint64_t)0/3);
+  v = (v & (uint64_t)~(uint64_t)0/15*3) + ((v >> 2) &
+    (uint64_t)~(uint64_t)0/15*3);
+  v = (v + (v >> 4)) & (uint64_t)~(uint64_t)0/255*15;
+  return (unsigned int)((uint64_t)(v * ((uint64_t)~(uint64_t)0/255)) >>
+    (sizeof(uint64_t) - 1) * CHAR_BIT);
+}
+
+static inline unsigned int distanceGenericInline(const unsigned char *a,
+  const unsigned char *b, int bytes)
+{
+  unsigned int ret = 0;
+  int i = 0;
+  for(; i + 8 <= bytes; i += 8)
+    ret += popcountGeneric(load64(a + i) ^ load64(b + i));
+  for(; i < bytes; ++i)
+    ret += popcountGeneric((uint64_t)(a[i] ^ b[i]));
+  return ret;
+}
+
+static bool availableGeneric()
+{
+  return true;
+}
+
+static unsigned int distanceGeneric(const unsigned char *a,
+  const unsigned char *b, int bytes)
+{
+  return distanceGenericInline(a, b, bytes);
+}
+
+template<int B>
+static void distancesGeneric(const unsigned char *q,
+  const unsigned char *blocks, unsigned int n, int bytes,
+  unsigned int *distances)
+{
+  if(B > 0) bytes = B;
+  for(unsigned int j = 0; j < n; ++j, blocks += bytes)
+    distances[j] = distanceGenericInline(q, blocks, bytes);
+}
+
+static inline double l2DistanceGenericInline(const float *a,
+  const float *b, int dims)
+{
+  double s[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  int i = 0;
+  for(; i + 8 <= dims; i += 8)
+  {
+    for(int k = 0; k < 8; ++k)
+    {
+      const float d = a[i + k] - b[i + k];
+      s[k] += (double)(d * d);
+    }
+  }
+  const double sum = ((s[0] + s[4]) + (s[1] + s[5])) +
+    ((s[2] + s[6]) + (s[3] + s[7]));
+  return l2Tail(a, b, i, dims, sum);
+}
+
+static double l2DistanceGeneric(const float *a, const float *b, int dims)
+{
+  return l2DistanceGenericInline(a, b, dims);
+}
+
+template<int D>
+static void l2DistancesGeneric(const float *q, const float *blocks,
+  unsigned int n, int dims, double *distances)
+{
+  if(D > 0) dims = D;
+  for(unsigned int j = 0; j < n; ++j, blocks += dims)
+    distances[j] = l2DistanceGenericInline(q, blocks, dims);
+}
+
+#ifdef DBOW2_X86_KERNELS
+
+// --------------------------------------------------------------------------
+// popcnt
+
+#define DBOW2_TARGET_POPCNT __attribute__((target("popcnt")))
+#define DBOW2_TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#define DBOW2_TARGET_AVX512 \
+  __attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+
+static DBOW2_TARGET_POPCNT inline unsigned int distancePopcntInline(
+  const unsigned char *a, const unsigned char *b, int bytes)
+{
+  uint64_t ret = 0;
+  int i = 0;
+  for(; i + 8 <= bytes; i += 8)
+    ret += (uint64_t)__builtin_popcountll(load64(a + i) ^ load64(b + i));
+  for(; i < bytes; ++i)
+    ret += (uint64_t)__builtin_popcount((unsigned int)(a[i] ^ b[i]));
+  return (unsigned int)ret;
+}
+
+static bool availablePopcnt()
+{
+  return __builtin_cpu_supports("popcnt");
+}
+
+static DBOW2_TARGET_POPCNT unsigned int distancePopcnt(
+  const unsigned char *a, const unsigned char *b, int bytes)
+{
+  return distancePopcntInline(a, b, bytes);
+}
+
+template<int B>
+static DBOW2_TARGET_POPCNT void distancesPopcnt(const unsigned char *q,
+  const unsigned char *blocks, unsigned int n, int bytes,
+  unsigned int *distances)
+{
+  if(B > 0) bytes = B;
+  for(unsigned int j = 0; j < n; ++j, blocks += bytes)
+    distances[j] = distancePopcntInline(q, blocks, bytes);
+}
+
+/// Float distances of the popcnt kernel, with SSE2, which all the x86-64
+/// CPUs have
+static inline double l2DistanceSse2Inline(const float *a, const float *b,
+  int dims)
+{
+  // s01 holds s0 and s1, s23 holds s2 and s3, and so on
+  __m128d s01 = _mm_setzero_pd(), s23 = _mm_setzero_pd();
+  __m128d s45 = _mm_setzero_pd(), s67 = _mm_setzero_pd();
+  int i = 0;
+  for(; i + 8 <= dims; i += 8)
+  {
+    const __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    const __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4),
+      _mm_loadu_ps(b + i + 4));
+    const __m128 q0 = _mm_mul_ps(d0, d0);
+    const __m128 q1 = _mm_mul_ps(d1, d1);
+    s01 = _mm_add_pd(s01, _mm_cvtps_pd(q0));
+    s23 = _mm_add_pd(s23, _mm_cvtps_pd(_mm_movehl_ps(q0, q0)));
+    s45 = _mm_add_pd(s45, _mm_cvtps_pd(q1));
+    s67 = _mm_add_pd(s67, _mm_cvtps_pd(_mm_movehl_ps(q1, q1)));
+  }
+  const __m128d t01 = _mm_add_pd(s01, s45);
+  const __m128d t23 = _mm_add_pd(s23, s67);
+  const __m128d sum = _mm_add_sd(
+    _mm_add_sd(t01, _mm_unpackhi_pd(t01, t01)),
+    _mm_add_sd(t23, _mm_unpackhi_pd(t23, t23)));
+  return l2Tail(a, b, i, dims, _mm_cvtsd_f64(sum));
+}
+
+static double l2DistanceSse2(const float *a, const float *b, int dims)
+{
+  return l2DistanceSse2Inline(a, b, dims);
+}
+
+template<int D>
+static void l2DistancesSse2(const float *q, const float *blocks,
+  unsigned int n, int dims, double *distances)
+{
+  if(D > 0) dims = D;
+  for(unsigned int j = 0; j < n; ++j, blocks += dims)
+    distances[j] = l2DistanceSse2Inline(q, blocks, dims);
+}
+
+// --------------------------------------------------------------------------
+// avx2
+
+/// Counts the bits set in each 64-bit lane of x, with the nibble lookup
+/// method of Mula et al.
+static DBOW2_TARGET_AVX2 inline __m256i popcountAvx2(__m256i x)
+{
+  const __m256i lut = _mm256_setr_epi8(
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+
+  const __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low));
+  const __m256i hi = _mm256_shuffle_epi8(lut,
+    _mm256_and_si256(_mm256_srli_epi16(x, 4), low));
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+/// Returns the bit counts of the first (bytes & ~15) bytes of a ^ b,
+/// spread in 4 lanes
+static DBOW2_TARGET_AVX2 inline __m256i partialAvx2(const unsigned char *a,
+  const unsigned char *b, int bytes)
+{
+  __m256i acc = _mm256_setzero_si256();
+  int i = 0;
+  for(; i + 32 <= bytes; i += 32)
+  {
+    const __m256i x = _mm256_xor_si256(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+    acc = _mm256_add_epi64(acc, popcountAvx2(x));
+  }
+  if(i + 16 <= bytes)
+  {
+    const __m128i x = _mm_xor_si128(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+    acc = _mm256_add_epi64(acc, popcountAvx2(
+      _mm256_inserti128_si256(_mm256_setzero_si256(), x, 0)));
+  }
+  return acc;
+}
+
+static DBOW2_TARGET_AVX2 inline unsigned int distanceAvx2Inline(
+  const unsigned char *a, const unsigned char *b, int bytes)
+{
+  // for short blocks, popcnt on 64-bit words is faster than the lookup
+  if(bytes < 64) return distancePopcntInline(a, b, bytes);
+
+  const __m256i acc = partialAvx2(a, b, bytes);
+  const __m128i s = _mm_add_epi64(_mm256_castsi256_si128(acc),
+    _mm256_extracti128_si256(acc, 1));
+  const int v = bytes & ~15;
+  return (unsigned int)(_mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1)) +
+    distancePopcntInline(a + v, b + v, bytes - v);
+}
+
+static bool availableAvx2()
+{
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+
+static DBOW2_TARGET_AVX2 unsigned int distanceAvx2(
+  const unsigned char *a, const unsigned char *b, int bytes)
+{
+  return distanceAvx2Inline(a, b, bytes);
+}
+
+template<int B>
+static DBOW2_TARGET_AVX2 void distancesAvx2(const unsigned char *q,
+  const unsigned char *blocks, unsigned int n, int bytes,
+  unsigned int *distances)
+{
+  if(B > 0) bytes = B;
+  const int v = bytes & ~15;
+
+  // 4 blocks at a time, so that their lanes are reduced together
+  unsigned int j = 0;
+  for(; j + 4 <= n; j += 4, blocks += 4 * bytes)
+  {
+    const __m256i c0 = partialAvx2(q, blocks, bytes);
+    const __m256i c1 = partialAvx2(q, blocks + bytes, bytes);
+    const __m256i c2 = partialAvx2(q, blocks + 2 * bytes, bytes);
+    const __m256i c3 = partialAvx2(q, blocks + 3 * bytes, bytes);
+
+    const __m256i t01 = _mm256_add_epi64(_mm256_unpacklo_epi64(c0, c1),
+      _mm256_unpackhi_epi64(c0, c1));
+    const __m256i t23 = _mm256_add_epi64(_mm256_unpacklo_epi64(c2, c3),
+      _mm256_unpackhi_epi64(c2, c3));
+    const __m256i s = _mm256_add_epi64(
+      _mm256_permute2x128_si256(t01, t23, 0x20),
+      _mm256_permute2x128_si256(t01, t23, 0x31));
+
+    uint64_t r[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(r), s);
+    for(int k = 0; k < 4; ++k)
+    {
+      distances[j + k] = (unsigned int)r[k];
+      if(v < bytes)
+        distances[j + k] += distancePopcntInline(q + v,
+          blocks + k * bytes + v, bytes - v);
+    }
+  }
+
+  for(; j < n; ++j, blocks += bytes)
+    distances[j] = distanceAvx2Inline(q, blocks, bytes);
+}
+
+static DBOW2_TARGET_AVX2 inline double l2DistanceAvx2Inline(const float *a,
+  const float *b, int dims)
+{
+  // s03 holds s0..s3 and s47 holds s4..s7
+  __m256d s03 = _mm256_setzero_pd(), s47 = _mm256_setzero_pd();
+  int i = 0;
+  for(; i + 8 <= dims; i += 8)
+  {
+    const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i),
+      _mm256_loadu_ps(b + i));
+    const __m256 q = _mm256_mul_ps(d, d);
+    s03 = _mm256_add_pd(s03, _mm256_cvtps_pd(_mm256_castps256_ps128(q)));
+    s47 = _mm256_add_pd(s47, _mm256_cvtps_pd(_mm256_extractf128_ps(q, 1)));
+  }
+  const __m256d t = _mm256_add_pd(s03, s47);
+  const __m128d t01 = _mm256_castpd256_pd128(t);
+  const __m128d t23 = _mm256_extractf128_pd(t, 1);
+  const __m128d sum = _mm_add_sd(
+    _mm_add_sd(t01, _mm_unpackhi_pd(t01, t01)),
+    _mm_add_sd(t23, _mm_unpackhi_pd(t23, t23)));
+  return l2Tail(a, b, i, dims, _mm_cvtsd_f64(sum));
+}
+
+static DBOW2_TARGET_AVX2 double l2DistanceAvx2(const float *a,
+  const float *b, int dims)
+{
+  return l2DistanceAvx2Inline(a, b, dims);
+}
+
+template<int D>
+static DBOW2_TARGET_AVX2 void l2DistancesAvx2(const float *q,
+  const float *blocks, unsigned int n, int dims, double *distances)
+{
+  if(D > 0) dims = D;
+  for(unsigned int j = 0; j < n; ++j, blocks += dims)
+    distances[j] = l2DistanceAvx2Inline(q, blocks, dims);
+}
+
+#ifdef DBOW2_AVX512_KERNELS
+
+// --------------------------------------------------------------------------
+// avx512
+
+static DBOW2_TARGET_AVX512 inline unsigned int distanceAvx512Inline(
+  const unsigned char *a, const unsigned char *b, int bytes)
+{
+  __m512i acc = _mm512_setzero_si512();
+  int i = 0;
+  for(; i + 64 <= bytes; i += 64)
+  {
+    const __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i),
+      _mm512_loadu_si512(b + i));
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+  }
+
+  const int words = (bytes - i) / 8;
+  if(words > 0)
+  {
+    // masked lanes are not read
+    const __mmask8 m = (__mmask8)((1u << words) - 1);
+    const __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi64(m, a + i),
+      _mm512_maskz_loadu_epi64(m, b + i));
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    i += words * 8;
+  }
+
+  unsigned int ret = (unsigned int)_mm512_reduce_add_epi64(acc);
+  if(i < bytes) ret += distancePopcntInline(a + i, b + i, bytes - i);
+  return ret;
+}
+
+static bool availableAvx512()
+{
+  return __builtin_cpu_supports("avx512f") &&
+    __builtin_cpu_supports("avx512vpopcntdq") &&
+    __builtin_cpu_supports("popcnt");
+}
+
+static DBOW2_TARGET_AVX512 unsigned int distanceAvx512(
+  const unsigned char *a, const unsigned char *b, int bytes)
+{
+  return distanceAvx512Inline(a, b, bytes);
+}
+
+template<int B>
+static DBOW2_TARGET_AVX512 void distancesAvx512(const unsigned char *q,
+  const unsigned char *blocks, unsigned int n, int bytes,
+  unsigned int *distances)
+{
+  if(B > 0) bytes = B;
+  unsigned int j = 0;
+
+  if(bytes == 32)
+  {
+    // 2 blocks per register and 4 blocks per reduction
+    const __m512i bq = _mm512_broadcast_i64x4(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(q)));
+
+    for(; j + 4 <= n; j += 4, blocks += 4 * 32)
+    {
+      const __m512i v0 = _mm512_popcnt_epi64(_mm512_xor_si512(bq,
+        _mm512_loadu_si512(blocks)));
+      const __m512i v1 = _mm512_popcnt_epi64(_mm512_xor_si512(bq,
+        _mm512_loadu_si512(blocks + 64)));
+
+      // 128-bit lane l of t holds the sums of the pairs l of v0 and v1
+      const __m512i t = _mm512_add_epi64(_mm512_unpacklo_epi64(v0, v1),
+        _mm512_unpackhi_epi64(v0, v1));
+      // lane 0: (d0, d2), lane 2: (d1, d3)
+      const __m512i s = _mm512_add_epi64(t,
+        _mm512_shuffle_i64x2(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+
+      uint64_t r[8];
+      _mm512_storeu_si512(r, s);
+      distances[j    ] = (unsigned int)r[0];
+      distances[j + 1] = (unsigned int)r[4];
+      distances[j + 2] = (unsigned int)r[1];
+      distances[j + 3] = (unsigned int)r[5];
+    }
+  }
+
+  for(; j < n; ++j, blocks += bytes)
+    distances[j] = distanceAvx512Inline(q, blocks, bytes);
+}
+
+#endif // DBOW2_AVX512_KERNELS
+
+#endif // DBOW2_X86_KERNELS
+
+#ifdef DBOW2_NEON_KERNELS
+
+// --------------------------------------------------------------------------
+// neon
+
+static inline unsigned int distanceNeonInline(const unsigned char *a,
+  const unsigned char *b, int bytes)
+{
+  uint16x8_t acc = vdupq_n_u16(0);
+  int i = 0;
+  for(; i + 16 <= bytes; i += 16)
+  {
+    const uint8x16_t x = veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+    acc = vpadalq_u8(acc, vcntq_u8(x));
+  }
+  unsigned int ret = vaddlvq_u16(acc);
+  if(i + 8 <= bytes)
+  {
+    const uint8x8_t x = veor_u8(vld1_u8(a + i), vld1_u8(b + i));
+    ret += vaddv_u8(vcnt_u8(x));
+    i += 8;
+  }
+  for(; i < bytes; ++i)
+    ret += popcountGeneric((uint64_t)(a[i] ^ b[i]));
+  return ret;
+}
+
+static bool availableNeon()
+{
+  return true;
+}
+
+static unsigned int distanceNeon(const unsigned char *a,
+  const unsigned char *b, int bytes)
+{
+  return distanceNeonInline(a, b, bytes);
+}
+
+template<int B>
+static void distancesNeon(const unsigned char *q,
+  const unsigned char *blocks, unsigned int n, int bytes,
+  unsigned int *distances)
+{
+  if(B > 0) bytes = B;
+  for(unsigned int j = 0; j < n; ++j, blocks += bytes)
+    distances[j] = distanceNeonInline(q, blocks, bytes);
+}
+
+static inline double l2DistanceNeonInline(const float *a, const float *b,
+  int dims)
+{
+  // s01 holds s0 and s1, s23 holds s2 and s3, and so on
+  float64x2_t s01 = vdupq_n_f64(0), s23 = vdupq_n_f64(0);
+  float64x2_t s45 = vdupq_n_f64(0), s67 = vdupq_n_f64(0);
+  int i = 0;
+  for(; i + 8 <= dims; i += 8)
+  {
+    const float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+    const float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4),
+      vld1q_f32(b + i + 4));
+    const float32x4_t q0 = vmulq_f32(d0, d0);
+    const float32x4_t q1 = vmulq_f32(d1, d1);
+    s01 = vaddq_f64(s01, vcvt_f64_f32(vget_low_f32(q0)));
+    s23 = vaddq_f64(s23, vcvt_high_f64_f32(q0));
+    s45 = vaddq_f64(s45, vcvt_f64_f32(vget_low_f32(q1)));
+    s67 = vaddq_f64(s67, vcvt_high_f64_f32(q1));
+  }
+  const float64x2_t t01 = vaddq_f64(s01, s45);
+  const float64x2_t t23 = vaddq_f64(s23, s67);
+  const double sum =
+    (vgetq_lane_f64(t01, 0) + vgetq_lane_f64(t01, 1)) +
+    (vgetq_lane_f64(t23, 0) + vgetq_lane_f64(t23, 1));
+  return l2Tail(a, b, i, dims, sum);
+}
+
+static double l2DistanceNeon(const float *a, const float *b, int dims)
+{
+  return l2DistanceNeonInline(a, b, dims);
+}
+
+template<int D>
+static void l2DistancesNeon(const float *q, const float *blocks,
+  unsigned int n, int dims, double *distances)
+{
+  if(D > 0) dims = D;
+  for(unsigned int j = 0; j < n; ++j, blocks += dims)
+    distances[j] = l2DistanceNeonInline(q, blocks, dims);
+}
+
+#endif // DBOW2_NEON_KERNELS
+
+// --------------------------------------------------------------------------
+
+/// Available kernels, from the most to the least preferred. The avx512
+/// kernel computes float distances with avx2, since 8 dimensions at a
+/// time already fill the 8 double partial sums
+static const Kernels g_all_kernels[] = {
+#ifdef DBOW2_X86_KERNELS
+#ifdef DBOW2_AVX512_KERNELS
+  { "avx512", &availableAvx512, &distanceAvx512, &distancesAvx512<32>,
+    &distancesAvx512<48>, &distancesAvx512<0>,
+    &l2DistanceAvx2, &l2DistancesAvx2<64>, &l2DistancesAvx2<0> },
+#endif
+  { "avx2", &availableAvx2, &distanceAvx2, &distancesAvx2<32>,
+    &distancesAvx2<48>, &distancesAvx2<0>,
+    &l2DistanceAvx2, &l2DistancesAvx2<64>, &l2DistancesAvx2<0> },
+  { "popcnt", &availablePopcnt, &distancePopcnt, &distancesPopcnt<32>,
+    &distancesPopcnt<48>, &distancesPopcnt<0>,
+    &l2DistanceSse2, &l2DistancesSse2<64>, &l2DistancesSse2<0> },
+#endif
+#ifdef DBOW2_NEON_KERNELS
+  { "neon", &availableNeon, &distanceNeon, &distancesNeon<32>,
+    &distancesNeon<48>, &distancesNeon<0>,
+    &l2DistanceNeon, &l2DistancesNeon<64>, &l2DistancesNeon<0> },
+#endif
+  { "generic", &availableGeneric, &distanceGeneric, &distancesGeneric<32>,
+    &distancesGeneric<48>, &distancesGeneric<0>,
+    &l2DistanceGeneric, &l2DistancesGeneric<64>, &l2DistancesGeneric<0> }
+};
+
+static const unsigned int g_nkernels =
+  sizeof(g_all_kernels) / sizeof(g_all_kernels[0]);
+
+/// Kernel in use. It starts as the generic one, which is always valid even
+/// if this is used during the static initialization of other units
+static const Kernels *g_kernels = &g_all_kernels[g_nkernels - 1];
+
+/**
+ * Selects the best kernel supported by this CPU
+ * @return true
+ */
+static bool selectBestKernel()
+{
+#ifdef DBOW2_X86_KERNELS
+  __builtin_cpu_init();
+#endif
+  for(unsigned int i = 0; i < g_nkernels; ++i)
+  {
+    if(g_all_kernels[i].available())
+    {
+      g_kernels = &g_all_kernels[i];
+      break;
+    }
+  }
+  return true;
+}
+
+static const bool g_kernel_selected = selectBestKernel();
+
+// --------------------------------------------------------------------------
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+unsigned int hammingDistance(const unsigned char *a, const unsigned char *b,
+  int bytes)
+{
+  return g_kernels->distance(a, b, bytes);
+}
+
+// --------------------------------------------------------------------------
+
+void hammingDistances(const unsigned char *q, const unsigned char *blocks,
+  unsigned int n, int bytes, unsigned int *distances)
+{
+  const Kernels *k = g_kernels;
+  if(bytes == 32)
+    k->distances32(q, blocks, n, bytes, distances);
+  else if(bytes == 48)
+    k->distances48(q, blocks, n, bytes, distances);
+  else
+    k->distances(q, blocks, n, bytes, distances);
+}
+
+// --------------------------------------------------------------------------
+
+unsigned int hammingNearest(const unsigned char *q,
+  const unsigned char *blocks, unsigned int n, int bytes,
+  unsigned int *distance)
+{
+  const unsigned int CHUNK = 64;
+  unsigned int d[CHUNK];
+
+  unsigned int best = 0;
+  unsigned int best_d = UINT_MAX;
+
+  for(unsigned int j = 0; j < n; j += CHUNK)
+  {
+    const unsigned int m = std::min(CHUNK, n - j);
+    hammingDistances(q, blocks + (size_t)j * bytes, m, bytes, d);
+
+    for(unsigned int i = 0; i < m; ++i)
+    {
+      if(d[i] < best_d)
+      {
+        best_d = d[i];
+        best = j + i;
+      }
+    }
+  }
+
+  if(distance) *distance = best_d;
+  return best;
+}
+
+// --------------------------------------------------------------------------
+
+double squaredL2Distance(const float *a, const float *b, int dims)
+{
+  return g_kernels->l2distance(a, b, dims);
+}
+
+// --------------------------------------------------------------------------
+
+double squaredL2Norm(const float *a, int dims)
+{
+  double sum = 0;
+  for(int i = 0; i < dims; ++i) sum += (double)(a[i] * a[i]);
+  return sum;
+}
+
+// --------------------------------------------------------------------------
+
+void squaredL2Distances(const float *q, const float *blocks,
+  unsigned int n, int dims, double *distances)
+{
+  const Kernels *k = g_kernels;
+  if(dims == 64)
+    k->l2distances64(q, blocks, n, dims, distances);
+  else
+    k->l2distances(q, blocks, n, dims, distances);
+}
+
+// --------------------------------------------------------------------------
+
+unsigned int squaredL2Nearest(const float *q, const float *blocks,
+  unsigned int n, int dims, double *distance)
+{
+  const unsigned int CHUNK = 64;
+  double d[CHUNK];
+
+  unsigned int best = 0;
+  double best_d = std::numeric_limits<double>::infinity();
+
+  for(unsigned int j = 0; j < n; j += CHUNK)
+  {
+    const unsigned int m = std::min(CHUNK, n - j);
+    squaredL2Distances(q, blocks + (size_t)j * dims, m, dims, d);
+
+    for(unsigned int i = 0; i < m; ++i)
+    {
+      if(d[i] < best_d)
+      {
+        best_d = d[i];
+        best = j + i;
+      }
+    }
+  }
+
+  if(distance) *distance = best_d;
+  return best;
+}
+
+// --------------------------------------------------------------------------
+
+const char* distanceKernel()
+{
+  return g_kernels->name;
+}
+
+// --------------------------------------------------------------------------
+
+bool selectDistanceKernel(const std::string &name)
+{
+#ifdef DBOW2_X86_KERNELS
+  __builtin_cpu_init();
+#endif
+  for(unsigned int i = 0; i < g_nkernels; ++i)
+  {
+    if(name == g_all_kernels[i].name)
+    {
+      if(!g_all_kernels[i].available()) return false;
+      g_kernels = &g_all_kernels[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
+
@@ -11,10 +11,9 @@
 #include <string>
 #include <sstream>
 
-// #include <stdint.h>
+#include <stdint.h>
 // #include <limits.h>
 
-#include <brisk/brisk.h>
 #include "FBRISK.h"
 
 using namespace std;
@@ -64,7 +63,7 @@ void FBRISK::meanValue(const std::vector<FBRISK::pDescriptor> &descriptors,
   
 double FBRISK::distance(const FBRISK::TDescriptor &a, const FBRISK::TDescriptor &b)
 {
-  return double(brisk::Hamming::PopcntofXORed(&a.front(),&b.front(),L/16));
+  return double(hammingDistance(&a.front(), &b.front(), L));
 }
 
 // // --------------------------------------------------------------------------
@@ -13,6 +13,7 @@
 
 #include "FClass.h"
 #include "FSurf64.h"
+#include "DistanceKernels.h"
 
 using namespace std;
 
@@ -46,15 +47,14 @@ void FSurf64::meanValue(const std::vector<FSurf64::pDescriptor> &descriptors,
   
 double FSurf64::distance(const FSurf64::TDescriptor &a, const FSurf64::TDescriptor &b)
 {
-  double sqd = 0.;
-  for(int i = 0; i < FSurf64::L; i += 4)
-  {
-    sqd += (a[i  ] - b[i  ])*(a[i  ] - b[i  ]);
-    sqd += (a[i+1] - b[i+1])*(a[i+1] - b[i+1]);
-    sqd += (a[i+2] - b[i+2])*(a[i+2] - b[i+2]);
-    sqd += (a[i+3] - b[i+3])*(a[i+3] - b[i+3]);
-  }
-  return sqd;
+  return distance(&a[0], &b[0]);
+}
+
+// --------------------------------------------------------------------------
+  
+double FSurf64::distance(const float *a, const float *b)
+{
+  return squaredL2Distance(a, b, FSurf64::L);
 }
 
 // --------------------------------------------------------------------------
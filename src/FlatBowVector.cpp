@@ -0,0 +1,123 @@
+/**
+ * File: FlatBowVector.cpp
+ * Date: October 2026
+ * Description: bag of words vector stored in sorted arrays
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "FlatBowVector.h"
+
+namespace DBoW2 {
+
+// --------------------------------------------------------------------------
+
+FlatBowVector::FlatBowVector(void)
+{
+}
+
+// --------------------------------------------------------------------------
+
+FlatBowVector::FlatBowVector(const BowVector &v)
+{
+  fromBowVector(v);
+}
+
+// --------------------------------------------------------------------------
+
+FlatBowVector::~FlatBowVector(void)
+{
+}
+
+// --------------------------------------------------------------------------
+
+WordValue FlatBowVector::find(WordId id) const
+{
+  std::vector<WordId>::const_iterator it =
+    std::lower_bound(m_ids.begin(), m_ids.end(), id);
+
+  if(it != m_ids.end() && *it == id)
+    return m_values[it - m_ids.begin()];
+  else
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+
+void FlatBowVector::normalize(LNorm norm_type)
+{
+  // the values are visited in the same order as in BowVector, so that
+  // both produce the same result
+  double norm = 0.0;
+  std::vector<WordValue>::iterator it;
+
+  if(norm_type == DBoW2::L1)
+  {
+    for(it = m_values.begin(); it != m_values.end(); ++it)
+      norm += fabs(*it);
+  }
+  else
+  {
+    for(it = m_values.begin(); it != m_values.end(); ++it)
+      norm += *it * *it;
+    norm = sqrt(norm);
+  }
+
+  if(norm > 0.0)
+  {
+    for(it = m_values.begin(); it != m_values.end(); ++it)
+      *it /= norm;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+void FlatBowVector::fromBowVector(const BowVector &v)
+{
+  clear();
+  reserve(v.size());
+
+  BowVector::const_iterator vit;
+  for(vit = v.begin(); vit != v.end(); ++vit)
+    push_back(vit->first, vit->second);
+}
+
+// --------------------------------------------------------------------------
+
+void FlatBowVector::toBowVector(BowVector &v) const
+{
+  v.clear();
+  for(size_t i = 0; i < m_ids.size(); ++i)
+    v.insert(v.end(), BowVector::value_type(m_ids[i], m_values[i]));
+}
+
+// --------------------------------------------------------------------------
+
+bool FlatBowVector::operator==(const FlatBowVector &v) const
+{
+  return m_ids == v.m_ids && m_values == v.m_values;
+}
+
+// --------------------------------------------------------------------------
+
+std::ostream& operator<< (std::ostream &out, const FlatBowVector &v)
+{
+  const size_t N = v.size();
+  for(size_t i = 0; i < N; ++i)
+  {
+    out << "<" << v.id(i) << ", " << v.value(i) << ">";
+
+    if(i < N-1) out << ", ";
+  }
+  return out;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
+
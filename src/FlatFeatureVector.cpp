@@ -0,0 +1,157 @@
+/**
+ * File: FlatFeatureVector.cpp
+ * Date: October 2026
+ * Description: feature vector stored in sorted arrays
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <vector>
+
+#include "FlatFeatureVector.h"
+
+namespace DBoW2 {
+
+// ---------------------------------------------------------------------------
+
+FlatFeatureVector::FlatFeatureVector(void)
+  : m_offsets(1, 0)
+{
+}
+
+// ---------------------------------------------------------------------------
+
+FlatFeatureVector::FlatFeatureVector(const FeatureVector &v)
+{
+  fromFeatureVector(v);
+}
+
+// ---------------------------------------------------------------------------
+
+FlatFeatureVector::~FlatFeatureVector(void)
+{
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::clear()
+{
+  m_nodes.clear();
+  m_offsets.resize(1);
+  m_offsets[0] = 0;
+  m_features.clear();
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::reserve(size_t nodes, size_t features)
+{
+  m_nodes.reserve(nodes);
+  m_offsets.reserve(nodes + 1);
+  m_features.reserve(features);
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::push_back(NodeId id, unsigned int i_feature)
+{
+  if(m_nodes.empty() || m_nodes.back() != id)
+  {
+    m_nodes.push_back(id);
+    m_offsets.push_back(m_offsets.back());
+  }
+  m_features.push_back(i_feature);
+  ++m_offsets.back();
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::push_back(NodeId id, const unsigned int *features,
+  size_t n)
+{
+  m_nodes.push_back(id);
+  m_features.insert(m_features.end(), features, features + n);
+  m_offsets.push_back(m_features.size());
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::swap(FlatFeatureVector &v)
+{
+  m_nodes.swap(v.m_nodes);
+  m_offsets.swap(v.m_offsets);
+  m_features.swap(v.m_features);
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::fromFeatureVector(const FeatureVector &v)
+{
+  clear();
+
+  size_t nfeatures = 0;
+  FeatureVector::const_iterator vit;
+  for(vit = v.begin(); vit != v.end(); ++vit)
+    nfeatures += vit->second.size();
+
+  reserve(v.size(), nfeatures);
+
+  for(vit = v.begin(); vit != v.end(); ++vit)
+  {
+    m_nodes.push_back(vit->first);
+    m_features.insert(m_features.end(), vit->second.begin(),
+      vit->second.end());
+    m_offsets.push_back(m_features.size());
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+void FlatFeatureVector::toFeatureVector(FeatureVector &v) const
+{
+  v.clear();
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+  {
+    FeatureVector::iterator vit = v.insert(v.end(),
+      FeatureVector::value_type(m_nodes[i], std::vector<unsigned int>()));
+    vit->second.assign(features(i), features(i) + nfeatures(i));
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+bool FlatFeatureVector::operator==(const FlatFeatureVector &v) const
+{
+  return m_nodes == v.m_nodes && m_offsets == v.m_offsets &&
+    m_features == v.m_features;
+}
+
+// ---------------------------------------------------------------------------
+
+std::ostream& operator<<(std::ostream &out,
+  const FlatFeatureVector &v)
+{
+  for(size_t i = 0; i < v.size(); ++i)
+  {
+    if(i > 0) out << ", ";
+
+    const unsigned int *f = v.features(i);
+    const size_t n = v.nfeatures(i);
+
+    out << "<" << v.nodeId(i) << ": [";
+    if(n > 0) out << f[0];
+    for(size_t j = 1; j < n; ++j)
+    {
+      out << ", " << f[j];
+    }
+    out << "]>";
+  }
+
+  return out;
+}
+
+// ---------------------------------------------------------------------------
+
+} // namespace DBoW2
+
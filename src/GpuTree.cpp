@@ -0,0 +1,73 @@
+/**
+ * File: GpuTree.cpp
+ * Date: October 2026
+ * Description: GpuTree of the builds without CUDA, which cannot upload
+ *   trees. The CUDA backend is in GpuTree.cu
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <string>
+
+#include "GpuTree.h"
+
+using namespace std;
+
+namespace DBoW2 {
+
+// --------------------------------------------------------------------------
+
+struct GpuTree::Device
+{
+};
+
+// --------------------------------------------------------------------------
+
+bool GpuTree::available()
+{
+  return false;
+}
+
+// --------------------------------------------------------------------------
+
+GpuTree::GpuTree(): m_device(NULL), m_nodes(0), m_bytes(0)
+{
+}
+
+// --------------------------------------------------------------------------
+
+GpuTree::~GpuTree()
+{
+  clear();
+}
+
+// --------------------------------------------------------------------------
+
+void GpuTree::upload(const unsigned int *, const unsigned int *,
+  unsigned int, const unsigned char *, int)
+{
+  throw string("GpuTree: DBoW2 was built without CUDA "
+    "(see the DBoW2_WITH_CUDA option)");
+}
+
+// --------------------------------------------------------------------------
+
+void GpuTree::clear()
+{
+  delete m_device;
+  m_device = NULL;
+  m_nodes = 0;
+  m_bytes = 0;
+}
+
+// --------------------------------------------------------------------------
+
+void GpuTree::quantize(const unsigned char *, size_t, int,
+  unsigned int *, unsigned int *) const
+{
+  throw string("GpuTree: no tree uploaded");
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
@@ -0,0 +1,284 @@
+/**
+ * File: GpuTree.cu
+ * Date: October 2026
+ * Description: CUDA backend of GpuTree
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <string>
+#include <algorithm>
+#include <climits>
+#include <stdint.h>
+#include <cuda_runtime.h>
+
+#include "GpuTree.h"
+
+using namespace std;
+
+namespace DBoW2 {
+
+// --------------------------------------------------------------------------
+
+struct GpuTree::Device
+{
+  /// Frozen index of the first child of each node
+  unsigned int *first_child;
+  /// Number of children of each node
+  unsigned int *nchildren;
+  /// Packed descriptors of the nodes, as 32-bit words
+  uint32_t *packed;
+
+  Device(): first_child(NULL), nchildren(NULL), packed(NULL) {}
+
+  ~Device()
+  {
+    cudaFree(first_child);
+    cudaFree(nchildren);
+    cudaFree(packed);
+  }
+};
+
+namespace {
+
+// --------------------------------------------------------------------------
+
+/// Descriptors quantized per kernel launch, which bounds the GPU memory
+/// used by a call to quantize
+const size_t BATCH = 1 << 20;
+
+/// Threads per block
+const unsigned int THREADS = 256;
+
+// --------------------------------------------------------------------------
+
+/**
+ * Throws if a CUDA call failed
+ * @param e result of the call
+ * @param what what was being done
+ */
+static void check(cudaError_t e, const char *what)
+{
+  if(e != cudaSuccess)
+    throw string("GpuTree: ") + what + ": " + cudaGetErrorString(e);
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * Propagates each descriptor down the tree, one per thread. W is the number
+ * of 32-bit words of a descriptor if it is known at compile time (8 for ORB
+ * and BRIEF, 12 for BRISK), so that the query is kept in registers, or 0
+ */
+template<int W>
+__global__ void quantizeKernel(const unsigned int * __restrict__ first_child,
+  const unsigned int * __restrict__ nchildren,
+  const uint32_t * __restrict__ packed, int words,
+  const uint32_t * __restrict__ descriptors, unsigned int n, int level,
+  unsigned int *leaves, unsigned int *ancestors)
+{
+  const unsigned int j = blockIdx.x * blockDim.x + threadIdx.x;
+  if(j >= n) return;
+
+  if(W > 0) words = W;
+  const uint32_t *q = descriptors + (size_t)j * words;
+
+  uint32_t r[W > 0 ? W : 1];
+  if(W > 0)
+  {
+    #pragma unroll
+    for(int w = 0; w < W; ++w) r[w] = q[w];
+  }
+
+  unsigned int i = 0; // root
+  unsigned int ancestor = 0;
+  int current_level = 0;
+
+  do
+  {
+    ++current_level;
+    unsigned int c = first_child[i];
+    const unsigned int cend = c + nchildren[i];
+
+    // the first closest child, as on the cpu
+    unsigned int best_d = UINT_MAX;
+    for(; c < cend; ++c)
+    {
+      const uint32_t *p = packed + (size_t)c * words;
+      unsigned int d = 0;
+      if(W > 0)
+      {
+        #pragma unroll
+        for(int w = 0; w < W; ++w) d += __popc(r[w] ^ p[w]);
+      }
+      else
+      {
+        for(int w = 0; w < words; ++w) d += __popc(q[w] ^ p[w]);
+      }
+
+      if(d < best_d)
+      {
+        best_d = d;
+        i = c;
+      }
+    }
+
+    if(current_level == level) ancestor = i;
+
+  } while(nchildren[i] > 0);
+
+  leaves[j] = i;
+  if(ancestors) ancestors[j] = ancestor;
+}
+
+// --------------------------------------------------------------------------
+
+/// Device buffer freed when it goes out of scope
+template<class T>
+struct DeviceBuffer
+{
+  T *p;
+
+  explicit DeviceBuffer(size_t n): p(NULL)
+  {
+    if(n > 0)
+      check(cudaMalloc(reinterpret_cast<void**>(&p), n * sizeof(T)),
+        "cannot allocate memory");
+  }
+
+  ~DeviceBuffer() { cudaFree(p); }
+
+private:
+
+  DeviceBuffer(const DeviceBuffer &);
+  DeviceBuffer& operator=(const DeviceBuffer &);
+};
+
+// --------------------------------------------------------------------------
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+bool GpuTree::available()
+{
+  int devices = 0;
+  return cudaGetDeviceCount(&devices) == cudaSuccess && devices > 0;
+}
+
+// --------------------------------------------------------------------------
+
+GpuTree::GpuTree(): m_device(NULL), m_nodes(0), m_bytes(0)
+{
+}
+
+// --------------------------------------------------------------------------
+
+GpuTree::~GpuTree()
+{
+  clear();
+}
+
+// --------------------------------------------------------------------------
+
+void GpuTree::upload(const unsigned int *first_child,
+  const unsigned int *nchildren, unsigned int nodes,
+  const unsigned char *packed, int bytes)
+{
+  if(nodes < 2 || nchildren[0] == 0)
+    throw string("GpuTree: the tree has no words");
+  if(bytes <= 0 || bytes % 4 != 0)
+    throw string("GpuTree: the descriptor length must be a multiple of 4");
+
+  clear();
+
+  Device *d = new Device;
+  try
+  {
+    check(cudaMalloc(reinterpret_cast<void**>(&d->first_child),
+      nodes * sizeof(unsigned int)), "cannot allocate the tree");
+    check(cudaMalloc(reinterpret_cast<void**>(&d->nchildren),
+      nodes * sizeof(unsigned int)), "cannot allocate the tree");
+    check(cudaMalloc(reinterpret_cast<void**>(&d->packed),
+      (size_t)nodes * bytes), "cannot allocate the tree");
+
+    check(cudaMemcpy(d->first_child, first_child,
+      nodes * sizeof(unsigned int), cudaMemcpyHostToDevice),
+      "cannot upload the tree");
+    check(cudaMemcpy(d->nchildren, nchildren,
+      nodes * sizeof(unsigned int), cudaMemcpyHostToDevice),
+      "cannot upload the tree");
+    check(cudaMemcpy(d->packed, packed, (size_t)nodes * bytes,
+      cudaMemcpyHostToDevice), "cannot upload the tree");
+  }
+  catch(...)
+  {
+    delete d;
+    throw;
+  }
+
+  m_device = d;
+  m_nodes = nodes;
+  m_bytes = bytes;
+}
+
+// --------------------------------------------------------------------------
+
+void GpuTree::clear()
+{
+  delete m_device;
+  m_device = NULL;
+  m_nodes = 0;
+  m_bytes = 0;
+}
+
+// --------------------------------------------------------------------------
+
+void GpuTree::quantize(const unsigned char *descriptors, size_t n,
+  int level, unsigned int *leaves, unsigned int *ancestors) const
+{
+  if(empty()) throw string("GpuTree: no tree uploaded");
+  if(n == 0) return;
+
+  const int words = m_bytes / 4;
+  const size_t m = std::min(n, BATCH);
+
+  DeviceBuffer<uint32_t> d_descriptors(m * words);
+  DeviceBuffer<unsigned int> d_leaves(m);
+  DeviceBuffer<unsigned int> d_ancestors(ancestors ? m : 0);
+
+  for(size_t b = 0; b < n; b += m)
+  {
+    const unsigned int k = (unsigned int)std::min(m, n - b);
+
+    check(cudaMemcpy(d_descriptors.p, descriptors + b * m_bytes,
+      (size_t)k * m_bytes, cudaMemcpyHostToDevice),
+      "cannot upload the descriptors");
+
+    const unsigned int blocks = (k + THREADS - 1) / THREADS;
+    if(words == 8)
+      quantizeKernel<8><<<blocks, THREADS>>>(m_device->first_child,
+        m_device->nchildren, m_device->packed, words, d_descriptors.p, k,
+        level, d_leaves.p, d_ancestors.p);
+    else if(words == 12)
+      quantizeKernel<12><<<blocks, THREADS>>>(m_device->first_child,
+        m_device->nchildren, m_device->packed, words, d_descriptors.p, k,
+        level, d_leaves.p, d_ancestors.p);
+    else
+      quantizeKernel<0><<<blocks, THREADS>>>(m_device->first_child,
+        m_device->nchildren, m_device->packed, words, d_descriptors.p, k,
+        level, d_leaves.p, d_ancestors.p);
+    check(cudaGetLastError(), "cannot run the kernel");
+
+    check(cudaMemcpy(leaves + b, d_leaves.p, k * sizeof(unsigned int),
+      cudaMemcpyDeviceToHost), "cannot download the words");
+    if(ancestors)
+      check(cudaMemcpy(ancestors + b, d_ancestors.p,
+        k * sizeof(unsigned int), cudaMemcpyDeviceToHost),
+        "cannot download the nodes");
+  }
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
@@ -0,0 +1,123 @@
+/**
+ * File: QueryFilter.cpp
+ * Date: October 2026
+ * Description: entries that database queries may return
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <algorithm>
+#include "QueryFilter.h"
+
+using namespace std;
+
+namespace DBoW2
+{
+
+const EntryId QueryFilter::END;
+
+// ---------------------------------------------------------------------------
+
+QueryFilter::QueryFilter(): m_ranges(1, Range(0, END)), m_mask(NULL)
+{
+}
+
+// ---------------------------------------------------------------------------
+
+QueryFilter::QueryFilter(EntryId begin, EntryId end): m_mask(NULL)
+{
+  if(begin < end) m_ranges.push_back(Range(begin, end));
+}
+
+// ---------------------------------------------------------------------------
+
+QueryFilter& QueryFilter::include(EntryId begin, EntryId end)
+{
+  if(begin >= end) return *this;
+
+  // the ranges that overlap or touch [begin, end) are merged with it
+  vector<Range>::iterator first = m_ranges.begin();
+  while(first != m_ranges.end() && first->second < begin) ++first;
+
+  vector<Range>::iterator last = first;
+  while(last != m_ranges.end() && last->first <= end)
+  {
+    begin = min(begin, last->first);
+    end = max(end, last->second);
+    ++last;
+  }
+
+  first = m_ranges.erase(first, last);
+  m_ranges.insert(first, Range(begin, end));
+  return *this;
+}
+
+// ---------------------------------------------------------------------------
+
+QueryFilter& QueryFilter::exclude(EntryId begin, EntryId end)
+{
+  if(begin >= end) return *this;
+
+  vector<Range> ranges;
+  ranges.reserve(m_ranges.size() + 1);
+  for(size_t i = 0; i < m_ranges.size(); ++i)
+  {
+    const Range &r = m_ranges[i];
+    if(r.second <= begin || r.first >= end)
+    {
+      ranges.push_back(r);
+      continue;
+    }
+
+    // the parts of r before and after [begin, end)
+    if(r.first < begin) ranges.push_back(Range(r.first, begin));
+    if(r.second > end) ranges.push_back(Range(end, r.second));
+  }
+
+  m_ranges.swap(ranges);
+  return *this;
+}
+
+// ---------------------------------------------------------------------------
+
+QueryFilter& QueryFilter::setMask(const std::vector<bool> *mask)
+{
+  m_mask = mask;
+  return *this;
+}
+
+// ---------------------------------------------------------------------------
+
+bool QueryFilter::accepts(EntryId id) const
+{
+  if(m_mask && (id >= m_mask->size() || !(*m_mask)[id])) return false;
+
+  // the range before the first one that begins after id
+  vector<Range>::const_iterator it = upper_bound(m_ranges.begin(),
+    m_ranges.end(), Range(id, END));
+  return it != m_ranges.begin() && (it - 1)->second > id;
+}
+
+// ---------------------------------------------------------------------------
+
+void QueryFilter::clip(EntryId end, std::vector<Range> &ranges) const
+{
+  ranges.clear();
+  for(size_t i = 0; i < m_ranges.size() && m_ranges[i].first < end; ++i)
+  {
+    ranges.push_back(Range(m_ranges[i].first,
+      min(m_ranges[i].second, end)));
+  }
+
+  // the mask rejects the entries beyond it
+  if(m_mask)
+  {
+    const EntryId n = (EntryId)m_mask->size();
+    while(!ranges.empty() && ranges.back().first >= n) ranges.pop_back();
+    if(!ranges.empty() && ranges.back().second > n) ranges.back().second = n;
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+} // namespace DBoW2
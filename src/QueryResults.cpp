@@ -9,6 +9,9 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
 #include "QueryResults.h"
 
 using namespace std;
@@ -16,6 +19,25 @@ using namespace std;
 namespace DBoW2
 {
 
+namespace {
+
+/// Orders results by score, and then by entry id
+struct ScoreOrder
+{
+  bool ascending;
+
+  explicit ScoreOrder(bool asc): ascending(asc) {}
+
+  inline bool operator()(const Result &a, const Result &b) const
+  {
+    if(a.Score != b.Score)
+      return ascending ? a.Score < b.Score : a.Score > b.Score;
+    return a.Id < b.Id;
+  }
+};
+
+} // namespace
+
 // ---------------------------------------------------------------------------
 
 ostream & operator<<(ostream& os, const Result& ret )
@@ -59,5 +81,87 @@ void QueryResults::saveM(const std::string &filename) const
 
 // ---------------------------------------------------------------------------
 
+void QueryResults::selectBest(int max_results, bool ascending)
+{
+  ScoreOrder order(ascending);
+
+  if(max_results > 0 && (int)size() > max_results)
+  {
+    std::nth_element(begin(), begin() + max_results, end(), order);
+    resize(max_results);
+  }
+
+  std::sort(begin(), end(), order);
+}
+
+// ---------------------------------------------------------------------------
+
+void QueryResults::merge(const std::vector<QueryResults> &parts, 
+  QueryResults &ret, int max_results, bool ascending)
+{
+  size_t n = 0;
+  for(size_t i = 0; i < parts.size(); ++i) n += parts[i].size();
+
+  ret.clear();
+  ret.reserve(n);
+  for(size_t i = 0; i < parts.size(); ++i)
+    ret.insert(ret.end(), parts[i].begin(), parts[i].end());
+
+  // the best results of all are among the best ones of each part, and
+  // ties are broken by id as in a single database
+  ret.selectBest(max_results, ascending);
+}
+
+// ---------------------------------------------------------------------------
+
+void QueryResults::serialize(std::vector<unsigned char> &buffer) const
+{
+  const uint32_t n = (uint32_t)size();
+  const size_t ITEM = sizeof(uint32_t) + sizeof(double);
+
+  size_t p = buffer.size();
+  buffer.resize(p + sizeof(n) + n * ITEM);
+  memcpy(&buffer[p], &n, sizeof(n));
+  p += sizeof(n);
+
+  for(const_iterator rit = begin(); rit != end(); ++rit, p += ITEM)
+  {
+    const uint32_t id = rit->Id;
+    memcpy(&buffer[p], &id, sizeof(id));
+    memcpy(&buffer[p + sizeof(id)], &rit->Score, sizeof(double));
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+size_t QueryResults::deserialize(const unsigned char *data, size_t bytes)
+{
+  const size_t ITEM = sizeof(uint32_t) + sizeof(double);
+
+  uint32_t n;
+  if(bytes < sizeof(n)) throw string("QueryResults: truncated data");
+  memcpy(&n, data, sizeof(n));
+  if((bytes - sizeof(n)) / ITEM < n) 
+    throw string("QueryResults: truncated data");
+
+  // whole results are added, so that the fields that are not serialized
+  // are 0 instead of those of the previous results
+  clear();
+  reserve(n);
+  const unsigned char *p = data + sizeof(n);
+  for(uint32_t i = 0; i < n; ++i, p += ITEM)
+  {
+    uint32_t id;
+    double score;
+    memcpy(&id, p, sizeof(id));
+    memcpy(&score, p + sizeof(id), sizeof(score));
+    push_back(Result(id, score));
+  }
+
+  return sizeof(n) + n * ITEM;
+}
+
+// ---------------------------------------------------------------------------
+
 } // namespace DBoW2
 
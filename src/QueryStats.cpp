@@ -0,0 +1,114 @@
+/**
+ * File: QueryStats.cpp
+ * Date: October 2026
+ * Description: counters of the work done by transforms and queries
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include "QueryStats.h"
+
+using namespace std;
+
+namespace DBoW2
+{
+
+// ---------------------------------------------------------------------------
+
+void QueryStats::clear()
+{
+  descriptors = distances = levels = 0;
+  queries = lists = postings = candidates = results = 0;
+  transform_time = scoring_time = sorting_time = 0;
+}
+
+// ---------------------------------------------------------------------------
+
+QueryStats& QueryStats::operator+=(const QueryStats &s)
+{
+  descriptors += s.descriptors;
+  distances += s.distances;
+  levels += s.levels;
+  queries += s.queries;
+  lists += s.lists;
+  postings += s.postings;
+  candidates += s.candidates;
+  results += s.results;
+  transform_time += s.transform_time;
+  scoring_time += s.scoring_time;
+  sorting_time += s.sorting_time;
+  return *this;
+}
+
+// ---------------------------------------------------------------------------
+
+ostream& operator<<(ostream &out, const QueryStats &s)
+{
+  out << "descriptors: " << s.descriptors 
+    << ", distances: " << s.distances 
+    << ", levels: " << s.levels 
+    << ", transform time: " << s.transform_time << " s" << endl
+    << "queries: " << s.queries 
+    << ", lists: " << s.lists 
+    << ", postings: " << s.postings 
+    << ", candidates: " << s.candidates 
+    << ", results: " << s.results << endl
+    << "scoring time: " << s.scoring_time << " s"
+    << ", sorting time: " << s.sorting_time << " s";
+  return out;
+}
+
+// ---------------------------------------------------------------------------
+
+void QueryCounters::add(const QueryStats &s)
+{
+  const uint64_t counts[8] = { s.descriptors, s.distances, s.levels, 
+    s.queries, s.lists, s.postings, s.candidates, s.results };
+  const double times[3] = { s.transform_time, s.scoring_time, 
+    s.sorting_time };
+
+  for(int i = 0; i < 8; ++i)
+  {
+    if(counts[i] > 0) 
+      m_counts[i].fetch_add(counts[i], std::memory_order_relaxed);
+  }
+  for(int i = 0; i < 3; ++i)
+  {
+    if(times[i] > 0) 
+      m_nanoseconds[i].fetch_add((uint64_t)(times[i] * 1e9 + 0.5), 
+        std::memory_order_relaxed);
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+QueryStats QueryCounters::get() const
+{
+  QueryStats s;
+  s.descriptors = m_counts[0].load(std::memory_order_relaxed);
+  s.distances = m_counts[1].load(std::memory_order_relaxed);
+  s.levels = m_counts[2].load(std::memory_order_relaxed);
+  s.queries = m_counts[3].load(std::memory_order_relaxed);
+  s.lists = m_counts[4].load(std::memory_order_relaxed);
+  s.postings = m_counts[5].load(std::memory_order_relaxed);
+  s.candidates = m_counts[6].load(std::memory_order_relaxed);
+  s.results = m_counts[7].load(std::memory_order_relaxed);
+  s.transform_time = m_nanoseconds[0].load(std::memory_order_relaxed) * 1e-9;
+  s.scoring_time = m_nanoseconds[1].load(std::memory_order_relaxed) * 1e-9;
+  s.sorting_time = m_nanoseconds[2].load(std::memory_order_relaxed) * 1e-9;
+  return s;
+}
+
+// ---------------------------------------------------------------------------
+
+void QueryCounters::reset()
+{
+  for(int i = 0; i < 8; ++i) m_counts[i].store(0, std::memory_order_relaxed);
+  for(int i = 0; i < 3; ++i) 
+    m_nanoseconds[i].store(0, std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------
+
+} // namespace DBoW2
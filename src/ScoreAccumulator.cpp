@@ -0,0 +1,259 @@
+/**
+ * File: ScoreAccumulator.cpp
+ * Date: October 2026
+ * Description: dense array of partial scores of database entries
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <vector>
+
+#include "ScoreAccumulator.h"
+
+namespace DBoW2 {
+
+namespace {
+
+/// Accumulators reused by the queries of a thread
+struct ThreadAccumulator
+{
+  ScoreAccumulator acc;
+  bool busy;
+
+  BlockScoreAccumulator block;
+  bool block_busy;
+
+  ThreadAccumulator(): busy(false), block_busy(false) {}
+};
+
+/// Bytes of a cache line
+const size_t CACHE_LINE = 64;
+
+thread_local ThreadAccumulator t_accumulator;
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+
+ScoreAccumulator::ScoreAccumulator()
+{
+}
+
+// ---------------------------------------------------------------------------
+
+void ScoreAccumulator::reset(size_t nentries, bool sums)
+{
+  clear();
+
+  if(m_count.size() < nentries)
+  {
+    m_score.resize(nentries);
+    m_count.resize(nentries, 0);
+  }
+
+  if(sums && m_sum_a.size() < nentries)
+  {
+    m_sum_a.resize(nentries);
+    m_sum_b.resize(nentries);
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+void ScoreAccumulator::clear()
+{
+  std::vector<EntryId>::const_iterator it;
+  for(it = m_touched.begin(); it != m_touched.end(); ++it)
+    m_count[*it] = 0;
+  m_touched.clear();
+}
+
+// ---------------------------------------------------------------------------
+
+void ScoreAccumulator::release()
+{
+  // swapping with empty vectors frees their memory, unlike clear()
+  std::vector<double>().swap(m_score);
+  std::vector<unsigned int>().swap(m_count);
+  std::vector<double>().swap(m_sum_a);
+  std::vector<double>().swap(m_sum_b);
+  std::vector<EntryId>().swap(m_touched);
+}
+
+// ---------------------------------------------------------------------------
+
+BlockScoreAccumulator::BlockScoreAccumulator(): m_first(0)
+{
+}
+
+// ---------------------------------------------------------------------------
+
+template<class T>
+T* BlockScoreAccumulator::aligned(std::vector<T> &v)
+{
+  if(v.empty()) return NULL;
+
+  const size_t misalignment =
+    reinterpret_cast<size_t>(v.data()) % CACHE_LINE;
+  if(misalignment == 0) return v.data();
+  return v.data() + (CACHE_LINE - misalignment) / sizeof(T);
+}
+
+// ---------------------------------------------------------------------------
+
+void BlockScoreAccumulator::reset(EntryId first, size_t nentries, 
+  bool sums)
+{
+  clear();
+  m_first = first;
+
+  // the arrays have room to align them to cache lines. The counts out of
+  // the touched entries are always 0, so they can be moved
+  const size_t n = nentries * QUERIES;
+
+  if(m_count.size() < n + CACHE_LINE / sizeof(unsigned int))
+  {
+    m_score.resize(n + CACHE_LINE / sizeof(double));
+    m_count.resize(n + CACHE_LINE / sizeof(unsigned int), 0);
+  }
+
+  if(sums && m_sum_a.size() < m_score.size())
+  {
+    m_sum_a.resize(m_score.size());
+    m_sum_b.resize(m_score.size());
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+void BlockScoreAccumulator::clear()
+{
+  unsigned int *count = aligned(m_count);
+  for(unsigned int q = 0; q < QUERIES; ++q)
+  {
+    std::vector<EntryId>::const_iterator it;
+    for(it = m_touched[q].begin(); it != m_touched[q].end(); ++it)
+      count[(size_t)(*it - m_first) * QUERIES + q] = 0;
+    m_touched[q].clear();
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+void BlockScoreAccumulator::release()
+{
+  // swapping with empty vectors frees their memory, unlike clear()
+  std::vector<double>().swap(m_score);
+  std::vector<unsigned int>().swap(m_count);
+  std::vector<double>().swap(m_sum_a);
+  std::vector<double>().swap(m_sum_b);
+  for(unsigned int q = 0; q < QUERIES; ++q)
+    std::vector<EntryId>().swap(m_touched[q]);
+}
+
+// ---------------------------------------------------------------------------
+
+BlockScoreAccumulator::Column BlockScoreAccumulator::column(unsigned int q)
+{
+  Column c;
+  c.m_first = m_first;
+  c.m_score = aligned(m_score) + q;
+  c.m_count = aligned(m_count) + q;
+  if(!m_sum_a.empty())
+  {
+    c.m_sum_a = aligned(m_sum_a) + q;
+    c.m_sum_b = aligned(m_sum_b) + q;
+  }
+  c.m_touched = &m_touched[q];
+  return c;
+}
+
+// ---------------------------------------------------------------------------
+
+LocalScoreAccumulator::LocalScoreAccumulator(size_t nentries, bool sums)
+{
+  ThreadAccumulator &t = t_accumulator;
+  if(t.busy)
+  {
+    m_acc = new ScoreAccumulator;
+    m_shared = false;
+  }
+  else
+  {
+    t.busy = true;
+    m_acc = &t.acc;
+    m_shared = true;
+  }
+
+  m_acc->reset(nentries, sums);
+}
+
+// ---------------------------------------------------------------------------
+
+LocalScoreAccumulator::~LocalScoreAccumulator()
+{
+  if(m_shared)
+  {
+    m_acc->clear();
+    t_accumulator.busy = false;
+  }
+  else
+  {
+    delete m_acc;
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+bool LocalScoreAccumulator::releaseThreadAccumulator()
+{
+  ThreadAccumulator &t = t_accumulator;
+  if(t.busy) return false;
+
+  t.acc.release();
+
+  // the block accumulator is never in use out of a batch of queries
+  if(!t.block_busy) t.block.release();
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+
+LocalBlockScoreAccumulator::LocalBlockScoreAccumulator(EntryId first,
+  size_t nentries, bool sums)
+{
+  ThreadAccumulator &t = t_accumulator;
+  if(t.block_busy)
+  {
+    m_acc = new BlockScoreAccumulator;
+    m_shared = false;
+  }
+  else
+  {
+    t.block_busy = true;
+    m_acc = &t.block;
+    m_shared = true;
+  }
+
+  m_acc->reset(first, nentries, sums);
+}
+
+// ---------------------------------------------------------------------------
+
+LocalBlockScoreAccumulator::~LocalBlockScoreAccumulator()
+{
+  if(m_shared)
+  {
+    m_acc->clear();
+    t_accumulator.block_busy = false;
+  }
+  else
+  {
+    delete m_acc;
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+} // namespace DBoW2
+
@@ -10,6 +10,7 @@
 #include <cfloat>
 #include "TemplatedVocabulary.h"
 #include "BowVector.h"
+#include "FlatBowVector.h"
 
 using namespace DBoW2;
 
@@ -17,6 +18,17 @@ using namespace DBoW2;
 // epsilon value (this is needed by the KL method)
 const double GeneralScoring::LOG_EPS = log(DBL_EPSILON); // FLT_EPSILON
 
+// ---------------------------------------------------------------------------
+
+double GeneralScoring::score(const FlatBowVector &v, const FlatBowVector &w)
+  const
+{
+  BowVector bv, bw;
+  v.toBowVector(bv);
+  w.toBowVector(bw);
+  return score(bv, bw);
+}
+
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
@@ -70,6 +82,53 @@ double L1Scoring::score(const BowVector &v1, const BowVector &v2) const
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
+double L1Scoring::score(const FlatBowVector &v1, 
+  const FlatBowVector &v2) const
+{
+  const WordId *ids1 = v1.ids();
+  const WordId *ids2 = v2.ids();
+  const WordValue *values1 = v1.values();
+  const WordValue *values2 = v2.values();
+  const size_t n1 = v1.size();
+  const size_t n2 = v2.size();
+
+  size_t i = 0, j = 0;
+  double score = 0;
+
+  while(i < n1 && j < n2)
+  {
+    const WordValue& vi = values1[i];
+    const WordValue& wi = values2[j];
+
+    if(ids1[i] == ids2[j])
+    {
+      score += fabs(vi - wi) - fabs(vi) - fabs(wi);
+
+      // move v1 and v2 forward
+      ++i;
+      ++j;
+    }
+    else if(ids1[i] < ids2[j])
+    {
+      // move v1 forward
+      ++i;
+    }
+    else
+    {
+      // move v2 forward
+      ++j;
+    }
+  }
+
+  // see L1Scoring::score(BowVector, BowVector)
+  score = -score/2.0;
+
+  return score; // [0..1]
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
 double L2Scoring::score(const BowVector &v1, const BowVector &v2) const
 {
   BowVector::const_iterator v1_it, v2_it;
@@ -122,6 +181,56 @@ double L2Scoring::score(const BowVector &v1, const BowVector &v2) const
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
+double L2Scoring::score(const FlatBowVector &v1, 
+  const FlatBowVector &v2) const
+{
+  const WordId *ids1 = v1.ids();
+  const WordId *ids2 = v2.ids();
+  const WordValue *values1 = v1.values();
+  const WordValue *values2 = v2.values();
+  const size_t n1 = v1.size();
+  const size_t n2 = v2.size();
+
+  size_t i = 0, j = 0;
+  double score = 0;
+
+  while(i < n1 && j < n2)
+  {
+    const WordValue& vi = values1[i];
+    const WordValue& wi = values2[j];
+
+    if(ids1[i] == ids2[j])
+    {
+      score += vi * wi;
+
+      // move v1 and v2 forward
+      ++i;
+      ++j;
+    }
+    else if(ids1[i] < ids2[j])
+    {
+      // move v1 forward
+      ++i;
+    }
+    else
+    {
+      // move v2 forward
+      ++j;
+    }
+  }
+
+  // see L2Scoring::score(BowVector, BowVector)
+  if(score >= 1) // rounding errors
+    score = 1.0;
+  else
+    score = 1.0 - sqrt(1.0 - score); // [0..1]
+
+  return score;
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
 double ChiSquareScoring::score(const BowVector &v1, const BowVector &v2) 
   const
 {
@@ -172,6 +281,53 @@ double ChiSquareScoring::score(const BowVector &v1, const BowVector &v2)
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
+double ChiSquareScoring::score(const FlatBowVector &v1, 
+  const FlatBowVector &v2) const
+{
+  const WordId *ids1 = v1.ids();
+  const WordId *ids2 = v2.ids();
+  const WordValue *values1 = v1.values();
+  const WordValue *values2 = v2.values();
+  const size_t n1 = v1.size();
+  const size_t n2 = v2.size();
+
+  size_t i = 0, j = 0;
+  double score = 0;
+
+  while(i < n1 && j < n2)
+  {
+    const WordValue& vi = values1[i];
+    const WordValue& wi = values2[j];
+
+    if(ids1[i] == ids2[j])
+    {
+      if(vi + wi != 0.0) score += vi * wi / (vi + wi);
+
+      // move v1 and v2 forward
+      ++i;
+      ++j;
+    }
+    else if(ids1[i] < ids2[j])
+    {
+      // move v1 forward
+      ++i;
+    }
+    else
+    {
+      // move v2 forward
+      ++j;
+    }
+  }
+
+  // this takes the -4 into account
+  score = 2. * score; // [0..1]
+
+  return score;
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
 double KLScoring::score(const BowVector &v1, const BowVector &v2) const
 { 
   BowVector::const_iterator v1_it, v2_it;
@@ -223,6 +379,56 @@ double KLScoring::score(const BowVector &v1, const BowVector &v2) const
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
+double KLScoring::score(const FlatBowVector &v1, 
+  const FlatBowVector &v2) const
+{
+  const WordId *ids1 = v1.ids();
+  const WordId *ids2 = v2.ids();
+  const WordValue *values1 = v1.values();
+  const WordValue *values2 = v2.values();
+  const size_t n1 = v1.size();
+  const size_t n2 = v2.size();
+
+  size_t i = 0, j = 0;
+  double score = 0;
+
+  while(i < n1 && j < n2)
+  {
+    const WordValue& vi = values1[i];
+    const WordValue& wi = values2[j];
+
+    if(ids1[i] == ids2[j])
+    {
+      if(vi != 0 && wi != 0) score += vi * log(vi/wi);
+
+      // move v1 and v2 forward
+      ++i;
+      ++j;
+    }
+    else if(ids1[i] < ids2[j])
+    {
+      // move v1 forward
+      score += vi * (log(vi) - LOG_EPS);
+      ++i;
+    }
+    else
+    {
+      // move v2 forward
+      ++j;
+    }
+  }
+
+  // sum rest of items of v
+  for(; i < n1; ++i) 
+    if(values1[i] != 0)
+      score += values1[i] * (log(values1[i]) - LOG_EPS);
+
+  return score; // cannot be scaled
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
 double BhattacharyyaScoring::score(const BowVector &v1, 
   const BowVector &v2) const
 {
@@ -268,6 +474,50 @@ double BhattacharyyaScoring::score(const BowVector &v1,
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
+double BhattacharyyaScoring::score(const FlatBowVector &v1, 
+  const FlatBowVector &v2) const
+{
+  const WordId *ids1 = v1.ids();
+  const WordId *ids2 = v2.ids();
+  const WordValue *values1 = v1.values();
+  const WordValue *values2 = v2.values();
+  const size_t n1 = v1.size();
+  const size_t n2 = v2.size();
+
+  size_t i = 0, j = 0;
+  double score = 0;
+
+  while(i < n1 && j < n2)
+  {
+    const WordValue& vi = values1[i];
+    const WordValue& wi = values2[j];
+
+    if(ids1[i] == ids2[j])
+    {
+      score += sqrt(vi * wi);
+
+      // move v1 and v2 forward
+      ++i;
+      ++j;
+    }
+    else if(ids1[i] < ids2[j])
+    {
+      // move v1 forward
+      ++i;
+    }
+    else
+    {
+      // move v2 forward
+      ++j;
+    }
+  }
+
+  return score; // already scaled
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
 double DotProductScoring::score(const BowVector &v1, 
   const BowVector &v2) const
 {
@@ -313,3 +563,47 @@ double DotProductScoring::score(const BowVector &v1,
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
+double DotProductScoring::score(const FlatBowVector &v1, 
+  const FlatBowVector &v2) const
+{
+  const WordId *ids1 = v1.ids();
+  const WordId *ids2 = v2.ids();
+  const WordValue *values1 = v1.values();
+  const WordValue *values2 = v2.values();
+  const size_t n1 = v1.size();
+  const size_t n2 = v2.size();
+
+  size_t i = 0, j = 0;
+  double score = 0;
+
+  while(i < n1 && j < n2)
+  {
+    const WordValue& vi = values1[i];
+    const WordValue& wi = values2[j];
+
+    if(ids1[i] == ids2[j])
+    {
+      score += vi * wi;
+
+      // move v1 and v2 forward
+      ++i;
+      ++j;
+    }
+    else if(ids1[i] < ids2[j])
+    {
+      // move v1 forward
+      ++i;
+    }
+    else
+    {
+      // move v2 forward
+      ++j;
+    }
+  }
+
+  return score; // cannot scale
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
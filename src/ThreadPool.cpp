@@ -0,0 +1,213 @@
+/**
+ * File: ThreadPool.cpp
+ * Date: October 2026
+ * Description: pool of worker threads to parallelize vocabulary and
+ *   database operations
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace DBoW2 {
+
+namespace {
+
+/// State of a parallelFor, shared with the tasks that help to run it
+struct ParallelJob
+{
+  ParallelJob(size_t _n, size_t _grain,
+    const std::function<void(size_t, size_t)> *_f)
+    : n(_n), grain(_grain), nchunks((_n + _grain - 1) / _grain), f(_f),
+      next(0), done(0) {}
+
+  /**
+   * Takes chunks until there are no more left
+   */
+  void run()
+  {
+    for(;;)
+    {
+      const size_t c = next.fetch_add(1);
+      if(c >= nchunks) break;
+
+      // f is only used while there are unfinished chunks, so it is
+      // still alive here
+      try
+      {
+        (*f)(c * grain, std::min(n, (c + 1) * grain));
+      }
+      catch(...)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!error) error = std::current_exception();
+      }
+
+      if(done.fetch_add(1) + 1 == nchunks)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.notify_all();
+      }
+    }
+  }
+
+  /**
+   * Returns whether all the chunks are done
+   */
+  inline bool complete() const
+  {
+    return done.load() == nchunks;
+  }
+
+  const size_t n;
+  const size_t grain;
+  const size_t nchunks;
+  const std::function<void(size_t, size_t)> *f;
+
+  std::atomic<size_t> next;
+  std::atomic<size_t> done;
+
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::exception_ptr error;
+};
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+ThreadPool::ThreadPool(unsigned int nthreads)
+  : m_stop(false)
+{
+  if(nthreads == 0)
+  {
+    const unsigned int hw = std::thread::hardware_concurrency();
+    nthreads = (hw > 1 ? hw - 1 : 0);
+  }
+
+  m_workers.reserve(nthreads);
+  for(unsigned int i = 0; i < nthreads; ++i)
+    m_workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+// --------------------------------------------------------------------------
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_condition.notify_all();
+
+  for(size_t i = 0; i < m_workers.size(); ++i)
+    m_workers[i].join();
+}
+
+// --------------------------------------------------------------------------
+
+void ThreadPool::enqueue(const std::function<void()> &task)
+{
+  if(m_workers.empty())
+  {
+    try { task(); } catch(...) {}
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back(task);
+  }
+  m_condition.notify_one();
+}
+
+// --------------------------------------------------------------------------
+
+bool ThreadPool::runPendingTask()
+{
+  std::function<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_tasks.empty()) return false;
+    task.swap(m_tasks.front());
+    m_tasks.pop_front();
+  }
+
+  try { task(); } catch(...) {}
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+void ThreadPool::parallelFor(size_t n,
+  const std::function<void(size_t, size_t)> &f, size_t grain)
+{
+  if(n == 0) return;
+  if(grain == 0) grain = 1;
+
+  if(m_workers.empty() || n <= grain)
+  {
+    f(0, n);
+    return;
+  }
+
+  std::shared_ptr<ParallelJob> job =
+    std::make_shared<ParallelJob>(n, grain, &f);
+
+  // helpers keep the job alive even if they start after it is complete
+  const size_t nhelpers = std::min(job->nchunks - 1, m_workers.size());
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(size_t i = 0; i < nhelpers; ++i)
+      m_tasks.push_back(std::bind(&ParallelJob::run, job));
+  }
+  if(nhelpers == 1) m_condition.notify_one();
+  else m_condition.notify_all();
+
+  job->run();
+
+  // the remaining chunks are being run by other threads. Give a hand with
+  // the queued tasks, which may belong to nested jobs
+  while(!job->complete())
+  {
+    if(!runPendingTask())
+    {
+      std::unique_lock<std::mutex> lock(job->mutex);
+      job->finished.wait(lock, std::bind(&ParallelJob::complete, job.get()));
+    }
+  }
+
+  if(job->error) std::rethrow_exception(job->error);
+}
+
+// --------------------------------------------------------------------------
+
+void ThreadPool::work()
+{
+  for(;;)
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while(!m_stop && m_tasks.empty()) m_condition.wait(lock);
+
+      if(m_tasks.empty()) return; // m_stop
+      task.swap(m_tasks.front());
+      m_tasks.pop_front();
+    }
+
+    try { task(); } catch(...) {}
+  }
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
+
@@ -0,0 +1,178 @@
+/**
+ * @file dbow2_batch_test.cpp
+ * @brief Tests that the batch functions of the database give the same
+ * results as the one-image ones.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 12000; ///< entries of the databases, in several tiles
+const int NTHREADS = 3; ///< threads of the pool
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Tests a scoring.
+/// \param voc Vocabulary.
+/// \param features Features of the query images.
+/// \param entries Features of the entries.
+/// \param pool Threads.
+void testScoring(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries, ThreadPool &pool);
+
+/// \brief Checks that queryBatch gives the results of query.
+/// \param db Database.
+/// \param queries Query vectors.
+/// \param pool Threads.
+/// \param what Description of the database.
+void checkQueryBatch(const Binary32Database &db,
+  const vector<FlatBowVector> &queries, ThreadPool &pool,
+  const string &what);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, entries;
+  createFeatures(features);
+  createEntries(features, NENTRIES, entries);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  ThreadPool pool(NTHREADS);
+
+  try
+  {
+    for(int s = 0; s < NSCORINGS; ++s)
+    {
+      Binary32Vocabulary v(voc);
+      v.setScoringType(SCORINGS[s]);
+      testScoring(v, features, entries, pool);
+    }
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+void testScoring(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries, ThreadPool &pool)
+{
+  const string name = "scoring " + to_string(voc.getScoringType());
+  cout << "Testing the batches with the " << name << "..." << endl;
+
+  // the entries one by one, and in batches with and without threads
+  Binary32Database db(voc, true, 1), batch(voc, true, 1),
+    threaded(voc, true, 1);
+  for(size_t i = 0; i < entries.size(); ++i) db.add(entries[i]);
+
+  const size_t half = entries.size() / 2;
+  batch.addBatch(vector<vector<Descriptor> >(entries.begin(),
+    entries.begin() + half));
+  batch.addBatch(vector<vector<Descriptor> >(entries.begin() + half,
+    entries.end()));
+  threaded.addBatch(entries, &pool);
+
+  vector<FlatBowVector> queries;
+  transformAll(voc, features, queries);
+
+  const Binary32Database *batches[] = { &batch, &threaded };
+  for(int b = 0; b < 2; ++b)
+  {
+    const string what = name + (b ? ", threaded addBatch" : ", addBatch");
+    check(batches[b]->size() == db.size(), what + ": size");
+
+    bool same_features = true;
+    for(EntryId id = 0; id < db.size(); ++id)
+    {
+      same_features = same_features &&
+        batches[b]->retrieveFlatFeatures(id) == db.retrieveFlatFeatures(id);
+    }
+    check(same_features, what + ": direct index");
+
+    bool same_results = true;
+    for(size_t i = 0; i < queries.size(); ++i)
+    {
+      QueryResults r, rb;
+      db.query(queries[i], r, 0);
+      batches[b]->query(queries[i], rb, 0);
+      same_results = same_results && sameResults(r, rb, 1e-12, true);
+    }
+    check(same_results, what + ": results");
+  }
+
+  checkQueryBatch(db, queries, pool, name);
+
+  // the removed entries are skipped in every tile
+  for(EntryId id = 0; id < db.size(); id += 5) db.remove(id);
+  checkQueryBatch(db, queries, pool, name + ", removed entries");
+
+  db.seal(&pool);
+  checkQueryBatch(db, queries, pool, name + ", sealed");
+}
+
+// ----------------------------------------------------------------------------
+
+void checkQueryBatch(const Binary32Database &db,
+  const vector<FlatBowVector> &queries, ThreadPool &pool,
+  const string &what)
+{
+  const int max_results[] = { 0, 1, 10 };
+  const int max_ids[] = { -1, 0, 100, 9000 };
+
+  for(int k = 0; k < 3; ++k)
+  {
+    for(int m = 0; m < 4; ++m)
+    {
+      vector<QueryResults> expected(queries.size());
+      for(size_t i = 0; i < queries.size(); ++i)
+        db.query(queries[i], expected[i], max_results[k], max_ids[m]);
+
+      for(int p = 0; p < 2; ++p)
+      {
+        vector<QueryResults> ret;
+        db.queryBatch(queries, ret, max_results[k], max_ids[m],
+          p ? &pool : NULL);
+
+        bool ok = (ret.size() == queries.size());
+        for(size_t i = 0; ok && i < queries.size(); ++i)
+          ok = sameResults(expected[i], ret[i], 1e-12, true);
+
+        check(ok, what + ": queryBatch with max_results " +
+          to_string(max_results[k]) + ", max_id " + to_string(max_ids[m]) +
+          (p ? " and a pool" : ""));
+      }
+
+      // a single query is a group of its own
+      vector<QueryResults> single;
+      db.queryBatch(vector<FlatBowVector>(1, queries[0]), single,
+        max_results[k], max_ids[m]);
+      check(single.size() == 1 &&
+        sameResults(expected[0], single[0], 1e-12, true),
+        what + ": queryBatch of one query with max_results " +
+        to_string(max_results[k]) + ", max_id " + to_string(max_ids[m]));
+    }
+  }
+}
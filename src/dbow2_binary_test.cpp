@@ -0,0 +1,486 @@
+/**
+ * @file dbow2_binary_test.cpp
+ * @brief Tests the binary database files and the journals.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <iterator>
+#include <cstring>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NREPLAYED = 15; ///< images added after the snapshot
+const size_t JOURNAL_HEADER = 40; ///< bytes of the header of the journals
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Returns whether two databases have the same contents.
+/// \param a Database.
+/// \param b Database.
+/// \param features Features to query them with.
+template<class TWeight>
+bool equal(const TemplatedDatabase<Descriptor, FBinary32, TWeight> &a,
+  const TemplatedDatabase<Descriptor, FBinary32, TWeight> &b,
+  const vector<vector<Descriptor> > &features);
+
+/// \brief Returns whether loading a database file throws.
+/// \param filename File.
+template<class TWeight>
+bool loadThrows(const string &filename);
+
+/// \brief Returns whether loading a database file on a database throws.
+/// \param db Database.
+/// \param filename File.
+template<class TWeight>
+bool loadThrows(TemplatedDatabase<Descriptor, FBinary32, TWeight> &db,
+  const string &filename);
+
+/// \brief Returns whether replaying a journal on a database throws.
+/// \param db Database.
+/// \param filename Journal.
+template<class TWeight>
+bool replayThrows(TemplatedDatabase<Descriptor, FBinary32, TWeight> &db,
+  const string &filename);
+
+/// \brief Returns whether resuming a journal on a database throws.
+/// \param db Database.
+/// \param filename Journal.
+template<class TWeight>
+bool resumeThrows(TemplatedDatabase<Descriptor, FBinary32, TWeight> &db,
+  const string &filename);
+
+/// \brief Tests the files of a type of weights.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+/// \param name Name of the type of weights.
+template<class TWeight>
+void testWeights(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features, const string &name);
+
+/// \brief Tests that fixed-point databases reject DOT_PRODUCT files and
+/// are not modified by them.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+void testDotProduct(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features);
+
+/// \brief Gives access to the layout of the binary files.
+template<class TWeight>
+class FileLayout: public TemplatedDatabase<Descriptor, FBinary32, TWeight>
+{
+public:
+  typedef TemplatedDatabase<Descriptor, FBinary32, TWeight> Database;
+  typedef typename Database::BinaryHeader Header;
+  using Database::SECTION_DI_FEATURE_OFFSETS;
+  using Database::NUM_SECTIONS;
+};
+
+/// \brief Changes the offset of the first feature of a direct index node
+/// in the bytes of a binary database file, and updates its checksum.
+/// \param data Bytes of the file.
+/// \param node Node of the direct index.
+/// \param offset New offset.
+/// \return Bytes of the changed file.
+template<class TWeight>
+string setFeatureOffset(const string &data, uint64_t node, uint64_t offset);
+
+/// \brief Reads a whole file.
+/// \param filename File.
+/// @param[out] data Its bytes.
+void readFile(const string &filename, string &data);
+
+/// \brief Writes a whole file.
+/// \param filename File.
+/// \param data Its bytes.
+void writeFile(const string &filename, const string &data);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features;
+  createFeatures(features);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  try
+  {
+    testWeights<WordValue>(voc, features, "double");
+    testWeights<float>(voc, features, "float");
+    testWeights<FixedWordValue>(voc, features, "fixed-point");
+    testDotProduct(voc, features);
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+bool equal(const TemplatedDatabase<Descriptor, FBinary32, TWeight> &a,
+  const TemplatedDatabase<Descriptor, FBinary32, TWeight> &b,
+  const vector<vector<Descriptor> > &features)
+{
+  if(a.size() != b.size() || a.removedEntries() != b.removedEntries() ||
+    a.usingDirectIndex() != b.usingDirectIndex())
+    return false;
+
+  for(EntryId i = 0; i < a.size(); ++i)
+  {
+    if(a.isRemoved(i) != b.isRemoved(i)) return false;
+    if(a.usingDirectIndex() &&
+      !(a.retrieveFlatFeatures(i) == b.retrieveFlatFeatures(i)))
+      return false;
+  }
+
+  // the weights have the same type, so the scores must be the same
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    QueryResults ra, rb;
+    a.query(features[i], ra, 0);
+    b.query(features[i], rb, 0);
+
+    if(ra.size() != rb.size()) return false;
+    for(size_t j = 0; j < ra.size(); ++j)
+    {
+      if(ra[j].Id != rb[j].Id || ra[j].Score != rb[j].Score) return false;
+    }
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+bool loadThrows(const string &filename)
+{
+  try
+  {
+    TemplatedDatabase<Descriptor, FBinary32, TWeight> db(filename);
+  }
+  catch(const std::string &)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+bool loadThrows(TemplatedDatabase<Descriptor, FBinary32, TWeight> &db,
+  const string &filename)
+{
+  try
+  {
+    db.load(filename);
+  }
+  catch(const std::string &)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+bool replayThrows(TemplatedDatabase<Descriptor, FBinary32, TWeight> &db,
+  const string &filename)
+{
+  try
+  {
+    db.replayJournal(filename);
+  }
+  catch(const std::string &)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+bool resumeThrows(TemplatedDatabase<Descriptor, FBinary32, TWeight> &db,
+  const string &filename)
+{
+  try
+  {
+    db.openJournal(filename, true);
+  }
+  catch(const std::string &)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+void testWeights(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features, const string &name)
+{
+  typedef TemplatedDatabase<Descriptor, FBinary32, TWeight> Database;
+
+  cout << "Testing the " << name << " weights..." << endl;
+
+  const string snapshot = "binary_test_snapshot.dbow2";
+  const string journal = "binary_test_journal.jnl";
+  const string copy = "binary_test_copy.dbow2";
+
+  // database with removed entries and the entries of a journal
+  Database db(voc, true, 1);
+  for(int i = 0; i < NIMAGES - NREPLAYED; ++i) db.add(features[i]);
+  db.remove(3);
+  db.saveBinary(snapshot);
+
+  db.openJournal(journal);
+  for(int i = NIMAGES - NREPLAYED; i < NIMAGES; ++i) db.add(features[i]);
+  db.remove(5);
+  db.remove(NIMAGES - 2);
+  db.closeJournal();
+
+  // round trip
+  db.saveBinary(copy);
+  {
+    Database loaded(copy);
+    check(equal(db, loaded, features), name + ": save and load");
+  }
+
+  // replay of the added and removed entries
+  {
+    Database replayed(snapshot);
+    check(replayed.size() == (unsigned int)(NIMAGES - NREPLAYED) &&
+      replayed.removedEntries() == 1, name + ": load the snapshot");
+    check(replayed.replayJournal(journal) == (unsigned int)NREPLAYED,
+      name + ": entries replayed");
+    check(equal(db, replayed, features), name + ": replay the journal");
+
+    // replaying it again changes nothing
+    check(replayed.replayJournal(journal) == 0 &&
+      equal(db, replayed, features), name + ": replay the journal twice");
+  }
+
+  // a torn record at the end is ignored, and resuming the journal
+  // overwrites it
+  {
+    string data;
+    readFile(journal, data);
+    writeFile(journal, data + string(37, '\x5a'));
+
+    Database replayed(snapshot);
+    check(replayed.replayJournal(journal) == (unsigned int)NREPLAYED &&
+      equal(db, replayed, features), name + ": replay with a garbage tail");
+
+    Database resumed(snapshot);
+    resumed.openJournal(journal, true);
+    resumed.add(features[0]);
+    resumed.closeJournal();
+    db.add(features[0]);
+
+    Database replayed2(snapshot);
+    check(replayed2.replayJournal(journal) == (unsigned int)NREPLAYED + 1 &&
+      equal(db, replayed2, features) && equal(db, resumed, features),
+      name + ": resume after a garbage tail");
+  }
+
+  // a journal cannot be resumed after adding entries without it, and a
+  // journal with a gap is rejected before changing the database
+  {
+    const string other = "binary_test_other.jnl";
+
+    Database gap(snapshot);
+    gap.openJournal(journal);
+    gap.add(features[0]);
+    gap.closeJournal();
+    gap.add(features[1]);
+    gap.openJournal(other);
+    gap.add(features[2]);
+    gap.closeJournal();
+
+    check(resumeThrows(gap, journal) &&
+      gap.size() == (unsigned int)(NIMAGES - NREPLAYED + 3),
+      name + ": reject resuming a journal that misses entries");
+
+    string data, tail;
+    readFile(journal, data);
+    readFile(other, tail);
+    writeFile(journal, data + tail.substr(JOURNAL_HEADER));
+
+    Database replayed(snapshot);
+    Database original(replayed);
+    check(replayThrows(replayed, journal) &&
+      equal(original, replayed, features),
+      name + ": reject a journal with a gap");
+
+    std::remove(other.c_str());
+  }
+
+  // corrupted and truncated files
+  {
+    string data;
+    readFile(copy, data);
+
+    string corrupted = data;
+    corrupted[corrupted.size() / 2] ^= 0x10;
+    writeFile(copy, corrupted);
+    check(loadThrows<TWeight>(copy), name + ": reject a corrupted file");
+
+    writeFile(copy, data.substr(0, data.size() - 8));
+    check(loadThrows<TWeight>(copy), name + ": reject a truncated file");
+
+    writeFile(copy, data.substr(0, 100));
+    check(loadThrows<TWeight>(copy), name + ": reject a truncated header");
+
+    // direct index nodes whose features are not in order or not in the
+    // file, which would otherwise size the vectors of the entries
+    writeFile(copy, setFeatureOffset<TWeight>(data, 0, 1000000));
+    check(loadThrows<TWeight>(copy),
+      name + ": reject direct index features not in order");
+
+    writeFile(copy, setFeatureOffset<TWeight>(data, 1, (uint64_t)1 << 60));
+    check(loadThrows<TWeight>(copy),
+      name + ": reject direct index features out of the file");
+
+    // a database that fails to load is not modified
+    Database loaded(db);
+    writeFile(copy, corrupted);
+    check(loadThrows(loaded, copy) && equal(db, loaded, features),
+      name + ": keep the database when a file is rejected");
+
+    string jdata;
+    readFile(journal, jdata);
+    jdata[0] ^= 0x01;
+    writeFile(journal, jdata);
+    Database replayed(snapshot);
+    check(replayThrows(replayed, journal) &&
+      replayed.size() == (unsigned int)(NIMAGES - NREPLAYED),
+      name + ": reject a corrupted journal");
+  }
+
+  // journals written before renumbering the entries are rejected
+  {
+    Database renumbered(snapshot);
+    renumbered.openJournal(journal);
+    renumbered.add(features[1]);
+    renumbered.closeJournal();
+    renumbered.compact(true);
+    renumbered.saveBinary(copy);
+
+    Database loaded(copy);
+    check(replayThrows(renumbered, journal) && replayThrows(loaded, journal),
+      name + ": reject a journal written before compact(true)");
+  }
+
+  std::remove(snapshot.c_str());
+  std::remove(journal.c_str());
+  std::remove(copy.c_str());
+}
+
+// ----------------------------------------------------------------------------
+
+void testDotProduct(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features)
+{
+  typedef TemplatedDatabase<Descriptor, FBinary32, FixedWordValue> Database;
+
+  cout << "Testing the DOT_PRODUCT files..." << endl;
+
+  const string filename = "binary_test_dot.dbow2";
+
+  // a larger vocabulary, so that using it with the old inverted file
+  // would read past its end
+  Binary32Vocabulary dot_voc(8, 3, TF_IDF, DOT_PRODUCT);
+  dot_voc.create(features);
+
+  Binary32Database dot(dot_voc, true, 1);
+  for(int i = 0; i < 5; ++i) dot.add(features[i]);
+  dot.saveBinary(filename);
+
+  Database db(voc, true, 1);
+  for(int i = 0; i < 5; ++i) db.add(features[i]);
+  Database copy(db);
+
+  check(loadThrows(db, filename) && db.getVocabulary()->size() == voc.size()
+    && equal(copy, db, features), "fixed-point: reject a DOT_PRODUCT file");
+
+  db.add(features[5]);
+  copy.add(features[5]);
+  check(equal(copy, db, features), "fixed-point: add after a rejected file");
+
+  std::remove(filename.c_str());
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+string setFeatureOffset(const string &data, uint64_t node, uint64_t offset)
+{
+  typedef FileLayout<TWeight> Layout;
+
+  string changed = data;
+  typename Layout::Header h;
+  memcpy(&h, changed.data(), sizeof(h));
+  memcpy(&changed[h.offsets[Layout::SECTION_DI_FEATURE_OFFSETS] +
+    node * sizeof(uint64_t)], &offset, sizeof(offset));
+
+  // the checksum is calculated with its field set to 0, section after
+  // section
+  h.checksum = 0;
+  memcpy(&changed[0], &h, sizeof(h));
+
+  const unsigned char *bytes =
+    reinterpret_cast<const unsigned char*>(changed.data());
+  uint64_t sum = 0;
+  for(int i = 0; i < Layout::NUM_SECTIONS; ++i)
+  {
+    const uint64_t end = (i + 1 < Layout::NUM_SECTIONS ?
+      h.offsets[i+1] : changed.size());
+    sum = checksum(bytes + h.offsets[i], end - h.offsets[i], sum);
+  }
+
+  h.checksum = sum;
+  memcpy(&changed[0], &h, sizeof(h));
+  return changed;
+}
+
+// ----------------------------------------------------------------------------
+
+void readFile(const string &filename, string &data)
+{
+  ifstream f(filename.c_str(), ios::in | ios::binary);
+  data.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+}
+
+// ----------------------------------------------------------------------------
+
+void writeFile(const string &filename, const string &data)
+{
+  ofstream f(filename.c_str(), ios::out | ios::binary | ios::trunc);
+  f.write(data.data(), data.size());
+}
+
+// ----------------------------------------------------------------------------
+
@@ -0,0 +1,214 @@
+/**
+ * @file dbow2_compact_test.cpp
+ * @brief Tests that the compacted databases give the results of databases
+ * rebuilt with the entries that were not removed.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 2000; ///< entries of the databases
+const int NADDED = 100; ///< entries added after compacting
+const int NTHREADS = 3; ///< threads of the pool
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Returns whether an entry is removed before compacting: the
+/// first and last ones, runs of entries and scattered ones.
+/// \param id Entry id.
+inline bool removed(EntryId id)
+{
+  return id == 0 || id == NENTRIES - 1 || (id >= 300 && id < 420) ||
+    id % 7 == 2 || id % 11 == 5;
+}
+
+/// \brief Tests the compacted databases with a type of weights.
+/// \param voc Vocabulary.
+/// \param features Features of the query images.
+/// \param entries Features of the entries.
+/// \param pool Threads.
+/// \param name Name of the weights.
+template<class TWeight>
+void testWeights(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries, ThreadPool &pool,
+  const string &name);
+
+/// \brief Checks that a compacted database gives the results of the
+/// rebuilt one, translating the ids of the latter.
+/// \param db Compacted database.
+/// \param rebuilt Database with the entries that were not removed.
+/// \param ids Id in db of each entry of rebuilt.
+/// \param queries Query vectors.
+/// \param what Description of the databases.
+template<class TWeight>
+void checkQueries(
+  const TemplatedDatabase<Descriptor, FBinary32, TWeight> &db,
+  const TemplatedDatabase<Descriptor, FBinary32, TWeight> &rebuilt,
+  const vector<EntryId> &ids, const vector<FlatBowVector> &queries,
+  const string &what);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, entries;
+  createFeatures(features);
+  createEntries(features, NENTRIES + NADDED, entries);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  ThreadPool pool(NTHREADS);
+
+  try
+  {
+    testWeights<WordValue>(voc, features, entries, pool, "double");
+    testWeights<float>(voc, features, entries, pool, "float");
+    testWeights<FixedWordValue>(voc, features, entries, pool, "fixed-point");
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+void testWeights(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries, ThreadPool &pool,
+  const string &name)
+{
+  typedef TemplatedDatabase<Descriptor, FBinary32, TWeight> Database;
+
+  for(int s = 0; s < NSCORINGS; ++s)
+  {
+    // fixed-point weights need normalized vectors
+    if(is_same<TWeight, FixedWordValue>::value && SCORINGS[s] == DOT_PRODUCT)
+      continue;
+
+    Binary32Vocabulary v(voc);
+    v.setScoringType(SCORINGS[s]);
+
+    const string what = name + " weights, scoring " + to_string(SCORINGS[s]);
+    cout << "Testing the compacted databases with " << what << "..." << endl;
+
+    vector<FlatBowVector> queries;
+    transformAll(v, features, queries);
+
+    // the database with every entry, and the one rebuilt with those that
+    // are not removed
+    Database db(v, true, 1), rebuilt(v, true, 1);
+    vector<EntryId> kept;
+    for(int i = 0; i < NENTRIES; ++i)
+    {
+      db.add(entries[i]);
+      if(!removed(i))
+      {
+        rebuilt.add(entries[i]);
+        kept.push_back(i);
+      }
+    }
+    for(EntryId id = 0; id < db.size(); ++id)
+      if(removed(id)) db.remove(id);
+
+    checkQueries(db, rebuilt, kept, queries, what + ", removed entries");
+
+    // the entries keep their ids
+    const size_t memory = db.invertedFileMemory();
+    vector<EntryId> ids = db.compact(false, s % 2 ? &pool : NULL);
+
+    bool map = (ids.size() == (size_t)NENTRIES);
+    for(EntryId id = 0; map && id < ids.size(); ++id)
+      map = (ids[id] == (removed(id) ? Database::REMOVED_ENTRY : id));
+    check(map, what + ": ids returned by compact(false)");
+    check(db.size() == (unsigned int)NENTRIES &&
+      db.removedEntries() == (unsigned int)(NENTRIES - kept.size()),
+      what + ": size after compact(false)");
+    check(db.invertedFileMemory() < memory, what + ": compacted memory");
+    checkQueries(db, rebuilt, kept, queries, what + ", compact(false)");
+
+    // the entries get the ids of the rebuilt database
+    ids = db.compact(true, s % 2 ? NULL : &pool);
+
+    map = (ids.size() == (size_t)NENTRIES);
+    EntryId next = 0;
+    for(EntryId id = 0; map && id < ids.size(); ++id)
+      map = (ids[id] == (removed(id) ? Database::REMOVED_ENTRY : next++));
+    check(map, what + ": ids returned by compact(true)");
+    check(db.size() == rebuilt.size() && db.removedEntries() == 0,
+      what + ": size after compact(true)");
+
+    vector<EntryId> same_ids(kept.size());
+    for(EntryId id = 0; id < same_ids.size(); ++id) same_ids[id] = id;
+    checkQueries(db, rebuilt, same_ids, queries, what + ", compact(true)");
+
+    // and the new entries follow them
+    for(int i = NENTRIES; i < NENTRIES + NADDED; ++i)
+    {
+      db.add(entries[i]);
+      rebuilt.add(entries[i]);
+      same_ids.push_back(same_ids.size());
+    }
+    checkQueries(db, rebuilt, same_ids, queries,
+      what + ", added after compact(true)");
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+void checkQueries(
+  const TemplatedDatabase<Descriptor, FBinary32, TWeight> &db,
+  const TemplatedDatabase<Descriptor, FBinary32, TWeight> &rebuilt,
+  const vector<EntryId> &ids, const vector<FlatBowVector> &queries,
+  const string &what)
+{
+  bool same_features = (ids.size() == rebuilt.size());
+  for(EntryId id = 0; same_features && id < rebuilt.size(); ++id)
+  {
+    same_features = !db.isRemoved(ids[id]) &&
+      db.retrieveFlatFeatures(ids[id]) == rebuilt.retrieveFlatFeatures(id);
+  }
+  check(same_features, what + ": direct index");
+
+  const int max_results[] = { 0, 1, 10 };
+
+  for(int k = 0; k < 3; ++k)
+  {
+    bool ok = true;
+    for(size_t i = 0; i < queries.size(); ++i)
+    {
+      QueryResults expected, ret;
+      rebuilt.query(queries[i], expected, max_results[k]);
+      db.query(queries[i], ret, max_results[k]);
+
+      for(size_t r = 0; r < expected.size(); ++r)
+        expected[r].Id = ids[expected[r].Id];
+      ok = ok && sameResults(expected, ret, 1e-12, true);
+    }
+
+    check(ok, what + ": results with max_results " +
+      to_string(max_results[k]));
+  }
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,278 @@
+/**
+ * @file dbow2_concurrency_test.cpp
+ * @brief Tests that a database can be queried by several threads while
+ * another one adds and removes entries.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <thread>
+#include <atomic>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 3000; ///< entries of the database
+const int NSEALED = 500; ///< entries sealed before the readers start
+const int NBATCH = 50; ///< entries of each addBatch of the writer
+const int NREADERS = 3; ///< threads that query the database
+const int NQUERIES = 200; ///< queries of each reader, at least
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Returns whether the writer removes an entry, right after adding
+/// the entry 6 ids after it.
+/// \param id Entry id.
+inline bool removed(EntryId id) { return id % 10 == 3; }
+
+/// \brief State shared by the writer and the readers.
+struct Shared
+{
+  /// Database written and queried
+  Binary32Database *db;
+  /// Query vectors
+  vector<FlatBowVector> queries;
+  /// Score of each entry for each query, or NAN if it is not returned
+  vector<vector<double> > scores;
+  /// Direct index of each entry
+  vector<FlatFeatureVector> features;
+  /// Entries removed by the writer
+  atomic<unsigned int> nremoved;
+  /// Whether the writer has finished
+  atomic<bool> done;
+};
+
+/// \brief Adds and removes the entries.
+/// \param shared State.
+/// \param entries Features of the entries.
+void writer(Shared &shared, const vector<vector<Descriptor> > &entries);
+
+/// \brief Queries the database while the writer works.
+/// \param shared State.
+/// \param seed Seed of the queries chosen.
+void reader(Shared &shared, unsigned int seed);
+
+/// \brief Checks some results of a query given by a reader.
+/// \param shared State.
+/// \param q Index of the query.
+/// \param ret Results.
+/// \param exhaustive Whether all the results were requested.
+/// \param size Size of the database before querying.
+/// \param nremoved Entries removed before querying.
+/// \param what Description of the query.
+void checkResults(const Shared &shared, size_t q, const QueryResults &ret,
+  bool exhaustive, unsigned int size, unsigned int nremoved,
+  const string &what);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, entries;
+  createFeatures(features);
+  createEntries(features, NENTRIES, entries);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  try
+  {
+    // results of the complete database, built by a single thread
+    Binary32Database reference(voc, true, 1);
+    for(size_t i = 0; i < entries.size(); ++i) reference.add(entries[i]);
+
+    Shared shared;
+    shared.queries.resize(features.size());
+    shared.scores.resize(features.size());
+    for(size_t q = 0; q < features.size(); ++q)
+    {
+      voc.transform(features[q], shared.queries[q]);
+
+      QueryResults all;
+      reference.query(shared.queries[q], all, 0);
+      shared.scores[q].assign(NENTRIES, NAN);
+      for(size_t r = 0; r < all.size(); ++r)
+        shared.scores[q][all[r].Id] = all[r].Score;
+    }
+    for(EntryId id = 0; id < reference.size(); ++id)
+      shared.features.push_back(reference.retrieveFlatFeatures(id));
+
+    for(EntryId id = 0; id < reference.size(); ++id)
+      if(removed(id)) reference.remove(id);
+
+    // the first entries are sealed before the readers start
+    cout << "Testing a writer and " << NREADERS << " readers..." << endl;
+
+    Binary32Database db(voc, true, 1);
+    for(int i = 0; i < NSEALED; ++i) db.add(entries[i]);
+    db.seal();
+
+    shared.db = &db;
+    shared.nremoved = 0;
+    shared.done = false;
+
+    vector<thread> readers;
+    for(int t = 0; t < NREADERS; ++t)
+      readers.push_back(thread(reader, ref(shared), (unsigned int)t + 1));
+    thread w(writer, ref(shared), cref(entries));
+
+    w.join();
+    for(int t = 0; t < NREADERS; ++t) readers[t].join();
+
+    // in the end, the database is the reference one
+    check(db.size() == reference.size(), "final size");
+    bool same = true;
+    for(size_t q = 0; q < shared.queries.size(); ++q)
+    {
+      QueryResults a, b;
+      db.query(shared.queries[q], a, 0);
+      reference.query(shared.queries[q], b, 0);
+      same = same && a.size() == b.size();
+      for(size_t r = 0; same && r < a.size(); ++r)
+        same = a[r].Id == b[r].Id && fabs(a[r].Score - b[r].Score) < 1e-12;
+    }
+    check(same, "final results");
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+void writer(Shared &shared, const vector<vector<Descriptor> > &entries)
+{
+  Binary32Database &db = *shared.db;
+
+  // one by one, and then in batches
+  for(size_t i = NSEALED; i < entries.size(); )
+  {
+    const size_t n = (i < entries.size() / 2 ? 1 :
+      min<size_t>(NBATCH, entries.size() - i));
+    if(n == 1) db.add(entries[i]);
+    else db.addBatch(vector<vector<Descriptor> >(entries.begin() + i,
+      entries.begin() + i + n));
+
+    // the entries are removed in order
+    for(i += n; ; )
+    {
+      const EntryId id = 10 * shared.nremoved + 3;
+      if(id + 6 >= i) break;
+      db.remove(id);
+      ++shared.nremoved;
+    }
+  }
+
+  for(EntryId id = 10 * shared.nremoved + 3; id < db.size(); id += 10)
+  {
+    db.remove(id);
+    ++shared.nremoved;
+  }
+
+  shared.done = true;
+}
+
+// ----------------------------------------------------------------------------
+
+void reader(Shared &shared, unsigned int seed)
+{
+  const Binary32Database &db = *shared.db;
+
+  QueryOptions early;
+  early.early_termination = true;
+
+  for(int n = 0; n < NQUERIES || !shared.done; ++n)
+  {
+    seed = seed * 1103515245u + 12345u;
+    const size_t q = (seed >> 16) % shared.queries.size();
+    const FlatBowVector &vec = shared.queries[q];
+
+    // the entries complete and removed before the query
+    const unsigned int nremoved = shared.nremoved;
+    const unsigned int size = db.size();
+
+    QueryResults ret;
+    switch(n % 4)
+    {
+      case 0:
+        db.query(vec, ret, 0);
+        checkResults(shared, q, ret, true, size, nremoved, "query");
+        break;
+
+      case 1:
+        db.query(vec, ret, early, 5);
+        checkResults(shared, q, ret, false, size, nremoved,
+          "query with early termination");
+        break;
+
+      case 2:
+      {
+        vector<QueryResults> batch;
+        db.queryBatch(vector<FlatBowVector>(3, vec), batch, 0);
+        for(size_t b = 0; b < batch.size(); ++b)
+          checkResults(shared, q, batch[b], true, size, nremoved,
+            "queryBatch");
+        break;
+      }
+
+      case 3:
+      {
+        // the features of the complete entries do not change
+        const EntryId id = (seed >> 4) % size;
+        check(db.retrieveFlatFeatures(id) == shared.features[id],
+          "retrieveFlatFeatures of entry " + to_string(id));
+        break;
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void checkResults(const Shared &shared, size_t q, const QueryResults &ret,
+  bool exhaustive, unsigned int size, unsigned int nremoved,
+  const string &what)
+{
+  const vector<double> &scores = shared.scores[q];
+
+  // the entries returned exist, with their scores, and in order
+  bool ok = true;
+  vector<bool> returned(NENTRIES, false);
+  for(size_t r = 0; ok && r < ret.size(); ++r)
+  {
+    const EntryId id = ret[r].Id;
+    ok = id < (EntryId)NENTRIES && !returned[id] &&
+      !(removed(id) && id / 10 < nremoved) &&
+      fabs(ret[r].Score - scores[id]) < 1e-12 &&
+      (r == 0 || ret[r].Score <= ret[r-1].Score);
+    if(ok) returned[id] = true;
+  }
+
+  // all the entries complete before the query are returned, unless they
+  // were removed while it ran
+  const unsigned int nremoved_after = shared.nremoved;
+  for(EntryId id = 0; ok && exhaustive && id < size; ++id)
+  {
+    if(!std::isnan(scores[id]) && !returned[id])
+      ok = removed(id) && id / 10 < nremoved_after;
+  }
+
+  check(ok, what + " with " + to_string(size) + " entries");
+}
+
+// ----------------------------------------------------------------------------
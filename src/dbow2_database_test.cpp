@@ -0,0 +1,587 @@
+/**
+ * @file dbow2_database_test.cpp
+ * @brief Tests the storage of the inverted index, the accumulators of the
+ * scores, that the queries give the results of the original ones and that
+ * databases sharing a vocabulary give the results of those with a copy.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <map>
+#include <cmath>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 300; ///< entries of the databases
+const int NPOSTINGS = 5000; ///< postings of the lists
+const int NADDS = 3000; ///< values added to the accumulators
+
+/// \brief Values added to an entry of an accumulator, as the original
+/// queries kept them in a std::map.
+struct Accumulated
+{
+  double score, a, b;
+  unsigned int count;
+};
+
+/// \brief Entries of an accumulator, and the order of their first touch.
+struct Reference
+{
+  std::map<EntryId, Accumulated> entries;
+  vector<EntryId> order;
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Tests that posting lists keep the postings appended in order,
+/// as the original lists of pairs.
+/// \param name Name of the weights.
+template<class TWeight>
+void testPostingLists(const string &name);
+
+/// \brief Returns whether a posting list has the given postings.
+/// \param l List.
+/// \param postings Entry ids and weights, in order.
+template<class TWeight>
+bool samePostings(const PostingList<TWeight> &l,
+  const vector<pair<EntryId, TWeight> > &postings);
+
+/// \brief Tests that the accumulators keep the values of a std::map,
+/// reusing them after clear, erase and reset.
+void testAccumulators();
+
+/// \brief Adds a pseudo-random value to an accumulator and its reference.
+/// \param acc ScoreAccumulator or BlockScoreAccumulator::Column.
+/// \param ref Reference.
+/// \param first First entry id.
+/// \param n Number of entries.
+/// \param seed Seed, updated.
+template<class TAccumulator>
+void addRandom(TAccumulator &acc, Reference &ref, EntryId first,
+  unsigned int n, unsigned int &seed);
+
+/// \brief Drops the entries of an accumulator and its reference.
+/// \param acc ScoreAccumulator or BlockScoreAccumulator::Column.
+/// \param ref Reference.
+/// \param k The entries whose id is a multiple of k are dropped.
+template<class TAccumulator>
+void eraseMultiples(TAccumulator &acc, Reference &ref, EntryId k);
+
+/// \brief Returns whether an accumulator has the entries of a reference,
+/// in the same order and with exactly the same values.
+/// \param acc ScoreAccumulator or BlockScoreAccumulator::Column.
+/// \param ref Reference.
+template<class TAccumulator>
+bool sameEntries(const TAccumulator &acc, const Reference &ref);
+
+/// \brief Tests that the queries give the results of the original ones,
+/// with every scoring.
+/// \param voc Vocabulary.
+/// \param features Features of the query images.
+/// \param entries Features of the entries.
+void testQueries(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries);
+
+/// \brief Tests that databases sharing a vocabulary give the results of
+/// those with a copy of it, and do not change it.
+/// \param voc Vocabulary.
+/// \param features Features of the query images.
+/// \param entries Features of the entries.
+void testSharing(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries);
+
+/// \brief Returns whether two databases have the same direct index and give
+/// exactly the same results.
+/// \param a Database.
+/// \param b Database.
+/// \param features Features of the query images.
+bool sameDatabase(const Binary32Database &a, const Binary32Database &b,
+  const vector<vector<Descriptor> > &features);
+
+/// \brief Queries the vectors of some entries as the original database did,
+/// visiting the words of the query in each entry.
+/// \param voc Vocabulary.
+/// \param query Query vector.
+/// \param vecs Vectors of the entries.
+/// \param max_results Maximum number of results, or 0 for all.
+/// @param[out] ret Results.
+void referenceQuery(const Binary32Vocabulary &voc, const BowVector &query,
+  const vector<BowVector> &vecs, int max_results, QueryResults &ret);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, entries;
+  createFeatures(features);
+  createEntries(features, NENTRIES, entries, true, 3);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  try
+  {
+    testPostingLists<WordValue>("double");
+    testPostingLists<float>("float");
+    testPostingLists<FixedWordValue>("fixed-point");
+    testAccumulators();
+    testQueries(voc, features, entries);
+    testSharing(voc, features, entries);
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+void testPostingLists(const string &name)
+{
+  cout << "Testing the posting lists with " << name << " weights..." << endl;
+
+  // ids with gaps, and weights in no order
+  vector<pair<EntryId, TWeight> > postings;
+  unsigned int seed = 777;
+  EntryId id = 0;
+  for(int i = 0; i < NPOSTINGS; ++i)
+  {
+    seed = seed * 1103515245u + 12345u;
+    id += 1 + (seed >> 16) % 5;
+    postings.push_back(make_pair(id, TWeight(((seed >> 8) % 1000) / 1000.)));
+  }
+
+  PostingList<TWeight> l;
+  TWeight max = 0;
+  bool prefixes = true;
+  for(size_t i = 0; i < postings.size(); ++i)
+  {
+    l.push_back(postings[i].first, postings[i].second);
+    max = std::max(max, postings[i].second);
+
+    if(i % 97 == 0)
+    {
+      prefixes = prefixes && samePostings(l,
+        vector<pair<EntryId, TWeight> >(postings.begin(),
+          postings.begin() + i + 1)) && l.maxWeight() == max;
+    }
+  }
+  check(prefixes, name + ": postings while appending");
+  check(samePostings(l, postings) && l.maxWeight() == max,
+    name + ": postings");
+
+  // full chunks grow up to the maximum size, the last one may not be full
+  bool chunks = true;
+  unsigned int last = 0;
+  for(const typename PostingList<TWeight>::Chunk *c = l.first(); c;
+    c = c->next())
+  {
+    chunks = chunks && c->size() <= PostingList<TWeight>::MAX_CHUNK &&
+      (!c->next() || c->size() >= last);
+    last = c->size();
+  }
+  check(chunks, name + ": sizes of the chunks");
+
+  bool contains = true;
+  for(size_t i = 0; i < postings.size(); ++i)
+  {
+    contains = contains && l.contains(postings[i].first) &&
+      !l.contains(postings[i].first + 1 == (i + 1 < postings.size() ?
+        postings[i+1].first : 0) ? 0 : postings[i].first + 1);
+  }
+  check(contains, name + ": contains");
+
+  PostingList<TWeight> copy(l), other;
+  check(samePostings(copy, postings) && copy.maxWeight() == max,
+    name + ": copy");
+
+  other.reserve(10);
+  other.push_back(1, TWeight(0.5));
+  other.swap(copy);
+  check(samePostings(other, postings) && copy.size() == 1 &&
+    copy.maxWeight() == TWeight(0.5), name + ": swap");
+
+  other.clear();
+  check(other.empty() && other.first() == NULL && other.maxWeight() == 0,
+    name + ": clear");
+
+  // a list reserved in advance takes a single chunk
+  PostingList<TWeight> reserved;
+  reserved.reserve(postings.size());
+  for(size_t i = 0; i < postings.size(); ++i)
+    reserved.push_back(postings[i].first, postings[i].second);
+  check(samePostings(reserved, postings) && reserved.first()->next() == NULL,
+    name + ": reserved list");
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+bool samePostings(const PostingList<TWeight> &l,
+  const vector<pair<EntryId, TWeight> > &postings)
+{
+  if(l.size() != postings.size()) return false;
+
+  size_t i = 0;
+  for(typename PostingList<TWeight>::Reader r(l); r.next(); )
+  {
+    const EntryId *ids = r.ids();
+    const TWeight *weights = r.weights();
+    for(unsigned int k = 0; k < r.size(); ++k, ++i)
+    {
+      if(i >= postings.size() || ids[k] != postings[i].first ||
+        !(weights[k] == postings[i].second)) return false;
+    }
+  }
+  return i == postings.size();
+}
+
+// ----------------------------------------------------------------------------
+
+void testAccumulators()
+{
+  cout << "Testing the accumulators..." << endl;
+
+  // larger and smaller databases, reusing the arrays
+  const unsigned int sizes[] = { 100, 1000, 50, 2000 };
+  unsigned int seed = 4321;
+
+  ScoreAccumulator acc;
+  for(int r = 0; r < 4; ++r)
+  {
+    const string what = "accumulator of " + to_string(sizes[r]) + " entries";
+    acc.reset(sizes[r], true);
+    check(acc.size() == 0, what + ": reset");
+
+    Reference ref;
+    for(int i = 0; i < NADDS; ++i) addRandom(acc, ref, 0, sizes[r], seed);
+    check(sameEntries(acc, ref), what + ": added values");
+
+    eraseMultiples(acc, ref, 3);
+    check(sameEntries(acc, ref), what + ": erased entries");
+    for(int i = 0; i < NADDS / 10; ++i) addRandom(acc, ref, 0, sizes[r], seed);
+    check(sameEntries(acc, ref), what + ": added after erasing");
+
+    acc.clear();
+    ref = Reference();
+    check(acc.size() == 0, what + ": clear");
+    for(int i = 0; i < NADDS / 10; ++i) addRandom(acc, ref, 0, sizes[r], seed);
+    check(sameEntries(acc, ref), what + ": added after clearing");
+  }
+
+  // the columns of a tile do not touch the values of the others
+  const EntryId first = 1000;
+  const unsigned int n = 500;
+  BlockScoreAccumulator block;
+  for(int r = 0; r < 2; ++r)
+  {
+    const string what = "block accumulator, round " + to_string(r);
+    block.reset(first + r * n, n, true);
+
+    Reference refs[BlockScoreAccumulator::QUERIES];
+    BlockScoreAccumulator::Column columns[BlockScoreAccumulator::QUERIES];
+    for(unsigned int q = 0; q < BlockScoreAccumulator::QUERIES; ++q)
+      columns[q] = block.column(q);
+
+    for(int i = 0; i < NADDS; ++i)
+    {
+      const unsigned int q = i % BlockScoreAccumulator::QUERIES;
+      addRandom(columns[q], refs[q], first + r * n, n, seed);
+    }
+    bool same = true;
+    for(unsigned int q = 0; q < BlockScoreAccumulator::QUERIES; ++q)
+      same = same && sameEntries(columns[q], refs[q]);
+    check(same, what + ": added values");
+
+    eraseMultiples(columns[1], refs[1], 2);
+    same = true;
+    for(unsigned int q = 0; q < BlockScoreAccumulator::QUERIES; ++q)
+      same = same && sameEntries(columns[q], refs[q]);
+    check(same, what + ": erased entries");
+
+    block.clear();
+    same = true;
+    for(unsigned int q = 0; q < BlockScoreAccumulator::QUERIES; ++q)
+      same = same && columns[q].size() == 0;
+    check(same, what + ": clear");
+  }
+
+  // a nested query gets an accumulator of its own
+  {
+    LocalScoreAccumulator outer(100);
+    outer->add(5, 1.);
+    {
+      LocalScoreAccumulator inner(100);
+      inner->add(5, 2.);
+      check(&*inner != &*outer && outer->score(5) == 1. &&
+        inner->score(5) == 2., "nested accumulators");
+      check(!LocalScoreAccumulator::releaseThreadAccumulator(),
+        "release of an accumulator in use");
+    }
+    check(outer->size() == 1 && outer->count(5) == 1,
+      "accumulator after a nested one");
+  }
+  check(LocalScoreAccumulator::releaseThreadAccumulator(),
+    "release of the accumulator of the thread");
+  {
+    LocalScoreAccumulator acc(10);
+    check(acc->size() == 0, "accumulator of the thread after releasing it");
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TAccumulator>
+void addRandom(TAccumulator &acc, Reference &ref, EntryId first,
+  unsigned int n, unsigned int &seed)
+{
+  seed = seed * 1103515245u + 12345u;
+  const EntryId id = first + (seed >> 16) % n;
+  const double value = ((seed >> 4) % 1000) / 1000. - 0.5;
+  const double a = value / 3, b = value * 7;
+
+  std::map<EntryId, Accumulated>::iterator it = ref.entries.find(id);
+  if(it == ref.entries.end())
+  {
+    Accumulated v = { value, a, b, 1 };
+    ref.entries[id] = v;
+    ref.order.push_back(id);
+  }
+  else
+  {
+    it->second.score += value;
+    it->second.a += a;
+    it->second.b += b;
+    ++it->second.count;
+  }
+
+  acc.add(id, value, a, b);
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TAccumulator>
+void eraseMultiples(TAccumulator &acc, Reference &ref, EntryId k)
+{
+  vector<EntryId> order;
+  for(size_t i = 0; i < ref.order.size(); ++i)
+  {
+    if(ref.order[i] % k == 0) ref.entries.erase(ref.order[i]);
+    else order.push_back(ref.order[i]);
+  }
+  ref.order.swap(order);
+
+  acc.erase([k](EntryId id) { return id % k == 0; });
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TAccumulator>
+bool sameEntries(const TAccumulator &acc, const Reference &ref)
+{
+  if(acc.size() != ref.order.size()) return false;
+
+  for(size_t i = 0; i < acc.size(); ++i)
+  {
+    const EntryId id = acc.entry(i);
+    if(id != ref.order[i]) return false;
+
+    const Accumulated &v = ref.entries.find(id)->second;
+    if(acc.score(id) != v.score || acc.count(id) != v.count ||
+      acc.sumA(id) != v.a || acc.sumB(id) != v.b) return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void testQueries(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries)
+{
+  for(int s = 0; s < NSCORINGS; ++s)
+  {
+    Binary32Vocabulary v(voc);
+    v.setScoringType(SCORINGS[s]);
+
+    const string what = "scoring " + to_string(SCORINGS[s]);
+    cout << "Testing the queries with " << what << "..." << endl;
+
+    Binary32Database db(v, false);
+    vector<BowVector> vecs(entries.size());
+    for(size_t i = 0; i < entries.size(); ++i)
+    {
+      v.transform(entries[i], vecs[i]);
+      db.add(vecs[i]);
+    }
+
+    // all, a few, and more than the entries touched, selected in part
+    const int max_results[] = { 0, 1, 10, 100, 1000 };
+    for(int k = 0; k < 5; ++k)
+    {
+      bool ok = true;
+      for(size_t i = 0; i < features.size(); ++i)
+      {
+        BowVector q;
+        v.transform(features[i], q);
+
+        QueryResults expected, ret;
+        referenceQuery(v, q, vecs, max_results[k], expected);
+        db.query(q, ret, max_results[k]);
+        ok = ok && sameResults(expected, ret, 1e-9, true);
+      }
+      check(ok, what + ": results with max_results " +
+        to_string(max_results[k]));
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void referenceQuery(const Binary32Vocabulary &voc, const BowVector &query,
+  const vector<BowVector> &vecs, int max_results, QueryResults &ret)
+{
+  const ScoringType scoring = voc.getScoringType();
+
+  ret.clear();
+  for(EntryId id = 0; id < vecs.size(); ++id)
+  {
+    // partial score as the original queries accumulated it
+    double value = 0;
+    int nwords = 0;
+    for(BowVector::const_iterator it = query.begin(); it != query.end(); ++it)
+    {
+      const double vi = it->second;
+      BowVector::const_iterator wit = vecs[id].find(it->first);
+      if(wit == vecs[id].end())
+      {
+        if(scoring == KL && vi != 0)
+          value += vi * (log(vi) - GeneralScoring::LOG_EPS);
+        continue;
+      }
+
+      const double wi = wit->second;
+      ++nwords;
+
+      switch(scoring)
+      {
+        case L1_NORM: value += fabs(vi - wi) - fabs(vi) - fabs(wi); break;
+        case L2_NORM: value -= vi * wi; break;
+        case CHI_SQUARE: if(vi + wi != 0) value -= vi * wi / (vi + wi); break;
+        case KL: if(vi != 0 && wi != 0) value += vi * log(vi / wi); break;
+        case BHATTACHARYYA: value += sqrt(vi * wi); break;
+        case DOT_PRODUCT:
+          value += (voc.getWeightingType() == BINARY ? 1 : vi * wi);
+          break;
+      }
+    }
+
+    if(nwords == 0 ||
+      ((scoring == CHI_SQUARE || scoring == BHATTACHARYYA) &&
+       nwords < MIN_COMMON_WORDS)) continue;
+
+    // scaled to [0 worst .. 1 best], but for KL, the lower the better
+    double score = value;
+    if(scoring == L1_NORM) score = -value / 2.;
+    else if(scoring == L2_NORM)
+      score = (value <= -1 ? 1 : 1 - sqrt(1 + value));
+    else if(scoring == CHI_SQUARE) score = -2. * value;
+
+    ret.push_back(Result(id, score));
+    ret.back().nWords = nwords;
+  }
+
+  sort(ret.begin(), ret.end(), [&](const Result &a, const Result &b)
+    {
+      return (scoring == KL ? a.Score < b.Score : a.Score > b.Score);
+    });
+  if(max_results > 0 && ret.size() > (size_t)max_results)
+    ret.resize(max_results);
+}
+
+// ----------------------------------------------------------------------------
+
+void testSharing(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries)
+{
+  cout << "Testing the databases sharing a vocabulary..." << endl;
+
+  std::shared_ptr<Binary32Vocabulary> shared(new Binary32Vocabulary(voc));
+  Binary32Database copied(voc, true, 1), a(shared, true, 1), b(shared, true, 1);
+  for(size_t i = 0; i < entries.size(); ++i)
+  {
+    copied.add(entries[i]);
+    a.add(entries[i]);
+    if(i % 2 == 0) b.add(entries[i]);
+  }
+
+  check(a.getSharedVocabulary().get() == shared.get() &&
+    b.getSharedVocabulary().get() == shared.get() &&
+    copied.getSharedVocabulary().get() != &voc, "vocabulary shared");
+  check(sameDatabase(copied, a, features), "results with a shared vocabulary");
+
+  // copies share it too, and the databases keep it alive
+  Binary32Database c(a);
+  check(c.getSharedVocabulary().get() == shared.get(), "copy shares it");
+  shared.reset();
+  check(sameDatabase(copied, c, features) && sameDatabase(copied, a, features),
+    "results after the vocabulary is released");
+
+  // loading a database gives it a vocabulary of its own
+  a.saveBinary("database_test_shared.dbow2");
+  b.loadBinary("database_test_shared.dbow2");
+  check(b.getSharedVocabulary() != c.getSharedVocabulary() &&
+    sameDatabase(copied, b, features) && sameDatabase(copied, c, features),
+    "results after loading a database");
+
+  // a vocabulary mapped from a binary file
+  voc.saveBinary("database_test_shared_voc.dbow2");
+  std::shared_ptr<Binary32Vocabulary> mapped(new Binary32Vocabulary);
+  mapped->loadBinary("database_test_shared_voc.dbow2");
+  Binary32Database d(mapped, true, 1);
+  for(size_t i = 0; i < entries.size(); ++i) d.add(entries[i]);
+  check(sameDatabase(copied, d, features), "results with a mapped vocabulary");
+}
+
+// ----------------------------------------------------------------------------
+
+bool sameDatabase(const Binary32Database &a, const Binary32Database &b,
+  const vector<vector<Descriptor> > &features)
+{
+  if(a.size() != b.size()) return false;
+
+  for(EntryId id = 0; id < a.size(); ++id)
+    if(!(a.retrieveFlatFeatures(id) == b.retrieveFlatFeatures(id)))
+      return false;
+
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    QueryResults ra, rb;
+    a.query(features[i], ra, 10);
+    b.query(features[i], rb, 10);
+    if(!identicalResults(ra, rb)) return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,131 @@
+/**
+ * @file dbow2_early_test.cpp
+ * @brief Tests that the queries with early termination return the best
+ * results of the exhaustive ones.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 3000; ///< entries of the databases
+const double TOLERANCE = 1e-7; ///< difference allowed between scores
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Tests a scoring.
+/// \param voc Vocabulary.
+/// \param features Features of the query images.
+/// \param entries Features of the entries.
+void testScoring(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, entries;
+  createFeatures(features);
+  createEntries(features, NENTRIES, entries, true);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  try
+  {
+    for(int s = 0; s < NSCORINGS; ++s)
+    {
+      Binary32Vocabulary v(voc);
+      v.setScoringType(SCORINGS[s]);
+      testScoring(v, features, entries);
+    }
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+void testScoring(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries)
+{
+  const string name = "scoring " + to_string(voc.getScoringType());
+  cout << "Testing the early termination with the " << name << "..." << endl;
+
+  Binary32Database db(voc, false);
+  for(size_t i = 0; i < entries.size(); ++i) db.add(entries[i]);
+
+  // every other entry of a range
+  vector<bool> mask(NENTRIES, false);
+  for(size_t i = 0; i < mask.size(); i += 2) mask[i] = true;
+
+  const int max_results[] = { 1, 5, 20 };
+
+  for(int sealed = 0; sealed < 2; ++sealed)
+  {
+    if(sealed) db.seal();
+
+    for(int f = 0; f < 3; ++f)
+    {
+      QueryOptions options;
+      if(f == 1) options.filter = QueryFilter(500, 2500);
+      else if(f == 2) options.filter = QueryFilter(1000, 2000).setMask(&mask);
+
+      for(int sort = 0; sort < 2; ++sort)
+      {
+        options.sort_words = (sort == 1);
+
+        for(int k = 0; k < 3; ++k)
+        {
+          bool ok = true;
+          for(size_t i = 0; i < features.size(); ++i)
+          {
+            BowVector v;
+            voc.transform(features[i], v);
+
+            // the best accepted entries of the exhaustive query
+            QueryResults all, expected;
+            db.query(v, all, 0);
+            for(size_t r = 0; r < all.size(); ++r)
+            {
+              if((int)expected.size() == max_results[k]) break;
+              if(options.filter.accepts(all[r].Id))
+                expected.push_back(all[r]);
+            }
+
+            QueryResults ret;
+            options.early_termination = true;
+            db.query(v, ret, options, max_results[k]);
+            ok = ok && sameResults(expected, ret, TOLERANCE);
+          }
+
+          check(ok, name + ": early termination with max_results " +
+            to_string(max_results[k]) + (f == 1 ? ", a range" : "") +
+            (f == 2 ? ", a range and a mask" : "") +
+            (sort ? ", sorted words" : "") + (sealed ? ", sealed" : ""));
+        }
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
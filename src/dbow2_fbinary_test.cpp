@@ -0,0 +1,214 @@
+/**
+ * @file dbow2_fbinary_test.cpp
+ * @brief Tests that FBinary<32> gives the distances, means, strings and
+ * vocabulary trees of FORB.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const unsigned int SEED = 1234; ///< seed of the trees created
+
+/// \brief ORB descriptor.
+typedef FORB::TDescriptor Orb;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Converts the descriptors of some images into ORB descriptors,
+/// with the same bytes.
+/// \param features Features of the images.
+/// @param[out] orb ORB features of each image.
+void toOrb(const vector<vector<Descriptor> > &features,
+  vector<vector<Orb> > &orb);
+
+/// \brief Returns whether a descriptor has the bytes of an ORB one.
+/// \param a Descriptor.
+/// \param b ORB descriptor.
+bool sameBytes(const Descriptor &a, const Orb &b);
+
+/// \brief Tests the functions of FBinary32 against those of FORB.
+/// \param features Features of the images.
+/// \param orb The same features as ORB descriptors.
+void testFunctions(const vector<vector<Descriptor> > &features,
+  const vector<vector<Orb> > &orb);
+
+/// \brief Tests that the vocabularies of FBinary32 and FORB are the same.
+/// \param features Features of the images.
+/// \param orb The same features as ORB descriptors.
+/// \param k Branching factor.
+/// \param L Depth levels.
+void testVocabularies(const vector<vector<Descriptor> > &features,
+  const vector<vector<Orb> > &orb, int k, int L);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features;
+  createFeatures(features);
+  vector<vector<Orb> > orb;
+  toOrb(features, orb);
+
+  try
+  {
+    testFunctions(features, orb);
+    testVocabularies(features, orb, 5, 3);
+    testVocabularies(features, orb, 9, 2);
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+void toOrb(const vector<vector<Descriptor> > &features,
+  vector<vector<Orb> > &orb)
+{
+  orb.resize(features.size());
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    cv::Mat mat;
+    FBinary32::toMat8U(features[i], mat);
+
+    orb[i].resize(features[i].size());
+    for(size_t j = 0; j < features[i].size(); ++j)
+      orb[i][j] = mat.row((int)j).clone();
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+bool sameBytes(const Descriptor &a, const Orb &b)
+{
+  return b.rows == 1 && b.cols == FORB::L &&
+    memcmp(FBinary32::bytes(a), b.ptr<unsigned char>(), FORB::L) == 0;
+}
+
+// ----------------------------------------------------------------------------
+
+void testFunctions(const vector<vector<Descriptor> > &features,
+  const vector<vector<Orb> > &orb)
+{
+  cout << "Testing the functions of FBinary32..." << endl;
+
+  const vector<Descriptor> &a = features[0];
+  const vector<Orb> &oa = orb[0];
+
+  bool bytes = true, distances = true, strings = true;
+  for(size_t i = 0; i < a.size(); ++i)
+  {
+    bytes = bytes && sameBytes(a[i], oa[i]);
+
+    for(size_t j = 0; j < features[1].size(); ++j)
+      distances = distances && FBinary32::distance(a[i], features[1][j]) ==
+        FORB::distance(oa[i], orb[1][j]);
+
+    // the text of each class is read by the other one
+    Descriptor d;
+    Orb o;
+    FBinary32::fromString(d, FORB::toString(oa[i]));
+    FORB::fromString(o, FBinary32::toString(a[i]));
+    strings = strings && FBinary32::toString(a[i]) == FORB::toString(oa[i]) &&
+      d == a[i] && sameBytes(a[i], o);
+  }
+  check(bytes, "the bytes of the OpenCV rows");
+  check(distances, "the distances of FORB");
+  check(strings, "the strings of FORB");
+
+  // means of one descriptor, of an even and odd number of them, of all
+  bool means = true;
+  const size_t sizes[] = { 1, 2, 3, 4, 7, a.size() };
+  for(int s = 0; s < 6; ++s)
+  {
+    vector<FBinary32::pDescriptor> pa;
+    vector<FORB::pDescriptor> po;
+    for(size_t i = 0; i < sizes[s]; ++i)
+    {
+      pa.push_back(&a[(i * 7) % a.size()]);
+      po.push_back(&oa[(i * 7) % a.size()]);
+    }
+
+    Descriptor mean;
+    Orb omean;
+    FBinary32::meanValue(pa, mean);
+    FORB::meanValue(po, omean);
+    means = means && sameBytes(mean, omean);
+  }
+  check(means, "the means of FORB");
+
+  // matrices of floats, one per bit, and of bytes
+  cv::Mat m32, o32, m8;
+  FBinary32::toMat32F(a, m32);
+  FORB::toMat32F(oa, o32);
+  bool floats = (m32.rows == o32.rows && m32.cols == o32.cols);
+  for(int r = 0; floats && r < m32.rows; ++r)
+    floats = memcmp(m32.ptr(r), o32.ptr(r), m32.cols * sizeof(float)) == 0;
+  check(floats, "the float matrices of FORB");
+
+  vector<Descriptor> back;
+  FBinary32::toMat8U(a, m8);
+  FBinary32::fromMat8U(m8, back);
+  check(back == a, "the byte matrices");
+}
+
+// ----------------------------------------------------------------------------
+
+void testVocabularies(const vector<vector<Descriptor> > &features,
+  const vector<vector<Orb> > &orb, int k, int L)
+{
+  const string what = "k = " + to_string(k) + ", L = " + to_string(L);
+  cout << "Testing the vocabularies with " << what << "..." << endl;
+
+  Binary32Vocabulary voc(k, L, TF_IDF, L1_NORM);
+  srand(SEED);
+  voc.create(features);
+
+  OrbVocabulary ovoc(k, L, TF_IDF, L1_NORM);
+  srand(SEED);
+  ovoc.create(orb);
+
+  // the same words, at the same place of the tree
+  bool words = (voc.size() == ovoc.size() && voc.size() > 0);
+  for(WordId w = 0; words && w < voc.size(); ++w)
+  {
+    words = sameBytes(voc.getWord(w), ovoc.getWord(w)) &&
+      voc.getWordWeight(w) == ovoc.getWordWeight(w);
+    for(int up = 1; words && up <= L; ++up)
+      words = voc.getParentNode(w, up) == ovoc.getParentNode(w, up);
+  }
+  check(words, what + ": the words of FORB");
+
+  // and the same vectors
+  bool vectors = true;
+  for(size_t i = 0; vectors && i < features.size(); ++i)
+  {
+    BowVector v, ov;
+    FeatureVector fv, ofv;
+    voc.transform(features[i], v, fv, 1);
+    ovoc.transform(orb[i], ov, ofv, 1);
+    vectors = (v == ov && fv == ofv);
+  }
+  check(vectors, what + ": the vectors of FORB");
+}
+
+// ----------------------------------------------------------------------------
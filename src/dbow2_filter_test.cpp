@@ -0,0 +1,247 @@
+/**
+ * @file dbow2_filter_test.cpp
+ * @brief Tests that the queries with a filter return the best results of
+ * the exhaustive ones that the filter accepts.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 3000; ///< entries of the databases
+const int NMASK = 2600; ///< entries of the mask, fewer than the entries
+const double TOLERANCE = 1e-7; ///< difference allowed between scores
+
+/// \brief Filter and the entries it must accept.
+struct FilterCase
+{
+  /// Description
+  string name;
+  /// Filter
+  QueryFilter filter;
+  /// Whether each entry is accepted
+  vector<bool> accepted;
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Creates the filters to test.
+/// \param mask Mask of some filters.
+/// @param[out] cases Filters.
+void createFilters(const vector<bool> &mask, vector<FilterCase> &cases);
+
+/// \brief Sets whether the entries of a range are accepted.
+/// \param accepted Whether each entry is accepted.
+/// \param begin First entry.
+/// \param end Entry after the last one.
+/// \param value Whether they are accepted.
+void setRange(vector<bool> &accepted, EntryId begin, EntryId end,
+  bool value);
+
+/// \brief Tests a scoring.
+/// \param voc Vocabulary.
+/// \param features Features of the query images.
+/// \param entries Features of the entries.
+/// \param cases Filters.
+void testScoring(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries,
+  const vector<FilterCase> &cases);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, entries;
+  createFeatures(features);
+  createEntries(features, NENTRIES, entries, true);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  vector<bool> mask(NMASK);
+  for(size_t i = 0; i < mask.size(); ++i) mask[i] = (i % 3 != 0);
+
+  vector<FilterCase> cases;
+  createFilters(mask, cases);
+
+  // the filters accept the entries they must
+  for(size_t c = 0; c < cases.size(); ++c)
+  {
+    bool ok = true;
+    for(EntryId id = 0; id < cases[c].accepted.size(); ++id)
+      ok = ok && cases[c].filter.accepts(id) == cases[c].accepted[id];
+    check(ok, "accepts with " + cases[c].name);
+  }
+
+  try
+  {
+    for(int s = 0; s < NSCORINGS; ++s)
+    {
+      Binary32Vocabulary v(voc);
+      v.setScoringType(SCORINGS[s]);
+      testScoring(v, features, entries, cases);
+    }
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+void createFilters(const vector<bool> &mask, vector<FilterCase> &cases)
+{
+  // some ids beyond the entries are checked too
+  const EntryId N = NENTRIES + 100;
+
+  FilterCase c;
+  c.name = "all the entries";
+  c.accepted.assign(N, true);
+  cases.push_back(c);
+
+  c.name = "a range";
+  c.filter = QueryFilter(400, 1300);
+  c.accepted.assign(N, false);
+  setRange(c.accepted, 400, 1300, true);
+  cases.push_back(c);
+
+  // overlapping and touching ranges are merged
+  c.name = "several ranges";
+  c.filter = QueryFilter(100, 300).include(2000, 2200).include(250, 700)
+    .include(700, 710).include(2900);
+  c.accepted.assign(N, false);
+  setRange(c.accepted, 100, 710, true);
+  setRange(c.accepted, 2000, 2200, true);
+  setRange(c.accepted, 2900, N, true);
+  cases.push_back(c);
+
+  c.name = "excluded ranges";
+  c.filter = QueryFilter(0, 2500).exclude(500, 600).exclude(550, 900)
+    .exclude(1800, 1801).exclude(2400);
+  c.accepted.assign(N, false);
+  setRange(c.accepted, 0, 2400, true);
+  setRange(c.accepted, 500, 900, false);
+  c.accepted[1800] = false;
+  cases.push_back(c);
+
+  // the mask rejects the entries beyond it
+  c.name = "a mask";
+  c.filter = QueryFilter().setMask(&mask);
+  c.accepted.assign(N, false);
+  for(size_t i = 0; i < mask.size(); ++i) c.accepted[i] = mask[i];
+  cases.push_back(c);
+
+  c.name = "ranges and a mask";
+  c.filter = QueryFilter(200, 1000).include(1500).setMask(&mask);
+  c.accepted.assign(N, false);
+  for(size_t i = 0; i < mask.size(); ++i)
+    c.accepted[i] = mask[i] && ((i >= 200 && i < 1000) || i >= 1500);
+  cases.push_back(c);
+
+  c.name = "no entries";
+  c.filter = QueryFilter(500, 500).include(NENTRIES + 50, NENTRIES + 60);
+  c.accepted.assign(N, false);
+  setRange(c.accepted, NENTRIES + 50, NENTRIES + 60, true);
+  cases.push_back(c);
+}
+
+// ----------------------------------------------------------------------------
+
+void setRange(vector<bool> &accepted, EntryId begin, EntryId end,
+  bool value)
+{
+  for(EntryId id = begin; id < end && id < accepted.size(); ++id)
+    accepted[id] = value;
+}
+
+// ----------------------------------------------------------------------------
+
+void testScoring(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries,
+  const vector<FilterCase> &cases)
+{
+  const string name = "scoring " + to_string(voc.getScoringType());
+  cout << "Testing the filters with the " << name << "..." << endl;
+
+  Binary32Database db(voc, false);
+  for(size_t i = 0; i < entries.size(); ++i) db.add(entries[i]);
+
+  vector<FlatBowVector> queries;
+  transformAll(voc, features, queries);
+
+  const int max_results[] = { 0, 10 };
+  const int max_ids[] = { -1, 1500 };
+
+  for(int state = 0; state < 2; ++state)
+  {
+    // the sealed rows skip the blocks out of the ranges
+    if(state == 1)
+    {
+      for(EntryId id = 0; id < db.size(); id += 11) db.remove(id);
+      db.seal();
+    }
+    const string what = name + (state ? ", sealed with removed entries" : "");
+
+    for(int m = 0; m < 2; ++m)
+    {
+      vector<QueryResults> all(queries.size());
+      for(size_t i = 0; i < queries.size(); ++i)
+        db.query(queries[i], all[i], 0, max_ids[m]);
+
+      for(size_t c = 0; c < cases.size(); ++c)
+      {
+        for(int k = 0; k < 2; ++k)
+        {
+          for(int early = 0; early < 2; ++early)
+          {
+            QueryOptions options;
+            options.filter = cases[c].filter;
+            options.early_termination = (early == 1);
+
+            bool ok = true;
+            for(size_t i = 0; i < queries.size(); ++i)
+            {
+              // the best accepted entries of the exhaustive query
+              QueryResults expected;
+              for(size_t r = 0; r < all[i].size(); ++r)
+              {
+                if(max_results[k] > 0 &&
+                  (int)expected.size() == max_results[k]) break;
+                if(cases[c].accepted[all[i][r].Id])
+                  expected.push_back(all[i][r]);
+              }
+
+              QueryResults ret;
+              db.query(queries[i], ret, options, max_results[k], max_ids[m]);
+              ok = ok && sameResults(expected, ret, TOLERANCE);
+            }
+
+            check(ok, what + ": " + cases[c].name + " with max_results " +
+              to_string(max_results[k]) + ", max_id " +
+              to_string(max_ids[m]) + (early ? ", early termination" : ""));
+          }
+        }
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,201 @@
+/**
+ * @file dbow2_gpu_test.cpp
+ * @brief Tests that the GPU transforms give the words, nodes and vectors of
+ * the CPU ones or, in the builds without a GPU, that they throw.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+/// \brief Returns whether uploading the tree of a vocabulary throws.
+/// \param voc Vocabulary.
+/// \param gpu Tree to upload into.
+template<class F>
+bool uploadThrows(const TemplatedVocabulary<Descriptor, F> &voc,
+  GpuTree &gpu);
+
+/// \brief Tests that the GPU functions throw when no tree can be
+/// uploaded.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+void testUnavailable(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features);
+
+/// \brief Tests that the GPU transforms give the results of the CPU ones.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+void testTransforms(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features;
+  createFeatures(features);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  try
+  {
+    // trees that no GPU backend can take
+    GpuTree gpu;
+    TemplatedVocabulary<Descriptor, FScalar> scalar(5, 3, TF_IDF, L1_NORM);
+    scalar.create(features);
+    check(uploadThrows(scalar, gpu) && gpu.empty(),
+      "upload the tree of descriptors that are not packed");
+    check(uploadThrows(Binary32Vocabulary(), gpu) && gpu.empty(),
+      "upload an empty tree");
+
+    if(GpuTree::available())
+    {
+      testTransforms(voc, features);
+    }
+    else
+    {
+      cout << "No GPU available: only the errors are tested" << endl;
+      testUnavailable(voc, features);
+    }
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+bool uploadThrows(const TemplatedVocabulary<Descriptor, F> &voc,
+  GpuTree &gpu)
+{
+  try
+  {
+    voc.uploadTree(gpu);
+  }
+  catch(const std::string &)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+
+void testUnavailable(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features)
+{
+  cout << "Testing the GPU functions without a GPU..." << endl;
+
+  GpuTree gpu;
+  check(uploadThrows(voc, gpu), "upload without a GPU");
+  check(gpu.empty() && gpu.nodes() == 0, "no tree after a failed upload");
+
+  vector<WordId> ids;
+  vector<WordValue> weights;
+  bool thrown = false;
+  try { voc.quantize(features[0], ids, weights, NULL, 0, gpu); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "quantize without a tree");
+
+  vector<BowVector> v;
+  thrown = false;
+  try { voc.transform(features, v, NULL, 0, gpu); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "transform without a tree");
+}
+
+// ----------------------------------------------------------------------------
+
+void testTransforms(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features)
+{
+  cout << "Testing the GPU transforms..." << endl;
+
+  GpuTree gpu;
+  voc.uploadTree(gpu);
+  check(!gpu.empty(), "tree uploaded");
+
+  // a tree of another vocabulary is rejected
+  Binary32Vocabulary other(3, 2, TF_IDF, L1_NORM);
+  other.create(features);
+  vector<WordId> ids;
+  vector<WordValue> weights;
+  bool thrown = false;
+  try { other.quantize(features[0], ids, weights, NULL, 0, gpu); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "quantize with the tree of another vocabulary");
+
+  for(int levelsup = 0; levelsup <= voc.getDepthLevels(); ++levelsup)
+  {
+    const string which = to_string(levelsup) + " levels up";
+
+    // the words, weights and nodes of each descriptor
+    bool words = true;
+    for(size_t i = 0; i < features.size(); ++i)
+    {
+      vector<NodeId> nids;
+      voc.quantize(features[i], ids, weights, &nids, levelsup, gpu);
+      words = words && ids.size() == features[i].size() &&
+        weights.size() == ids.size() && nids.size() == ids.size();
+
+      for(size_t j = 0; words && j < features[i].size(); ++j)
+      {
+        const WordId wid = voc.transform(features[i][j]);
+        words = ids[j] == wid && weights[j] == voc.getWordWeight(wid) &&
+          nids[j] == voc.getParentNode(wid, levelsup);
+      }
+    }
+    check(words, which + ": the words and nodes of the CPU");
+
+    // the vectors of all the images at once
+    vector<BowVector> v;
+    vector<FeatureVector> fv;
+    voc.transform(features, v, &fv, levelsup, gpu);
+
+    bool vectors = (v.size() == features.size() && fv.size() == v.size());
+    for(size_t i = 0; vectors && i < features.size(); ++i)
+    {
+      BowVector cv;
+      FeatureVector cfv;
+      voc.transform(features[i], cv, cfv, levelsup);
+      vectors = (v[i] == cv && fv[i] == cfv);
+    }
+    check(vectors, which + ": the vectors of the CPU");
+  }
+
+  // and again after the tree is cleared and uploaded
+  gpu.clear();
+  check(gpu.empty(), "tree cleared");
+  voc.uploadTree(gpu);
+
+  vector<BowVector> v;
+  voc.transform(features, v, NULL, 0, gpu);
+  bool vectors = (v.size() == features.size());
+  for(size_t i = 0; vectors && i < features.size(); ++i)
+  {
+    BowVector cv;
+    voc.transform(features[i], cv);
+    vectors = (v[i] == cv);
+  }
+  check(vectors, "the vectors of the CPU after another upload");
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,532 @@
+/**
+ * @file dbow2_kmeans_test.cpp
+ * @brief Tests that the hierarchical k-means builds the tree of the
+ * original one, also when its iterations are capped, and that its other
+ * options build valid trees.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <limits>
+#include <cstdlib>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const unsigned int SEED = 1234; ///< seed of the trees created
+const int NTHREADS = 3; ///< threads of the pool
+
+/// \brief Node of a tree built by the original k-means.
+struct ReferenceNode
+{
+  Descriptor descriptor;
+  NodeId parent;
+  vector<NodeId> children;
+};
+
+/// \brief Vocabulary whose nodes can be read.
+template<class F>
+class NodeVocabulary: public TemplatedVocabulary<Descriptor, F>
+{
+public:
+
+  /// \brief Creates an empty vocabulary.
+  /// \param k Branching factor.
+  /// \param L Depth levels.
+  NodeVocabulary(int k, int L):
+    TemplatedVocabulary<Descriptor, F>(k, L, TF_IDF, L1_NORM) {}
+
+  /// \brief Returns whether the nodes are those of a reference tree.
+  /// \param nodes Nodes of the tree, the root first.
+  bool sameNodes(const vector<ReferenceNode> &nodes) const
+  {
+    if(this->m_nodes.size() != nodes.size()) return false;
+
+    for(size_t i = 1; i < nodes.size(); ++i)
+    {
+      if(this->m_nodes[i].descriptor != nodes[i].descriptor ||
+        this->m_nodes[i].parent != nodes[i].parent ||
+        this->m_nodes[i].children != nodes[i].children) return false;
+    }
+    return this->m_nodes[0].children == nodes[0].children;
+  }
+
+  /// \brief Returns whether the nodes form a tree of at most k children
+  /// per node and L levels, whose leaves are the words.
+  bool validTree() const
+  {
+    const vector<typename TemplatedVocabulary<Descriptor, F>::Node> &nodes =
+      this->m_nodes;
+    if(nodes.size() < 2) return false;
+
+    size_t leaves = 0;
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+      if(nodes[i].id != i ||
+        (int)nodes[i].children.size() > this->m_k) return false;
+
+      if(nodes[i].children.empty())
+      {
+        const WordId w = nodes[i].word_id;
+        if(i == 0 || w >= this->m_words.size() ||
+          this->m_words[w] != &nodes[i]) return false;
+        ++leaves;
+      }
+
+      if(i == 0) continue;
+
+      // the parent has it as child, and it is at most L levels deep
+      const vector<NodeId> &siblings = nodes[nodes[i].parent].children;
+      if(nodes[i].parent >= i ||
+        find(siblings.begin(), siblings.end(), i) == siblings.end())
+        return false;
+
+      int depth = 1;
+      for(NodeId p = nodes[i].parent; p != 0; p = nodes[p].parent) ++depth;
+      if(depth > this->m_L) return false;
+    }
+    return leaves == this->m_words.size();
+  }
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Builds a tree with the original hierarchical k-means, drawing
+/// the random numbers from rand() as it did.
+template<class F>
+class ReferenceKMeans
+{
+public:
+
+  /// \brief Builds a tree.
+  /// \param features Features of the images.
+  /// \param k Branching factor.
+  /// \param L Depth levels.
+  /// @param[out] nodes Nodes of the tree, the root first.
+  /// \param options Options of the k-means. Only max_iterations and
+  ///   tolerance are taken.
+  void create(const vector<vector<Descriptor> > &features, int k, int L,
+    vector<ReferenceNode> &nodes,
+    const KMeansOptions &options = KMeansOptions());
+
+protected:
+
+  /// \brief Clusters the descriptors of a node and goes on with its
+  /// children.
+  /// \param parent_id Node id.
+  /// \param descriptors Descriptors of the node.
+  /// \param current_level Level of the children.
+  void step(NodeId parent_id, const vector<const Descriptor*> &descriptors,
+    int current_level);
+
+  /// \brief Seeds the clusters with kmeans++.
+  /// \param descriptors Descriptors of the node.
+  /// @param[out] clusters Seeds.
+  void seed(const vector<const Descriptor*> &descriptors,
+    vector<Descriptor> &clusters) const;
+
+  int m_k; ///< branching factor
+  int m_L; ///< depth levels
+  KMeansOptions m_options; ///< options of the k-means
+  vector<ReferenceNode> *m_nodes; ///< tree being built
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Tests that a vocabulary builds the tree of the original k-means.
+/// \param features Features of the images.
+/// \param k Branching factor.
+/// \param L Depth levels.
+/// \param what Description of the descriptors.
+template<class F>
+void testOriginal(const vector<vector<Descriptor> > &features, int k, int L,
+  const string &what);
+
+/// \brief Tests that the k-means options that do not apply build the
+/// original tree, that capped iterations stop as the original k-means
+/// would, and that the other options build valid trees.
+/// \param features Features of the images.
+/// \param pool Threads.
+/// \param what Description of the descriptors.
+template<class F>
+void testOptions(const vector<vector<Descriptor> > &features,
+  ThreadPool &pool, const string &what);
+
+/// \brief Returns whether every word of a vocabulary is reached by some
+/// training descriptor.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+template<class F>
+bool allReached(const NodeVocabulary<F> &voc,
+  const vector<vector<Descriptor> > &features);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features;
+  createFeatures(features);
+
+  try
+  {
+    // nodes clustered with k-means, with as many descriptors as clusters
+    // and with a single descriptor
+    const int ks[] = { 5, 9, 3, 10 };
+    const int Ls[] = { 3, 2, 6, 4 };
+    for(int c = 0; c < 4; ++c)
+    {
+      testOriginal<FBinary32>(features, ks[c], Ls[c], "packed");
+      testOriginal<FScalar>(features, ks[c], Ls[c], "unpacked");
+    }
+
+    ThreadPool pool(NTHREADS);
+    testOptions<FBinary32>(features, pool, "packed");
+    testOptions<FScalar>(features, pool, "unpacked");
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void ReferenceKMeans<F>::create(const vector<vector<Descriptor> > &features,
+  int k, int L, vector<ReferenceNode> &nodes, const KMeansOptions &options)
+{
+  m_k = k;
+  m_L = L;
+  m_options = options;
+  m_nodes = &nodes;
+
+  vector<const Descriptor*> descriptors;
+  for(size_t i = 0; i < features.size(); ++i)
+    for(size_t j = 0; j < features[i].size(); ++j)
+      descriptors.push_back(&features[i][j]);
+
+  nodes.assign(1, ReferenceNode());
+  nodes[0].parent = 0;
+  step(0, descriptors, 1);
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void ReferenceKMeans<F>::step(NodeId parent_id,
+  const vector<const Descriptor*> &descriptors, int current_level)
+{
+  if(descriptors.empty()) return;
+
+  vector<Descriptor> clusters;
+  vector<vector<unsigned int> > groups;
+
+  if((int)descriptors.size() <= m_k)
+  {
+    // one cluster per descriptor
+    groups.resize(descriptors.size());
+    for(unsigned int i = 0; i < descriptors.size(); ++i)
+    {
+      groups[i].push_back(i);
+      clusters.push_back(*descriptors[i]);
+    }
+  }
+  else
+  {
+    bool first_time = true, goon = true;
+    unsigned int iterations = 0;
+    vector<int> last_association, current_association;
+
+    while(goon)
+    {
+      if(first_time)
+      {
+        seed(descriptors, clusters);
+      }
+      else
+      {
+        ++iterations;
+        for(unsigned int c = 0; c < clusters.size(); ++c)
+        {
+          vector<const Descriptor*> cluster_descriptors;
+          for(size_t i = 0; i < groups[c].size(); ++i)
+            cluster_descriptors.push_back(descriptors[groups[c][i]]);
+          F::meanValue(cluster_descriptors, clusters[c]);
+        }
+      }
+
+      groups.assign(clusters.size(), vector<unsigned int>());
+      current_association.resize(descriptors.size());
+      for(unsigned int i = 0; i < descriptors.size(); ++i)
+      {
+        double best_dist = F::distance(*descriptors[i], clusters[0]);
+        unsigned int icluster = 0;
+        for(unsigned int c = 1; c < clusters.size(); ++c)
+        {
+          const double dist = F::distance(*descriptors[i], clusters[c]);
+          if(dist < best_dist)
+          {
+            best_dist = dist;
+            icluster = c;
+          }
+        }
+        groups[icluster].push_back(i);
+        current_association[i] = icluster;
+      }
+
+      if(first_time)
+      {
+        first_time = false;
+      }
+      else
+      {
+        size_t changed = 0;
+        for(size_t i = 0; i < descriptors.size(); ++i)
+          if(current_association[i] != last_association[i]) ++changed;
+
+        goon = (changed > m_options.tolerance * descriptors.size());
+        if(m_options.max_iterations > 0 &&
+          iterations >= m_options.max_iterations) goon = false;
+      }
+
+      if(goon) last_association = current_association;
+    }
+  }
+
+  vector<ReferenceNode> &nodes = *m_nodes;
+  for(unsigned int i = 0; i < clusters.size(); ++i)
+  {
+    const NodeId id = nodes.size();
+    nodes.push_back(ReferenceNode());
+    nodes.back().descriptor = clusters[i];
+    nodes.back().parent = parent_id;
+    nodes[parent_id].children.push_back(id);
+  }
+
+  if(current_level < m_L)
+  {
+    const vector<NodeId> children = nodes[parent_id].children;
+    for(unsigned int i = 0; i < clusters.size(); ++i)
+    {
+      vector<const Descriptor*> child_descriptors;
+      for(size_t j = 0; j < groups[i].size(); ++j)
+        child_descriptors.push_back(descriptors[groups[i][j]]);
+
+      if(child_descriptors.size() > 1)
+        step(children[i], child_descriptors, current_level + 1);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void ReferenceKMeans<F>::seed(const vector<const Descriptor*> &descriptors,
+  vector<Descriptor> &clusters) const
+{
+  clusters.clear();
+
+  // the first centre uniformly, the next ones with a probability
+  // proportional to their distance to the closest centre
+  const double n = (double)descriptors.size();
+  int ifeature = int(((double)rand() / ((double)RAND_MAX + 1.0)) * n);
+  clusters.push_back(*descriptors[ifeature]);
+
+  vector<double> min_dists(descriptors.size());
+  for(size_t i = 0; i < descriptors.size(); ++i)
+    min_dists[i] = F::distance(*descriptors[i], clusters.back());
+
+  while((int)clusters.size() < m_k)
+  {
+    for(size_t i = 0; i < descriptors.size(); ++i)
+    {
+      if(min_dists[i] > 0)
+      {
+        const double dist = F::distance(*descriptors[i], clusters.back());
+        if(dist < min_dists[i]) min_dists[i] = dist;
+      }
+    }
+
+    const double dist_sum =
+      std::accumulate(min_dists.begin(), min_dists.end(), 0.0);
+    if(dist_sum <= 0) break;
+
+    double cut_d;
+    do
+    {
+      cut_d = ((double)rand() / (double)RAND_MAX) * dist_sum;
+    } while(cut_d == 0.0);
+
+    double d_up_now = 0;
+    size_t i = 0;
+    for(; i < min_dists.size(); ++i)
+    {
+      d_up_now += min_dists[i];
+      if(d_up_now >= cut_d) break;
+    }
+    ifeature = (i == min_dists.size() ? (int)min_dists.size() - 1 : (int)i);
+    clusters.push_back(*descriptors[ifeature]);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void testOriginal(const vector<vector<Descriptor> > &features, int k, int L,
+  const string &what)
+{
+  const string which = what + ", k = " + to_string(k) + ", L = " +
+    to_string(L);
+  cout << "Testing the k-means of " << which << "..." << endl;
+
+  vector<ReferenceNode> nodes;
+  srand(SEED);
+  ReferenceKMeans<F>().create(features, k, L, nodes);
+
+  NodeVocabulary<F> voc(k, L);
+  srand(SEED);
+  voc.create(features);
+
+  check(nodes.size() > 1 && voc.sameNodes(nodes),
+    which + ": the nodes of the original k-means");
+
+  // and the same number of random numbers drawn
+  const int next = rand();
+  srand(SEED);
+  ReferenceKMeans<F>().create(features, k, L, nodes);
+  check(next == rand(), which + ": the random numbers of the original");
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void testOptions(const vector<vector<Descriptor> > &features,
+  ThreadPool &pool, const string &what)
+{
+  cout << "Testing the k-means options of " << what << "..." << endl;
+
+  const int k = 5, L = 3;
+  vector<ReferenceNode> nodes;
+  srand(SEED);
+  ReferenceKMeans<F>().create(features, k, L, nodes);
+
+  // options that do not apply to these nodes: the original tree
+  KMeansOptions options;
+  options.max_iterations = 1000;
+  options.seeding_sample = 100000;
+  options.minibatch_levels = L;
+  options.minibatch_size = 100000;
+
+  NodeVocabulary<F> voc(k, L);
+  voc.setKMeansOptions(options);
+  srand(SEED);
+  voc.create(features);
+  check(voc.sameNodes(nodes), what + ": the tree of options that do not "
+    "apply");
+
+  // capped iterations and a tolerance: those of the original k-means
+  const unsigned int max_iterations[] = { 1, 2, 0 };
+  const double tolerances[] = { 0, 0, 0.1 };
+  const char* const names[] = { "1 iteration", "2 iterations",
+    "tolerance 0.1" };
+  for(int c = 0; c < 3; ++c)
+  {
+    options = KMeansOptions();
+    options.max_iterations = max_iterations[c];
+    options.tolerance = tolerances[c];
+
+    srand(SEED);
+    ReferenceKMeans<F>().create(features, k, L, nodes, options);
+
+    NodeVocabulary<F> capped(k, L);
+    capped.setKMeansOptions(options);
+    srand(SEED);
+    capped.create(features);
+    check(capped.sameNodes(nodes), what + ": " + names[c] +
+      ": the tree of the original k-means");
+  }
+
+  // a sample to seed with, and mini-batches in the first two levels:
+  // valid trees, which depend on the seed only and are not the default one
+  for(int c = 0; c < 2; ++c)
+  {
+    options = KMeansOptions();
+    if(c == 0)
+    {
+      options.seeding_sample = 20;
+    }
+    else
+    {
+      options.minibatch_levels = 2;
+      options.minibatch_size = 200;
+      options.minibatch_iterations = 5;
+    }
+    const string which = what + (c == 0 ? ": seeding sample" :
+      ": mini-batches");
+
+    for(int p = 0; p < 2; ++p)
+    {
+      NodeVocabulary<F> a(k, L), b(k, L), plain(k, L);
+      a.setKMeansOptions(options);
+      b.setKMeansOptions(options);
+      srand(SEED);
+      if(p) a.create(features, pool);
+      else a.create(features);
+      srand(SEED);
+      if(p) b.create(features, pool);
+      else b.create(features);
+      srand(SEED);
+      if(p) plain.create(features, pool);
+      else plain.create(features);
+
+      const string with = which + (p ? ", threads" : "");
+      check(a.validTree() && allReached(a, features), with +
+        ": a valid tree");
+
+      bool same = (a.size() == b.size());
+      for(WordId w = 0; same && w < a.size(); ++w)
+      {
+        same = a.getWord(w) == b.getWord(w);
+        for(int up = 1; same && up <= L; ++up)
+          same = a.getParentNode(w, up) == b.getParentNode(w, up);
+      }
+      check(same, with + ": the same tree from the same seed");
+
+      bool other = (a.size() != plain.size());
+      for(WordId w = 0; !other && w < a.size(); ++w)
+        other = !(a.getWord(w) == plain.getWord(w));
+      check(other, with + ": not the default tree");
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+bool allReached(const NodeVocabulary<F> &voc,
+  const vector<vector<Descriptor> > &features)
+{
+  vector<bool> reached(voc.size(), false);
+  for(size_t i = 0; i < features.size(); ++i)
+    for(size_t j = 0; j < features[i].size(); ++j)
+      reached[voc.transform(features[i][j])] = true;
+
+  return find(reached.begin(), reached.end(), false) == reached.end();
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,361 @@
+/**
+ * @file dbow2_match_test.cpp
+ * @brief Tests that matchFeatures gives the matches of a brute-force
+ * search in each direct index node.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 60; ///< entries of the databases
+const int NTHREADS = 3; ///< threads of the pool
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Creates the query images, as the given ones with a few bits of
+/// each descriptor flipped.
+/// \param features Features of the images.
+/// @param[out] queries Features of each query.
+void createQueries(const vector<vector<Descriptor> > &features,
+  vector<vector<Descriptor> > &queries);
+
+/// \brief Matches the features of a query and an entry by brute force.
+/// \param fv Feature vector of the query.
+/// \param features Descriptors of the query.
+/// \param efv Feature vector of the entry.
+/// \param entry_features Descriptors of the entry.
+/// \param options Options to accept the matches.
+/// @param[out] matches Matches, in ascending order of query feature.
+void bruteForce(const FeatureVector &fv, const vector<Descriptor> &features,
+  const FeatureVector &efv, const vector<Descriptor> &entry_features,
+  const MatchOptions &options, vector<FeatureMatch> &matches);
+
+/// \brief Returns whether two lists of matches are the same.
+/// \param a Matches.
+/// \param b Matches.
+bool sameMatches(const vector<FeatureMatch> &a,
+  const vector<FeatureMatch> &b);
+
+/// \brief Tests the matches of a descriptor class and direct index levels.
+/// \param voc Vocabulary.
+/// \param queries Features of the queries.
+/// \param entries Features of the entries.
+/// \param levels Levels up of the direct index.
+/// \param pool Threads.
+/// \param what Description of the test.
+template<class F>
+void testMatches(const TemplatedVocabulary<Descriptor, F> &voc,
+  const vector<vector<Descriptor> > &queries,
+  const vector<vector<Descriptor> > &entries, int levels, ThreadPool &pool,
+  const string &what);
+
+/// \brief Tests that the wrong arguments throw.
+/// \param voc Vocabulary.
+/// \param queries Features of the queries.
+/// \param entries Features of the entries.
+void testThrows(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &queries,
+  const vector<vector<Descriptor> > &entries);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, queries, entries;
+  createFeatures(features);
+  createQueries(features, queries);
+  createEntries(features, NENTRIES, entries);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+  TemplatedVocabulary<Descriptor, FScalar> scalar(5, 3, TF_IDF, L1_NORM);
+  scalar.create(features);
+
+  ThreadPool pool(NTHREADS);
+
+  try
+  {
+    for(int levels = 0; levels <= 2; ++levels)
+    {
+      const string which = ", " + to_string(levels) + " levels up";
+      testMatches(voc, queries, entries, levels, pool, "packed" + which);
+      testMatches(scalar, queries, entries, levels, pool, "unpacked" + which);
+    }
+    testThrows(voc, queries, entries);
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+void createQueries(const vector<vector<Descriptor> > &features,
+  vector<vector<Descriptor> > &queries)
+{
+  // from 0 to 15 bits, so that the distances are different
+  unsigned int seed = 999;
+  queries = features;
+  for(size_t i = 0; i < queries.size(); ++i)
+  {
+    for(size_t j = 0; j < queries[i].size(); ++j)
+    {
+      seed = seed * 1103515245u + 12345u;
+      const unsigned int nbits = (seed >> 16) % 16;
+      for(unsigned int b = 0; b < nbits; ++b)
+      {
+        seed = seed * 1103515245u + 12345u;
+        const unsigned int bit = (seed >> 8) % (64 * FBinary32::W);
+        queries[i][j][bit / 64] ^= (uint64_t)1 << (bit % 64);
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void bruteForce(const FeatureVector &fv, const vector<Descriptor> &features,
+  const FeatureVector &efv, const vector<Descriptor> &entry_features,
+  const MatchOptions &options, vector<FeatureMatch> &matches)
+{
+  matches.clear();
+
+  for(FeatureVector::const_iterator it = fv.begin(); it != fv.end(); ++it)
+  {
+    FeatureVector::const_iterator eit = efv.find(it->first);
+    if(eit == efv.end() || eit->second.empty()) continue;
+    const vector<unsigned int> &ef = eit->second;
+
+    for(size_t k = 0; k < it->second.size(); ++k)
+    {
+      const unsigned int q = it->second[k];
+
+      // the first closest entry feature, and the closest of the others
+      size_t best = 0;
+      for(size_t l = 1; l < ef.size(); ++l)
+      {
+        if(FBinary32::distance(features[q], entry_features[ef[l]]) <
+          FBinary32::distance(features[q], entry_features[ef[best]]))
+          best = l;
+      }
+      double second = numeric_limits<double>::max();
+      for(size_t l = 0; l < ef.size(); ++l)
+      {
+        if(l != best)
+          second = min(second,
+            FBinary32::distance(features[q], entry_features[ef[l]]));
+      }
+
+      const double d =
+        FBinary32::distance(features[q], entry_features[ef[best]]);
+      if(d <= options.max_distance &&
+        (options.ratio >= 1 || d < options.ratio * second))
+        matches.push_back(FeatureMatch(q, ef[best], d));
+    }
+  }
+
+  if(options.unique)
+  {
+    // the closest query feature of each entry feature, the first one if
+    // there are ties
+    vector<FeatureMatch> kept;
+    for(size_t k = 0; k < matches.size(); ++k)
+    {
+      bool closest = true;
+      for(size_t l = 0; closest && l < matches.size(); ++l)
+      {
+        closest = matches[l].entry != matches[k].entry ||
+          matches[l].distance > matches[k].distance ||
+          (matches[l].distance == matches[k].distance &&
+           matches[l].query >= matches[k].query);
+      }
+      if(closest) kept.push_back(matches[k]);
+    }
+    matches.swap(kept);
+  }
+
+  sort(matches.begin(), matches.end(),
+    [](const FeatureMatch &a, const FeatureMatch &b)
+    {
+      return a.query < b.query;
+    });
+}
+
+// ----------------------------------------------------------------------------
+
+bool sameMatches(const vector<FeatureMatch> &a,
+  const vector<FeatureMatch> &b)
+{
+  if(a.size() != b.size()) return false;
+
+  for(size_t i = 0; i < a.size(); ++i)
+  {
+    if(a[i].query != b[i].query || a[i].entry != b[i].entry ||
+      a[i].distance != b[i].distance) return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void testMatches(const TemplatedVocabulary<Descriptor, F> &voc,
+  const vector<vector<Descriptor> > &queries,
+  const vector<vector<Descriptor> > &entries, int levels, ThreadPool &pool,
+  const string &what)
+{
+  cout << "Testing the matches with " << what << "..." << endl;
+
+  TemplatedDatabase<Descriptor, F> db(voc, true, levels);
+  for(size_t i = 0; i < entries.size(); ++i) db.add(entries[i]);
+
+  // no limit, a distance, the ratio test, one to one matches, and all
+  MatchOptions options[5];
+  options[1].max_distance = 6;
+  options[2].ratio = 0.8;
+  options[3].unique = true;
+  options[4].max_distance = 10;
+  options[4].ratio = 0.9;
+  options[4].unique = true;
+
+  vector<EntryId> ids;
+  vector<const vector<Descriptor>*> entry_features;
+  for(EntryId id = 0; id < db.size(); id += 3)
+  {
+    ids.push_back(id);
+    entry_features.push_back(&entries[id]);
+  }
+
+  for(int o = 0; o < 5; ++o)
+  {
+    bool flat = true, map = true, several = true, threaded = true;
+    size_t nmatches = 0;
+
+    for(size_t i = 0; i < queries.size(); ++i)
+    {
+      BowVector v;
+      FeatureVector fv;
+      voc.transform(queries[i], v, fv, levels);
+
+      vector<vector<FeatureMatch> > expected(ids.size());
+      for(size_t e = 0; e < ids.size(); ++e)
+      {
+        bruteForce(fv, queries[i], db.retrieveFeatures(ids[e]),
+          *entry_features[e], options[o], expected[e]);
+        nmatches += expected[e].size();
+
+        vector<FeatureMatch> m;
+        db.matchFeatures(FlatFeatureVector(fv), queries[i], ids[e],
+          *entry_features[e], m, options[o]);
+        flat = flat && sameMatches(expected[e], m);
+
+        db.matchFeatures(fv, queries[i], ids[e], *entry_features[e], m,
+          options[o]);
+        map = map && sameMatches(expected[e], m);
+      }
+
+      for(int p = 0; p < 2; ++p)
+      {
+        vector<vector<FeatureMatch> > m;
+        db.matchFeatures(FlatFeatureVector(fv), queries[i], ids,
+          entry_features, m, options[o], p ? &pool : NULL);
+
+        bool ok = (m.size() == ids.size());
+        for(size_t e = 0; ok && e < ids.size(); ++e)
+          ok = sameMatches(expected[e], m[e]);
+        (p ? threaded : several) = (p ? threaded : several) && ok;
+      }
+    }
+
+    const string which = what + ", options " + to_string(o);
+    check(nmatches > 0, which + ": some matches");
+    check(flat, which + ": matches with a FlatFeatureVector");
+    check(map, which + ": matches with a FeatureVector");
+    check(several, which + ": matches with several entries");
+    check(threaded, which + ": matches with several entries and a pool");
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void testThrows(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &queries,
+  const vector<vector<Descriptor> > &entries)
+{
+  cout << "Testing the wrong arguments..." << endl;
+
+  Binary32Database db(voc, true, 1), no_di(voc, false);
+  for(int i = 0; i < 5; ++i)
+  {
+    db.add(entries[i]);
+    no_di.add(entries[i]);
+  }
+
+  // the query image of the first entry, so that their nodes meet
+  BowVector v;
+  FeatureVector fv;
+  voc.transform(queries[0], v, fv, 1);
+
+  const vector<Descriptor> few_query(queries[0].begin(),
+    queries[0].begin() + queries[0].size() / 4);
+  const vector<Descriptor> few_entry(entries[0].begin(),
+    entries[0].begin() + entries[0].size() / 4);
+
+  vector<FeatureMatch> m;
+  bool thrown = false;
+  try { db.matchFeatures(fv, few_query, 0, entries[0], m); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "query feature out of the descriptors");
+
+  thrown = false;
+  try { db.matchFeatures(fv, queries[0], 0, few_entry, m); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "entry feature out of the descriptors");
+
+  thrown = false;
+  try { no_di.matchFeatures(fv, queries[0], 0, entries[0], m); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "no direct index");
+
+  vector<vector<FeatureMatch> > mm;
+  thrown = false;
+  try
+  {
+    db.matchFeatures(FlatFeatureVector(fv), queries[0],
+      vector<EntryId>(2, 0),
+      vector<const vector<Descriptor>*>(1, &entries[0]), mm);
+  }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "descriptors of fewer entries than ids");
+
+  thrown = false;
+  try
+  {
+    db.matchFeatures(FlatFeatureVector(fv), queries[0],
+      vector<EntryId>(1, 0),
+      vector<const vector<Descriptor>*>(1, &few_entry), mm);
+  }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "entry feature out of the descriptors of several entries");
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,285 @@
+/**
+ * @file dbow2_matrix_test.cpp
+ * @brief Tests that the transforms, adds and queries that read the
+ * descriptors from the rows of a matrix give the results of those that
+ * take a std::vector of descriptors.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 60; ///< entries of the databases
+const int NTHREADS = 3; ///< threads of the pool
+
+/// \brief Rows of the descriptors of an image in a buffer of its own.
+struct ImageRows
+{
+  /// Buffer, with some bytes before the first row
+  vector<unsigned char> buffer;
+  /// View of the rows
+  DescriptorMatrix matrix;
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Writes the descriptors of an image as the rows of a buffer.
+/// \param features Descriptors of the image.
+/// \param offset Bytes before the first row, so that the rows may not be
+///   aligned.
+/// \param stride Bytes between the starts of two rows, or 0 if they are
+///   contiguous.
+/// @param[out] rows Buffer and view of the rows.
+void toRows(const vector<Descriptor> &features, size_t offset, size_t stride,
+  ImageRows &rows);
+
+/// \brief Tests the transforms of the rows of a matrix.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+/// \param pool Threads.
+void testTransforms(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features, ThreadPool &pool);
+
+/// \brief Tests adding and querying with the rows of a matrix.
+/// \param voc Vocabulary.
+/// \param features Features of the queries.
+/// \param entries Features of the entries.
+void testDatabase(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries);
+
+/// \brief Tests that the wrong matrices throw.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+void testThrows(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, entries;
+  createFeatures(features);
+  createEntries(features, NENTRIES, entries, true);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  ThreadPool pool(NTHREADS);
+
+  try
+  {
+    testTransforms(voc, features, pool);
+    testDatabase(voc, features, entries);
+    testThrows(voc, features);
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+void toRows(const vector<Descriptor> &features, size_t offset, size_t stride,
+  ImageRows &rows)
+{
+  const size_t bytes = FBinary32::L;
+  const size_t step = (stride > 0 ? stride : bytes);
+
+  rows.buffer.assign(offset + features.size() * step, 0xff);
+  for(size_t i = 0; i < features.size(); ++i)
+    memcpy(&rows.buffer[offset + i * step], FBinary32::bytes(features[i]),
+      bytes);
+
+  rows.matrix = DescriptorMatrix(rows.buffer.data() + offset,
+    features.size(), bytes, stride);
+}
+
+// ----------------------------------------------------------------------------
+
+void testTransforms(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features, ThreadPool &pool)
+{
+  cout << "Testing the transforms of matrices..." << endl;
+
+  // contiguous rows, rows that are not aligned, rows with padding between
+  // them, and the region of the first columns of an OpenCV matrix
+  const size_t offsets[] = { 0, 1, 8, 0 };
+  const size_t strides[] = { 0, 0, 40, 48 };
+  const char* const names[] = { "contiguous", "unaligned", "strided",
+    "cv::Mat" };
+
+  for(int m = 0; m < 4; ++m)
+  {
+    for(int p = 0; p < 2; ++p)
+    {
+      ThreadPool *tp = (p ? &pool : NULL);
+      bool bow = true, flat = true;
+
+      for(size_t i = 0; i < features.size(); ++i)
+      {
+        ImageRows rows;
+        toRows(features[i], offsets[m], strides[m], rows);
+        if(m == 3)
+        {
+          const cv::Mat mat((int)features[i].size(), FBinary32::L, CV_8U,
+            rows.buffer.data(), strides[m]);
+          rows.matrix = DescriptorMatrix(mat);
+        }
+
+        for(int levelsup = 0; levelsup <= 2; ++levelsup)
+        {
+          BowVector v, mv, mv2;
+          FeatureVector fv, mfv;
+          voc.transform(features[i], v, fv, levelsup);
+          voc.transform(rows.matrix, mv, mfv, levelsup, tp);
+          voc.transform(rows.matrix, mv2, tp);
+          bow = bow && v == mv && fv == mfv && v == mv2;
+
+          FlatBowVector f, mf, mf2;
+          FlatFeatureVector ffv, mffv;
+          voc.transform(features[i], f, ffv, levelsup);
+          voc.transform(rows.matrix, mf, mffv, levelsup, tp);
+          voc.transform(rows.matrix, mf2, tp);
+          flat = flat && f == mf && ffv == mffv && f == mf2;
+        }
+      }
+
+      const string which = string(names[m]) + (p ? ", threads" : "");
+      check(bow, which + ": the bow and feature vectors");
+      check(flat, which + ": the flat vectors");
+    }
+  }
+
+  // no rows
+  BowVector v;
+  FeatureVector fv;
+  voc.transform(DescriptorMatrix(), v, fv, 1);
+  check(v.empty() && fv.empty(), "the vectors of no rows");
+}
+
+// ----------------------------------------------------------------------------
+
+void testDatabase(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries)
+{
+  cout << "Testing the databases of matrices..." << endl;
+
+  // with and without direct index
+  for(int di = 0; di < 2; ++di)
+  {
+    const string which = (di ? "direct index" : "no direct index");
+
+    Binary32Database db(voc, di == 1, 1), mdb(voc, di == 1, 1);
+    bool added = true;
+    for(size_t i = 0; i < entries.size(); ++i)
+    {
+      ImageRows rows;
+      toRows(entries[i], i % 3, (i % 2 ? 40 : 0), rows);
+
+      FlatBowVector v;
+      FlatFeatureVector fv;
+      const EntryId id = db.add(entries[i]);
+      added = added && mdb.add(rows.matrix, &v, &fv) == id;
+
+      // the vectors returned are those of the vocabulary
+      FlatBowVector tv;
+      FlatFeatureVector tfv;
+      voc.transform(entries[i], tv, tfv, 1);
+      added = added && v == tv && fv == tfv;
+
+      if(di) added = added && db.retrieveFeatures(id) ==
+        mdb.retrieveFeatures(id);
+    }
+    check(added, which + ": the entries added");
+
+    bool queries = true, options = true;
+    QueryOptions opt;
+    opt.max_df = 0.5;
+    for(size_t i = 0; i < features.size(); ++i)
+    {
+      ImageRows rows;
+      toRows(features[i], 1, 0, rows);
+
+      QueryResults ret, mret, mret2;
+      db.query(features[i], ret, 10);
+      db.query(rows.matrix, mret, 10);
+      mdb.query(rows.matrix, mret2, 10);
+      queries = queries && identicalResults(ret, mret) &&
+        identicalResults(ret, mret2);
+
+      db.query(features[i], ret, opt, 10);
+      db.query(rows.matrix, mret, opt, 10);
+      options = options && identicalResults(ret, mret);
+    }
+    check(queries, which + ": the results of the queries");
+    check(options, which + ": the results of the queries with options");
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void testThrows(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features)
+{
+  cout << "Testing the wrong matrices..." << endl;
+
+  // rows of another length
+  ImageRows rows;
+  toRows(features[0], 0, 0, rows);
+  const DescriptorMatrix shorter(rows.buffer.data(), features[0].size(),
+    FBinary32::L - 1, FBinary32::L);
+
+  BowVector v;
+  bool thrown = false;
+  try { voc.transform(shorter, v); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "transform rows of another length");
+
+  Binary32Database db(voc, false);
+  thrown = false;
+  try { db.add(shorter); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown && db.size() == 0, "add rows of another length");
+
+  QueryResults ret;
+  thrown = false;
+  try { db.query(shorter, ret); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "query rows of another length");
+
+  // an OpenCV matrix of another type
+  const cv::Mat words((int)features[0].size(), FBinary32::L / 2, CV_16U);
+  thrown = false;
+  try { DescriptorMatrix m(words); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "view an OpenCV matrix of another type");
+
+  // descriptors without packed representation
+  TemplatedVocabulary<Descriptor, FScalar> scalar(5, 3, TF_IDF, L1_NORM);
+  scalar.create(features);
+  thrown = false;
+  try { scalar.transform(rows.matrix, v); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "transform descriptors that are not packed");
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,489 @@
+/**
+ * @file dbow2_pipeline_test.cpp
+ * @brief Tests the bounded queues and the pipelines: a pipeline must give
+ * the results of querying and adding its frames one by one, and it must
+ * deliver the dropped and failed frames in order.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NFRAMES = 150; ///< frames given to the pipelines
+const int NTHREADS = 3; ///< threads of the pool
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Tests the bounded queues.
+void testQueue();
+
+/// \brief Tests that the pipelines cannot be created with wrong options.
+/// \param voc Vocabulary.
+void testOptions(const Binary32Vocabulary &voc);
+
+/// \brief Tests that a pipeline gives the results of the frames one by one.
+/// If the frames are not added, the database has the first half of them.
+/// \param voc Vocabulary.
+/// \param frames Features of the frames.
+/// \param options Options of the pipeline.
+/// \param pool Threads, or NULL.
+/// \param what Description of the test.
+template<class F>
+void testSequence(const TemplatedVocabulary<Descriptor, F> &voc,
+  const vector<vector<Descriptor> > &frames, const PipelineOptions &options,
+  ThreadPool *pool, const string &what);
+
+/// \brief Computes the results of some frames one by one.
+/// \param db Database.
+/// \param frames Features of the frames.
+/// \param options Options of the pipeline.
+/// @param[out] results Result of each frame.
+template<class F>
+void runSequentially(TemplatedDatabase<Descriptor, F> &db,
+  const vector<vector<Descriptor> > &frames, const PipelineOptions &options,
+  vector<FrameResult> &results);
+
+/// \brief Tests that the dropped frames are delivered in order.
+/// \param voc Vocabulary.
+/// \param frames Features of the frames.
+void testDrops(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &frames);
+
+/// \brief Returns whether two results of a frame are the same. Candidates
+/// with the same score may be in different order.
+/// \param a Result.
+/// \param b Result.
+bool sameResult(const FrameResult &a, const FrameResult &b);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  testQueue();
+
+  vector<vector<Descriptor> > features, frames;
+  createFeatures(features);
+  createEntries(features, NFRAMES, frames, false, 7);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  ThreadPool pool(NTHREADS);
+
+  try
+  {
+    testOptions(voc);
+
+    PipelineOptions options;
+    testSequence(voc, frames, options, NULL, "default options");
+
+    options.exclude_recent = 3;
+    options.max_batch = 8;
+    options.queue_size = 16;
+    testSequence(voc, frames, options, NULL, "batches");
+    testSequence(voc, frames, options, &pool, "batches and a pool");
+
+    options.verify = 2;
+    testSequence(voc, frames, options, &pool, "verified batches");
+
+    options.keep_features = 20;
+    testSequence(voc, frames, options, &pool, "bounded features");
+
+    options = PipelineOptions();
+    options.add = false;
+    testSequence(voc, frames, options, NULL, "frames not added");
+
+    testDrops(voc, frames);
+
+    // the transforms of some frames fail, and the following ones are
+    // queried and added as if those frames had not been submitted
+    TemplatedVocabulary<Descriptor, FFailing> failing(5, 3, TF_IDF, L1_NORM);
+    failing.create(features);
+
+    vector<vector<Descriptor> > wrong(frames);
+    for(size_t i = 5; i < wrong.size(); i += 17)
+      wrong[i].push_back(FFailing::failing());
+
+    options.add = true;
+    options.exclude_recent = 3;
+    options.max_batch = 8;
+    options.verify = 2;
+    testSequence(failing, wrong, options, NULL, "failures");
+    testSequence(failing, wrong, options, &pool, "failures and a pool");
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+void testQueue()
+{
+  cout << "Testing the bounded queues..." << endl;
+
+  {
+    BoundedQueue<int> q(3);
+    check(q.capacity() == 3 && q.size() == 0, "queue: empty");
+
+    bool ok = true;
+    for(int i = 1; i <= 3; ++i) ok = ok && q.tryPush(i);
+    int item = 4;
+    check(ok && q.size() == 3, "queue: tryPush");
+    check(!q.tryPush(item) && item == 4, "queue: tryPush when full");
+
+    for(int i = 1; i <= 3; ++i) ok = ok && q.tryPop(item) && item == i;
+    check(ok && q.size() == 0, "queue: tryPop in order");
+    check(!q.tryPop(item), "queue: tryPop when empty");
+
+    check(BoundedQueue<int>(0).capacity() == 1, "queue: capacity 0");
+  }
+
+  {
+    // the items pushed before closing can still be popped
+    BoundedQueue<unique_ptr<int> > q(4);
+    unique_ptr<int> item(new int(1));
+    q.push(item);
+    item.reset(new int(2));
+    q.push(item);
+    q.close();
+
+    item.reset(new int(3));
+    check(q.closed(), "queue: closed");
+    check(!q.tryPush(item) && item && *item == 3, "queue: tryPush closed");
+    check(!q.push(item) && item && *item == 3, "queue: push closed");
+
+    bool ok = q.pop(item) && item && *item == 1;
+    ok = ok && q.pop(item) && item && *item == 2;
+    check(ok, "queue: drain after close");
+    check(!q.pop(item), "queue: pop closed and empty");
+  }
+
+  {
+    // the producer waits for room and the consumer for items
+    const int N = 10000;
+    BoundedQueue<int> q(2);
+    thread producer([&q]()
+    {
+      for(int i = 0; i < N; ++i)
+      {
+        if(i == N / 2) this_thread::sleep_for(chrono::milliseconds(20));
+        int item = i;
+        q.push(item);
+      }
+      q.close();
+    });
+
+    this_thread::sleep_for(chrono::milliseconds(20));
+    int item, n = 0;
+    bool ok = true;
+    while(q.pop(item)) ok = ok && item == n++;
+    producer.join();
+    check(ok && n == N, "queue: blocking push and pop");
+  }
+
+  {
+    // close wakes up the consumer waiting for items
+    BoundedQueue<int> q(2);
+    atomic<int> popped(-1);
+    thread consumer([&q, &popped]()
+    {
+      int item;
+      popped = (q.pop(item) ? 1 : 0);
+    });
+    this_thread::sleep_for(chrono::milliseconds(20));
+    check(popped == -1, "queue: pop waits");
+    q.close();
+    consumer.join();
+    check(popped == 0, "queue: close wakes pop");
+  }
+
+  {
+    // close wakes up the producer waiting for room
+    BoundedQueue<int> q(1);
+    int item = 1;
+    q.push(item);
+    atomic<int> pushed(-1);
+    thread producer([&q, &pushed]()
+    {
+      int item = 2;
+      pushed = (q.push(item) ? 1 : 0);
+    });
+    this_thread::sleep_for(chrono::milliseconds(20));
+    check(pushed == -1, "queue: push waits");
+    q.close();
+    producer.join();
+    check(pushed == 0, "queue: close wakes push");
+    check(q.pop(item) && item == 1 && !q.pop(item), "queue: push after close");
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void testOptions(const Binary32Vocabulary &voc)
+{
+  cout << "Testing the options of the pipelines..." << endl;
+
+  Binary32Database db(voc, true, 1), nodi(voc, false);
+
+  PipelineOptions options;
+  options.verify = 2;
+  options.add = false;
+
+  bool thrown = false;
+  try { Binary32Pipeline p(db, options); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "verify without add");
+
+  options.add = true;
+  thrown = false;
+  try { Binary32Pipeline p(nodi, options); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "verify without direct index");
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void testSequence(const TemplatedVocabulary<Descriptor, F> &voc,
+  const vector<vector<Descriptor> > &frames, const PipelineOptions &options,
+  ThreadPool *pool, const string &what)
+{
+  cout << "Testing a pipeline with " << what << "..." << endl;
+
+  TemplatedDatabase<Descriptor, F> db(voc, true, 1), sequential(voc, true, 1);
+  const size_t nprevious = (options.add ? 0 : frames.size() / 2);
+  for(size_t i = 0; i < nprevious; ++i)
+  {
+    db.add(frames[i]);
+    sequential.add(frames[i]);
+  }
+
+  vector<FrameResult> expected;
+  runSequentially(sequential, frames, options, expected);
+
+  vector<future<FrameResult> > futures;
+  {
+    TemplatedPipeline<Descriptor, F> pipeline(db, options, pool);
+    for(size_t i = 0; i < frames.size(); ++i)
+      futures.push_back(pipeline.submit(frames[i]));
+    pipeline.flush();
+    check(pipeline.pending() == 0, what + ": pending");
+  }
+
+  size_t nfailed = 0, nsame = 0;
+  for(size_t i = 0; i < futures.size(); ++i)
+  {
+    const FrameResult r = futures[i].get();
+    if(r.status == FRAME_FAILED) ++nfailed;
+    if(r.frame == i && sameResult(expected[i], r)) ++nsame;
+  }
+  check(nsame == frames.size(), what + ": results");
+  check((nfailed > 0) == (what.find("failures") != string::npos),
+    what + ": failed frames");
+  check(db.size() == nprevious + (options.add ? frames.size() - nfailed : 0),
+    what + ": database size");
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void runSequentially(TemplatedDatabase<Descriptor, F> &db,
+  const vector<vector<Descriptor> > &frames, const PipelineOptions &options,
+  vector<FrameResult> &results)
+{
+  const TemplatedVocabulary<Descriptor, F> &voc = *db.getVocabulary();
+  vector<vector<Descriptor> > kept;
+
+  results.assign(frames.size(), FrameResult());
+  for(size_t i = 0; i < frames.size(); ++i)
+  {
+    FrameResult &r = results[i];
+    r.frame = (unsigned int)i;
+
+    FlatBowVector bow;
+    FlatFeatureVector fv;
+    try
+    {
+      voc.transform(frames[i], bow, fv, db.getDirectIndexLevels());
+    }
+    catch(const std::string &ex)
+    {
+      r.status = FRAME_FAILED;
+      r.error = ex;
+      continue;
+    }
+
+    if(db.size() > options.exclude_recent)
+    {
+      db.query(bow, r.candidates, options.query, options.max_results,
+        (int)(db.size() - options.exclude_recent));
+    }
+
+    // the entries added before the query whose features are kept
+    const size_t nkept = kept.size();
+    const size_t keep = options.keep_features;
+    const size_t begin = (keep > 0 && nkept > keep ? nkept - keep : 0);
+
+    if(!options.add) continue;
+    r.entry = db.add(bow, fv);
+    r.added = true;
+    kept.push_back(frames[i]);
+
+    if(options.verify == 0) continue;
+
+    r.matches.resize(min<size_t>(options.verify, r.candidates.size()));
+    for(size_t c = 0; c < r.matches.size(); ++c)
+    {
+      const EntryId id = r.candidates[c].Id;
+      if(id >= begin && id < nkept)
+        db.matchFeatures(fv, frames[i], id, kept[id], r.matches[c],
+          options.match);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void testDrops(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &frames)
+{
+  cout << "Testing the dropped frames..." << endl;
+
+  const size_t N = 30;
+
+  PipelineOptions options;
+  options.drop_frames = true;
+  options.queue_size = 1;
+
+  // the callback of the first frame blocks the last stage until the gate
+  // opens, so the pipeline fills up and the next frames are dropped. The
+  // frames are submitted slowly enough for the stages to take some
+  promise<void> gate;
+  shared_future<void> opened(gate.get_future());
+
+  mutex m;
+  vector<unsigned int> order;
+  vector<FrameResult> results(N);
+  atomic<int> running(0), max_running(0);
+
+  Binary32Database db(voc, true, 1);
+  Binary32Pipeline pipeline(db, options);
+
+  vector<bool> accepted(N);
+  for(size_t i = 0; i < N; ++i)
+  {
+    accepted[i] = pipeline.submit(frames[i], [&, i](const FrameResult &r)
+    {
+      const int now = ++running;
+      if(now > max_running) max_running = now;
+      if(i == 0) opened.wait();
+      {
+        lock_guard<mutex> lock(m);
+        order.push_back(r.frame);
+        results[i] = r;
+      }
+      this_thread::sleep_for(chrono::microseconds(200));
+      --running;
+      if(i == 1) throw std::string("ignored");
+    });
+    this_thread::sleep_for(chrono::milliseconds(2));
+  }
+
+  // the results of the dropped frames wait for the first one
+  future<FrameResult> last = pipeline.submit(frames[N]);
+  check(last.wait_for(chrono::milliseconds(20)) == future_status::timeout,
+    "dropped frame delivered before the previous ones");
+
+  gate.set_value();
+  pipeline.flush();
+
+  const FrameResult r = last.get();
+  check(r.frame == N && r.status == FRAME_DROPPED, "dropped future");
+
+  size_t ndropped = 0, nadded = 0;
+  bool in_order = (order.size() == N), right = true;
+  for(size_t i = 0; i < N; ++i)
+  {
+    in_order = in_order && order[i] == i;
+    if(accepted[i])
+    {
+      right = right && results[i].status == FRAME_DONE &&
+        results[i].added && results[i].entry == nadded++;
+    }
+    else
+    {
+      ++ndropped;
+      right = right && results[i].status == FRAME_DROPPED &&
+        !results[i].added && results[i].candidates.empty();
+    }
+  }
+
+  check(ndropped > 0, "frames dropped");
+  check(in_order, "results in order");
+  check(right, "results of the dropped frames");
+  check(max_running == 1, "callbacks at the same time");
+  check(db.size() == nadded, "database size with drops");
+}
+
+// ----------------------------------------------------------------------------
+
+bool sameResult(const FrameResult &a, const FrameResult &b)
+{
+  if(a.status != b.status || a.added != b.added || a.error != b.error)
+    return false;
+  if(a.added && a.entry != b.entry) return false;
+
+  const QueryResults &ca = a.candidates, &cb = b.candidates;
+  if(ca.size() != cb.size() || a.matches.size() != b.matches.size())
+    return false;
+
+  for(size_t i = 0; i < ca.size(); ++i)
+  {
+    if(fabs(ca[i].Score - cb[i].Score) > 1e-12) return false;
+    if(ca[i].Id != cb[i].Id)
+    {
+      // different ids are only right if they tie with a neighbour, and
+      // then their matches are different too
+      const bool tie = (i > 0 && ca[i].Score == ca[i-1].Score) ||
+        (i + 1 < ca.size() && ca[i].Score == ca[i+1].Score);
+      if(!tie) return false;
+      continue;
+    }
+
+    if(i >= a.matches.size()) continue;
+    const vector<FeatureMatch> &ma = a.matches[i], &mb = b.matches[i];
+    if(ma.size() != mb.size()) return false;
+    for(size_t j = 0; j < ma.size(); ++j)
+    {
+      if(ma[j].query != mb[j].query || ma[j].entry != mb[j].entry ||
+        ma[j].distance != mb[j].distance) return false;
+    }
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,207 @@
+/**
+ * @file dbow2_seal_test.cpp
+ * @brief Tests that the sealed databases give the same results as the
+ * unsealed ones, also after adding, removing and compacting entries.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 2000; ///< entries of the databases
+const int NSEALED = 1500; ///< entries added before sealing
+const int NTHREADS = 3; ///< threads of the pool
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Tests the sealed databases with a type of weights.
+/// \param voc Vocabulary.
+/// \param features Features of the query images.
+/// \param entries Features of the entries.
+/// \param pool Threads.
+/// \param name Name of the weights.
+template<class TWeight>
+void testWeights(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries, ThreadPool &pool,
+  const string &name);
+
+/// \brief Checks that a sealed database gives the same results as an
+/// unsealed one.
+/// \param db Unsealed database.
+/// \param sealed Sealed database.
+/// \param queries Query vectors.
+/// \param what Description of the databases.
+template<class TWeight>
+void checkQueries(
+  const TemplatedDatabase<Descriptor, FBinary32, TWeight> &db,
+  const TemplatedDatabase<Descriptor, FBinary32, TWeight> &sealed,
+  const vector<BowVector> &queries, const string &what);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, entries;
+  createFeatures(features);
+  createEntries(features, NENTRIES, entries);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  ThreadPool pool(NTHREADS);
+
+  try
+  {
+    testWeights<WordValue>(voc, features, entries, pool, "double");
+    testWeights<float>(voc, features, entries, pool, "float");
+    testWeights<FixedWordValue>(voc, features, entries, pool, "fixed-point");
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+void testWeights(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries, ThreadPool &pool,
+  const string &name)
+{
+  typedef TemplatedDatabase<Descriptor, FBinary32, TWeight> Database;
+
+  for(int s = 0; s < NSCORINGS; ++s)
+  {
+    // fixed-point weights need normalized vectors
+    if(is_same<TWeight, FixedWordValue>::value && SCORINGS[s] == DOT_PRODUCT)
+      continue;
+
+    Binary32Vocabulary v(voc);
+    v.setScoringType(SCORINGS[s]);
+
+    const string what = name + " weights, scoring " + to_string(SCORINGS[s]);
+    cout << "Testing the sealed databases with " << what << "..." << endl;
+
+    vector<BowVector> queries;
+    transformAll(v, features, queries);
+
+    // the last entries are added after sealing, to unsealed rows
+    Database db(v, true, 1), sealed(v, true, 1);
+    for(int i = 0; i < NSEALED; ++i)
+    {
+      db.add(entries[i]);
+      sealed.add(entries[i]);
+    }
+
+    const size_t memory = sealed.invertedFileMemory();
+    sealed.seal(s % 2 ? &pool : NULL);
+    check(sealed.invertedFileMemory() < memory, what + ": sealed memory");
+    checkQueries(db, sealed, queries, what + ", sealed");
+
+    for(int i = NSEALED; i < NENTRIES; ++i)
+    {
+      db.add(entries[i]);
+      sealed.add(entries[i]);
+    }
+    checkQueries(db, sealed, queries, what + ", added after sealing");
+
+    // sealing again packs the new entries in new segments
+    sealed.seal();
+    checkQueries(db, sealed, queries, what + ", sealed twice");
+
+    bool same_features = true;
+    for(EntryId id = 0; id < db.size(); ++id)
+    {
+      same_features = same_features &&
+        db.retrieveFlatFeatures(id) == sealed.retrieveFlatFeatures(id);
+    }
+    check(same_features, what + ": direct index");
+
+    // the removed entries are in sealed and unsealed rows
+    for(EntryId id = 0; id < db.size(); id += 7)
+    {
+      db.remove(id);
+      sealed.remove(id);
+    }
+    checkQueries(db, sealed, queries, what + ", removed entries");
+
+    db.compact(false, &pool);
+    sealed.compact(false, &pool);
+    checkQueries(db, sealed, queries, what + ", compacted");
+
+    const vector<EntryId> ids = db.compact(true);
+    check(sealed.compact(true, &pool) == ids, what + ": renumbered ids");
+    check(sealed.size() == db.size(), what + ": renumbered size");
+    checkQueries(db, sealed, queries, what + ", renumbered");
+
+    for(int i = 0; i < NIMAGES; ++i)
+    {
+      db.add(entries[i]);
+      sealed.add(entries[i]);
+    }
+    checkQueries(db, sealed, queries, what + ", added after compacting");
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+template<class TWeight>
+void checkQueries(
+  const TemplatedDatabase<Descriptor, FBinary32, TWeight> &db,
+  const TemplatedDatabase<Descriptor, FBinary32, TWeight> &sealed,
+  const vector<BowVector> &queries, const string &what)
+{
+  // all the results, the best ones of some entries, and the best ones with
+  // early termination and a filter, which skip the blocks of the segments
+  QueryOptions early, filtered;
+  early.early_termination = true;
+  filtered.filter = QueryFilter(300, 700).include(1200);
+
+  const QueryOptions *options[] = { NULL, NULL, &early, &filtered };
+  const int max_results[] = { 0, 5, 5, 10 };
+  const int max_ids[] = { -1, 1000, -1, -1 };
+
+  for(int c = 0; c < 4; ++c)
+  {
+    bool ok = true;
+    for(size_t i = 0; i < queries.size(); ++i)
+    {
+      QueryResults a, b;
+      if(options[c])
+      {
+        db.query(queries[i], a, *options[c], max_results[c], max_ids[c]);
+        sealed.query(queries[i], b, *options[c], max_results[c], max_ids[c]);
+      }
+      else
+      {
+        db.query(queries[i], a, max_results[c], max_ids[c]);
+        sealed.query(queries[i], b, max_results[c], max_ids[c]);
+      }
+      ok = ok && identicalResults(a, b);
+    }
+
+    check(ok, what + ": results with max_results " +
+      to_string(max_results[c]) + ", max_id " + to_string(max_ids[c]) +
+      (c == 2 ? ", early termination" : "") + (c == 3 ? ", a filter" : ""));
+  }
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,328 @@
+/**
+ * @file dbow2_sharded_test.cpp
+ * @brief Tests that the sharded databases, and the results of shards
+ * merged after being serialized, give the results of a single database.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 2000; ///< entries of the databases
+const int NSHARDS = 4; ///< shards of the databases
+const int NTHREADS = 3; ///< threads of the pool
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Tests a scoring.
+/// \param voc Vocabulary.
+/// \param features Features of the query images.
+/// \param entries Features of the entries.
+/// \param pool Threads.
+void testScoring(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries, ThreadPool &pool);
+
+/// \brief Checks that a sharded database gives the results of a single
+/// one, directly and merging the serialized results of its shards.
+/// \param db Single database.
+/// \param sharded Sharded database.
+/// \param queries Query vectors.
+/// \param pool Threads.
+/// \param what Description of the databases.
+void checkQueries(const Binary32Database &db,
+  const Binary32ShardedDatabase &sharded,
+  const vector<FlatBowVector> &queries, ThreadPool &pool,
+  const string &what);
+
+/// \brief Tests that the entries whose shard fails to add them do not
+/// change the sharded databases.
+/// \param features Features of the query images.
+/// \param entries Features of the entries.
+void testFailedAdd(const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries);
+
+/// \brief Tests QueryResults::merge, serialize and deserialize.
+/// \param db Database.
+/// \param queries Query vectors.
+/// \param what Description of the database.
+void testResults(const Binary32Database &db,
+  const vector<FlatBowVector> &queries, const string &what);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, entries;
+  createFeatures(features);
+  createEntries(features, NENTRIES, entries);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  ThreadPool pool(NTHREADS);
+
+  try
+  {
+    for(int s = 0; s < NSCORINGS; ++s)
+    {
+      Binary32Vocabulary v(voc);
+      v.setScoringType(SCORINGS[s]);
+      testScoring(v, features, entries, pool);
+    }
+
+    testFailedAdd(features, entries);
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+void testScoring(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries, ThreadPool &pool)
+{
+  const string name = "scoring " + to_string(voc.getScoringType());
+  cout << "Testing the sharded databases with the " << name << "..." << endl;
+
+  vector<FlatBowVector> queries;
+  transformAll(voc, features, queries);
+
+  // the entries fill the shards in order, or are spread among them, with
+  // the same global ids as in the single database
+  Binary32Database db(voc, true, 1);
+  Binary32ShardedDatabase filled(voc, NSHARDS, NENTRIES / NSHARDS, true, 1),
+    spread(voc, NSHARDS, 0, true, 1);
+  for(size_t i = 0; i < entries.size(); ++i)
+  {
+    db.add(entries[i]);
+    filled.add(entries[i]);
+    spread.add((unsigned int)((i * 7) % NSHARDS), entries[i]);
+  }
+
+  check(filled.size() == db.size() && spread.size() == db.size(),
+    name + ": sizes");
+
+  testResults(db, queries, name);
+  checkQueries(db, filled, queries, pool, name + ", filled shards");
+  checkQueries(db, spread, queries, pool, name + ", spread entries");
+
+  for(EntryId id = 0; id < db.size(); id += 9)
+  {
+    db.remove(id);
+    filled.remove(id);
+    spread.remove(id);
+  }
+  checkQueries(db, spread, queries, pool, name + ", removed entries");
+
+  // the sealed shards keep their results
+  spread.seal(1);
+  checkQueries(db, spread, queries, pool, name + ", a sealed shard");
+}
+
+// ----------------------------------------------------------------------------
+
+void checkQueries(const Binary32Database &db,
+  const Binary32ShardedDatabase &sharded,
+  const vector<FlatBowVector> &queries, ThreadPool &pool,
+  const string &what)
+{
+  const int max_results[] = { 0, 1, 10 };
+  const int max_ids[] = { -1, 0, 700 };
+
+  for(int k = 0; k < 3; ++k)
+  {
+    for(int m = 0; m < 3; ++m)
+    {
+      bool ok = true, ok_pool = true;
+      for(size_t i = 0; i < queries.size(); ++i)
+      {
+        QueryResults expected, ret, ret_pool;
+        db.query(queries[i], expected, max_results[k], max_ids[m]);
+        sharded.query(queries[i], ret, max_results[k], max_ids[m]);
+        sharded.query(queries[i], ret_pool, max_results[k], max_ids[m],
+          &pool);
+        ok = ok && sameResults(expected, ret);
+        ok_pool = ok_pool && sameResults(expected, ret_pool);
+      }
+
+      const string which = " with max_results " + to_string(max_results[k]) +
+        ", max_id " + to_string(max_ids[m]);
+      check(ok, what + ": query" + which);
+      check(ok_pool, what + ": query with a pool" + which);
+    }
+
+    // the shards are queried apart and their results are sent in a buffer
+    bool ok = true;
+    for(size_t i = 0; i < queries.size(); ++i)
+    {
+      vector<unsigned char> buffer;
+      for(unsigned int s = 0; s < sharded.shards(); ++s)
+      {
+        QueryResults part;
+        sharded.shard(s).query(queries[i], part, max_results[k]);
+        part.serialize(buffer);
+      }
+
+      vector<QueryResults> parts(sharded.shards());
+      size_t p = 0;
+      for(unsigned int s = 0; s < sharded.shards(); ++s)
+        p += parts[s].deserialize(&buffer[p], buffer.size() - p);
+
+      QueryResults expected, ret;
+      db.query(queries[i], expected, max_results[k]);
+      sharded.merge(parts, ret, max_results[k]);
+      ok = ok && p == buffer.size() && sameResults(expected, ret);
+    }
+    check(ok, what + ": merge of serialized shards with max_results " +
+      to_string(max_results[k]));
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void testResults(const Binary32Database &db,
+  const vector<FlatBowVector> &queries, const string &what)
+{
+  const bool ascending = (db.getVocabulary()->getScoringType() == KL);
+
+  bool merged = true, serialized = true, truncated = true;
+  for(size_t i = 0; i < queries.size(); ++i)
+  {
+    QueryResults all;
+    db.query(queries[i], all, 0);
+
+    // the entries split by id, each part with its own best ones
+    for(int k = 0; k < 3; ++k)
+    {
+      const int max_results = (k == 0 ? 0 : (k == 1 ? 1 : 10));
+
+      vector<QueryResults> parts(3);
+      for(size_t r = 0; r < all.size(); ++r)
+        parts[all[r].Id % 3].push_back(all[r]);
+      for(size_t p = 0; p < parts.size(); ++p)
+        parts[p].selectBest(max_results, ascending);
+
+      QueryResults expected(all), ret;
+      expected.selectBest(max_results, ascending);
+      QueryResults::merge(parts, ret, max_results, ascending);
+      merged = merged && sameResults(expected, ret);
+    }
+
+    // the ids and scores are kept, and the other fields are 0
+    vector<unsigned char> buffer(5, 0xff);
+    all.serialize(buffer);
+
+    QueryResults read;
+    read.push_back(Result(1, 2.0));
+    const size_t bytes = read.deserialize(&buffer[5], buffer.size() - 5);
+    serialized = serialized && bytes == buffer.size() - 5 &&
+      read.size() == all.size();
+    for(size_t r = 0; serialized && r < all.size(); ++r)
+    {
+      serialized = read[r].Id == all[r].Id && read[r].Score == all[r].Score &&
+        read[r].nWords == 0;
+    }
+
+    if(!all.empty())
+    {
+      try
+      {
+        read.deserialize(&buffer[5], buffer.size() - 6);
+        truncated = false;
+      }
+      catch(const std::string &) {}
+    }
+  }
+
+  check(merged, what + ": QueryResults::merge");
+  check(serialized, what + ": QueryResults::serialize");
+  check(truncated, what + ": QueryResults::deserialize of truncated data");
+}
+
+// ----------------------------------------------------------------------------
+
+void testFailedAdd(const vector<vector<Descriptor> > &features,
+  const vector<vector<Descriptor> > &entries)
+{
+  cout << "Testing the entries that fail to be added..." << endl;
+
+  TemplatedVocabulary<Descriptor, FFailing> voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+
+  vector<Descriptor> wrong(entries[0]);
+  wrong.push_back(FFailing::failing());
+
+  // some entries fail between the others, in every shard
+  TemplatedDatabase<Descriptor, FFailing> db(voc, true, 1);
+  TemplatedShardedDatabase<Descriptor, FFailing>
+    filled(voc, NSHARDS, NENTRIES / NSHARDS, true, 1),
+    spread(voc, NSHARDS, 0, true, 1);
+
+  bool thrown = true;
+  for(int i = 0; i < NENTRIES; ++i)
+  {
+    if(i % 7 == 3)
+    {
+      try { filled.add(wrong); thrown = false; }
+      catch(const std::string &) {}
+      try { spread.add((unsigned int)(i % NSHARDS), wrong); thrown = false; }
+      catch(const std::string &) {}
+    }
+
+    db.add(entries[i]);
+    filled.add(entries[i]);
+    spread.add((unsigned int)(i % NSHARDS), entries[i]);
+  }
+  check(thrown, "failed add: exceptions");
+
+  const TemplatedShardedDatabase<Descriptor, FFailing> *sharded[] =
+    { &filled, &spread };
+  for(int k = 0; k < 2; ++k)
+  {
+    const string what = string("failed add") +
+      (k ? ", spread entries" : ", filled shards");
+
+    // the global and local ids of the entries match
+    unsigned int nlocal = 0;
+    for(unsigned int s = 0; s < sharded[k]->shards(); ++s)
+      nlocal += sharded[k]->shard(s).size();
+    bool ids = sharded[k]->size() == db.size() && nlocal == db.size();
+    for(EntryId id = 0; ids && id < sharded[k]->size(); ++id)
+    {
+      ids = sharded[k]->globalId(sharded[k]->shardOf(id),
+        sharded[k]->localId(id)) == id;
+    }
+    check(ids, what + ": ids");
+
+    bool same = true;
+    for(size_t i = 0; i < features.size(); ++i)
+    {
+      QueryResults expected, ret;
+      db.query(features[i], expected, 10);
+      sharded[k]->query(features[i], ret, 10);
+      same = same && sameResults(expected, ret);
+    }
+    check(same, what + ": results");
+  }
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,381 @@
+/**
+ * @file dbow2_stats_test.cpp
+ * @brief Tests that the stats do not change the results of transforms and
+ * queries and, if they are enabled, that they count the work done.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const int NENTRIES = 60; ///< entries of the databases
+const int NTHREADS = 3; ///< threads of the pool
+
+/// \brief Vocabulary that tells the number of children of its nodes.
+template<class F>
+class InspectedVocabulary: public TemplatedVocabulary<Descriptor, F>
+{
+public:
+
+  /// \brief Creates an empty vocabulary.
+  /// \param k Branching factor.
+  /// \param L Depth levels.
+  InspectedVocabulary(int k, int L):
+    TemplatedVocabulary<Descriptor, F>(k, L, TF_IDF, L1_NORM) {}
+
+  /// \brief Returns the number of children of a node.
+  /// \param id Node id.
+  size_t children(NodeId id) const
+  {
+    return this->m_nodes[id].children.size();
+  }
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Returns whether the counters of two stats are the same. The
+/// times are not compared.
+/// \param a Stats.
+/// \param b Stats.
+bool sameCounters(const QueryStats &a, const QueryStats &b);
+
+/// \brief Counts the work of a transform by walking the tree up from the
+/// word of each descriptor.
+/// \param voc Vocabulary.
+/// \param features Descriptors of an image.
+/// @param[out] expected Descriptors, distances and levels.
+template<class F>
+void countTransform(const InspectedVocabulary<F> &voc,
+  const vector<Descriptor> &features, QueryStats &expected);
+
+/// \brief Counts the work of a query by looking for its words in the
+/// vectors of the entries.
+/// \param vec Query vector.
+/// \param entries Vector of each entry.
+/// \param removed Removed entries.
+/// \param end_id Only the entries with id < end_id are visited.
+/// \param results Results of the query.
+/// @param[out] expected Counters of the inverted file.
+void countQuery(const FlatBowVector &vec, const vector<BowVector> &entries,
+  const vector<EntryId> &removed, EntryId end_id, const QueryResults &results,
+  QueryStats &expected);
+
+/// \brief Tests the stats of the transforms of a descriptor class.
+/// \param features Features of the images.
+/// \param pool Threads.
+/// \param what Description of the test.
+template<class F>
+void testTransforms(const vector<vector<Descriptor> > &features,
+  ThreadPool &pool, const string &what);
+
+/// \brief Tests the stats of the queries of a scoring.
+/// \param voc Vocabulary.
+/// \param queries Features of the queries.
+/// \param entries Features of the entries.
+/// \param scoring Scoring of the database.
+/// \param pool Threads.
+void testQueries(Binary32Vocabulary voc,
+  const vector<vector<Descriptor> > &queries,
+  const vector<vector<Descriptor> > &entries, ScoringType scoring,
+  ThreadPool &pool);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, entries;
+  createFeatures(features);
+  createEntries(features, NENTRIES, entries, true);
+
+  ThreadPool pool(NTHREADS);
+
+#ifdef DBOW2_ENABLE_STATS
+  cout << "The stats are enabled" << endl;
+#else
+  cout << "The stats are disabled" << endl;
+#endif
+
+  try
+  {
+    testTransforms<FBinary32>(features, pool, "packed");
+    testTransforms<FScalar>(features, pool, "unpacked");
+
+    Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+    voc.create(features);
+    for(int s = 0; s < NSCORINGS; ++s)
+      testQueries(voc, features, entries, SCORINGS[s], pool);
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+bool sameCounters(const QueryStats &a, const QueryStats &b)
+{
+  return a.descriptors == b.descriptors && a.distances == b.distances &&
+    a.levels == b.levels && a.queries == b.queries && a.lists == b.lists &&
+    a.postings == b.postings && a.candidates == b.candidates &&
+    a.results == b.results;
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void countTransform(const InspectedVocabulary<F> &voc,
+  const vector<Descriptor> &features, QueryStats &expected)
+{
+  expected.clear();
+  expected.descriptors = features.size();
+
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    // the children of each node from the root to the parent of the word
+    // are compared with the descriptor
+    const WordId wid = voc.transform(features[i]);
+    for(int up = 1; ; ++up)
+    {
+      const NodeId parent = voc.getParentNode(wid, up);
+      expected.distances += voc.children(parent);
+      if(parent == 0)
+      {
+        expected.levels += up;
+        break;
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void countQuery(const FlatBowVector &vec, const vector<BowVector> &entries,
+  const vector<EntryId> &removed, EntryId end_id, const QueryResults &results,
+  QueryStats &expected)
+{
+  expected.clear();
+  expected.queries = 1;
+  expected.lists = vec.size();
+  expected.results = results.size();
+
+  for(EntryId id = 0; id < end_id; ++id)
+  {
+    unsigned int common = 0;
+    for(size_t i = 0; i < vec.size(); ++i)
+      common += entries[id].count(vec.id(i));
+
+    // the postings of the removed entries are visited, but they are not
+    // candidates
+    expected.postings += common;
+    if(common > 0 && find(removed.begin(), removed.end(), id) == removed.end())
+      ++expected.candidates;
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void testTransforms(const vector<vector<Descriptor> > &features,
+  ThreadPool &pool, const string &what)
+{
+  cout << "Testing the stats of the " << what << " transforms..." << endl;
+
+  InspectedVocabulary<F> voc(5, 3);
+  voc.create(features);
+
+  // the walks up the tree are transforms too, so they are done first
+  vector<QueryStats> expected(features.size());
+#ifdef DBOW2_ENABLE_STATS
+  for(size_t i = 0; i < features.size(); ++i)
+    countTransform(voc, features[i], expected[i]);
+#endif
+
+  voc.resetStats();
+
+  bool same = true, counted = true, threaded = true;
+  QueryStats all;
+
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    FlatBowVector plain, v, tv;
+    voc.transform(features[i], plain);
+
+    QueryStats s, ts;
+    voc.transform(features[i], v, NULL, &s);
+    voc.transform(features[i], tv, &pool, &ts);
+    same = same && v == plain && tv == plain;
+
+    counted = counted && sameCounters(s, expected[i]);
+    threaded = threaded && sameCounters(ts, expected[i]);
+
+    // the transforms without stats of the caller are counted too
+    for(int k = 0; k < 3; ++k) all += expected[i];
+  }
+
+  const bool cumulative = sameCounters(voc.getStats(), all);
+
+  check(same, what + ": the vectors with stats are those without them");
+  check(counted, what + ": the stats count the work of the transforms");
+  check(threaded, what + ": the stats of threaded transforms");
+  check(cumulative, what + ": the cumulative stats of the vocabulary");
+
+#ifdef DBOW2_ENABLE_STATS
+  check(all.descriptors > 0 && all.distances > all.levels,
+    what + ": some work counted");
+#endif
+
+  voc.resetStats();
+  check(sameCounters(voc.getStats(), QueryStats()),
+    what + ": the stats are reset");
+}
+
+// ----------------------------------------------------------------------------
+
+void testQueries(Binary32Vocabulary voc,
+  const vector<vector<Descriptor> > &queries,
+  const vector<vector<Descriptor> > &entries, ScoringType scoring,
+  ThreadPool &pool)
+{
+  const string what = "scoring " + to_string(scoring);
+  cout << "Testing the stats of the queries with " << what << "..." << endl;
+
+  voc.setScoringType(scoring);
+  Binary32Database db(voc, false);
+
+  vector<BowVector> entry_vecs;
+  transformAll(voc, entries, entry_vecs);
+  for(size_t i = 0; i < entry_vecs.size(); ++i) db.add(entry_vecs[i]);
+
+  vector<EntryId> removed;
+  removed.push_back(3);
+  removed.push_back(NENTRIES / 2 + 1);
+  for(size_t i = 0; i < removed.size(); ++i) db.remove(removed[i]);
+
+  vector<FlatBowVector> vecs;
+  transformAll(voc, queries, vecs);
+
+  db.resetStats();
+  db.getVocabulary()->resetStats();
+
+  bool same = true, counted = true;
+  QueryStats total;
+
+  // the best of all the entries, and all of the first half
+  const int max_ids[] = { -1, NENTRIES / 2 };
+  const int max_results[] = { 10, 0 };
+  for(int m = 0; m < 2; ++m)
+  {
+    const EntryId end_id = (max_ids[m] < 0 ? NENTRIES : max_ids[m]);
+
+    for(size_t i = 0; i < vecs.size(); ++i)
+    {
+      QueryResults plain, ret;
+      db.query(vecs[i], plain, max_results[m], max_ids[m]);
+
+      QueryStats s, expected;
+      db.query(vecs[i], ret, max_results[m], max_ids[m], &s);
+      same = same && identicalResults(plain, ret);
+
+#ifdef DBOW2_ENABLE_STATS
+      countQuery(vecs[i], entry_vecs, removed, end_id, ret, expected);
+#else
+      (void)end_id;
+#endif
+      counted = counted && sameCounters(s, expected);
+      total += s;
+    }
+  }
+
+  check(same, what + ": the results with stats are those without them");
+  check(counted, what + ": the stats count the work of the queries");
+
+  // the queries without stats of the caller are counted too
+  QueryStats all = total;
+  all += total;
+#ifndef DBOW2_ENABLE_STATS
+  all.clear();
+#endif
+  check(sameCounters(db.getStats(), all),
+    what + ": the cumulative stats of the database");
+
+  // the batches visit each row once for all the queries of a group, so
+  // they may visit fewer postings
+  vector<QueryResults> batch, plain_batch;
+  db.queryBatch(vecs, plain_batch, 10);
+
+  QueryStats bs, expected;
+  db.queryBatch(vecs, batch, 10, -1, &pool, &bs);
+
+  bool batch_same = (batch.size() == vecs.size());
+  QueryStats singles;
+  for(size_t i = 0; batch_same && i < vecs.size(); ++i)
+  {
+    QueryResults ret;
+    QueryStats s;
+    db.query(vecs[i], ret, 10, -1, &s);
+    batch_same = identicalResults(plain_batch[i], batch[i]) &&
+      sameResults(ret, batch[i]);
+    singles += s;
+  }
+  check(batch_same, what + ": the batch results with stats");
+
+#ifdef DBOW2_ENABLE_STATS
+  expected = singles;
+  expected.postings = bs.postings;
+  check(bs.postings > 0 && bs.postings <= singles.postings,
+    what + ": the postings of a batch");
+#endif
+  check(sameCounters(bs, expected), what + ": the stats of a batch");
+
+  // the database only counts the work on its inverted file, and the
+  // vocabulary the transforms of the queries with descriptors
+  db.resetStats();
+  db.getVocabulary()->resetStats();
+
+  QueryResults plain, ret;
+  db.query(queries[0], plain, 10);
+
+  QueryStats s, transform, query;
+  db.query(queries[0], ret, 10, -1, &s);
+  check(identicalResults(plain, ret),
+    what + ": the results of the descriptors with stats");
+
+#ifdef DBOW2_ENABLE_STATS
+  FlatBowVector v;
+  db.getVocabulary()->transform(queries[0], v, NULL, &transform);
+  db.query(v, ret, 10, -1, &query);
+  db.getVocabulary()->resetStats();
+  db.resetStats();
+  db.query(queries[0], ret, 10, -1);
+#endif
+
+  QueryStats sum = transform;
+  sum += query;
+  check(sameCounters(s, sum), what + ": the stats of a transform and query");
+  check(sameCounters(db.getStats(), query) &&
+    sameCounters(db.getVocabulary()->getStats(), transform),
+    what + ": the stats of the database and of its vocabulary");
+
+  db.resetStats();
+  check(sameCounters(db.getStats(), QueryStats()),
+    what + ": the stats are reset");
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,249 @@
+/**
+ * @file dbow2_surf_test.cpp
+ * @brief Tests the SURF64 distances against plain loops and that the trees
+ * trained with matrix products are those of the plain k-means.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+#include <DBoW2/FSurf64.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+/// \brief SURF64 descriptor.
+typedef FSurf64::TDescriptor Surf;
+
+/// \brief SURF64 descriptors without packed representation, so that the
+/// k-means compares descriptors and clusters one by one, with
+/// FSurf64::distance.
+class FSurfScalar: public FSurf64 {};
+
+const unsigned int SEED = 1234; ///< seed of the trees created
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Creates NIMAGES random images of NFEATURES SURF64 features of a
+/// few kinds. Some features repeat others.
+/// @param[out] features Features of each image.
+/// \param offset Value added to every component. Large offsets make the
+///   float products of the k-means inexact.
+void createSurfFeatures(vector<vector<Surf> > &features, float offset = 0);
+
+/// \brief Returns the squared distance of two descriptors as the original
+/// FSurf64::distance did: the squares in float, added up in order.
+/// \param a Descriptor.
+/// \param b Descriptor.
+double plainDistance(const Surf &a, const Surf &b);
+
+/// \brief Tests the distances, nearest descriptors and means of FSurf64
+/// against plain loops.
+/// \param features Features of the images.
+void testDistances(const vector<vector<Surf> > &features);
+
+/// \brief Tests that the trees trained with matrix products are those of
+/// the plain k-means.
+/// \param features Features of the images.
+/// \param k Branching factor.
+/// \param L Depth levels.
+/// \param pool If given, threads to train with.
+void testTrees(const vector<vector<Surf> > &features, int k, int L,
+  ThreadPool *pool);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Surf> > features, far;
+  createSurfFeatures(features);
+  createSurfFeatures(far, 30);
+
+  ThreadPool pool(3);
+
+  try
+  {
+    testDistances(features);
+    testTrees(features, 5, 3, NULL);
+    testTrees(features, 9, 2, NULL);
+    testTrees(features, 5, 3, &pool);
+    testTrees(far, 5, 3, NULL);
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+void createSurfFeatures(vector<vector<Surf> > &features, float offset)
+{
+  // descriptors of the same kind are close, as those of createFeatures
+  unsigned int seed = 12345;
+  features.resize(NIMAGES);
+  for(int i = 0; i < NIMAGES; ++i)
+  {
+    features[i].resize(NFEATURES);
+    for(int j = 0; j < NFEATURES; ++j)
+    {
+      if(j % 10 == 9)
+      {
+        // a copy of another feature
+        features[i][j] = features[(i * 7) % (i + 1)][j - 9];
+        continue;
+      }
+
+      const int kind = (i + j) % 7;
+      features[i][j].resize(FSurf64::L);
+      for(int d = 0; d < FSurf64::L; ++d)
+      {
+        seed = seed * 1103515245u + 12345u;
+        const float noise = (float)((seed >> 8) % 1000) / 1000.f - 0.5f;
+        features[i][j][d] = (float)((kind * 13 + d) % 11) / 10.f - 0.5f +
+          0.1f * noise + offset;
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+double plainDistance(const Surf &a, const Surf &b)
+{
+  double d = 0;
+  for(int i = 0; i < FSurf64::L; ++i)
+  {
+    const float s = a[i] - b[i];
+    d += s * s;
+  }
+  return d;
+}
+
+// ----------------------------------------------------------------------------
+
+void testDistances(const vector<vector<Surf> > &features)
+{
+  cout << "Testing the SURF64 distances..." << endl;
+
+  const vector<Surf> &a = features[0], &b = features[1];
+
+  // b packed into contiguous blocks
+  vector<unsigned char> blocks(b.size() * DescriptorTraits<FSurf64>::bytes);
+  for(size_t j = 0; j < b.size(); ++j)
+    DescriptorTraits<FSurf64>::pack(b[j],
+      &blocks[j * DescriptorTraits<FSurf64>::bytes]);
+
+  bool distance = true, batch = true, nearest = true;
+  vector<double> d(b.size());
+  for(size_t i = 0; i < a.size(); ++i)
+  {
+    unsigned char q[DescriptorTraits<FSurf64>::bytes];
+    DescriptorTraits<FSurf64>::pack(a[i], q);
+
+    size_t best = 0;
+    for(size_t j = 0; j < b.size(); ++j)
+    {
+      const double plain = plainDistance(a[i], b[j]);
+      const double d_ab = FSurf64::distance(a[i], b[j]);
+      distance = distance && fabs(d_ab - plain) <= 1e-9 * (1 + plain) &&
+        d_ab == FSurf64::distance(&a[i][0], &b[j][0]);
+
+      if(FSurf64::distance(a[i], b[j]) < FSurf64::distance(a[i], b[best]))
+        best = j;
+    }
+
+    DescriptorTraits<FSurf64>::distances(q, &blocks[0], b.size(), &d[0]);
+    for(size_t j = 0; j < b.size(); ++j)
+      batch = batch && d[j] == FSurf64::distance(a[i], b[j]);
+
+    double best_d = -1;
+    nearest = nearest && best ==
+      DescriptorTraits<FSurf64>::nearest(q, &blocks[0], b.size(), &best_d) &&
+      best_d == FSurf64::distance(a[i], b[best]);
+  }
+
+  check(distance, "distances of a loop");
+  check(batch, "distances of a batch");
+  check(nearest, "nearest descriptors");
+
+  // the mean of the images of a kind
+  vector<FSurf64::pDescriptor> descriptors;
+  for(size_t i = 0; i < a.size(); ++i) descriptors.push_back(&a[i]);
+
+  Surf mean;
+  FSurf64::meanValue(descriptors, mean);
+  bool same = (mean.size() == (size_t)FSurf64::L);
+  for(int k = 0; same && k < FSurf64::L; ++k)
+  {
+    double sum = 0;
+    for(size_t i = 0; i < a.size(); ++i) sum += a[i][k];
+    same = fabs(mean[k] - sum / a.size()) <= 1e-5;
+  }
+  check(same, "mean value");
+}
+
+// ----------------------------------------------------------------------------
+
+void testTrees(const vector<vector<Surf> > &features, int k, int L,
+  ThreadPool *pool)
+{
+  const string what = "k = " + to_string(k) + ", L = " + to_string(L) +
+    (pool ? ", threads" : "") + (features[0][0][0] > 10 ? ", far" : "");
+  cout << "Testing the trees of SURF64 with " << what << "..." << endl;
+
+  // a cap on the iterations, so that k-means stops if it assigns the
+  // descriptors inconsistently
+  KMeansOptions options;
+  options.max_iterations = 100;
+
+  TemplatedVocabulary<Surf, FSurf64> product(k, L, TF_IDF, L1_NORM);
+  product.setKMeansOptions(options);
+  srand(SEED);
+  if(pool) product.create(features, *pool);
+  else product.create(features);
+
+  TemplatedVocabulary<Surf, FSurfScalar> plain(k, L, TF_IDF, L1_NORM);
+  plain.setKMeansOptions(options);
+  srand(SEED);
+  if(pool) plain.create(features, *pool);
+  else plain.create(features);
+
+  // the same words, at the same place of the tree
+  bool same = (product.size() == plain.size() && product.size() > 0);
+  for(WordId w = 0; same && w < product.size(); ++w)
+  {
+    same = product.getWord(w) == plain.getWord(w) &&
+      product.getWordWeight(w) == plain.getWordWeight(w);
+    for(int up = 1; same && up <= L; ++up)
+      same = product.getParentNode(w, up) == plain.getParentNode(w, up);
+  }
+  check(same, what + ": the words of the plain k-means");
+
+  // and the same vectors
+  bool vectors = true;
+  for(size_t i = 0; vectors && i < features.size(); ++i)
+  {
+    BowVector a, b;
+    product.transform(features[i], a);
+    plain.transform(features[i], b);
+    vectors = (a == b);
+  }
+  check(vectors, what + ": the vectors of the plain k-means");
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,214 @@
+/**
+ * @file dbow2_test_utils.h
+ * @brief Functions shared by the tests: checks, random images and
+ * comparison of query results.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_DBOW2_TEST_UTILS__
+#define __D_T_DBOW2_TEST_UTILS__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <mutex>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+/// \brief Descriptor of the tests.
+typedef FBinary32::TDescriptor Descriptor;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Binary descriptors whose distance throws with a given descriptor,
+/// to make the transform of some images fail.
+class FFailing: public FBinary32
+{
+public:
+
+  /// \brief Descriptor that makes distance throw.
+  static Descriptor failing()
+  {
+    Descriptor d;
+    d.fill(~(uint64_t)0);
+    return d;
+  }
+
+  /// \brief Hamming distance.
+  /// \throw std::string if a is the failing descriptor.
+  static double distance(const Descriptor &a, const Descriptor &b)
+  {
+    if(a == failing()) throw std::string("failing descriptor");
+    return FBinary32::distance(a, b);
+  }
+};
+
+/// \brief Binary descriptors without packed representation, so that the
+/// distances are computed with F::distance.
+class FScalar: public FBinary32 {};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+const int NIMAGES = 40; ///< number of images
+const int NFEATURES = 60; ///< features of each image
+
+/// \brief Scorings the tests are run with.
+const DBoW2::ScoringType SCORINGS[] = { DBoW2::L1_NORM, DBoW2::L2_NORM,
+  DBoW2::CHI_SQUARE, DBoW2::KL, DBoW2::BHATTACHARYYA, DBoW2::DOT_PRODUCT };
+const int NSCORINGS = 6; ///< number of scorings
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Returns the number of failed checks.
+inline int& failures()
+{
+  static int n = 0;
+  return n;
+}
+
+/// \brief Reports a failed check. Several threads may call it.
+/// \param ok Result of the check.
+/// \param what Description of the check.
+inline void check(bool ok, const std::string &what)
+{
+  static std::mutex mutex;
+  if(!ok)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << "FAILED: " << what << std::endl;
+    ++failures();
+  }
+}
+
+/// \brief Prints the outcome of the checks.
+/// \return 0 iff all the checks passed, to be returned by main.
+inline int report()
+{
+  if(failures() == 0) std::cout << "All the checks passed" << std::endl;
+  else std::cout << failures() << " checks failed" << std::endl;
+
+  return (failures() == 0 ? 0 : 1);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Creates NIMAGES random images of NFEATURES features of a few
+/// kinds.
+/// @param[out] features Features of each image.
+inline void createFeatures(std::vector<std::vector<Descriptor> > &features)
+{
+  // descriptors of the same kind share most of their bits, so that the
+  // images of a kind share words
+  unsigned int seed = 12345;
+  features.resize(NIMAGES);
+  for(int i = 0; i < NIMAGES; ++i)
+  {
+    features[i].resize(NFEATURES);
+    for(int j = 0; j < NFEATURES; ++j)
+    {
+      const uint64_t kind = (uint64_t)((i + j) % 7) * 0x9e3779b97f4a7c15ULL;
+      for(int w = 0; w < FBinary32::W; ++w)
+      {
+        seed = seed * 1103515245u + 12345u;
+        features[i][j][w] = (kind << w) ^ ((uint64_t)(seed >> 8) & 0x0f0f);
+      }
+    }
+  }
+}
+
+/// \brief Creates images that see some of the features of the given ones,
+/// e.g. the entries of a database. Image i sees image (i * step) % NIMAGES.
+/// \param features Features of the images.
+/// \param n Number of images to create.
+/// @param[out] entries Features of each new image.
+/// \param varied If true, the images keep from 1/2 to 4/5 of the features,
+///   so that their scores are different. Otherwise they keep 2/3 of them.
+/// \param step Step between the images seen.
+inline void createEntries(
+  const std::vector<std::vector<Descriptor> > &features, int n,
+  std::vector<std::vector<Descriptor> > &entries, bool varied = false,
+  int step = 1)
+{
+  unsigned int seed = 54321;
+  entries.clear();
+  entries.resize(n);
+  for(int i = 0; i < n; ++i)
+  {
+    const std::vector<Descriptor> &image = features[(i * step) % NIMAGES];
+    const unsigned int keep = (varied ? 2 + i % 5 : 3);
+    for(size_t j = 0; j < image.size(); ++j)
+    {
+      seed = seed * 1103515245u + 12345u;
+      if((seed >> 16) % keep != 0) entries[i].push_back(image[j]);
+    }
+  }
+}
+
+/// \brief Transforms some images.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+/// @param[out] vecs Bow vector of each image, BowVector or FlatBowVector.
+template<class TVocabulary, class TBowVector>
+void transformAll(const TVocabulary &voc,
+  const std::vector<std::vector<Descriptor> > &features,
+  std::vector<TBowVector> &vecs)
+{
+  vecs.resize(features.size());
+  for(size_t i = 0; i < features.size(); ++i)
+    voc.transform(features[i], vecs[i]);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Returns whether two results are the same. Results whose scores
+/// differ at most tolerance may be in different order.
+/// \param a Results.
+/// \param b Results.
+/// \param tolerance Difference allowed between scores.
+/// \param words If true, the results of the same entry must have the same
+///   number of words too.
+inline bool sameResults(const DBoW2::QueryResults &a,
+  const DBoW2::QueryResults &b, double tolerance = 1e-12, bool words = false)
+{
+  if(a.size() != b.size()) return false;
+
+  for(size_t i = 0; i < a.size(); ++i)
+  {
+    if(std::fabs(a[i].Score - b[i].Score) > tolerance) return false;
+    if(a[i].Id == b[i].Id)
+    {
+      if(words && a[i].nWords != b[i].nWords) return false;
+      continue;
+    }
+
+    // different ids are only right if they tie with a neighbour
+    const bool tie =
+      (i > 0 && std::fabs(a[i].Score - a[i-1].Score) <= tolerance) ||
+      (i + 1 < a.size() && std::fabs(a[i].Score - a[i+1].Score) <= tolerance);
+    if(!tie) return false;
+  }
+  return true;
+}
+
+/// \brief Returns whether two results are exactly the same, in the same
+/// order.
+/// \param a Results.
+/// \param b Results.
+inline bool identicalResults(const DBoW2::QueryResults &a,
+  const DBoW2::QueryResults &b)
+{
+  if(a.size() != b.size()) return false;
+
+  for(size_t i = 0; i < a.size(); ++i)
+  {
+    if(a[i].Id != b[i].Id || a[i].Score != b[i].Score ||
+      a[i].nWords != b[i].nWords) return false;
+  }
+  return true;
+}
+
+#endif
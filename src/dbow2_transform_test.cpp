@@ -0,0 +1,511 @@
+/**
+ * @file dbow2_transform_test.cpp
+ * @brief Tests that the transforms of the vocabularies give the vectors of
+ * the original descent of the tree.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+/// \brief Vocabulary whose frozen tree can be dropped, so that transform
+/// goes down the nodes of the tree comparing the descriptors one by one.
+template<class F>
+class TreeVocabulary: public TemplatedVocabulary<Descriptor, F>
+{
+public:
+
+  /// \brief Copies a vocabulary.
+  /// \param voc Vocabulary.
+  explicit TreeVocabulary(const TemplatedVocabulary<Descriptor, F> &voc)
+    : TemplatedVocabulary<Descriptor, F>(voc) {}
+
+  /// \brief Drops the frozen tree.
+  void thaw()
+  {
+    this->m_frozen =
+      typename TemplatedVocabulary<Descriptor, F>::FrozenTree();
+  }
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Distance kernels, the generic one last.
+const char* const KERNELS[] = { "avx512", "avx2", "popcnt", "neon",
+  "generic" };
+const int NKERNELS = 5; ///< number of kernels
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Tests that the frozen tree gives the words, bow vectors and
+/// feature vectors of the tree.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+/// \param what Description of the vocabulary.
+template<class F>
+void testFrozen(const TemplatedVocabulary<Descriptor, F> &voc,
+  const vector<vector<Descriptor> > &features, const string &what);
+
+/// \brief Tests that every kernel available in this CPU gives the distances
+/// of bit and float loops, and the vectors of the generic kernel.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+void testKernels(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features);
+
+/// \brief Checks the hamming distance functions with the kernel in use.
+/// \param what Description of the kernel.
+void checkHamming(const string &what);
+
+/// \brief Checks the squared L2 distance functions with the kernel in use.
+/// \param what Description of the kernel.
+void checkL2(const string &what);
+
+/// \brief Tests that the transforms with threads give the vectors of the
+/// serial ones.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+void testParallel(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features);
+
+/// \brief Tests that the flat vectors have the words, values and features
+/// of the map ones, and give the same scores.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+/// \param pool Threads.
+void testFlat(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features, ThreadPool &pool);
+
+/// \brief Returns whether a flat bow vector has the words and values of a
+/// bow vector, in ascending order of word id.
+/// \param flat Flat vector.
+/// \param v Bow vector.
+bool sameWords(const FlatBowVector &flat, const BowVector &v);
+
+/// \brief Returns whether a flat feature vector has the nodes and features
+/// of a feature vector, in ascending order of node id.
+/// \param flat Flat vector.
+/// \param fv Feature vector.
+bool sameFeatures(const FlatFeatureVector &flat, const FeatureVector &fv);
+
+/// \brief Returns a pseudo-random number.
+/// \param seed State of the generator, updated.
+inline unsigned int next(unsigned int &seed)
+{
+  seed = seed * 1103515245u + 12345u;
+  return seed >> 8;
+}
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features, queries;
+  createFeatures(features);
+  createEntries(features, NIMAGES, queries, true, 3);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+  TemplatedVocabulary<Descriptor, FScalar> scalar(5, 3, TF_IDF, L1_NORM);
+  scalar.create(features);
+
+  try
+  {
+    testFrozen(voc, queries, "packed descriptors");
+    testFrozen(scalar, queries, "unpacked descriptors");
+    testKernels(voc, queries);
+    testParallel(voc, queries);
+
+    ThreadPool pool(3);
+    testFlat(voc, queries, pool);
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void testFrozen(const TemplatedVocabulary<Descriptor, F> &voc,
+  const vector<vector<Descriptor> > &features, const string &what)
+{
+  cout << "Testing the frozen tree with " << what << "..." << endl;
+
+  TreeVocabulary<F> tree(voc);
+  tree.thaw();
+
+  bool words = true, bows = true, fvs = true;
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    for(size_t j = 0; j < features[i].size(); ++j)
+      words = words && voc.transform(features[i][j]) ==
+        tree.transform(features[i][j]);
+
+    BowVector v, tv;
+    voc.transform(features[i], v);
+    tree.transform(features[i], tv);
+    bows = bows && !v.empty() && v == tv;
+
+    for(int levels = 0; levels <= voc.getDepthLevels(); ++levels)
+    {
+      FeatureVector fv, tfv;
+      voc.transform(features[i], v, fv, levels);
+      tree.transform(features[i], tv, tfv, levels);
+      fvs = fvs && v == tv && fv == tfv;
+    }
+  }
+
+  check(words, what + ": words");
+  check(bows, what + ": bow vectors");
+  check(fvs, what + ": feature vectors");
+}
+
+// ----------------------------------------------------------------------------
+
+void testKernels(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features)
+{
+  const string selected = distanceKernel();
+
+  vector<BowVector> generic_v(features.size());
+  vector<FeatureVector> generic_fv(features.size());
+  check(selectDistanceKernel("generic"), "select the generic kernel");
+  for(size_t i = 0; i < features.size(); ++i)
+    voc.transform(features[i], generic_v[i], generic_fv[i], 1);
+
+  for(int k = 0; k < NKERNELS; ++k)
+  {
+    // the kernels this CPU does not support are not tested
+    if(!selectDistanceKernel(KERNELS[k])) continue;
+
+    const string what = string("the ") + KERNELS[k] + " kernel";
+    cout << "Testing " << what << "..." << endl;
+
+    checkHamming(what);
+    checkL2(what);
+
+    bool same = true;
+    for(size_t i = 0; i < features.size(); ++i)
+    {
+      BowVector v;
+      FeatureVector fv;
+      voc.transform(features[i], v, fv, 1);
+      same = same && v == generic_v[i] && fv == generic_fv[i];
+    }
+    check(same, what + ": vectors of the generic kernel");
+  }
+
+  selectDistanceKernel(selected);
+}
+
+// ----------------------------------------------------------------------------
+
+void checkHamming(const string &what)
+{
+  // the lengths of the batch kernels, and others
+  const int lengths[] = { 1, 7, 16, 32, 33, 48, 64, 96 };
+  const unsigned int counts[] = { 1, 5, 64, 65, 130 };
+  unsigned int seed = 2024;
+
+  bool one = true, many = true, nearest = true;
+  for(int l = 0; l < 8; ++l)
+  {
+    const int bytes = lengths[l];
+    for(int c = 0; c < 5; ++c)
+    {
+      const unsigned int n = counts[c];
+
+      vector<unsigned char> q(bytes), blocks((size_t)n * bytes);
+      for(int b = 0; b < bytes; ++b) q[b] = next(seed);
+      for(size_t b = 0; b < blocks.size(); ++b)
+      {
+        // blocks close to the query, so that there are ties
+        blocks[b] = q[b % bytes] ^ (next(seed) % 4 == 0 ? next(seed) : 0);
+      }
+
+      vector<unsigned int> expected(n), d(n);
+      unsigned int best = 0;
+      for(unsigned int j = 0; j < n; ++j)
+      {
+        expected[j] = 0;
+        for(int b = 0; b < bytes; ++b)
+        {
+          for(unsigned char x = q[b] ^ blocks[(size_t)j * bytes + b]; x;
+            x >>= 1) expected[j] += x & 1;
+        }
+        if(expected[j] < expected[best]) best = j;
+
+        one = one && hammingDistance(&q[0], &blocks[(size_t)j * bytes],
+          bytes) == expected[j];
+      }
+
+      hammingDistances(&q[0], &blocks[0], n, bytes, &d[0]);
+      many = many && d == expected;
+
+      unsigned int best_d = 0;
+      nearest = nearest &&
+        hammingNearest(&q[0], &blocks[0], n, bytes, &best_d) == best &&
+        best_d == expected[best];
+    }
+  }
+
+  check(one, what + ": hamming distance");
+  check(many, what + ": hamming distances of several blocks");
+  check(nearest, what + ": nearest block, the first one if tied");
+}
+
+// ----------------------------------------------------------------------------
+
+void checkL2(const string &what)
+{
+  // the length of SURF64, and others
+  const int lengths[] = { 1, 3, 8, 17, 63, 64, 65, 128 };
+  const unsigned int counts[] = { 1, 5, 64, 65, 130 };
+  unsigned int seed = 4202;
+
+  bool one = true, many = true, nearest = true;
+  for(int l = 0; l < 8; ++l)
+  {
+    const int dims = lengths[l];
+    for(int c = 0; c < 5; ++c)
+    {
+      const unsigned int n = counts[c];
+
+      vector<float> q(dims), blocks((size_t)n * dims);
+      for(int i = 0; i < dims; ++i) q[i] = (next(seed) % 2001) / 1000.f - 1;
+      for(size_t i = 0; i < blocks.size(); ++i)
+        blocks[i] = q[i % dims] + (next(seed) % 201) / 1000.f - 0.1f;
+      // a tie with the last vector
+      for(int i = 0; i < dims; ++i) blocks[(size_t)(n - 1) * dims + i] =
+        blocks[(size_t)(n / 2) * dims + i];
+
+      // squares computed in float, added up in double in 8 partial sums
+      // and then the remaining dimensions
+      vector<double> expected(n), d(n);
+      unsigned int best = 0;
+      for(unsigned int j = 0; j < n; ++j)
+      {
+        const float *b = &blocks[(size_t)j * dims];
+        double partial[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        int i = 0;
+        for(; i + 8 <= dims; i += 8)
+        {
+          for(int k = 0; k < 8; ++k)
+          {
+            const float x = q[i + k] - b[i + k];
+            partial[k] += (double)(x * x);
+          }
+        }
+        expected[j] = ((partial[0] + partial[4]) + (partial[1] + partial[5])) +
+          ((partial[2] + partial[6]) + (partial[3] + partial[7]));
+        for(; i < dims; ++i)
+        {
+          const float x = q[i] - b[i];
+          expected[j] += (double)(x * x);
+        }
+        if(expected[j] < expected[best]) best = j;
+
+        one = one && squaredL2Distance(&q[0], b, dims) == expected[j];
+      }
+
+      squaredL2Distances(&q[0], &blocks[0], n, dims, &d[0]);
+      many = many && d == expected;
+
+      double best_d = 0;
+      nearest = nearest &&
+        squaredL2Nearest(&q[0], &blocks[0], n, dims, &best_d) == best &&
+        best_d == expected[best];
+    }
+  }
+
+  check(one, what + ": squared L2 distance");
+  check(many, what + ": squared L2 distances of several vectors");
+  check(nearest, what + ": nearest vector, the first one if tied");
+}
+
+// ----------------------------------------------------------------------------
+
+void testParallel(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features)
+{
+  // the images, and one with all their features, which is split among
+  // the threads
+  vector<vector<Descriptor> > images(features);
+  images.push_back(vector<Descriptor>());
+  for(size_t i = 0; i < features.size(); ++i)
+    images.back().insert(images.back().end(), features[i].begin(),
+      features[i].end());
+
+  const int threads[] = { 1, 2, 5 };
+  for(int t = 0; t < 3; ++t)
+  {
+    const string what = to_string(threads[t]) +
+      (threads[t] == 1 ? " thread" : " threads");
+    cout << "Testing the transforms with " << what << "..." << endl;
+
+    ThreadPool pool(threads[t]);
+
+    bool bows = true, fvs = true;
+    for(size_t i = 0; i < images.size(); ++i)
+    {
+      BowVector v, pv;
+      voc.transform(images[i], v);
+      voc.transform(images[i], pv, pool);
+      bows = bows && v == pv;
+
+      for(int levels = 0; levels <= 2; ++levels)
+      {
+        FeatureVector fv, pfv;
+        voc.transform(images[i], v, fv, levels);
+        voc.transform(images[i], pv, pfv, levels, pool);
+        fvs = fvs && v == pv && fv == pfv;
+      }
+    }
+
+    check(bows, what + ": bow vectors");
+    check(fvs, what + ": bow and feature vectors");
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void testFlat(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features, ThreadPool &pool)
+{
+  cout << "Testing the flat vectors..." << endl;
+
+  vector<BowVector> vs(features.size());
+  vector<FlatBowVector> flats(features.size());
+
+  bool bows = true, fvs = true, found = true, conversions = true;
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    FeatureVector fv;
+    voc.transform(features[i], vs[i], fv, 1);
+
+    for(int p = 0; p < 2; ++p)
+    {
+      FlatBowVector flat;
+      FlatFeatureVector flat_fv;
+      voc.transform(features[i], flat, p ? &pool : NULL);
+      bows = bows && sameWords(flat, vs[i]);
+
+      voc.transform(features[i], flat, flat_fv, 1, p ? &pool : NULL);
+      bows = bows && sameWords(flat, vs[i]);
+      fvs = fvs && sameFeatures(flat_fv, fv);
+      flats[i] = flat;
+
+      FeatureVector back;
+      flat_fv.toFeatureVector(back);
+      conversions = conversions && back == fv &&
+        FlatFeatureVector(fv) == flat_fv;
+    }
+
+    // every word of the vocabulary, in and out of the vector
+    for(WordId w = 0; w < voc.size(); ++w)
+    {
+      BowVector::const_iterator it = vs[i].find(w);
+      found = found &&
+        flats[i].find(w) == (it == vs[i].end() ? 0 : it->second);
+    }
+
+    BowVector back;
+    flats[i].toBowVector(back);
+    conversions = conversions && back == vs[i] &&
+      FlatBowVector(vs[i]) == flats[i];
+  }
+
+  check(bows, "flat bow vectors");
+  check(fvs, "flat feature vectors");
+  check(found, "values of the words of flat vectors");
+  check(conversions, "conversions of flat vectors");
+
+  // unnormalized vectors, normalized in both ways
+  bool normalized = true;
+  const LNorm norms[] = { L1, L2 };
+  for(size_t i = 0; i < vs.size(); ++i)
+  {
+    BowVector v;
+    for(BowVector::const_iterator it = vs[i].begin(); it != vs[i].end(); ++it)
+      v.addWeight(it->first, it->second * (1 + it->first % 3));
+
+    for(int n = 0; n < 2; ++n)
+    {
+      BowVector nv(v);
+      FlatBowVector flat(v);
+      nv.normalize(norms[n]);
+      flat.normalize(norms[n]);
+      normalized = normalized && sameWords(flat, nv);
+    }
+  }
+  check(normalized, "normalized flat vectors");
+
+  for(int s = 0; s < NSCORINGS; ++s)
+  {
+    Binary32Vocabulary v(voc);
+    v.setScoringType(SCORINGS[s]);
+
+    vector<BowVector> bs;
+    vector<FlatBowVector> fs;
+    transformAll(v, features, bs);
+    transformAll(v, features, fs);
+
+    bool scores = true;
+    for(size_t i = 0; i < bs.size(); ++i)
+      for(size_t j = 0; j < bs.size(); ++j)
+        scores = scores && v.score(fs[i], fs[j]) == v.score(bs[i], bs[j]);
+
+    check(scores, "scores of flat vectors with scoring " +
+      to_string(SCORINGS[s]));
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+bool sameWords(const FlatBowVector &flat, const BowVector &v)
+{
+  if(flat.size() != v.size()) return false;
+
+  BowVector::const_iterator it = v.begin();
+  for(size_t k = 0; k < flat.size(); ++k, ++it)
+  {
+    if(flat.id(k) != it->first || flat.value(k) != it->second) return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+
+bool sameFeatures(const FlatFeatureVector &flat, const FeatureVector &fv)
+{
+  if(flat.size() != fv.size()) return false;
+
+  FeatureVector::const_iterator it = fv.begin();
+  for(size_t k = 0; k < flat.size(); ++k, ++it)
+  {
+    if(flat.nodeId(k) != it->first ||
+      !equal(it->second.begin(), it->second.end(), flat.features(k)) ||
+      flat.nfeatures(k) != it->second.size()) return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
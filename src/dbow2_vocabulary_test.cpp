@@ -0,0 +1,519 @@
+/**
+ * @file dbow2_vocabulary_test.cpp
+ * @brief Tests that the vocabularies saved and loaded in the binary format
+ * give the vectors of the original ones, that the weights of the words are
+ * those of the images they are computed from, and that the trees created
+ * with threads or from descriptor files do not depend on the number of
+ * threads.
+ *
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// DBoW2
+#include <DBoW2/DBoW2.h>
+
+#include "dbow2_test_utils.h"
+
+using namespace DBoW2;
+using namespace std;
+
+const unsigned int SEED = 1234; ///< seed of the trees created
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// \brief Tests that a vocabulary saved and loaded in the binary format is
+/// the same as the original one.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+/// \param what Description of the vocabulary.
+template<class F>
+void testBinary(const TemplatedVocabulary<Descriptor, F> &voc,
+  const vector<vector<Descriptor> > &features, const string &what);
+
+/// \brief Tests that the idf weights are those of the images they are
+/// computed from, extended or not, with and without threads.
+/// \param voc Vocabulary created from features.
+/// \param features Features of the images.
+void testWeights(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features);
+
+/// \brief Returns whether the weights of a vocabulary are the idf weights
+/// ln(N/Ni) of some images, and the transforms use them.
+/// \param voc Vocabulary with TF_IDF weighting and DOT_PRODUCT scoring,
+///   whose vectors are not normalized.
+/// \param features Features of the images.
+bool idfWeights(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features);
+
+/// \brief Tests that the trees created with threads are the same with any
+/// number of them, and that their weights are those of the images.
+/// \param features Features of the images.
+void testParallel(const vector<vector<Descriptor> > &features);
+
+/// \brief Tests the trees created from a descriptor file, with all the
+/// descriptors in memory or not.
+/// \param features Features of the images.
+void testOutOfCore(const vector<vector<Descriptor> > &features);
+
+/// \brief Returns whether every word of a vocabulary is reached by some
+/// descriptors of the given images.
+/// \param voc Vocabulary.
+/// \param features Features of the images.
+bool allWordsReached(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features);
+
+/// \brief Creates the training images of the trees: the given ones and
+/// copies of them with a bit of each descriptor flipped, so that some nodes
+/// below the root are large enough to be split among the threads.
+/// \param features Features of the images.
+/// \param ncopies Copies of each image.
+/// @param[out] training Features of the training images.
+void createTraining(const vector<vector<Descriptor> > &features, int ncopies,
+  vector<vector<Descriptor> > &training);
+
+/// \brief Returns whether two vocabularies have the same parameters and
+/// words, and give the same bow vectors and feature vectors.
+/// \param a Vocabulary.
+/// \param b Vocabulary.
+/// \param features Features of the images to transform.
+void testWeights(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features)
+{
+  cout << "Testing the weights..." << endl;
+
+  check(idfWeights(voc, features), "weights of the training images");
+
+  // half of the images, and the others
+  const size_t half = features.size() / 2;
+  const vector<vector<Descriptor> > a(features.begin(),
+    features.begin() + half), b(features.begin() + half, features.end());
+
+  Binary32Vocabulary v(voc);
+  v.setScoringType(DOT_PRODUCT);
+  check(idfWeights(v, features), "transforms with the training weights");
+
+  v.recomputeWeights(a);
+  check(idfWeights(v, a), "recomputed weights");
+
+  v.extendWeights(b);
+  check(idfWeights(v, features), "extended weights");
+
+  // with threads, the same weights
+  const int nthreads[] = { 1, 4 };
+  for(int t = 0; t < 2; ++t)
+  {
+    ThreadPool pool(nthreads[t]);
+    const string which = " with " + to_string(nthreads[t]) +
+      (nthreads[t] == 1 ? " thread" : " threads");
+
+    Binary32Vocabulary p(voc), q(voc);
+    p.setScoringType(DOT_PRODUCT);
+    q.setScoringType(DOT_PRODUCT);
+    p.recomputeWeights(a, &pool);
+    q.recomputeWeights(a);
+    check(idfWeights(p, a), "recomputed weights" + which);
+
+    p.extendWeights(b, &pool);
+    q.extendWeights(b);
+    bool same = true;
+    for(WordId w = 0; w < p.size(); ++w)
+      same = same && p.getWordWeight(w) == q.getWordWeight(w);
+    check(same && idfWeights(p, features), "extended weights" + which);
+  }
+
+  // without document frequencies, or weights that do not depend on them
+  Binary32Vocabulary loaded;
+  voc.saveBinary("vocabulary_test_weights.dbow2");
+  loaded.loadBinary("vocabulary_test_weights.dbow2");
+  bool thrown = false;
+  try { loaded.extendWeights(b); }
+  catch(const std::string &) { thrown = true; }
+  check(thrown, "extend the weights of a loaded vocabulary");
+
+  loaded.recomputeWeights(a);
+  loaded.extendWeights(b);
+  bool same = true;
+  for(WordId w = 0; w < v.size(); ++w)
+    same = same && loaded.getWordWeight(w) == v.getWordWeight(w);
+  check(same, "extend the weights of a loaded vocabulary recomputed");
+
+  Binary32Vocabulary tf(voc);
+  tf.setWeightingType(TF);
+  tf.recomputeWeights(a);
+  tf.extendWeights(b);
+  same = true;
+  for(WordId w = 0; w < tf.size(); ++w) same = same && tf.getWordWeight(w) == 1;
+  check(same, "TF weights");
+}
+
+// ----------------------------------------------------------------------------
+
+bool idfWeights(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features)
+{
+  // images where each word is
+  vector<unsigned int> Ni(voc.size(), 0);
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    set<WordId> words;
+    for(size_t j = 0; j < features[i].size(); ++j)
+      words.insert(voc.transform(features[i][j]));
+    for(set<WordId>::const_iterator it = words.begin(); it != words.end();
+      ++it) Ni[*it]++;
+  }
+
+  for(WordId w = 0; w < voc.size(); ++w)
+  {
+    const double idf = (Ni[w] > 0 ?
+      log((double)features.size() / (double)Ni[w]) : 0);
+    if(voc.getWordWeight(w) != idf) return false;
+  }
+
+  if(voc.getScoringType() != DOT_PRODUCT) return true;
+
+  // the vectors are tf * idf, where tf is divided by the number of words,
+  // as in the original transform
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    BowVector v, expected;
+    voc.transform(features[i], v);
+    for(size_t j = 0; j < features[i].size(); ++j)
+    {
+      const WordId w = voc.transform(features[i][j]);
+      const double idf = voc.getWordWeight(w);
+      if(idf > 0) expected.addWeight(w, idf);
+    }
+    const double nwords = expected.size();
+    for(BowVector::iterator it = expected.begin(); it != expected.end(); ++it)
+      it->second /= nwords;
+
+    if(v.size() != expected.size()) return false;
+    for(BowVector::const_iterator it = v.begin(), eit = expected.begin();
+      it != v.end(); ++it, ++eit)
+    {
+      if(it->first != eit->first || fabs(it->second - eit->second) > 1e-12)
+        return false;
+    }
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void testParallel(const vector<vector<Descriptor> > &features)
+{
+  cout << "Testing the trees created with threads..." << endl;
+
+  vector<vector<Descriptor> > training;
+  createTraining(features, 4, training);
+
+  vector<unsigned char> first;
+  const int nthreads[] = { 1, 2, 4, 4 };
+  for(int t = 0; t < 4; ++t)
+  {
+    ThreadPool pool(nthreads[t]);
+    const string which = to_string(nthreads[t]) +
+      (nthreads[t] == 1 ? " thread" : " threads");
+
+    Binary32Vocabulary v(5, 3, TF_IDF, DOT_PRODUCT);
+    srand(SEED);
+    v.create(training, pool);
+
+    vector<unsigned char> buffer;
+    v.saveBinary(buffer);
+    if(t == 0) first = buffer;
+    else check(buffer == first, "tree created with " + which);
+
+    check(v.size() > 0 && idfWeights(v, training),
+      "weights of the tree created with " + which);
+  }
+
+  // the seed is used
+  ThreadPool pool(4);
+  Binary32Vocabulary v(5, 3, TF_IDF, DOT_PRODUCT);
+  srand(SEED + 1);
+  v.create(training, pool);
+  vector<unsigned char> buffer;
+  v.saveBinary(buffer);
+  check(buffer != first, "tree created with another seed");
+}
+
+// ----------------------------------------------------------------------------
+
+void testOutOfCore(const vector<vector<Descriptor> > &features)
+{
+  cout << "Testing the trees created from descriptor files..." << endl;
+
+  vector<vector<Descriptor> > training;
+  createTraining(features, 4, training);
+
+  size_t ndescriptors = 0;
+  const string filename = "vocabulary_test_descriptors.bin";
+  {
+    TemplatedDescriptorWriter<Descriptor, FBinary32> writer(filename);
+    for(size_t i = 0; i < training.size(); ++i)
+    {
+      writer.add(training[i]);
+      ndescriptors += training[i].size();
+    }
+  }
+  TemplatedDescriptorReader<Descriptor, FBinary32> reader(filename);
+
+  // all the descriptors in memory give the tree created with threads
+  ThreadPool pool(4);
+  Binary32Vocabulary memory(5, 3, TF_IDF, DOT_PRODUCT);
+  srand(SEED);
+  memory.create(training, pool);
+  vector<unsigned char> expected;
+  memory.saveBinary(expected);
+
+  // top levels and subtrees, with and without threads
+  const size_t max_descriptors[] = { ndescriptors, ndescriptors / 5,
+    ndescriptors / 30 };
+  const string tmp_prefix = "vocabulary_test_tmp";
+  for(int m = 0; m < 3; ++m)
+  {
+    const string which = "tree created from a file with " +
+      to_string(max_descriptors[m]) + " descriptors in memory";
+
+    vector<unsigned char> buffers[2];
+    for(int p = 0; p < 2; ++p)
+    {
+      Binary32Vocabulary v(5, 3, TF_IDF, DOT_PRODUCT);
+      srand(SEED);
+      v.create(reader, max_descriptors[m], tmp_prefix, p ? &pool : NULL);
+      v.saveBinary(buffers[p]);
+
+      const string with = which + (p ? ", with threads" : "");
+      check(v.size() > 0 && idfWeights(v, training), with + ": weights");
+      check(allWordsReached(v, training), with + ": words");
+
+      ifstream tmp((tmp_prefix + ".0").c_str());
+      check(!tmp.is_open(), with + ": temporary files removed");
+    }
+
+    check(buffers[0] == buffers[1], which + ": with and without threads");
+    if(m == 0) check(buffers[0] == expected, which + ": tree in memory");
+  }
+
+  std::remove(filename.c_str());
+}
+
+// ----------------------------------------------------------------------------
+
+bool allWordsReached(const Binary32Vocabulary &voc,
+  const vector<vector<Descriptor> > &features)
+{
+  vector<bool> reached(voc.size(), false);
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    for(size_t j = 0; j < features[i].size(); ++j)
+      reached[voc.transform(features[i][j])] = true;
+  }
+  return find(reached.begin(), reached.end(), false) == reached.end();
+}
+
+// ----------------------------------------------------------------------------
+
+void createTraining(const vector<vector<Descriptor> > &features, int ncopies,
+  vector<vector<Descriptor> > &training)
+{
+  unsigned int seed = 2468;
+  training.clear();
+  for(int c = 0; c < ncopies; ++c)
+  {
+    for(size_t i = 0; i < features.size(); ++i)
+    {
+      training.push_back(features[i]);
+      if(c == 0) continue;
+
+      vector<Descriptor> &image = training.back();
+      for(size_t j = 0; j < image.size(); ++j)
+      {
+        seed = seed * 1103515245u + 12345u;
+        const unsigned int bit = (seed >> 8) % (64 * FBinary32::W);
+        image[j][bit / 64] ^= (uint64_t)1 << (bit % 64);
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+bool sameVocabulary(const TemplatedVocabulary<Descriptor, F> &a,
+  const TemplatedVocabulary<Descriptor, F> &b,
+  const vector<vector<Descriptor> > &features);
+
+/// \brief Returns whether loading a file into a vocabulary throws.
+/// \param voc Vocabulary.
+/// \param filename File.
+template<class F>
+bool loadThrows(TemplatedVocabulary<Descriptor, F> &voc,
+  const string &filename);
+
+/// \brief Reads a whole file.
+/// \param filename File.
+/// @param[out] data Content of the file.
+void readFile(const string &filename, vector<unsigned char> &data);
+
+// ----------------------------------------------------------------------------
+
+/// \brief Main
+/// \return 0 iff all the checks passed.
+int main()
+{
+  vector<vector<Descriptor> > features;
+  createFeatures(features);
+
+  Binary32Vocabulary voc(5, 3, TF_IDF, L1_NORM);
+  voc.create(features);
+  TemplatedVocabulary<Descriptor, FScalar> scalar(5, 3, TF_IDF, L2_NORM);
+  scalar.create(features);
+
+  try
+  {
+    testBinary(voc, features, "packed");
+    testBinary(scalar, features, "unpacked");
+
+    // the files of a descriptor class that packs its descriptors and one
+    // that does not are not exchanged
+    check(loadThrows(voc, "vocabulary_test_unpacked.dbow2") &&
+      loadThrows(scalar, "vocabulary_test_packed.dbow2"),
+      "reject another descriptor");
+
+    testWeights(voc, features);
+    testParallel(features);
+    testOutOfCore(features);
+  }
+  catch(const std::string &ex)
+  {
+    check(false, "unexpected exception: " + ex);
+  }
+
+  return report();
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+void testBinary(const TemplatedVocabulary<Descriptor, F> &voc,
+  const vector<vector<Descriptor> > &features, const string &what)
+{
+  cout << "Testing the binary " << what << " vocabularies..." << endl;
+
+  typedef TemplatedVocabulary<Descriptor, F> Vocabulary;
+
+  const string filename = "vocabulary_test_" + what + ".dbow2";
+  const string copy = "vocabulary_test_" + what + "_copy.dbow2";
+
+  // chosen by the extension
+  voc.save(filename);
+  Vocabulary loaded;
+  loaded.load(filename);
+  check(sameVocabulary(voc, loaded, features), what + ": save and load");
+
+  // the same bytes, written to a file or to a buffer, and saved again
+  vector<unsigned char> data, buffer, again;
+  readFile(filename, data);
+  voc.saveBinary(buffer);
+  loaded.saveBinary(again);
+  check(!data.empty() && data == buffer && data == again,
+    what + ": bytes saved");
+
+  // the vocabulary is kept after the file is gone
+  loaded.saveBinary(copy);
+  Vocabulary other;
+  other.loadBinary(copy);
+  std::remove(copy.c_str());
+  check(sameVocabulary(voc, other, features), what + ": file removed");
+
+  // two vocabularies mapping the same file
+  Vocabulary shared;
+  shared.load(filename);
+  check(sameVocabulary(loaded, shared, features), what + ": shared file");
+
+  // broken files are rejected
+  vector<unsigned char> changed = data;
+  changed[changed.size() / 2] ^= 0x10;
+  writeFile(copy, changed);
+  check(loadThrows(other, copy), what + ": reject a corrupted file");
+
+  changed.assign(data.begin(), data.end() - 64);
+  writeFile(copy, changed);
+  check(loadThrows(other, copy), what + ": reject a truncated file");
+
+  changed.assign(data.begin(), data.begin() + 16);
+  writeFile(copy, changed);
+  check(loadThrows(other, copy), what + ": reject a truncated header");
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+bool sameVocabulary(const TemplatedVocabulary<Descriptor, F> &a,
+  const TemplatedVocabulary<Descriptor, F> &b,
+  const vector<vector<Descriptor> > &features)
+{
+  if(a.getBranchingFactor() != b.getBranchingFactor() ||
+    a.getDepthLevels() != b.getDepthLevels() ||
+    a.getWeightingType() != b.getWeightingType() ||
+    a.getScoringType() != b.getScoringType() || a.size() != b.size())
+    return false;
+
+  for(WordId w = 0; w < a.size(); ++w)
+  {
+    if(a.getWordWeight(w) != b.getWordWeight(w) ||
+      !(a.getWord(w) == b.getWord(w))) return false;
+  }
+
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    BowVector va, vb;
+    FeatureVector fa, fb;
+    a.transform(features[i], va, fa, 2);
+    b.transform(features[i], vb, fb, 2);
+    if(va != vb || fa != fb) return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+
+template<class F>
+bool loadThrows(TemplatedVocabulary<Descriptor, F> &voc,
+  const string &filename)
+{
+  try
+  {
+    voc.loadBinary(filename);
+  }
+  catch(const std::string &)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+
+void readFile(const string &filename, vector<unsigned char> &data)
+{
+  ifstream f(filename.c_str(), ios::in | ios::binary);
+  data.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+}
+
+// ----------------------------------------------------------------------------
+
@@ -33,6 +33,7 @@ using namespace std;
 // Output filenames (can be overridden via CLI)
 static std::string g_vocab_file = "small_voc.yml.gz";
 static std::string g_db_file    = "small_db.yml.gz";
+static std::string g_desc_file  = "small_desc.bin";
 
 // \brief BRISK vocabulary.
 typedef DBoW2::TemplatedVocabulary<DBoW2::FBRISK::TDescriptor, DBoW2::FBRISK>
@@ -41,12 +42,18 @@ typedef DBoW2::TemplatedVocabulary<DBoW2::FBRISK::TDescriptor, DBoW2::FBRISK>
 /// \brief BRISK database.
 typedef DBoW2::TemplatedDatabase<DBoW2::FBRISK::TDescriptor, DBoW2::FBRISK>
   FBriskDatabase;
+
+/// \brief File of BRISK descriptors to train vocabularies out of core.
+typedef DBoW2::TemplatedDescriptorWriter<DBoW2::FBRISK::TDescriptor,
+  DBoW2::FBRISK> FBriskDescriptorWriter;
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 /// \brief Load features from path.
 /// \param path Path.
 /// @param[out] features The loaded features.
-void loadFeatures(const string &path, vector<vector<vector<unsigned char> > > &features);
+/// @param[out] dump If given, file to write the features of each image to.
+void loadFeatures(const string &path, vector<vector<vector<unsigned char> > > &features,
+  FBriskDescriptorWriter *dump = NULL);
 
 /// \brief Convert data structure.
 /// \param mat cv::Mat format.
@@ -90,10 +97,19 @@ int main(int argc, char **argv)
     const std::string base = argv[2];
     g_vocab_file = base + "_voc.yml.gz";
     g_db_file    = base + "_db.yml.gz";
+    g_desc_file  = base + "_desc.bin";
   }
 
+  // the descriptors are also dumped, so that large vocabularies can be 
+  // trained from them with the out-of-core create
   vector<vector<vector<unsigned char> > > features;
-  loadFeatures(path, features);
+  {
+    FBriskDescriptorWriter dump(g_desc_file);
+    loadFeatures(path, features, &dump);
+    dump.close();
+    std::cout << "Saved " << dump.descriptors() << " descriptors to '" 
+      << g_desc_file << "'" << std::endl;
+  }
 
   // Set NIMAGES from the number of loaded images
   // NIMAGES = static_cast<int>(features.size());
@@ -109,7 +125,8 @@ int main(int argc, char **argv)
 
 // ----------------------------------------------------------------------------
 
-void loadFeatures(const string &path, vector<vector<vector<unsigned char> > > &features)
+void loadFeatures(const string &path, vector<vector<vector<unsigned char> > > &features,
+  FBriskDescriptorWriter *dump)
 {
   features.clear();
   features.reserve(NIMAGES);
@@ -144,6 +161,7 @@ void loadFeatures(const string &path, vector<vector<vector<unsigned char> > > &f
       // 
       features.push_back(vector<vector<unsigned char> >());
       changeStructure(descriptors, features.back(), 48);
+      if(dump) dump->add(features.back());
 
       ctr++;
     }
@@ -179,8 +197,11 @@ void testVocCreation(const vector<vector<vector<unsigned char> > > &features)
 
   FBriskVocabulary voc(k, L, weight, score);
 
+  // the tree is clustered with all the hardware threads
+  ThreadPool pool;
+
   cout << "Creating a small " << k << "^" << L << " vocabulary..." << endl;
-  voc.create(features);
+  voc.create(features, pool);
   cout << "... done!" << endl;
 
   cout << "Vocabulary information: " << endl